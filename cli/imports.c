@@ -0,0 +1,358 @@
+/*
+ *  Copyright (c) 2020-2021 Thakee Nathees
+ *  Distributed Under The MIT License
+ */
+
+// Compiling the imports of a script in parallel. A VM (and it's compiler and
+// garbage collector) can only be used by a single thread, so each thread
+// compiles the scripts on it's own VM and writes them to their bytecode
+// caches. The VM which runs the script will then load the imports from their
+// caches (see pkCompileSource()).
+
+#include "internal.h"
+#include "modules.h"
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <pthread.h>
+#endif
+
+// Level of a script in the import graph which isn't computed yet.
+#define LEVEL_UNKNOWN -1
+
+// Level of a script which is being computed, if it's reached again from one
+// of it's imports, there is a cyclic import.
+#define LEVEL_VISITING -2
+
+// A script in the import graph of the script which will be run.
+typedef struct {
+  PkStringPtr path;   //< Resolved path of the script.
+  PkStringPtr source; //< Source of the script.
+
+  int* imports;       //< Indexes of the scripts it imports in the graph.
+  int imports_count;
+  int imports_capacity;
+
+  // The scripts only import the scripts of the lower levels (except for the
+  // cyclic imports), so the scripts of a level could be compiled in parallel
+  // once the lower levels are compiled.
+  int level;
+} ImportNode;
+
+typedef struct {
+  ImportNode* nodes;
+  int count;
+  int capacity;
+} ImportGraph;
+
+// The scripts of a level compiled by a thread, which are every [stride]th
+// script of the [scripts] from the [start].
+typedef struct {
+  const ImportGraph* graph;
+  const int* scripts;
+  int count;
+  int start;
+  int stride;
+  bool debug;
+} CompileJob;
+
+static bool isNameChar(char c) {
+  return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') ||
+         ('0' <= c && c <= '9') || (c == '_');
+}
+
+static const char* skipSpaces(const char* c) {
+  while (*c == ' ' || *c == '\t' || *c == '\r') c++;
+  return c;
+}
+
+static const char* skipName(const char* c) {
+  while (isNameChar(*c)) c++;
+  return c;
+}
+
+// Skip the string literal at [c] and set it's content to [start] and
+// [length] (escape characters are not processed).
+static const char* skipString(const char* c, const char** start,
+                              size_t* length) {
+  char quote = *c++;
+  *start = c;
+  while (*c != '\0' && *c != quote) {
+    if (*c == '\\' && c[1] != '\0') c++;
+    c++;
+  }
+  *length = (size_t)(c - *start);
+  if (*c != '\0') c++;
+  return c;
+}
+
+// Add the script to the graph and returns it's index. The graph owns the
+// [path] and the [source] once it's added.
+static int graphAddNode(ImportGraph* graph, PkStringPtr path,
+                        PkStringPtr source) {
+  if (graph->count == graph->capacity) {
+    graph->capacity = (graph->capacity == 0) ? 8 : graph->capacity * 2;
+    graph->nodes = (ImportNode*)realloc(graph->nodes,
+                                        sizeof(ImportNode) * graph->capacity);
+  }
+
+  ImportNode* node = &graph->nodes[graph->count];
+  node->path = path;
+  node->source = source;
+  node->imports = NULL;
+  node->imports_count = 0;
+  node->imports_capacity = 0;
+  node->level = LEVEL_UNKNOWN;
+  return graph->count++;
+}
+
+// Returns the index of the script at the [path] in the graph. If it's not in
+// the graph it'll be loaded and added, or returns -1 if it couldn't be loaded.
+// The graph owns the path once it's called.
+static int graphAddScript(ImportGraph* graph, PkStringPtr path) {
+  for (int i = 0; i < graph->count; i++) {
+    if (strcmp(graph->nodes[i].path.string, path.string) == 0) {
+      if (path.on_done != NULL) path.on_done(NULL, path);
+      return i;
+    }
+  }
+
+  PkStringPtr source = loadScript(NULL, path.string);
+  if (source.string == NULL) {
+    if (path.on_done != NULL) path.on_done(NULL, path);
+    return -1;
+  }
+
+  return graphAddNode(graph, path, source);
+}
+
+static void nodeAddImport(ImportNode* node, int index) {
+  if (node->imports_count == node->imports_capacity) {
+    node->imports_capacity = (node->imports_capacity == 0)
+                           ? 8 : node->imports_capacity * 2;
+    node->imports = (int*)realloc(node->imports,
+                                  sizeof(int) * node->imports_capacity);
+  }
+  node->imports[node->imports_count++] = index;
+}
+
+// Scan the source of the [index]th script of the graph for the paths of it's
+// import statements (import 'foo.pk', from 'bar.pk' import baz) and add them
+// to the graph. It doesn't parse the source, if it misses an import the VM
+// will compile it when the script is imported as usual.
+static void scanImports(ImportGraph* graph, int index) {
+  const char* c = graph->nodes[index].source.string;
+
+  while (*c != '\0') {
+
+    if (*c == '#') {
+      while (*c != '\0' && *c != '\n') c++;
+      continue;
+    }
+
+    if (*c == '"' || *c == '\'') {
+      const char* start; size_t length;
+      c = skipString(c, &start, &length);
+      continue;
+    }
+
+    if (!isNameChar(*c)) {
+      c++;
+      continue;
+    }
+
+    const char* word = c;
+    c = skipName(c);
+    size_t length = (size_t)(c - word);
+    if (!(length == 6 && strncmp(word, "import", 6) == 0) &&
+        !(length == 4 && strncmp(word, "from", 4) == 0)) {
+      continue;
+    }
+
+    // The imported modules are separated by commas and may have an alias.
+    do {
+      c = skipSpaces(c);
+
+      if (*c == '"' || *c == '\'') {
+        const char* start; size_t path_length;
+        c = skipString(c, &start, &path_length);
+
+        char* path = (char*)malloc(path_length + 1);
+        memcpy(path, start, path_length);
+        path[path_length] = '\0';
+        PkStringPtr resolved = resolvePath(NULL,
+                                           graph->nodes[index].path.string,
+                                           path);
+        free(path);
+
+        int imported = graphAddScript(graph, resolved);
+        if (imported != -1) nodeAddImport(&graph->nodes[index], imported);
+
+      } else {
+        c = skipName(c);
+      }
+
+      c = skipSpaces(c);
+      if (c[0] == 'a' && c[1] == 's' && !isNameChar(c[2])) {
+        c = skipSpaces(skipName(skipSpaces(c + 2)));
+      }
+
+      if (*c != ',') break;
+      c++;
+    } while (true);
+  }
+}
+
+// Compute the level of the [index]th script which is one more than the
+// highest level of it's imports (0 if it doesn't import any). A cyclic import
+// is ignored, so the scripts of a cycle will be compiled at different levels.
+static int computeLevel(ImportGraph* graph, int index) {
+  ImportNode* node = &graph->nodes[index];
+  if (node->level >= 0) return node->level;
+  if (node->level == LEVEL_VISITING) return -1;
+
+  node->level = LEVEL_VISITING;
+  int level = 0;
+  for (int i = 0; i < node->imports_count; i++) {
+    int import_level = computeLevel(graph, node->imports[i]);
+    if (import_level + 1 > level) level = import_level + 1;
+  }
+  node->level = level;
+  return level;
+}
+
+// Create a VM to compile the scripts. The compilation errors aren't reported
+// here, a script which failed to compile won't have a cache, so the VM which
+// runs the script will compile and report it.
+static PKVM* newCompilerVM(void) {
+  PkConfiguration config = pkNewConfiguration();
+  config.load_script_fn = loadScript;
+  config.resolve_path_fn = resolvePath;
+  config.load_cache_fn = loadCache;
+  config.write_cache_fn = writeCache;
+
+  PKVM* vm = pkNewVM(&config);
+  registerModules(vm);
+  return vm;
+}
+
+static void runCompileJob(const CompileJob* job) {
+  PKVM* vm = newCompilerVM();
+
+  PkCompileOptions options = pkNewCompilerOptions();
+  options.debug = job->debug;
+
+  for (int i = job->start; i < job->count; i += job->stride) {
+    const ImportNode* node = &job->graph->nodes[job->scripts[i]];
+    PkStringPtr source = { node->source.string, NULL, NULL, 0, 0 };
+    PkStringPtr path = { node->path.string, NULL, NULL, 0, 0 };
+    pkCompileSource(vm, source, path, &options);
+  }
+
+  pkFreeVM(vm);
+}
+
+#ifdef _WIN32
+  typedef HANDLE Thread;
+
+  static DWORD WINAPI compileThread(LPVOID job) {
+    runCompileJob((const CompileJob*)job);
+    return 0;
+  }
+
+  static bool threadStart(Thread* thread, CompileJob* job) {
+    *thread = CreateThread(NULL, 0, compileThread, job, 0, NULL);
+    return *thread != NULL;
+  }
+
+  static void threadJoin(Thread thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+  }
+
+#else
+  typedef pthread_t Thread;
+
+  static void* compileThread(void* job) {
+    runCompileJob((const CompileJob*)job);
+    return NULL;
+  }
+
+  static bool threadStart(Thread* thread, CompileJob* job) {
+    return pthread_create(thread, NULL, compileThread, job) == 0;
+  }
+
+  static void threadJoin(Thread thread) {
+    pthread_join(thread, NULL);
+  }
+#endif
+
+void compileImports(const char* path, const char* source, int jobs,
+                    bool debug) {
+  ImportGraph graph = { NULL, 0, 0 };
+
+  // The script itself is compiled by the VM which runs it, it's path and the
+  // source are owned by the caller.
+  PkStringPtr script_path = { path, NULL, NULL, 0, 0 };
+  PkStringPtr script_source = { source, NULL, NULL, 0, 0 };
+  graphAddNode(&graph, script_path, script_source);
+
+  // Scan the scripts breadth first, the newly added scripts will be scanned
+  // once we reach them.
+  for (int i = 0; i < graph.count; i++) scanImports(&graph, i);
+
+  int max_level = 0;
+  for (int i = 0; i < graph.count; i++) {
+    int level = computeLevel(&graph, i);
+    if (level > max_level) max_level = level;
+  }
+
+  int* scripts = (int*)malloc(sizeof(int) * graph.count);
+  Thread* threads = (Thread*)malloc(sizeof(Thread) * jobs);
+  CompileJob* compile_jobs = (CompileJob*)malloc(sizeof(CompileJob) * jobs);
+  bool* started = (bool*)malloc(sizeof(bool) * jobs);
+
+  for (int level = 0; level <= max_level; level++) {
+    int count = 0;
+    for (int i = 1; i < graph.count; i++) {
+      if (graph.nodes[i].level == level) scripts[count++] = i;
+    }
+    if (count == 0) continue;
+
+    int stride = (count < jobs) ? count : jobs;
+    for (int i = 0; i < stride; i++) {
+      CompileJob* job = &compile_jobs[i];
+      job->graph = &graph;
+      job->scripts = scripts;
+      job->count = count;
+      job->start = i;
+      job->stride = stride;
+      job->debug = debug;
+    }
+
+    // The first job runs on this thread, if a thread couldn't be started
+    // it's job will also run here.
+    for (int i = 1; i < stride; i++) {
+      started[i] = threadStart(&threads[i], &compile_jobs[i]);
+    }
+    runCompileJob(&compile_jobs[0]);
+    for (int i = 1; i < stride; i++) {
+      if (started[i]) threadJoin(threads[i]);
+      else runCompileJob(&compile_jobs[i]);
+    }
+  }
+
+  free(started);
+  free(compile_jobs);
+  free(threads);
+  free(scripts);
+
+  for (int i = 0; i < graph.count; i++) {
+    ImportNode* node = &graph.nodes[i];
+    if (node->path.on_done != NULL) node->path.on_done(NULL, node->path);
+    if (node->source.on_done != NULL) node->source.on_done(NULL, node->source);
+    free(node->imports);
+  }
+  free(graph.nodes);
+}
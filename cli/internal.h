@@ -20,3 +20,15 @@ typedef struct {
   bool repl_mode;
 } VmUserData;
 
+// The script loading and bytecode cache functions of the VMs (see main.c).
+PkStringPtr resolvePath(PKVM* vm, const char* from, const char* path);
+PkStringPtr loadScript(PKVM* vm, const char* path);
+PkStringPtr loadCache(PKVM* vm, const char* path);
+void writeCache(PKVM* vm, const char* path, const uint8_t* data,
+                uint32_t size);
+
+// Compile the scripts imported by the script at [path] (with it's [source])
+// on [jobs] threads and write them to their bytecode caches, so the VM which
+// runs the script will load them instead of compiling one after another.
+void compileImports(const char* path, const char* source, int jobs,
+                    bool debug);
@@ -8,6 +8,13 @@
 
 #include "thirdparty/argparse/argparse.h"
 
+#ifndef _WIN32
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
 // FIXME: Everything below here is temporary and for testing.
 
 int repl(PKVM* vm, const PkCompileOptions* options);
@@ -122,6 +129,115 @@ PkStringPtr loadScript(PKVM* vm, const char* path) {
   return result;
 }
 
+// Returns a newly allocated path of the bytecode cache of the script at
+// [path], which is the script's path with a 'c' at the end (foo.pk -> foo.pkc).
+static char* cachePath(const char* path) {
+  size_t length = strlen(path);
+  char* cache_path = (char*)malloc(length + 2);
+  memcpy(cache_path, path, length);
+  cache_path[length] = 'c';
+  cache_path[length + 1] = '\0';
+  return cache_path;
+}
+
+void onCacheDone(PKVM* vm, PkStringPtr result) {
+#ifdef _WIN32
+  free((void*)result.string);
+#else
+  munmap((void*)result.string, (size_t)result.length);
+#endif
+}
+
+// Map the file at the [path] to the memory (read only) and return it, on
+// failure the string attribute of the result will be NULL.
+static PkStringPtr mapFile(const char* path) {
+  PkStringPtr result = { NULL, onCacheDone, NULL, 0, 0 };
+
+#ifdef _WIN32
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) return result;
+
+  fseek(file, 0, SEEK_END);
+  long file_size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  char* buff = (char*)malloc((size_t)file_size + 1);
+  result.length = (uint32_t)fread(buff, sizeof(char), file_size, file);
+  fclose(file);
+  result.string = buff;
+
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return result;
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      result.string = (const char*)data;
+      result.length = (uint32_t)st.st_size;
+    }
+  }
+  close(fd);
+#endif
+
+  return result;
+}
+
+PkStringPtr loadCache(PKVM* vm, const char* path) {
+  char* cache_path = cachePath(path);
+  PkStringPtr result = mapFile(cache_path);
+  free(cache_path);
+  return result;
+}
+
+void writeCache(PKVM* vm, const char* path, const uint8_t* data,
+                uint32_t size) {
+  char* cache_path = cachePath(path);
+
+  // Write to a temporary file and rename it, so that another process which
+  // has the old cache mapped won't see a partially written file. The VM's
+  // address is a part of the name since the imports could be compiled by
+  // multiple VMs at the same time (see imports.c).
+  size_t length = strlen(cache_path) + 32;
+  char* temp_path = (char*)malloc(length);
+  snprintf(temp_path, length, "%s.%p.tmp", cache_path, (void*)vm);
+
+  // Failing to write the cache isn't an error, the script will be compiled
+  // again the next time.
+  FILE* file = fopen(temp_path, "wb");
+  if (file != NULL) {
+    bool written = fwrite(data, sizeof(uint8_t), size, file) == size;
+    written = (fclose(file) == 0) && written;
+#ifdef _WIN32
+    if (written) remove(cache_path);
+#endif
+    if (!written || rename(temp_path, cache_path) != 0) remove(temp_path);
+  }
+
+  free(temp_path);
+  free(cache_path);
+}
+
+// Size of the chunks a script is read from the standard input.
+#define STREAM_CHUNK_SIZE 4096
+
+// Read the next chunk of the script from the [stream] (a FILE*). The VM copies
+// the chunk so the same buffer is used for every chunk.
+static PkStringPtr readChunk(PKVM* vm, void* stream) {
+  static char buff[STREAM_CHUNK_SIZE];
+  PkStringPtr result = { buff, NULL, NULL, 0, 0 };
+  result.length = (uint32_t)fread(buff, sizeof(char), sizeof(buff),
+                                  (FILE*)stream);
+  return result;
+}
+
+// Returns true if the [path] is a bytecode cache file (ends with ".pkc").
+static bool isCacheFile(const char* path) {
+  size_t length = strlen(path);
+  return length > 4 && strcmp(path + length - 4, ".pkc") == 0;
+}
+
 // Create new atomlang VM and set it's configuration.
 static PKVM* intializeatomlangVM() {
   PkConfiguration config = pkNewConfiguration();
@@ -136,6 +252,9 @@ static PKVM* intializeatomlangVM() {
 
   config.load_script_fn = loadScript;
   config.resolve_path_fn = resolvePath;
+  config.load_cache_fn = loadCache;
+  config.write_cache_fn = writeCache;
+  config.read_chunk_fn = readChunk;
 
   return pkNewVM(&config);
 }
@@ -145,12 +264,13 @@ int main(int argc, const char** argv) {
   // Parse command line arguments.
 
   const char* usage[] = {
-    "atomlang ... [-c cmd | file] ...",
+    "atomlang ... [-c cmd | file | -] ...",
     NULL,
   };
 
   const char* cmd = NULL;
   int debug = false, help = false, quiet = false, version = false;
+  int jobs = 0;
   struct argparse_option cli_opts[] = {
       OPT_STRING('c', "cmd", (void*)&cmd,
         "Evaluate and run the passed string.", NULL, 0, 0),
@@ -158,6 +278,10 @@ int main(int argc, const char** argv) {
       OPT_BOOLEAN('d', "debug", (void*)&debug,
         "Compile and run the debug version.", NULL, 0, 0),
 
+      OPT_INTEGER('j', "jobs", (void*)&jobs,
+        "Compile the imports of the script on the number of threads.",
+        NULL, 0, 0),
+
       OPT_BOOLEAN('h', "help",  (void*)&help,
         "Prints this help message and exit.", NULL, 0, 0),
 
@@ -215,12 +339,39 @@ int main(int argc, const char** argv) {
     options.repl_mode = true;
     exitcode = repl(vm, &options);
 
+  } else if (strcmp(argv[0], "-") == 0) { // atomlang - < file.pk
+
+    // The script is compiled as it's read from the standard input, which
+    // could be a pipe that doesn't have the entire source yet.
+    PkStringPtr path = { "$(Stdin)", NULL, NULL, 0, 0 };
+    PkResult result = pkInterpretStream(vm, (void*)stdin, path, &options);
+    exitcode = (int)result;
+
+  } else if (isCacheFile(argv[0])) { // atomlang file.pkc ...
+
+    PkStringPtr resolved = resolvePath(vm, ".", argv[0]);
+    PkStringPtr bytecode = mapFile(resolved.string);
+
+    if (bytecode.string != NULL) {
+      // The script's path is the path of it's source, so that it'll be the
+      // same script as if it was run from the source.
+      ((char*)resolved.string)[strlen(resolved.string) - 1] = '\0';
+      PkResult result = pkInterpretBytecode(vm, bytecode, resolved, &options);
+      exitcode = (int)result;
+    } else {
+      fprintf(stderr, "Error: cannot open file at \"%s\"\n", resolved.string);
+      if (resolved.on_done != NULL) resolved.on_done(vm, resolved);
+    }
+
   } else { // atomlang file.pk ...
 
     PkStringPtr resolved = resolvePath(vm, ".", argv[0]);
     PkStringPtr source = loadScript(vm, resolved.string);
 
     if (source.string != NULL) {
+      if (jobs > 1) {
+        compileImports(resolved.string, source.string, jobs, debug);
+      }
       PkResult result = pkInterpretSource(vm, source, resolved, &options);
       exitcode = (int)result;
     } else {
@@ -85,8 +85,20 @@ typedef enum {
   PK_FIBER,
   PK_CLASS,
   PK_INST,
+  PK_TYPED_ARRAY,
+  PK_SET,
+  PK_DEQUE,
 } PkVarType;
 
+// Element type of the typed arrays. The elements of a typed array are stored
+// unboxed in a contiguous buffer which can be accessed from the host
+// application with pkTypedArrayGetData() without copying.
+typedef enum {
+  PK_ARRAY_FLOAT64, // double    (Float64Array)
+  PK_ARRAY_INT32,   // int32_t   (Int32Array)
+  PK_ARRAY_UINT8,   // uint8_t   (ByteArray)
+} PkArrayType;
+
 typedef struct PkStringPtr PkStringPtr;
 typedef struct PkConfiguration PkConfiguration;
 typedef struct PkCompileOptions PkCompileOptions;
@@ -193,6 +205,26 @@ typedef PkStringPtr (*pkResolvePathFn) (PKVM* vm, const char* from,
 // to indicate if it's failed to load the script.
 typedef PkStringPtr (*pkLoadScriptFn) (PKVM* vm, const char* path);
 
+// Load and return the bytecode cache of the script at [path] which was
+// written before with the pkWriteCacheFn. Unlike other strings the host
+// application should set the length attribute of the result to the size of
+// the cache in bytes. Set the string attribute to NULL if there isn't any
+// cache. The VM is done with the memory once on_done is called, so it can be
+// a read only mapping of the cache file.
+typedef PkStringPtr (*pkLoadCacheFn) (PKVM* vm, const char* path);
+
+// Write the bytecode cache [data] of [size] bytes for the script at [path].
+typedef void (*pkWriteCacheFn) (PKVM* vm, const char* path,
+                                const uint8_t* data, uint32_t size);
+
+// Read and return the next chunk of the source from the [stream] given to
+// pkInterpretStream(). Like a bytecode cache the host application should set
+// the length attribute of the chunk to it's size (it doesn't need to be null
+// terminated). Set the string attribute to NULL (or the length to 0) once
+// the stream has ended. The chunk is copied by the VM before on_done is
+// called, so the host can reuse the same buffer for each chunk.
+typedef PkStringPtr (*pkReadChunkFn) (PKVM* vm, void* stream);
+
 /*****************************************************************************/
 /* ATOMLANG PUBLIC API                                                     */
 /*****************************************************************************/
@@ -237,6 +269,13 @@ PK_PUBLIC void pkReleaseHandle(PKVM* vm, PkHandle* handle);
 PK_PUBLIC void pkModuleAddGlobal(PKVM* vm, PkHandle* module,
                                  const char* name, PkHandle* value);
 
+// Add a constant [value] to the given module, which should be a null, boolean,
+// number or a string. Unlike a global variable it can't be modified and the
+// compiler will use the value in place of the constant in the scripts which
+// imports the module.
+PK_PUBLIC void pkModuleAddConstant(PKVM* vm, PkHandle* module,
+                                   const char* name, PkHandle* value);
+
 // Add a native function to the given module. If [arity] is -1 that means
 // The function has variadic parameters and use pkGetArgc() to get the argc.
 PK_PUBLIC void pkModuleAddFunction(PKVM* vm, PkHandle* module,
@@ -263,6 +302,41 @@ PK_PUBLIC PkResult pkInterpretSource(PKVM* vm,
                                      PkStringPtr path,
                                      const PkCompileOptions* options);
 
+// Compile the source of the script at the [path] (and the scripts it imports)
+// without running it, same as pkInterpretSource() the strings will be cleaned
+// with their 'on_done' once it's done with them. The compiled scripts are
+// written to the host's bytecode cache (if write_cache_fn is registered), so
+// the host could compile the imports of a script in parallel on separate VMs
+// (one VM per thread) and the VM that runs the script will load them from
+// their caches instead of compiling.
+PK_PUBLIC PkResult pkCompileSource(PKVM* vm,
+                                   PkStringPtr source,
+                                   PkStringPtr path,
+                                   const PkCompileOptions* options);
+
+// Interpret the source read from the [stream] in chunks with the
+// read_chunk_fn of the configuration, instead of loading the entire source
+// to the memory first. The compiler only keeps the chunks of the top level
+// statement it's compiling, so it could be used for large generated scripts
+// or sources which are read from a pipe. The script isn't loaded from (or
+// written to) the bytecode cache since the source isn't known before it's
+// compiled.
+PK_PUBLIC PkResult pkInterpretStream(PKVM* vm,
+                                     void* stream,
+                                     PkStringPtr path,
+                                     const PkCompileOptions* options);
+
+// Interpret the compiled [bytecode] (the contents of a bytecode cache, with
+// it's length attribute set to the size) as the script at [path] without
+// validating it against the source. The bytecode should be compiled with the
+// same debug option of the [options] (which is used to compile the scripts it
+// imports as well). Once it's done with the bytecode and path 'on_done' will
+// be called to clean them if it's not NULL.
+PK_PUBLIC PkResult pkInterpretBytecode(PKVM* vm,
+                                       PkStringPtr bytecode,
+                                       PkStringPtr path,
+                                       const PkCompileOptions* options);
+
 // Runs the fiber's function with the provided arguments (param [arc] is the
 // argument count and [argv] are the values). It'll returns it's run status
 // result (success or failure) if you need the yielded or returned value use
@@ -289,7 +363,8 @@ struct PkStringPtr {
   void* user_data;        //< User related data.
 
   // These values are provided by the atomlang VM to the host application, you're
-  // not expected to set this when provideing string to the atomlang VM.
+  // not expected to set this when provideing string to the atomlang VM (except
+  // the length of a bytecode cache, see pkLoadCacheFn).
   uint32_t length;  //< Length of the string.
   uint32_t hash;    //< Its 32 bit FNV-1a hash.
 };
@@ -312,6 +387,14 @@ struct PkConfiguration {
   pkResolvePathFn resolve_path_fn;
   pkLoadScriptFn load_script_fn;
 
+  // Optional bytecode cache functions, if both are NULL the scripts will
+  // always be compiled from their sources.
+  pkLoadCacheFn load_cache_fn;
+  pkWriteCacheFn write_cache_fn;
+
+  // Required to interpret a source stream (see pkInterpretStream()).
+  pkReadChunkFn read_chunk_fn;
+
   // User defined data associated with VM.
   void* user_data;
 };
@@ -392,6 +475,14 @@ PK_PUBLIC void pkReturnInstNative(PKVM* vm, void* data, uint32_t id);
 // a string before calling this function, otherwise it'll fail an assertion.
 PK_PUBLIC const char* pkStringGetData(const PkVar value);
 
+// Returns the pointer to the contiguous element buffer of the given typed
+// array and set it's element type to [type] and the number of elements to
+// [count] if they're not NULL. The buffer could be read and written in place
+// and it'll be valid till the array is alive. Make sure the [value] is a typed
+// array before calling this function, otherwise it'll fail an assertion.
+PK_PUBLIC void* pkTypedArrayGetData(const PkVar value, PkArrayType* type,
+                                    uint32_t* count);
+
 // Returns the return value or if it's yielded, the yielded value of the fiber
 // as PkVar, this value lives on stack and will die (popped) once the fiber
 // resumed use handle to keep it alive.
@@ -413,6 +504,11 @@ PK_PUBLIC PkHandle* pkNewStringLength(PKVM* vm, const char* value, size_t len);
 PK_PUBLIC PkHandle* pkNewList(PKVM* vm);
 PK_PUBLIC PkHandle* pkNewMap(PKVM* vm);
 
+// Create and return a new typed array of [count] elements of [type], all the
+// elements are initialized to zero.
+PK_PUBLIC PkHandle* pkNewTypedArray(PKVM* vm, PkArrayType type,
+                                    uint32_t count);
+
 // Add a new module named [name] to the [vm]. Note that the module shouldn't
 // already existed, otherwise an assertion will fail to indicate that.
 PK_PUBLIC PkHandle* pkNewModule(PKVM* vm, const char* name);
@@ -0,0 +1,1264 @@
+/*
+ *  Copyright (c) 2020-2021 Thakee Nathees
+ *  Distributed Under The MIT License
+ */
+
+#include "pk_cache.h"
+
+#include "pk_compiler.h"
+#include "pk_core.h"
+#include "pk_utils.h"
+#include "pk_vm.h"
+
+// Kind of a function in the cache.
+typedef enum {
+  CACHE_FN_SCRIPT = 0, //< Function defined in the script.
+  CACHE_FN_NATIVE,     //< Native function declared in the script.
+  CACHE_FN_CTOR,       //< Constructor of a class (followed by the class).
+} CacheFnKind;
+
+// Literal types that could be written to the cache.
+typedef enum {
+  CACHE_LITERAL_NUMBER = 0,
+  CACHE_LITERAL_STRING,
+  CACHE_LITERAL_NULL,  //< Only the constants could be null or a boolean.
+  CACHE_LITERAL_TRUE,
+  CACHE_LITERAL_FALSE,
+  CACHE_LITERAL_RANGE, //< Jump tables of the match statements.
+  CACHE_LITERAL_MAP,
+} CacheLiteralType;
+
+// Opcode names, their parameter sizes and stack changes, used to generate the
+// signature of the instruction set and to walk through the bytecode.
+static const char* op_names[] = {
+  #define OPCODE(name, params, stack) #name,
+  #include "pk_opcodes.h"
+  #undef OPCODE
+};
+
+static const uint8_t op_params[] = {
+  #define OPCODE(name, params, stack) params,
+  #include "pk_opcodes.h"
+  #undef OPCODE
+};
+
+static const int8_t op_stack[] = {
+  #define OPCODE(name, params, stack) stack,
+  #include "pk_opcodes.h"
+  #undef OPCODE
+};
+
+// Add the [length] bytes at [data] to the FNV-1a [hash] and return it.
+static uint32_t hashBytes(uint32_t hash, const void* data, uint32_t length) {
+  for (uint32_t i = 0; i < length; i++) {
+    hash = (hash ^ ((const uint8_t*)data)[i]) * 16777619u;
+  }
+  return hash;
+}
+
+// Returns the FNV-1a hash of all the opcode names and their parameter sizes
+// and the names of the builtin functions (since they're referenced by their
+// index). Adding, removing, reordering or changing an opcode or a builtin
+// function will change the signature and the caches written before will be
+// rejected.
+static uint32_t opcodeSignature(PKVM* vm) {
+  uint32_t hash = 2166136261u;
+  for (uint32_t i = 0; i < sizeof(op_params); i++) {
+    hash = hashBytes(hash, op_names[i], (uint32_t)strlen(op_names[i]));
+    hash = hashBytes(hash, &op_params[i], 1);
+  }
+  for (uint32_t i = 0; i < vm->builtins_count; i++) {
+    hash = hashBytes(hash, vm->builtins[i].name, vm->builtins[i].length + 1);
+  }
+  return hash;
+}
+
+/*****************************************************************************/
+/* BYTECODE VERIFIER                                                         */
+/*****************************************************************************/
+
+// The VM doesn't check the bytecode it runs since it trusts the compiler, but
+// a cache could be corrupted (or crafted) so it's verified before it's used.
+// The verifier makes sure that every instruction is valid, all the indexes
+// are in the bounds of the buffers they refer to, the jumps land on an
+// instruction of the same function and the stack never underflows or grows
+// past the function's stack size. The values on the stack aren't type
+// checked since the VM checks them at runtime (or the bounds, like the
+// iterator of a loop) except the instance of a constructor which should be
+// at it's first slot to set it's fields.
+
+// An instruction decoded by the verifier.
+typedef struct {
+  Opcode op;
+  bool wide;     //< True if it's prefixed with OP_WIDE.
+  uint32_t arg;  //< The first parameter (0 if it doesn't have any).
+  uint32_t size; //< Size of the instruction in bytes (including OP_WIDE).
+} VerifyInstr;
+
+// Returns true if the [op] could be prefixed with OP_WIDE (see the VM's
+// OP_WIDE handler).
+static bool isWideOpcode(Opcode op) {
+  switch (op) {
+    case OP_PUSH_CONSTANT:
+    case OP_PUSH_INSTANCE:
+    case OP_PUSH_LOCAL_N:
+    case OP_STORE_LOCAL_N:
+    case OP_PUSH_GLOBAL:
+    case OP_STORE_GLOBAL:
+    case OP_PUSH_FN:
+    case OP_PUSH_TYPE:
+    case OP_ITER:
+    case OP_JUMP:
+    case OP_LOOP:
+    case OP_JUMP_IF:
+    case OP_JUMP_IF_NOT:
+    case OP_SWITCH_TABLE:
+    case OP_SWITCH_MAP:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+// Decode the instruction at the [offset] of the [opcodes] to [instr]. Returns
+// false if it's not a valid instruction or it's truncated.
+static bool verifyDecode(const pkByteBuffer* opcodes, uint32_t offset,
+                         VerifyInstr* instr) {
+  const uint8_t* data = opcodes->data + offset;
+  uint32_t left = opcodes->count - offset;
+
+  instr->wide = (data[0] == OP_WIDE);
+  uint32_t start = instr->wide ? 1 : 0;
+  if (start >= left || data[start] >= sizeof(op_params)) return false;
+
+  instr->op = (Opcode)data[start];
+  if (instr->wide && !isWideOpcode(instr->op)) return false;
+
+  // The first parameter is 1 or 2 bytes (twice as wide if prefixed), the
+  // 3 bytes parameters are a name index followed by a byte (the function
+  // index of OP_GET_MODULE_FN or the inline cache index of the attribute
+  // access instructions) which is verified separately.
+  uint32_t params = op_params[instr->op] * (instr->wide ? 2 : 1);
+  instr->size = start + 1 + params;
+  if (instr->size > left) return false;
+
+  uint32_t width = (params == 3) ? 2 : params;
+  instr->arg = 0;
+  for (uint32_t i = 0; i < width; i++) {
+    instr->arg = (instr->arg << 8) | data[start + 1 + i];
+  }
+  return true;
+}
+
+// Returns the number of values at the stack top the [instr] reads (at least
+// the number of values it pops) which should exist on the stack.
+static int verifyStackReads(const VerifyInstr* instr) {
+  switch (instr->op) {
+    case OP_STORE_LOCAL_0:
+    case OP_STORE_LOCAL_1:
+    case OP_STORE_LOCAL_2:
+    case OP_STORE_LOCAL_3:
+    case OP_STORE_LOCAL_4:
+    case OP_STORE_LOCAL_5:
+    case OP_STORE_LOCAL_6:
+    case OP_STORE_LOCAL_7:
+    case OP_STORE_LOCAL_8:
+    case OP_STORE_LOCAL_N:
+    case OP_STORE_GLOBAL:
+    case OP_GET_ATTRIB:
+    case OP_GET_MODULE_FN:
+    case OP_GET_ATTRIB_KEEP:
+    case OP_NEGATIVE:
+    case OP_NOT:
+    case OP_BIT_NOT:
+    case OP_REPL_PRINT:
+      return 1;
+
+    // The return at the end of a function pops the return value slot at the
+    // frame's base, which is below the locals (see emitFunctionEnd()).
+    case OP_RETURN:
+      return 0;
+
+    case OP_SWAP:
+    case OP_GET_SUBSCRIPT_KEEP:
+      return 2;
+
+    case OP_ITER_TEST:
+    case OP_ITER:
+      return 3;
+
+    case OP_CALL:
+    case OP_TAIL_CALL:
+      return (int)instr->arg + 1;
+
+    case OP_CALL_INTRINSIC:
+      return getIntrinsicArity((Intrinsic)instr->arg) + 1;
+
+    default:
+      // The binary operators and the instructions that pops values to set
+      // them to the value below them, reads one more than they pop.
+      if (op_stack[instr->op] >= 0) return 0;
+      if (instr->op == OP_POP ||
+          instr->op == OP_JUMP_IF || instr->op == OP_JUMP_IF_NOT ||
+          instr->op == OP_SWITCH_TABLE || instr->op == OP_SWITCH_MAP) {
+        return -op_stack[instr->op];
+      }
+      return -op_stack[instr->op] + 1;
+  }
+}
+
+// Returns the change of the stack size after the [instr].
+static int verifyStackChange(const VerifyInstr* instr) {
+  switch (instr->op) {
+    case OP_CALL:
+    case OP_TAIL_CALL:
+      return -(int)instr->arg;
+
+    case OP_CALL_INTRINSIC:
+      return -getIntrinsicArity((Intrinsic)instr->arg);
+
+    default:
+      return op_stack[instr->op];
+  }
+}
+
+// Returns the number of entries (excluding the default entry) of the jump
+// table literal of a switch instruction or -1 if it's not a valid table.
+static int64_t verifyJumpTable(Opcode op, Var table) {
+  if (op == OP_SWITCH_TABLE) {
+    if (!IS_OBJ_TYPE(table, OBJ_RANGE)) return -1;
+    const Range* range = (const Range*)AS_OBJ(table);
+    if (!(range->from >= INT32_MIN && range->to <= INT32_MAX) ||
+        range->from != (int64_t)range->from ||
+        range->to != (int64_t)range->to || range->to < range->from) {
+      return -1;
+    }
+    return (int64_t)(range->to - range->from);
+  }
+
+  if (!IS_OBJ_TYPE(table, OBJ_MAP)) return -1;
+  const Map* map = (const Map*)AS_OBJ(table);
+
+  uint32_t iter = 0;
+  Var entry;
+  while (mapIterate(map, &iter, NULL, &entry)) {
+    if (!IS_INT(entry) || AS_INT(entry) < 0 ||
+        (uint32_t)AS_INT(entry) > map->count) {
+      return -1;
+    }
+  }
+  return map->count;
+}
+
+// Verify the operand of the decoded instruction [instr] at the [offset].
+// Returns false if it's out of the bounds.
+static bool verifyOperand(PKVM* vm, const Script* script, const Fn* fn,
+                          uint32_t offset, const VerifyInstr* instr) {
+  uint32_t arg = instr->arg;
+
+  switch (instr->op) {
+    case OP_PUSH_CONSTANT:
+      return arg < script->literals.count;
+
+    case OP_PUSH_INSTANCE:
+    case OP_PUSH_TYPE:
+      return arg < script->classes.count;
+
+    case OP_PUSH_GLOBAL:
+    case OP_STORE_GLOBAL:
+      return arg < script->globals.count;
+
+    case OP_PUSH_FN:
+      return arg < script->functions.count;
+
+    case OP_PUSH_BUILTIN_FN:
+      return arg < vm->builtins_count;
+
+    case OP_CALL_INTRINSIC:
+      return arg < INTRINSIC_COUNT;
+
+    case OP_GET_MODULE_FN: //< The function index is checked at runtime.
+      return arg < script->names.count;
+
+    // The inline cache index is the byte after the name index.
+    case OP_GET_ATTRIB:
+    case OP_GET_ATTRIB_KEEP:
+    case OP_SET_ATTRIB:
+      return arg < script->names.count &&
+             fn->opcodes.data[offset + 3] < fn->attrib_count;
+
+    case OP_IMPORT:
+    {
+      // The imported scripts are loaded before the script.
+      if (arg >= script->names.count) return false;
+      String* path = script->names.data[arg];
+      return getCoreLib(vm, path) != NULL ||
+             IS_OBJ_TYPE(mapGet(vm->scripts, VAR_OBJ(path)), OBJ_SCRIPT);
+    }
+
+    case OP_SWITCH_TABLE:
+    case OP_SWITCH_MAP:
+    {
+      if (arg >= script->literals.count) return false;
+      int64_t entries = verifyJumpTable(instr->op,
+                                        script->literals.data[arg]);
+      if (entries < 0) return false;
+
+      // The table should be followed by the default entry and an entry for
+      // each case, which are jumps of the same size.
+      uint32_t entry = offset + instr->size;
+      if (entry >= fn->opcodes.count) return false;
+      bool wide = (fn->opcodes.data[entry] == OP_WIDE);
+      for (int64_t i = 0; i <= entries; i++) {
+        VerifyInstr jump;
+        if (entry >= fn->opcodes.count ||
+            !verifyDecode(&fn->opcodes, entry, &jump) || jump.wide != wide ||
+            (jump.op != OP_JUMP && jump.op != OP_LOOP)) {
+          return false;
+        }
+        entry += jump.size;
+      }
+      return true;
+    }
+
+    default:
+      return true;
+  }
+}
+
+// Returns true if the [instr] at the [offset] is a jump and set the [target]
+// to it's destination (the offset is from the end of the instruction).
+static bool verifyJumpTarget(const VerifyInstr* instr, uint32_t offset,
+                             int64_t* target) {
+  int64_t next = (int64_t)offset + instr->size;
+  switch (instr->op) {
+    case OP_ITER:
+    case OP_JUMP:
+    case OP_JUMP_IF:
+    case OP_JUMP_IF_NOT:
+      *target = next + instr->arg;
+      return true;
+
+    case OP_LOOP:
+      *target = next - instr->arg;
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+// Set the stack size at the instruction at the [offset] of the [count] bytes
+// to [height] if it's not reached yet and add it to the [work] list. Returns
+// false if it's not the beginning of an instruction or it was reached before
+// with a different stack size.
+static bool verifyReach(PKVM* vm, int32_t* heights, uint32_t count,
+                        pkUintBuffer* work, int64_t offset, int32_t height) {
+  if (offset < 0 || offset >= count || heights[offset] == -2) return false;
+  if (heights[offset] >= 0) return heights[offset] == height;
+  heights[offset] = height;
+  pkUintBufferWrite(work, vm, (uint32_t)offset);
+  return true;
+}
+
+// Returns the class of the script if the [func] is it's constructor, or NULL.
+static const Class* verifyCtorClass(const Script* script,
+                                    const Function* func) {
+  for (uint32_t i = 0; i < script->classes.count; i++) {
+    if (script->classes.data[i]->ctor == func) return script->classes.data[i];
+  }
+  return NULL;
+}
+
+// Verify the bytecode of the [func] of the [script] (see the comment at the
+// beginning of this section). Returns false if it's not valid.
+static bool verifyFunction(PKVM* vm, const Script* script,
+                           const Function* func) {
+  if (func->is_native) return true;
+  const Fn* fn = func->fn;
+  const pkByteBuffer* opcodes = &fn->opcodes;
+
+  // Every instruction pushes at most one value so the stack size can't be
+  // larger than the number of the instructions (plus the arguments).
+  int32_t arity = (func == script->body) ? 0 : func->arity;
+  if (opcodes->count == 0 || arity < 0 || arity > fn->stack_size ||
+      (uint32_t)fn->stack_size > (uint32_t)arity + opcodes->count) {
+    return false;
+  }
+
+  // The inlined calls are only used to report the errors, their opcodes
+  // and function should be in the bounds.
+  if (fn->inlined.count % INLINED_CALL_SIZE != 0) return false;
+  for (uint32_t i = 0; i < fn->inlined.count; i += INLINED_CALL_SIZE) {
+    const uint32_t* call = fn->inlined.data + i;
+    if (call[0] >= call[1] || call[1] > opcodes->count ||
+        call[2] >= script->functions.count) {
+      return false;
+    }
+  }
+
+  // The stack size at the beginning of each instruction, -1 if it's not
+  // reached (yet) and -2 if it's not the beginning of an instruction.
+  int32_t* heights = ALLOCATE_ARRAY(vm, int32_t, opcodes->count);
+  for (uint32_t i = 0; i < opcodes->count; i++) heights[i] = -2;
+
+  // Decode all the instructions (even the unreachable ones) and verify
+  // their operands. The function should end with OP_END.
+  bool valid = true;
+  VerifyInstr instr = { OP_END, false, 0, 1 };
+  const Class* cls = verifyCtorClass(script, func);
+  uint32_t offset = 0;
+  while (valid && offset < opcodes->count) {
+    valid = verifyDecode(opcodes, offset, &instr) &&
+            verifyOperand(vm, script, fn, offset, &instr);
+    if (!valid) break;
+
+    // A constructor begins with pushing the instance of it's class, which is
+    // the only place the instances are created and their fields are set.
+    if (instr.op == OP_PUSH_INSTANCE) {
+      valid = cls != NULL && offset == 0 &&
+              script->classes.data[instr.arg] == cls;
+    } else if (instr.op == OP_INST_INIT_FIELD) {
+      valid = cls != NULL && instr.arg < cls->field_names.count;
+    } else if (offset == 0) {
+      valid = cls == NULL;
+    }
+
+    heights[offset] = -1;
+    offset += instr.size;
+  }
+  valid = valid && instr.op == OP_END && !instr.wide;
+
+  // Walk through all the reachable instructions and compute the stack size
+  // at each of them, which should be the same from all the paths.
+  pkUintBuffer work;
+  pkUintBufferInit(&work);
+  if (valid) valid = verifyReach(vm, heights, opcodes->count, &work, 0, arity);
+
+  while (valid && work.count > 0) {
+    offset = work.data[--work.count];
+    int32_t height = heights[offset];
+    verifyDecode(opcodes, offset, &instr);
+
+    // The end of a function is never reached (the compiler emits a return).
+    if (instr.op == OP_END ||
+        height < verifyStackReads(&instr) ||
+        height + verifyStackChange(&instr) > fn->stack_size) {
+      valid = false;
+      break;
+    }
+
+    // The instance of a constructor is at the first slot till it's returned
+    // so the fields are always set to the instance. Nothing else should
+    // touch the slot.
+    if (cls != NULL && offset != 0 && instr.op != OP_RETURN) {
+      int32_t bottom = height - verifyStackReads(&instr);
+      if (instr.op == OP_INST_INIT_FIELD) {
+        valid = (height == 2);
+      } else if (bottom < 1 || instr.op == OP_STORE_LOCAL_0 ||
+                 (instr.op == OP_STORE_LOCAL_N && instr.arg == 0)) {
+        valid = false;
+      }
+      if (!valid) break;
+    }
+
+    // A local should exist on the stack to be accessed.
+    if (OP_PUSH_LOCAL_0 <= instr.op && instr.op <= OP_PUSH_LOCAL_8) {
+      valid = (int32_t)(instr.op - OP_PUSH_LOCAL_0) < height;
+    } else if (OP_STORE_LOCAL_0 <= instr.op && instr.op <= OP_STORE_LOCAL_8) {
+      valid = (int32_t)(instr.op - OP_STORE_LOCAL_0) < height;
+    } else if (instr.op == OP_PUSH_LOCAL_N || instr.op == OP_STORE_LOCAL_N) {
+      valid = (int64_t)instr.arg < height;
+    }
+    if (!valid) break;
+
+    height += verifyStackChange(&instr);
+    int64_t next = (int64_t)offset + instr.size;
+
+    if (instr.op == OP_SWITCH_TABLE || instr.op == OP_SWITCH_MAP) {
+      // Each entry of the jump table could be reached.
+      int64_t entries = verifyJumpTable(instr.op,
+                                        script->literals.data[instr.arg]);
+      for (int64_t i = 0; valid && i <= entries; i++) {
+        VerifyInstr jump;
+        verifyDecode(opcodes, (uint32_t)next, &jump);
+        valid = verifyReach(vm, heights, opcodes->count, &work, next, height);
+        next += jump.size;
+      }
+      continue;
+    }
+
+    int64_t target;
+    if (verifyJumpTarget(&instr, offset, &target)) {
+      valid = verifyReach(vm, heights, opcodes->count, &work, target, height);
+    }
+
+    // The instructions that won't continue to the next instruction.
+    if (instr.op == OP_JUMP || instr.op == OP_LOOP || instr.op == OP_RETURN) {
+      continue;
+    }
+    if (valid) {
+      valid = verifyReach(vm, heights, opcodes->count, &work, next, height);
+    }
+  }
+
+  pkUintBufferClear(&work, vm);
+  DEALLOCATE(vm, heights);
+  return valid;
+}
+
+/*****************************************************************************/
+/* CACHE WRITER                                                              */
+/*****************************************************************************/
+
+static void writeByte(PKVM* vm, pkByteBuffer* buff, uint8_t value) {
+  pkByteBufferWrite(buff, vm, value);
+}
+
+static void writeUint(PKVM* vm, pkByteBuffer* buff, uint32_t value) {
+  pkByteBufferReserve(buff, vm, buff->count + sizeof(uint32_t));
+  for (int i = 0; i < 4; i++) {
+    buff->data[buff->count++] = (uint8_t)((value >> (8 * i)) & 0xff);
+  }
+}
+
+static void writeString(PKVM* vm, pkByteBuffer* buff,
+                        const char* data, uint32_t length) {
+  writeUint(vm, buff, length);
+  pkByteBufferAddString(buff, vm, data, length);
+}
+
+static void writeUint64(PKVM* vm, pkByteBuffer* buff, uint64_t value) {
+  writeUint(vm, buff, (uint32_t)(value & 0xffffffff));
+  writeUint(vm, buff, (uint32_t)(value >> 32));
+}
+
+static void writeDouble(PKVM* vm, pkByteBuffer* buff, double value) {
+  writeUint64(vm, buff, utilDoubleToBits(value));
+}
+
+// Write the literal [value] to the buffer, returns false if it's not a type
+// of value that could be a literal.
+static bool writeLiteral(PKVM* vm, pkByteBuffer* buff, Var value) {
+  if (IS_NUM(value)) {
+    writeByte(vm, buff, CACHE_LITERAL_NUMBER);
+    writeDouble(vm, buff, AS_NUM(value));
+
+  } else if (IS_OBJ_TYPE(value, OBJ_STRING)) {
+    String* str = (String*)AS_OBJ(value);
+    writeByte(vm, buff, CACHE_LITERAL_STRING);
+    writeString(vm, buff, str->data, str->length);
+
+  } else if (IS_NULL(value)) {
+    writeByte(vm, buff, CACHE_LITERAL_NULL);
+
+  } else if (IS_BOOL(value)) {
+    writeByte(vm, buff, AS_BOOL(value) ? CACHE_LITERAL_TRUE
+                                       : CACHE_LITERAL_FALSE);
+
+  } else if (IS_OBJ_TYPE(value, OBJ_RANGE)) {
+    Range* range = (Range*)AS_OBJ(value);
+    writeByte(vm, buff, CACHE_LITERAL_RANGE);
+    writeDouble(vm, buff, range->from);
+    writeDouble(vm, buff, range->to);
+    writeDouble(vm, buff, range->step);
+
+  } else if (IS_OBJ_TYPE(value, OBJ_MAP)) {
+    Map* map = (Map*)AS_OBJ(value);
+    writeByte(vm, buff, CACHE_LITERAL_MAP);
+    writeUint(vm, buff, map->count);
+
+    uint32_t iter = 0;
+    Var key, entry;
+    while (mapIterate(map, &iter, &key, &entry)) {
+      if (!writeLiteral(vm, buff, key)) return false;
+      if (!writeLiteral(vm, buff, entry)) return false;
+    }
+
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+// Write the name indexes of the scripts imported by the [func] (that aren't
+// already in [imports]) to the [imports] buffer.
+static void collectImports(PKVM* vm, const Function* func,
+                           pkUintBuffer* imports) {
+  if (func->is_native) return;
+
+  const pkByteBuffer* opcodes = &func->fn->opcodes;
+  uint32_t i = 0;
+  while (i < opcodes->count) {
+    Opcode op = (Opcode)opcodes->data[i];
+    ASSERT(op < sizeof(op_params), OOPS);
+
+    if (op == OP_IMPORT) {
+      ASSERT(i + 2 < opcodes->count, OOPS);
+      uint32_t index = (opcodes->data[i + 1] << 8) | opcodes->data[i + 2];
+
+      bool exists = false;
+      for (uint32_t j = 0; j < imports->count; j++) {
+        if (imports->data[j] == index) {
+          exists = true;
+          break;
+        }
+      }
+      if (!exists) pkUintBufferWrite(imports, vm, index);
+    }
+
+    // The parameter of an instruction prefixed with OP_WIDE is twice as
+    // wide (OP_IMPORT is never prefixed).
+    if (op == OP_WIDE) {
+      ASSERT(i + 1 < opcodes->count, OOPS);
+      i += 2 + op_params[opcodes->data[i + 1]] * 2;
+      continue;
+    }
+
+    i += 1 + op_params[op];
+  }
+}
+
+// Returns the signature of the native module [lib], which is a hash of it's
+// functions, globals, classes and the values of it's constants. The scripts
+// which import it resolve (or inline) them at compile time by their index,
+// so the cache is only valid with the same module (ie. the debug build's
+// lang module has functions that the release build doesn't).
+static uint32_t moduleSignature(PKVM* vm, const Script* lib) {
+  pkByteBuffer buff;
+  pkByteBufferInit(&buff);
+
+  for (uint32_t i = 0; i < lib->functions.count; i++) {
+    const Function* func = lib->functions.data[i];
+    writeString(vm, &buff, func->name, (uint32_t)strlen(func->name));
+    writeUint(vm, &buff, (uint32_t)func->arity);
+  }
+
+  for (uint32_t i = 0; i < lib->global_names.count; i++) {
+    const String* name = lib->names.data[lib->global_names.data[i]];
+    writeString(vm, &buff, name->data, name->length);
+  }
+
+  for (uint32_t i = 0; i < lib->classes.count; i++) {
+    const String* name = lib->names.data[lib->classes.data[i]->name];
+    writeString(vm, &buff, name->data, name->length);
+  }
+
+  // A constant that isn't a literal is never inlined.
+  for (uint32_t i = 0; i < lib->constants.count; i++) {
+    uint32_t index = lib->constants.data[i];
+    writeUint(vm, &buff, index);
+    writeLiteral(vm, &buff, lib->globals.data[index]);
+  }
+
+  uint32_t hash = hashBytes(2166136261u, buff.data, buff.count);
+  pkByteBufferClear(&buff, vm);
+  return hash;
+}
+
+bool cacheWriteScript(PKVM* vm, Script* script, bool debug,
+                      pkByteBuffer* buff) {
+
+  // Header.
+  pkByteBufferAddString(buff, vm, CACHE_MAGIC, sizeof(CACHE_MAGIC) - 1);
+  writeUint(vm, buff, CACHE_VERSION);
+  writeUint(vm, buff, opcodeSignature(vm));
+  writeUint64(vm, buff, script->source_hash);
+  writeByte(vm, buff, (uint8_t)debug);
+
+  // Imported scripts with the hash of their sources, followed by the native
+  // modules with their signatures.
+  pkUintBuffer imports;
+  pkUintBufferInit(&imports);
+  for (uint32_t i = 0; i < script->functions.count; i++) {
+    collectImports(vm, script->functions.data[i], &imports);
+  }
+
+  for (int pass = 0; pass < 2; pass++) {
+    bool natives = (pass == 1);
+    uint32_t count_pos = buff->count, count = 0;
+    writeUint(vm, buff, 0); //< Will be patched once we know the count.
+
+    for (uint32_t i = 0; i < imports.count; i++) {
+      ASSERT_INDEX(imports.data[i], script->names.count);
+      String* path = script->names.data[imports.data[i]];
+
+      Var lib = mapGet(vm->core_libs, VAR_OBJ(path));
+      bool is_native = !IS_UNDEF(lib);
+      if (is_native != natives) continue;
+
+      uint64_t hash;
+      if (is_native) {
+        hash = moduleSignature(vm, (Script*)AS_OBJ(lib));
+      } else {
+        Var entry = mapGet(vm->scripts, VAR_OBJ(path));
+        ASSERT(IS_OBJ_TYPE(entry, OBJ_SCRIPT), OOPS);
+        hash = ((Script*)AS_OBJ(entry))->source_hash;
+      }
+
+      writeString(vm, buff, path->data, path->length);
+      writeUint64(vm, buff, hash);
+      count++;
+    }
+
+    for (int i = 0; i < 4; i++) {
+      buff->data[count_pos + i] = (uint8_t)((count >> (8 * i)) & 0xff);
+    }
+  }
+  pkUintBufferClear(&imports, vm);
+
+  // Module name.
+  writeByte(vm, buff, (uint8_t)(script->module != NULL));
+  if (script->module != NULL) {
+    writeString(vm, buff, script->module->data, script->module->length);
+  }
+
+  // Names.
+  writeUint(vm, buff, script->names.count);
+  for (uint32_t i = 0; i < script->names.count; i++) {
+    String* name = script->names.data[i];
+    writeString(vm, buff, name->data, name->length);
+  }
+
+  // Globals (their values are set when the script body runs).
+  writeUint(vm, buff, script->global_names.count);
+  for (uint32_t i = 0; i < script->global_names.count; i++) {
+    writeUint(vm, buff, script->global_names.data[i]);
+  }
+
+  // Constants (unlike the other globals their values are known before the
+  // script body runs, and the scripts which import it depends on them).
+  writeUint(vm, buff, script->constants.count);
+  for (uint32_t i = 0; i < script->constants.count; i++) {
+    uint32_t index = script->constants.data[i];
+    writeUint(vm, buff, index);
+    if (!writeLiteral(vm, buff, script->globals.data[index])) return false;
+  }
+
+  // Literals.
+  writeUint(vm, buff, script->literals.count);
+  for (uint32_t i = 0; i < script->literals.count; i++) {
+    if (!writeLiteral(vm, buff, script->literals.data[i])) return false;
+  }
+
+  // Functions, a class is written along with it's constructor since the
+  // constructor is added to the functions buffer when the class is created.
+  uint32_t class_index = 0;
+  writeUint(vm, buff, script->functions.count);
+  for (uint32_t i = 0; i < script->functions.count; i++) {
+    Function* func = script->functions.data[i];
+    writeString(vm, buff, func->name, (uint32_t)strlen(func->name));
+
+    if (class_index < script->classes.count &&
+        script->classes.data[class_index]->ctor == func) {
+      Class* cls = script->classes.data[class_index++];
+      writeByte(vm, buff, CACHE_FN_CTOR);
+      writeUint(vm, buff, cls->name);
+      writeUint(vm, buff, cls->field_names.count);
+      for (uint32_t j = 0; j < cls->field_names.count; j++) {
+        writeUint(vm, buff, cls->field_names.data[j]);
+      }
+
+    } else if (func->is_native) {
+      writeByte(vm, buff, CACHE_FN_NATIVE);
+
+    } else {
+      writeByte(vm, buff, CACHE_FN_SCRIPT);
+    }
+
+    writeUint(vm, buff, (uint32_t)func->arity);
+    if (func->is_native) continue;
+
+    ASSERT(verifyFunction(vm, script, func),
+           "The compiler emitted an invalid bytecode.");
+
+    Fn* fn = func->fn;
+    writeUint(vm, buff, (uint32_t)fn->stack_size);
+    writeUint(vm, buff, fn->opcodes.count);
+    pkByteBufferAddString(buff, vm, (const char*)fn->opcodes.data,
+                          fn->opcodes.count);
+    writeUint(vm, buff, fn->line_table.count);
+    pkByteBufferAddString(buff, vm, (const char*)fn->line_table.data,
+                          fn->line_table.count);
+
+    writeUint(vm, buff, fn->inlined.count / INLINED_CALL_SIZE);
+    for (uint32_t j = 0; j < fn->inlined.count; j++) {
+      writeUint(vm, buff, fn->inlined.data[j]);
+    }
+
+    writeUint(vm, buff, fn->attrib_count);
+  }
+
+  // All the classes should have been written with their constructors.
+  return class_index == script->classes.count;
+}
+
+/*****************************************************************************/
+/* CACHE READER                                                              */
+/*****************************************************************************/
+
+typedef struct {
+  const uint8_t* data; //< The cache data.
+  uint32_t size;       //< Size of the data in bytes.
+  uint32_t pos;        //< Position of the next byte to read.
+  bool error;          //< Set if tried to read past the end of the data.
+} Reader;
+
+// Returns a pointer to the next [length] bytes of the reader and advance the
+// position, or NULL if there aren't enough bytes left.
+static const uint8_t* readBytes(Reader* reader, uint32_t length) {
+  if (reader->error || length > reader->size - reader->pos) {
+    reader->error = true;
+    return NULL;
+  }
+  const uint8_t* bytes = reader->data + reader->pos;
+  reader->pos += length;
+  return bytes;
+}
+
+static uint8_t readByte(Reader* reader) {
+  const uint8_t* bytes = readBytes(reader, 1);
+  return (bytes != NULL) ? bytes[0] : 0;
+}
+
+static uint32_t readUint(Reader* reader) {
+  const uint8_t* bytes = readBytes(reader, 4);
+  if (bytes == NULL) return 0;
+  return (uint32_t)bytes[0]         | ((uint32_t)bytes[1] << 8) |
+         ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+// Read a string from the reader and return a pointer to it's characters (not
+// null terminated), or NULL on error.
+static const char* readString(Reader* reader, uint32_t* length) {
+  *length = readUint(reader);
+  return (const char*)readBytes(reader, *length);
+}
+
+static uint64_t readUint64(Reader* reader) {
+  uint64_t value = readUint(reader);
+  return value | ((uint64_t)readUint(reader) << 32);
+}
+
+static double readDouble(Reader* reader) {
+  return utilDoubleFromBits(readUint64(reader));
+}
+
+// Read a literal written with writeLiteral() and set it to [value]. Returns
+// false if the cache is corrupted. An object value isn't referenced by
+// anything yet, so it should be pushed as a temp reference before allocating.
+static bool readLiteral(PKVM* vm, Reader* reader, Var* value) {
+  switch ((CacheLiteralType)readByte(reader)) {
+    case CACHE_LITERAL_NUMBER:
+      *value = VAR_NUM(readDouble(reader));
+      break;
+
+    case CACHE_LITERAL_STRING: {
+      uint32_t length;
+      const char* data = readString(reader, &length);
+      if (data == NULL) return false;
+      *value = VAR_OBJ(newStringLength(vm, data, length));
+      break;
+    }
+
+    case CACHE_LITERAL_NULL:  *value = VAR_NULL;  break;
+    case CACHE_LITERAL_TRUE:  *value = VAR_TRUE;  break;
+    case CACHE_LITERAL_FALSE: *value = VAR_FALSE; break;
+
+    case CACHE_LITERAL_RANGE: {
+      double from = readDouble(reader);
+      double to = readDouble(reader);
+      double step = readDouble(reader);
+      if (reader->error || step == 0) return false;
+      *value = VAR_OBJ(newRange(vm, from, to, step));
+      break;
+    }
+
+    case CACHE_LITERAL_MAP: {
+      uint32_t count = readUint(reader);
+      Map* map = newMap(vm);
+      vmPushTempRef(vm, &map->_super); // map.
+
+      bool ok = true;
+      for (uint32_t i = 0; ok && i < count; i++) {
+        Var key, entry;
+        ok = readLiteral(vm, reader, &key);
+        if (!ok) break;
+        if (IS_OBJ(key)) vmPushTempRef(vm, AS_OBJ(key)); // key.
+        ok = readLiteral(vm, reader, &entry) && !IS_OBJ(entry) &&
+             (!IS_OBJ(key) || isObjectHashable(AS_OBJ(key)->type));
+        if (ok) mapSet(vm, map, key, entry);
+        if (IS_OBJ(key)) vmPopTempRef(vm); // key.
+      }
+
+      vmPopTempRef(vm); // map.
+      if (!ok) return false;
+      *value = VAR_OBJ(map);
+      break;
+    }
+
+    default:
+      return false;
+  }
+
+  return !reader->error;
+}
+
+// Load the host's bytecode cache of the [script].
+static bool loadHostCache(PKVM* vm, Script* script, bool debug,
+                          bool validate) {
+  if (vm->config.load_cache_fn == NULL) return false;
+
+  PkStringPtr cache = vm->config.load_cache_fn(vm, script->path->data);
+  if (cache.string == NULL) return false;
+
+  bool loaded = cacheLoadScript(vm, script, (const uint8_t*)cache.string,
+                                cache.length, debug, validate);
+  if (cache.on_done != NULL) cache.on_done(vm, cache);
+  return loaded;
+}
+
+// Make sure the script at the [path] which was imported by a cached script is
+// loaded, if it's not it'll be compiled (or loaded from it's cache). Returns
+// false if the script couldn't be loaded or [validate] is true and it isn't
+// the same script (compiled from a source of the [hash]) the cache was
+// compiled with.
+static bool cacheImportScript(PKVM* vm, String* path, uint64_t hash,
+                              bool debug, bool validate) {
+
+  Var entry = mapGet(vm->scripts, VAR_OBJ(path));
+  if (!IS_UNDEF(entry)) {
+    ASSERT(AS_OBJ(entry)->type == OBJ_SCRIPT, OOPS);
+    return !validate || ((Script*)AS_OBJ(entry))->source_hash == hash;
+  }
+
+  if (vm->config.load_script_fn == NULL) return false;
+
+  // If the source doesn't exists and we're not validating (ie. running a cache
+  // file directly) the script will be loaded from the host's cache.
+  PkStringPtr source = vm->config.load_script_fn(vm, path->data);
+  if (source.string == NULL && validate) return false;
+  if (source.string != NULL && validate &&
+      utilHashString64(source.string) != hash) {
+    if (source.on_done != NULL) source.on_done(vm, source);
+    return false;
+  }
+
+  vmPushTempRef(vm, &path->_super); // path.
+  Script* scr = newScript(vm, path, false);
+  vmPushTempRef(vm, &scr->_super); // scr.
+  mapSet(vm, vm->scripts, VAR_OBJ(path), VAR_OBJ(scr));
+  vmPopTempRef(vm); // scr.
+  vmPopTempRef(vm); // path.
+
+  bool loaded;
+  if (source.string != NULL) {
+    PkCompileOptions options = pkNewCompilerOptions();
+    options.debug = debug;
+    loaded = compileCached(vm, scr, source.string, &options) ==
+               PK_RESULT_SUCCESS;
+    if (source.on_done != NULL) source.on_done(vm, source);
+  } else {
+    loaded = loadHostCache(vm, scr, debug, false);
+  }
+
+  if (!loaded) mapRemoveKey(vm, vm->scripts, VAR_OBJ(path));
+  return loaded;
+}
+
+// Read the functions (and the classes) of the cache to the [script]. Returns
+// false if the cache is corrupted.
+static bool readFunctions(PKVM* vm, Script* script, Reader* reader) {
+
+  uint32_t count = readUint(reader);
+  for (uint32_t i = 0; i < count && !reader->error; i++) {
+    uint32_t length;
+    const char* name = readString(reader, &length);
+    CacheFnKind kind = (CacheFnKind)readByte(reader);
+    if (reader->error) return false;
+
+    Function* func;
+    if (i < script->functions.count) {
+      // The script's body function which was created with the script.
+      func = script->functions.data[i];
+      if (kind != CACHE_FN_SCRIPT || strlen(func->name) != length ||
+          strncmp(func->name, name, length) != 0) {
+        return false;
+      }
+
+    } else if (kind == CACHE_FN_CTOR) {
+      uint32_t class_name = readUint(reader);
+      if (reader->error || class_name >= script->names.count) return false;
+
+      String* ty_name = script->names.data[class_name];
+      Class* cls = newClass(vm, script, ty_name->data, ty_name->length);
+      func = cls->ctor;
+
+      uint32_t fields_count = readUint(reader);
+      for (uint32_t j = 0; j < fields_count; j++) {
+        uint32_t field = readUint(reader);
+        if (reader->error || field >= script->names.count) return false;
+        pkUintBufferWrite(&cls->field_names, vm, field);
+      }
+
+    } else if (kind == CACHE_FN_SCRIPT || kind == CACHE_FN_NATIVE) {
+      func = newFunction(vm, name, (int)length, script,
+                         kind == CACHE_FN_NATIVE, NULL);
+
+    } else {
+      return false;
+    }
+
+    func->arity = (int)readUint(reader);
+    if (func->is_native) continue;
+
+    Fn* fn = func->fn;
+    fn->stack_size = (int)readUint(reader);
+    uint32_t opcodes_count = readUint(reader);
+    const uint8_t* opcodes = readBytes(reader, opcodes_count);
+    if (opcodes == NULL) return false;
+
+    // The opcodes are copied with a single memcpy since the host could unmap
+    // the cache once we're done with it.
+    fn->opcodes.count = 0;
+    if (opcodes_count == 0) return false; //< Should end with OP_END.
+    pkByteBufferReserve(&fn->opcodes, vm, opcodes_count);
+    memcpy(fn->opcodes.data, opcodes, opcodes_count);
+    fn->opcodes.count = opcodes_count;
+
+    uint32_t table_count = readUint(reader);
+    const uint8_t* table = readBytes(reader, table_count);
+    if (table == NULL) return false;
+
+    fn->line_table.count = 0;
+    if (table_count > 0) {
+      pkByteBufferReserve(&fn->line_table, vm, table_count);
+      memcpy(fn->line_table.data, table, table_count);
+      fn->line_table.count = table_count;
+    }
+
+    // The inlined calls are verified with the opcodes (see verifyFunction()).
+    uint32_t calls_count = readUint(reader);
+    uint32_t call_bytes = sizeof(uint32_t) * INLINED_CALL_SIZE;
+    if (calls_count > (reader->size - reader->pos) / call_bytes) return false;
+
+    fn->inlined.count = 0;
+    for (uint32_t j = 0; j < calls_count * INLINED_CALL_SIZE; j++) {
+      pkUintBufferWrite(&fn->inlined, vm, readUint(reader));
+    }
+
+    // The cache indexes of the instructions are verified with the opcodes.
+    uint32_t attrib_count = readUint(reader);
+    if (attrib_count > MAX_ATTRIB_CACHES) return false;
+    fnInitAttribCaches(vm, fn, attrib_count);
+  }
+
+  return !reader->error;
+}
+
+// Read the script's contents from the cache after the imports. Returns false
+// if the cache is corrupted.
+static bool readScript(PKVM* vm, Script* script, Reader* reader) {
+  uint32_t length;
+  const char* data;
+
+  // Module name.
+  if (readByte(reader)) {
+    data = readString(reader, &length);
+    if (data == NULL) return false;
+    script->module = newStringLength(vm, data, length);
+  }
+
+  // Names, the ones that were added when the script created are already
+  // exists (the implicit main function's name, "__file__", ...).
+  uint32_t count = readUint(reader);
+  for (uint32_t i = 0; i < count; i++) {
+    data = readString(reader, &length);
+    if (data == NULL) return false;
+
+    if (i < script->names.count) {
+      String* name = script->names.data[i];
+      if (name->length != length || strncmp(name->data, data, length) != 0) {
+        return false;
+      }
+    } else {
+      String* name = newStringLength(vm, data, length);
+      vmPushTempRef(vm, &name->_super); // name.
+      pkStringBufferWrite(&script->names, vm, name);
+      vmPopTempRef(vm); // name.
+    }
+  }
+
+  // Globals.
+  count = readUint(reader);
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t name = readUint(reader);
+    if (reader->error || name >= script->names.count) return false;
+
+    if (i < script->global_names.count) {
+      if (script->global_names.data[i] != name) return false;
+    } else {
+      pkUintBufferWrite(&script->global_names, vm, name);
+      pkVarBufferWrite(&script->globals, vm, VAR_NULL);
+    }
+  }
+
+  // Constants, in the ascending order of their indexes.
+  count = readUint(reader);
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t index = readUint(reader);
+    if (reader->error || index >= script->globals.count) return false;
+    if (script->constants.count > 0 &&
+        script->constants.data[script->constants.count - 1] >= index) {
+      return false;
+    }
+
+    Var value;
+    if (!readLiteral(vm, reader, &value)) return false;
+    if (IS_OBJ(value)) vmPushTempRef(vm, AS_OBJ(value)); // value.
+    scriptAddConstant(vm, script, index, value);
+    if (IS_OBJ(value)) vmPopTempRef(vm); // value.
+  }
+
+  // Literals.
+  count = readUint(reader);
+  for (uint32_t i = 0; i < count; i++) {
+    Var literal;
+    if (!readLiteral(vm, reader, &literal)) return false;
+    if (IS_OBJ(literal)) vmPushTempRef(vm, AS_OBJ(literal)); // literal.
+    pkVarBufferWrite(&script->literals, vm, literal);
+    if (IS_OBJ(literal)) vmPopTempRef(vm); // literal.
+  }
+
+  if (reader->error || !readFunctions(vm, script, reader)) return false;
+
+  // The bytecode is verified once all the functions and the classes are read
+  // since they refer to each other.
+  for (uint32_t i = 0; i < script->functions.count; i++) {
+    if (!verifyFunction(vm, script, script->functions.data[i])) return false;
+  }
+  return true;
+}
+
+bool cacheLoadScript(PKVM* vm, Script* script, const uint8_t* data,
+                     uint32_t size, bool debug, bool validate) {
+
+  // Only a newly created script can be loaded from a cache.
+  if (script->body == NULL || script->functions.count != 1 ||
+      script->classes.count != 0 || script->literals.count != 0) {
+    return false;
+  }
+
+  Reader reader = { data, size, 0, false };
+
+  // Header.
+  const uint8_t* magic = readBytes(&reader, sizeof(CACHE_MAGIC) - 1);
+  if (magic == NULL ||
+      memcmp(magic, CACHE_MAGIC, sizeof(CACHE_MAGIC) - 1) != 0) {
+    return false;
+  }
+  if (readUint(&reader) != CACHE_VERSION) return false;
+  if (readUint(&reader) != opcodeSignature(vm)) return false;
+  uint64_t source_hash = readUint64(&reader);
+  bool cache_debug = readByte(&reader) != 0;
+  if (reader.error) return false;
+
+  // The debug option is checked even if it's not validated since the
+  // scripts it imports are compiled (or loaded) with the same option.
+  if (cache_debug != debug) return false;
+
+  if (validate) {
+    if (source_hash != script->source_hash) return false;
+  } else {
+    script->source_hash = source_hash;
+  }
+
+  // The imported scripts should be loaded before the script, since a script
+  // compiled with them depends on their contents.
+  uint32_t imports_count = readUint(&reader);
+  for (uint32_t i = 0; i < imports_count; i++) {
+    uint32_t length;
+    const char* path = readString(&reader, &length);
+    uint64_t hash = readUint64(&reader);
+    if (reader.error) return false;
+
+    String* path_name = newStringLength(vm, path, length);
+    if (!cacheImportScript(vm, path_name, hash, debug, validate)) {
+      return false;
+    }
+  }
+
+  // The native modules should be the same as the ones the cache was compiled
+  // with, even if it's not validated, otherwise the bytecode could refer to a
+  // function or a global that doesn't exists.
+  uint32_t natives_count = readUint(&reader);
+  for (uint32_t i = 0; i < natives_count; i++) {
+    uint32_t length;
+    const char* name = readString(&reader, &length);
+    uint64_t signature = readUint64(&reader);
+    if (reader.error) return false;
+
+    String* lib_name = newStringLength(vm, name, length);
+    Var lib = mapGet(vm->core_libs, VAR_OBJ(lib_name));
+    if (IS_UNDEF(lib) ||
+        moduleSignature(vm, (Script*)AS_OBJ(lib)) != signature) {
+      return false;
+    }
+  }
+
+  // Remember the counts, if the cache is corrupted discard everything we've
+  // added to the script (same as the compiler does on a compilation error).
+  uint32_t names_count = script->names.count;
+  uint32_t globals_count = script->globals.count;
+
+  if (!readScript(vm, script, &reader)) {
+    script->module = NULL;
+    script->names.count = names_count;
+    script->globals.count = script->global_names.count = globals_count;
+    script->constants.count = 0;
+    script->functions.count = 1;
+    script->classes.count = 0;
+    script->literals.count = 0;
+    scriptDiscardIndexes(script);
+    script->body->fn->opcodes.count = 0;
+    script->body->fn->line_table.count = 0;
+    script->body->fn->inlined.count = 0;
+    fnInitAttribCaches(vm, script->body->fn, 0);
+    return false;
+  }
+
+  return true;
+}
+
+PkResult compileCached(PKVM* vm, Script* script, const char* source,
+                       const PkCompileOptions* options) {
+
+  script->source_hash = utilHashString64(source);
+  bool debug = options != NULL && options->debug;
+
+  // Scripts compiled in REPL mode and the special scripts ($(REPL), $(TRY))
+  // aren't cached.
+  bool cacheable = script->path->data[0] != '$' &&
+                   (options == NULL || !options->repl_mode);
+
+  if (cacheable && loadHostCache(vm, script, debug, true)) {
+    return PK_RESULT_SUCCESS;
+  }
+
+  PkResult result = compile(vm, script, source, options);
+
+  if (cacheable && result == PK_RESULT_SUCCESS &&
+      vm->config.write_cache_fn != NULL) {
+    pkByteBuffer buff;
+    pkByteBufferInit(&buff);
+    if (cacheWriteScript(vm, script, debug, &buff)) {
+      vm->config.write_cache_fn(vm, script->path->data, buff.data,
+                                buff.count);
+    }
+    pkByteBufferClear(&buff, vm);
+  }
+
+  return result;
+}
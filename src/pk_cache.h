@@ -0,0 +1,48 @@
+#pragma once
+
+#include "pk_internal.h"
+#include "pk_var.h"
+
+// A bytecode cache is the serialized form of a compiled script (it's names,
+// globals, literals, functions and classes) which could be loaded instead of
+// compiling the script again. The cache begins with a header that contains
+// the magic bytes, the format version, a signature of the instruction set
+// and the 64 bit hash of the source it's compiled from. All the integers are
+// written in little endian. The cache also contains the paths of the scripts
+// it imports (with their source hashes) and the names of the native modules
+// it imports (with their signatures) since the compiled code depends on them
+// (ie. 'from "foo.pk" import *').
+//
+// Reading and writing the cache files are done by the hosting application
+// with the pkLoadCacheFn and pkWriteCacheFn callbacks, so the VM doesn't
+// need to know anything about the file system.
+
+// Magic bytes at the beginning of a bytecode cache.
+#define CACHE_MAGIC "\x1bPKC"
+
+// The version of the cache format, increment this when the format changes.
+// Changes to the instruction set are detected by the opcode signature.
+#define CACHE_VERSION 8
+
+// Compile the [source] to the newly created [script] the same as compile()
+// does. If the host application has a bytecode cache of the script that's
+// still valid for the [source] the script will be loaded from the cache
+// instead, otherwise after a successfull compilation the cache will be
+// written back with the host's write_cache_fn.
+PkResult compileCached(PKVM* vm, Script* script, const char* source,
+                       const PkCompileOptions* options);
+
+// Serialize the compiled [script] and write it to the [buff]. Returns false
+// if the script cannot be cached (ie. a literal of a type that cannot be
+// serialized).
+bool cacheWriteScript(PKVM* vm, Script* script, bool debug,
+                      pkByteBuffer* buff);
+
+// Load the bytecode cache [data] of [size] bytes to the newly created
+// [script], the scripts it imports will be loaded (or compiled) as well. The
+// cache should be compiled with the same [debug] option and if [validate] is
+// true it's only used if it was compiled from the source with the script's
+// source_hash and the imported scripts haven't changed since. Returns false
+// if the cache is invalid and leaves the script the way it was.
+bool cacheLoadScript(PKVM* vm, Script* script, const uint8_t* data,
+                     uint32_t size, bool debug, bool validate);
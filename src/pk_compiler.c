@@ -7,38 +7,48 @@
 
 #include "pk_core.h"
 #include "pk_buffers.h"
+#include "pk_cache.h"
 #include "pk_utils.h"
 #include "pk_vm.h"
 #include "pk_debug.h"
 
 // The maximum number of variables (or global if compiling top level script)
 // to lookup from the compiling context. Also it's limited by it's opcode
-// which is using a single byte value to identify the local.
-#define MAX_VARIABLES 256
+// which is using a single byte value to identify the local (2 bytes if it's
+// prefixed with OP_WIDE).
+#define MAX_VARIABLES (1 << 16)
 
 // The maximum number of functions a script could contain. Also it's limited by
-// it's opcode which is using a single byte value to identify.
-#define MAX_FUNCTIONS 256
+// it's opcode which is using a single byte value to identify (2 bytes if it's
+// prefixed with OP_WIDE).
+#define MAX_FUNCTIONS (1 << 16)
 
 // The maximum number of classes a script could contain. Also it's limited by
-// it's opcode which is using a single byte value to identify.
-#define MAX_CLASSES 255
+// it's opcode which is using a single byte value to identify (2 bytes if it's
+// prefixed with OP_WIDE).
+#define MAX_CLASSES ((1 << 16) - 1)
 
-// The maximum number of names that were used before defined. Its just the size
-// of the Forward buffer of the compiler. Feel free to increase it if it
-// require more.
-#define MAX_FORWARD_NAMES 256
+// The maximum number of fields a class can have, limited by the opcode which
+// is using a short value to identify the field.
+#define MAX_FIELDS (1 << 16)
 
 // The maximum number of constant literal a script can contain. Also it's
-// limited by it's opcode which is using a short value to identify.
-#define MAX_CONSTANTS (1 << 16)
+// limited by it's opcode which is using a short value to identify (4 bytes if
+// it's prefixed with OP_WIDE).
+#define MAX_CONSTANTS (1 << 24)
 
-// The maximum address possible to jump. Similar limitation as above.
+// The maximum address offset of a jump with a short parameter. Larger jumps
+// are prefixed with OP_WIDE, which will be re-written after the compilation
+// if the offset isn't known when the jump is emitted.
 #define MAX_JUMP (1 << 16)
 
 // Max number of break statement in a loop statement to patch.
 #define MAX_BREAK_PATCH 256
 
+// Max number of entries of a jump table of the integer cases of a match
+// statement, if the cases are sparse they're looked up in a map instead.
+#define MATCH_TABLE_MAX_SIZE 1024
+
 // The name of a literal function.
 #define LITERAL_FN_NAME "$(LiteralFn)"
 
@@ -111,6 +121,7 @@ typedef enum {
   TK_AS,         // as
   TK_DEF,        // def
   TK_NATIVE,     // native (C function declaration)
+  TK_CONST,      // const
   TK_FUNC,       // func (literal function)
   TK_END,        // end
 
@@ -129,6 +140,8 @@ typedef enum {
   TK_IF,         // if
   TK_ELSIF,      // elsif
   TK_ELSE,       // else
+  TK_MATCH,      // match
+  TK_CASE,       // case
   TK_BREAK,      // break
   TK_CONTINUE,   // continue
   TK_RETURN,     // return
@@ -166,37 +179,77 @@ typedef struct {
   TokenType tk_type;
 } _Keyword;
 
-// List of keywords mapped into their identifiers.
-static _Keyword _keywords[] = {
-  { "module",   6, TK_MODULE   },
-  { "class",    5, TK_CLASS    },
-  { "from",     4, TK_FROM     },
-  { "import",   6, TK_IMPORT   },
-  { "as",       2, TK_AS       },
-  { "def",      3, TK_DEF      },
-  { "native",   6, TK_NATIVE   },
-  { "func",     4, TK_FUNC     },
-  { "end",      3, TK_END      },
-  { "null",     4, TK_NULL     },
-  { "in",       2, TK_IN       },
-  { "and",      3, TK_AND      },
-  { "or",       2, TK_OR       },
-  { "not",      3, TK_NOT      },
-  { "true",     4, TK_TRUE     },
-  { "false",    5, TK_FALSE    },
-  { "do",       2, TK_DO       },
-  { "then",     4, TK_THEN     },
-  { "while",    5, TK_WHILE    },
-  { "for",      3, TK_FOR      },
-  { "if",       2, TK_IF       },
-  { "elsif",    5, TK_ELSIF    },
-  { "else",     4, TK_ELSE     },
-  { "break",    5, TK_BREAK    },
-  { "continue", 8, TK_CONTINUE },
-  { "return",   6, TK_RETURN   },
-
-  { NULL,       0, (TokenType)(0) }, // Sentinel to mark the end of the array
+// Size of the keyword hash table (should be a power of 2).
+#define KEYWORD_TABLE_SIZE 64
+
+// Slot of a name in the keyword hash table, computed from it's first char,
+// last char and length. The multiplier and the shift was searched (by brute
+// force) such that the keywords won't collide, so a name could only be the
+// keyword at it's slot. If a keyword is added, a new pair should be searched
+// and the table below should be re-ordered.
+#define KEYWORD_HASH(name, length)                       \
+  (((uint32_t)(uint8_t)(name)[0] +                       \
+    (uint32_t)(uint8_t)(name)[(length) - 1] * 53u +      \
+    ((uint32_t)(length) << 2)) & (KEYWORD_TABLE_SIZE - 1))
+
+// Perfect hash table of the keywords mapped into their identifiers.
+static const _Keyword _keywords[KEYWORD_TABLE_SIZE] = {
+  [5]  = { "import",   6, TK_IMPORT   },
+  [6]  = { "class",    5, TK_CLASS    },
+  [7]  = { "from",     4, TK_FROM     },
+  [9]  = { "match",    5, TK_MATCH    },
+  [10] = { "then",     4, TK_THEN     },
+  [12] = { "for",      3, TK_FOR      },
+  [14] = { "def",      3, TK_DEF      },
+  [15] = { "if",       2, TK_IF       },
+  [16] = { "return",   6, TK_RETURN   },
+  [17] = { "or",       2, TK_OR       },
+  [23] = { "elsif",    5, TK_ELSIF    },
+  [26] = { "null",     4, TK_NULL     },
+  [28] = { "case",     4, TK_CASE     },
+  [29] = { "break",    5, TK_BREAK    },
+  [30] = { "else",     4, TK_ELSE     },
+  [33] = { "and",      3, TK_AND      },
+  [35] = { "false",    5, TK_FALSE    },
+  [37] = { "end",      3, TK_END      },
+  [39] = { "do",       2, TK_DO       },
+  [44] = { "continue", 8, TK_CONTINUE },
+  [45] = { "true",     4, TK_TRUE     },
+  [46] = { "module",   6, TK_MODULE   },
+  [47] = { "native",   6, TK_NATIVE   },
+  [52] = { "while",    5, TK_WHILE    },
+  [53] = { "func",     4, TK_FUNC     },
+  [55] = { "in",       2, TK_IN       },
+  [56] = { "as",       2, TK_AS       },
+  [59] = { "const",    5, TK_CONST    },
+  [62] = { "not",      3, TK_NOT      },
+};
+
+// Character classes of the source chars, to scan runs of them without
+// comparing each char with every char of the class.
+#define CHAR_NAME  0x1 //< [a-zA-Z_]
+#define CHAR_DIGIT 0x2 //< [0-9]
+#define CHAR_SPACE 0x4 //< ' ', '\t', '\r'
+
+#define N CHAR_NAME
+#define D CHAR_DIGIT
+#define S CHAR_SPACE
+static const uint8_t _char_class[256] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, S, 0, 0, 0, S, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  S, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  D, D, D, D, D, D, D, D, D, D, 0, 0, 0, 0, 0, 0,
+  0, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+  N, N, N, N, N, N, N, N, N, N, N, 0, 0, 0, 0, N,
+  0, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+  N, N, N, N, N, N, N, N, N, N, N, 0, 0, 0, 0, 0,
+  // Non ASCII bytes are all 0.
 };
+#undef N
+#undef D
+#undef S
+
+#define IS_CHAR_CLASS(c, cls) ((_char_class[(uint8_t)(c)] & (cls)) != 0)
 
 /*****************************************************************************/
 /* COMPILER INTERNAL TYPES                                                   */
@@ -286,7 +339,8 @@ typedef struct sLoop {
 typedef struct sForwardName {
 
   // Index of the short instruction that has the value of the name (in the
-  // names buffer of the script).
+  // names buffer of the script). It'll be -1 if the instruction was discarded
+  // (dead code) but the name still needs to be resolved.
   int instruction;
 
   // The function where the name is used, and the instruction is belongs to.
@@ -301,6 +355,61 @@ typedef struct sForwardName {
 
 } ForwardName;
 
+// A parameter of an instruction which doesn't fit in it, but it wasn't known
+// when the instruction was emitted (a forward jump or a forward declared
+// function). The instruction will be re-written with the OP_WIDE prefix once
+// the script is compiled.
+typedef struct {
+
+  // The function where the instruction belongs to.
+  Fn* func;
+
+  // Index of the parameter in the opcodes buffer of the function.
+  int index;
+
+  // Value of the parameter (for jumps it's the address of the instruction to
+  // jump to, instead of the offset).
+  uint32_t value;
+
+} WideParam;
+
+// A call to a function of the script, which could be inlined once all the
+// functions of the script are compiled (since the function could be forward
+// declared). See peepInline() for the details.
+typedef struct {
+
+  // The function where the call belongs to.
+  Fn* func;
+
+  // Index of the instruction which pushes the called function and the call
+  // instruction in the opcodes buffer of the function.
+  int push;
+  int call;
+
+  // Index of the called function's slot in the stack frame, the same as the
+  // index of a local variable at that position.
+  int slot;
+
+} InlineCall;
+
+// A global variable of the script which is bound to an imported module or a
+// function of it by an import statement. Attributes of the module accessed
+// with the global are resolved at compile time (see exprAttrib) and so are
+// the calls to the functions of the math library (see exprCall).
+typedef struct {
+
+  // Index of the global variable in the script.
+  int global;
+
+  // The imported module the variable is bound to.
+  Script* module;
+
+  // Index of the imported function in the module or -1 if the variable is
+  // bound to the module itself.
+  int function;
+
+} ModuleBinding;
+
 typedef struct sFunc {
 
   // Scope of the function. -2 for script body, -1 for top level function and
@@ -317,11 +426,28 @@ typedef struct sFunc {
   // function. Null for script body function.
   struct sFunc* outer_func;
 
+  // Stack size of the outer function which will be restored once the
+  // function is compiled.
+  int outer_stack_size;
+
+  // Line number of each byte of the function's opcodes, which will be encoded
+  // to the function's line table once it's compiled.
+  pkUintBuffer lines;
+
 } Func;
 
 // A convenient macro to get the current function.
 #define _FN (compiler->func->ptr->fn)
 
+// A block of the source read from a stream (see compileStream()). A block
+// starts with the chars of the token which was being lexed when it was read,
+// so that a token is never split between two blocks.
+typedef struct sSourceBlock {
+  struct sSourceBlock* next; //< The block read after this one.
+  uint32_t size;             //< Number of chars (without the null byte).
+  char data[DYNAMIC_TAIL_ARRAY];
+} SourceBlock;
+
 struct Compiler {
 
   PKVM* vm;
@@ -331,6 +457,16 @@ struct Compiler {
   const char* source;       //< Currently compiled source (Weak pointer).
   const char* token_start;  //< Start of the currently parsed token.
   const char* current_char; //< Current char position in the source.
+  const char* source_end;   //< The null byte at the end of the source.
+
+  // The stream the source is read from, which is NULL if the source is a
+  // string. The blocks of the stream are in the order they're read and the
+  // last block is the one being lexed.
+  void* stream;
+  bool stream_ended;
+  SourceBlock* blocks;
+  SourceBlock* last_block;
+
   int current_line;         //< Line number of the current char.
   Token previous, current, next; //< Currently parsed tokens.
 
@@ -343,8 +479,9 @@ struct Compiler {
   // level and > 0 is inner scope.
   int scope_depth;
 
-  Local locals[MAX_VARIABLES]; //< Variables in the current context.
-  int local_count; //< Number of locals in [locals].
+  Local* locals;      //< Variables in the current context.
+  int local_count;    //< Number of locals in [locals].
+  int local_capacity; //< Allocated size of the [locals].
 
   int stack_size;  //< Current size including locals ind temps.
 
@@ -354,8 +491,27 @@ struct Compiler {
 
   // An array of implicitly forward declared names, which will be resolved once
   // the script is completely compiled.
-  ForwardName forwards[MAX_FORWARD_NAMES];
+  ForwardName* forwards;
   int forwards_count;
+  int forwards_capacity;
+
+  // An array of instruction parameters which needs to be re-written with the
+  // OP_WIDE prefix once the script is compiled.
+  WideParam* wide_params;
+  int wide_count;
+  int wide_capacity;
+
+  // An array of calls to the functions of the script to be inlined once the
+  // script is compiled.
+  InlineCall* calls;
+  int calls_count;
+  int calls_capacity;
+
+  // An array of global variables which are bound to imported modules. A
+  // binding is removed once the variable is assigned to something else.
+  ModuleBinding* modules;
+  int modules_count;
+  int modules_capacity;
 
   // True if the last statement is a new local variable assignment. Because
   // the assignment is different than regular assignment and use this boolean
@@ -379,6 +535,11 @@ struct Compiler {
   // call. Which is usefull to check if a return expression is function call
   // to perform a tail call optimization.
   bool is_last_call;
+
+  // Index of the first instruction of the left operand, set by the
+  // parsePrecedence() before calling an infix rule. Used to check if the
+  // operands are constants which could be folded at compile time.
+  int operand_start;
 };
 
 typedef struct {
@@ -475,13 +636,172 @@ static void setNextToken(Compiler* compiler, TokenType type);
 static bool matchChar(Compiler* compiler, char c);
 static bool matchLine(Compiler* compiler);
 
+// Read the next chunk of the source stream to a new block and continue lexing
+// the current token from it. Returns false if the source isn't a stream or
+// the stream has ended.
+static bool lexReadChunk(Compiler* compiler) {
+  if (compiler->stream == NULL || compiler->stream_ended) return false;
+
+  PKVM* vm = compiler->vm;
+  PkStringPtr chunk = vm->config.read_chunk_fn(vm, compiler->stream);
+
+  // The source can't have a null byte, the same as a source string it's the
+  // end of the source.
+  uint32_t length = 0;
+  if (chunk.string != NULL) {
+    const char* null = memchr(chunk.string, '\0', chunk.length);
+    length = (null != NULL) ? (uint32_t)(null - chunk.string) : chunk.length;
+    if (null != NULL) compiler->stream_ended = true;
+  }
+
+  if (length == 0) {
+    if (chunk.on_done != NULL) chunk.on_done(vm, chunk);
+    compiler->stream_ended = true;
+    return false;
+  }
+
+  uint32_t token_length = (uint32_t)(compiler->source_end -
+                                     compiler->token_start);
+  uint32_t size = token_length + length;
+  SourceBlock* block = ALLOCATE_DYNAMIC(vm, SourceBlock, size + 1, char);
+  block->next = NULL;
+  block->size = size;
+  memcpy(block->data, compiler->token_start, token_length);
+  memcpy(block->data + token_length, chunk.string, length);
+  block->data[size] = '\0';
+  if (chunk.on_done != NULL) chunk.on_done(vm, chunk);
+
+  if (compiler->last_block != NULL) compiler->last_block->next = block;
+  else compiler->blocks = block;
+  compiler->last_block = block;
+
+  uint32_t offset = (uint32_t)(compiler->current_char - compiler->token_start);
+  compiler->token_start = block->data;
+  compiler->current_char = block->data + offset;
+  compiler->source_end = block->data + size;
+  return true;
+}
+
+// Returns true if the lexer has reached the end of the source it has read
+// and the next chunk of the stream is read to continue.
+static bool lexMoreSource(Compiler* compiler) {
+  return compiler->current_char == compiler->source_end &&
+         lexReadChunk(compiler);
+}
+
+// Returns true if the [ptr] points into the source [block].
+static bool blockHasPointer(const SourceBlock* block, const char* ptr) {
+  return block->data <= ptr && ptr <= block->data + block->size;
+}
+
+// Free the blocks of the source stream which none of the tokens points into
+// or all of them if [all] is true. The tokens are read in order so only the
+// oldest blocks could be freed.
+static void lexFreeBlocks(Compiler* compiler, bool all) {
+  while (compiler->blocks != NULL) {
+    SourceBlock* block = compiler->blocks;
+    if (!all) {
+      if (block == compiler->last_block) break;
+      if (blockHasPointer(block, compiler->previous.start) ||
+          blockHasPointer(block, compiler->current.start) ||
+          blockHasPointer(block, compiler->next.start) ||
+          blockHasPointer(block, compiler->token_start)) {
+        break;
+      }
+    }
+
+    compiler->blocks = block->next;
+    vmRealloc(compiler->vm, block, sizeof(SourceBlock) + block->size + 1, 0);
+  }
+  if (compiler->blocks == NULL) compiler->last_block = NULL;
+}
+
+// Returns the first char from [ch] which isn't a part of a plain run of a
+// string's body, ie. the [quote], an escape, a new line or the null byte at
+// the [end] of the source. The chars are tested 8 at a time (while there are
+// 8 more chars before the end) and the rest one at a time.
+static const char* scanStringRun(const char* ch, const char* end, char quote) {
+
+  // Bit hacks from: https://graphics.stanford.edu/~seander/bithacks.html
+  // HAS_ZERO(word) is non-zero if any of it's 8 bytes is zero.
+#define ONES 0x0101010101010101ULL
+#define HAS_ZERO(word) (((word) - ONES) & ~(word) & (ONES << 7))
+
+  const uint64_t quotes = ONES * (uint8_t)quote;
+  const uint64_t escapes = ONES * (uint8_t)'\\';
+  const uint64_t lines = ONES * (uint8_t)'\n';
+
+  // There is no null byte before the end so the words don't need to be
+  // tested for it.
+  while (end - ch >= 8) {
+    uint64_t word;
+    memcpy(&word, ch, sizeof(word));
+    if (HAS_ZERO(word ^ quotes) | HAS_ZERO(word ^ escapes) |
+        HAS_ZERO(word ^ lines)) {
+      break;
+    }
+    ch += 8;
+  }
+
+#undef HAS_ZERO
+#undef ONES
+
+  while (*ch != quote && *ch != '\\' && *ch != '\n' && *ch != '\0') ch++;
+  return ch;
+}
+
+// Append the [length] chars at [data] to the end of the buffer [self].
+static void byteBufferAppend(pkByteBuffer* self, PKVM* vm, const char* data,
+                             uint32_t length) {
+  if (length == 0) return;
+  pkByteBufferReserve(self, vm, (size_t)self->count + length);
+  memcpy(self->data + self->count, data, length);
+  self->count += length;
+}
+
+// Returns a string of the literal's [length] chars at [data]. If the script
+// already has the same string as a literal, it'll be returned instead of
+// allocating a new one, so the duplicate string literals in a script will
+// share the same string.
+static Var lexStringValue(Compiler* compiler, const char* data,
+                          uint32_t length) {
+  int index = scriptGetStringLiteral(compiler->vm, compiler->script,
+                                     data, length);
+  if (index != -1) return compiler->script->literals.data[index];
+
+  // '\0' will be added by varNewSring();
+  return VAR_OBJ(newStringLength(compiler->vm, data, length));
+}
+
 static void eatString(Compiler* compiler, bool single_quote) {
+  char quote = (single_quote) ? '\'' : '"';
+
+  // If the string doesn't have any escape characters it's body in the source
+  // will be the string, otherwise the body will be written to [buff] with the
+  // escaped characters.
+  const char* body = compiler->current_char;
+  const char* body_end = NULL;
+  bool escaped = false;
+
   pkByteBuffer buff;
   pkByteBufferInit(&buff);
 
-  char quote = (single_quote) ? '\'' : '"';
-
   while (true) {
+    const char* run = compiler->current_char;
+    compiler->current_char = scanStringRun(run, compiler->source_end, quote);
+    if (escaped) {
+      byteBufferAppend(&buff, compiler->vm, run,
+                       (uint32_t)(compiler->current_char - run));
+    }
+
+    // The string continues in the next chunk of the source stream, which
+    // starts with the string's token.
+    if (lexMoreSource(compiler)) {
+      body = compiler->token_start + 1;
+      continue;
+    }
+
+    body_end = compiler->current_char;
     char c = eatChar(compiler);
 
     if (c == quote) break;
@@ -495,6 +815,12 @@ static void eatString(Compiler* compiler, bool single_quote) {
     }
 
     if (c == '\\') {
+      if (!escaped) {
+        escaped = true;
+        byteBufferAppend(&buff, compiler->vm, body,
+                         (uint32_t)(body_end - body));
+      }
+
       switch (eatChar(compiler)) {
         case '"':  pkByteBufferWrite(&buff, compiler->vm, '"'); break;
         case '\'': pkByteBufferWrite(&buff, compiler->vm, '\''); break;
@@ -503,18 +829,28 @@ static void eatString(Compiler* compiler, bool single_quote) {
         case 'r':  pkByteBufferWrite(&buff, compiler->vm, '\r'); break;
         case 't':  pkByteBufferWrite(&buff, compiler->vm, '\t'); break;
 
+        case '\0':
+          // Don't go past the end of the source, it'll be reported as a non
+          // terminated string.
+          compiler->current_char--;
+          break;
+
         default:
           lexError(compiler, "Error: invalid escape character");
           break;
       }
-    } else {
+
+    } else if (escaped) { // A new line in the string.
       pkByteBufferWrite(&buff, compiler->vm, c);
     }
   }
 
-  // '\0' will be added by varNewSring();
-  Var string = VAR_OBJ(newStringLength(compiler->vm, (const char*)buff.data,
-                       (uint32_t)buff.count));
+  Var string;
+  if (escaped) {
+    string = lexStringValue(compiler, (const char*)buff.data, buff.count);
+  } else {
+    string = lexStringValue(compiler, body, (uint32_t)(body_end - body));
+  }
 
   pkByteBufferClear(&buff, compiler->vm);
 
@@ -523,12 +859,17 @@ static void eatString(Compiler* compiler, bool single_quote) {
 
 // Returns the current char of the compiler on.
 static char peekChar(Compiler* compiler) {
-  return *compiler->current_char;
+  char c = *compiler->current_char;
+  if (c == '\0' && lexMoreSource(compiler)) c = *compiler->current_char;
+  return c;
 }
 
 // Returns the next char of the compiler on.
 static char peekNextChar(Compiler* compiler) {
   if (peekChar(compiler) == '\0') return '\0';
+  if (compiler->current_char + 1 == compiler->source_end) {
+    lexReadChunk(compiler);
+  }
   return *(compiler->current_char + 1);
 }
 
@@ -543,23 +884,22 @@ static char eatChar(Compiler* compiler) {
 // Complete lexing an identifier name.
 static void eatName(Compiler* compiler) {
 
-  char c = peekChar(compiler);
-  while (utilIsName(c) || utilIsDigit(c)) {
-    eatChar(compiler);
-    c = peekChar(compiler);
-  }
+  // Names can't have new lines so the chars are consumed without eatChar().
+  do {
+    const char* ch = compiler->current_char;
+    while (IS_CHAR_CLASS(*ch, CHAR_NAME | CHAR_DIGIT)) ch++;
+    compiler->current_char = ch;
+  } while (lexMoreSource(compiler));
 
   const char* name_start = compiler->token_start;
+  int length = (int)(compiler->current_char - name_start);
 
   TokenType type = TK_NAME;
 
-  int length = (int)(compiler->current_char - name_start);
-  for (int i = 0; _keywords[i].identifier != NULL; i++) {
-    if (_keywords[i].length == length &&
-      strncmp(name_start, _keywords[i].identifier, length) == 0) {
-      type = _keywords[i].tk_type;
-      break;
-    }
+  const _Keyword* keyword = &_keywords[KEYWORD_HASH(name_start, length)];
+  if (keyword->length == length &&
+      memcmp(name_start, keyword->identifier, length) == 0) {
+    type = keyword->tk_type;
   }
 
   setNextToken(compiler, type);
@@ -686,12 +1026,17 @@ static void eatNumber(Compiler* compiler) {
 
 // Read and ignore chars till it reach new line or EOF.
 static void skipLineComment(Compiler* compiler) {
-  char c;
-  while ((c = peekChar(compiler)) != '\0') {
-    // Don't eat new line it's not part of the comment.
-    if (c == '\n') return;
-    eatChar(compiler);
-  }
+  // Don't eat new line it's not part of the comment.
+  const char* line_end;
+  do {
+    line_end = memchr(compiler->current_char, '\n',
+                      compiler->source_end - compiler->current_char);
+    compiler->current_char = (line_end != NULL) ? line_end
+                                                : compiler->source_end;
+
+    // The comment isn't a token, don't copy it to the next chunk.
+    compiler->token_start = compiler->current_char;
+  } while (line_end == NULL && lexMoreSource(compiler));
 }
 
 // If the current char is [c] consume it and advance char by 1 and returns
@@ -735,8 +1080,11 @@ static void lexToken(Compiler* compiler) {
 
   if (compiler->current.type == TK_EOF) return;
 
-  while (peekChar(compiler) != '\0') {
+  while (true) {
+    // The token starts before peekChar() reads the next chunk of a stream so
+    // the previous token isn't copied to it.
     compiler->token_start = compiler->current_char;
+    if (peekChar(compiler) == '\0') break;
     char c = eatChar(compiler);
 
     switch (c) {
@@ -773,11 +1121,12 @@ static void lexToken(Compiler* compiler) {
       case ' ':
       case '\t':
       case '\r': {
-        c = peekChar(compiler);
-        while (c == ' ' || c == '\t' || c == '\r') {
-          eatChar(compiler);
-          c = peekChar(compiler);
-        }
+        do {
+          const char* ch = compiler->current_char;
+          while (IS_CHAR_CLASS(*ch, CHAR_SPACE)) ch++;
+          compiler->current_char = ch;
+          compiler->token_start = ch;
+        } while (lexMoreSource(compiler));
         break;
       }
 
@@ -852,10 +1201,10 @@ static void lexToken(Compiler* compiler) {
 
       default: {
 
-        if (utilIsDigit(c)) {
+        if (IS_CHAR_CLASS(c, CHAR_DIGIT)) {
           eatNumber(compiler);
 
-        } else if (utilIsName(c)) {
+        } else if (IS_CHAR_CLASS(c, CHAR_NAME)) {
           eatName(compiler);
 
         } else {
@@ -936,8 +1285,8 @@ static void skipNewLines(Compiler* compiler) {
   matchLine(compiler);
 }
 
-// Match semi collon, multiple new lines or peek 'end', 'else', 'elsif'
-// keywords.
+// Match semi collon, multiple new lines or peek 'end', 'else', 'elsif',
+// 'case' keywords.
 static bool matchEndStatement(Compiler* compiler) {
   if (match(compiler, TK_SEMICOLLON)) {
     skipNewLines(compiler);
@@ -949,7 +1298,7 @@ static bool matchEndStatement(Compiler* compiler) {
   // In the below statement we don't require any new lines or semicolons.
   // 'if cond then stmnt1 elsif cond2 then stmnt2 else stmnt3 end'
   if (peek(compiler) == TK_END || peek(compiler) == TK_ELSE ||
-      peek(compiler) == TK_ELSIF)
+      peek(compiler) == TK_ELSIF || peek(compiler) == TK_CASE)
     return true;
 
   return false;
@@ -1056,7 +1405,7 @@ static NameSearchResult compilerSearchName(Compiler* compiler,
   int index; // For storing the search result below.
 
   // Search through globals.
-  index = scriptGetGlobals(compiler->script, name, length);
+  index = scriptGetGlobals(compiler->vm, compiler->script, name, length);
   if (index != -1) {
     result.type = NAME_GLOBAL_VAR;
     result.index = index;
@@ -1064,7 +1413,7 @@ static NameSearchResult compilerSearchName(Compiler* compiler,
   }
 
   // Search through classes.
-  index = scriptGetClass(compiler->script, name, length);
+  index = scriptGetClass(compiler->vm, compiler->script, name, length);
   if (index != -1) {
     result.type = NAME_CLASS;
     result.index = index;
@@ -1072,7 +1421,7 @@ static NameSearchResult compilerSearchName(Compiler* compiler,
   }
 
   // Search through functions.
-  index = scriptGetFunc(compiler->script, name, length);
+  index = scriptGetFunc(compiler->vm, compiler->script, name, length);
   if (index != -1) {
     result.type = NAME_FUNCTION;
     result.index = index;
@@ -1098,19 +1447,44 @@ static NameSearchResult compilerSearchName(Compiler* compiler,
 static void emitOpcode(Compiler* compiler, Opcode opcode);
 static int emitByte(Compiler* compiler, int byte);
 static int emitShort(Compiler* compiler, int arg);
+static void emitOpcodeArg(Compiler* compiler, Opcode opcode, int arg);
+static void emitAttribOpcode(Compiler* compiler, Opcode opcode, int name);
 
 static void emitLoopJump(Compiler* compiler);
 static void emitAssignment(Compiler* compiler, TokenType assignment);
 static void emitFunctionEnd(Compiler* compiler);
 
+static void emitConstant(Compiler* compiler, Var value);
+
 static void patchJump(Compiler* compiler, int addr_index);
 static void patchForward(Compiler* compiler, Fn* fn, int index, int name);
 
+static bool compilerConstantAt(Compiler* compiler, int start, int end,
+                               Var* value);
+static void compilerDiscardCode(Compiler* compiler, int start);
+static bool foldBinaryOp(Compiler* compiler, Opcode op, Var lhs, Var rhs,
+                         Var* result);
+static bool foldUnaryOp(Compiler* compiler, Opcode op, Var value,
+                        Var* result);
+
 static int compilerAddConstant(Compiler* compiler, Var value);
+static void compilerChangeStack(Compiler* compiler, int num);
 static int compilerAddVariable(Compiler* compiler, const char* name,
                                uint32_t length, int line);
 static void compilerAddForward(Compiler* compiler, int instruction, Fn* fn,
                                const char* name, int length, int line);
+static void compilerAddWideParam(Compiler* compiler, Fn* fn, int index,
+                                 uint32_t value);
+static ModuleBinding* compilerGetBinding(Compiler* compiler, int global);
+static Script* compilerBoundModule(Compiler* compiler, int global);
+static void compilerUnbindModule(Compiler* compiler, int global);
+static void compilerImportConstant(Compiler* compiler, int global,
+                                   Script* module, const char* name,
+                                   uint32_t length);
+static int compilerGlobalAt(Compiler* compiler, int start, int end);
+static bool compilerFunctionAt(Compiler* compiler, int start, int end);
+static void compilerAddCall(Compiler* compiler, int push, int call, int slot);
+static int compilerIntrinsicAt(Compiler* compiler, int start, int end);
 
 // Forward declaration of grammar functions.
 static void parsePrecedence(Compiler* compiler, Precedence precedence);
@@ -1195,6 +1569,7 @@ GrammarRule rules[] = {  // Prefix       Infix             Infix Precedence
   /* TK_AS         */   NO_RULE,
   /* TK_DEF        */   NO_RULE,
   /* TK_EXTERN     */   NO_RULE,
+  /* TK_CONST      */   NO_RULE,
   /* TK_FUNC       */ { exprFunc,      NULL,             NO_INFIX },
   /* TK_END        */   NO_RULE,
   /* TK_NULL       */ { exprValue,     NULL,             NO_INFIX },
@@ -1211,6 +1586,8 @@ GrammarRule rules[] = {  // Prefix       Infix             Infix Precedence
   /* TK_IF         */   NO_RULE,
   /* TK_ELSIF      */   NO_RULE,
   /* TK_ELSE       */   NO_RULE,
+  /* TK_MATCH      */   NO_RULE,
+  /* TK_CASE       */   NO_RULE,
   /* TK_BREAK      */   NO_RULE,
   /* TK_CONTINUE   */   NO_RULE,
   /* TK_RETURN     */   NO_RULE,
@@ -1226,30 +1603,27 @@ static GrammarRule* getRule(TokenType type) {
 // Emit variable store.
 static void emitStoreVariable(Compiler* compiler, int index, bool global) {
   if (global) {
-    emitOpcode(compiler, OP_STORE_GLOBAL);
-    emitByte(compiler, index);
+    compilerUnbindModule(compiler, index);
+    emitOpcodeArg(compiler, OP_STORE_GLOBAL, index);
 
   } else {
     if (index < 9) { //< 0..8 locals have single opcode.
       emitOpcode(compiler, (Opcode)(OP_STORE_LOCAL_0 + index));
     } else {
-      emitOpcode(compiler, OP_STORE_LOCAL_N);
-      emitByte(compiler, index);
+      emitOpcodeArg(compiler, OP_STORE_LOCAL_N, index);
     }
   }
 }
 
 static void emitPushVariable(Compiler* compiler, int index, bool global) {
   if (global) {
-    emitOpcode(compiler, OP_PUSH_GLOBAL);
-    emitByte(compiler, index);
+    emitOpcodeArg(compiler, OP_PUSH_GLOBAL, index);
 
   } else {
     if (index < 9) { //< 0..8 locals have single opcode.
       emitOpcode(compiler, (Opcode)(OP_PUSH_LOCAL_0 + index));
     } else {
-      emitOpcode(compiler, OP_PUSH_LOCAL_N);
-      emitByte(compiler, index);
+      emitOpcodeArg(compiler, OP_PUSH_LOCAL_N, index);
     }
   }
 }
@@ -1257,16 +1631,14 @@ static void emitPushVariable(Compiler* compiler, int index, bool global) {
 static void exprLiteral(Compiler* compiler) {
   Token* value = &compiler->previous;
   int index = compilerAddConstant(compiler, value->value);
-  emitOpcode(compiler, OP_PUSH_CONSTANT);
-  emitShort(compiler, index);
+  emitOpcodeArg(compiler, OP_PUSH_CONSTANT, index);
 
   compiler->is_last_call = false;
 }
 
 static void exprFunc(Compiler* compiler) {
   int fn_index = compileFunction(compiler, FN_LITERAL);
-  emitOpcode(compiler, OP_PUSH_FN);
-  emitByte(compiler, fn_index);
+  emitOpcodeArg(compiler, OP_PUSH_FN, fn_index);
 
   compiler->is_last_call = false;
 }
@@ -1317,6 +1689,22 @@ static void exprName(Compiler* compiler) {
       case NAME_GLOBAL_VAR: {
         const bool is_global = result.type == NAME_GLOBAL_VAR;
 
+        // A constant is replaced with it's value, so it could be folded with
+        // the other constant operands.
+        Var value;
+        if (is_global &&
+            scriptGetConstant(compiler->script, result.index, &value)) {
+          if (compiler->l_value && matchAssignment(compiler)) {
+            parseError(compiler, "Cannot assign to the constant '%.*s'.",
+                       length, start);
+            skipNewLines(compiler);
+            compileExpression(compiler);
+          } else {
+            emitConstant(compiler, value);
+          }
+          break;
+        }
+
         if (compiler->l_value && matchAssignment(compiler)) {
           skipNewLines(compiler);
 
@@ -1339,13 +1727,11 @@ static void exprName(Compiler* compiler) {
       }
 
       case NAME_FUNCTION:
-        emitOpcode(compiler, OP_PUSH_FN);
-        emitByte(compiler, result.index);
+        emitOpcodeArg(compiler, OP_PUSH_FN, result.index);
         break;
 
       case NAME_CLASS:
-        emitOpcode(compiler, OP_PUSH_TYPE);
-        emitByte(compiler, result.index);
+        emitOpcodeArg(compiler, OP_PUSH_TYPE, result.index);
         break;
 
       case NAME_BUILTIN:
@@ -1388,6 +1774,7 @@ void exprOr(Compiler* compiler) {
   patchJump(compiler, true_offset_a);
   patchJump(compiler, true_offset_b);
   emitOpcode(compiler, OP_PUSH_TRUE);
+  compilerChangeStack(compiler, -1); //< Only one of the branches is taken.
 
   patchJump(compiler, end_offset);
 
@@ -1409,6 +1796,7 @@ void exprAnd(Compiler* compiler) {
   patchJump(compiler, false_offset_a);
   patchJump(compiler, false_offset_b);
   emitOpcode(compiler, OP_PUSH_FALSE);
+  compilerChangeStack(compiler, -1); //< Only one of the branches is taken.
 
   patchJump(compiler, end_offset);
 
@@ -1439,54 +1827,86 @@ static void exprChainCall(Compiler* compiler) {
 
   emitOpcode(compiler, OP_CALL);
   emitByte(compiler, argc);
+  compilerChangeStack(compiler, -argc);
 
   compiler->is_last_call = false;
 }
 
 static void exprBinaryOp(Compiler* compiler) {
   TokenType op = compiler->previous.type;
+  int lhs_start = compiler->operand_start;
+
   skipNewLines(compiler);
+  int rhs_start = (int)_FN->opcodes.count;
   parsePrecedence(compiler, (Precedence)(getRule(op)->precedence + 1));
 
+  Opcode opcode;
   switch (op) {
-    case TK_DOTDOT:  emitOpcode(compiler, OP_RANGE);      break;
-    case TK_PERCENT: emitOpcode(compiler, OP_MOD);        break;
-    case TK_AMP:     emitOpcode(compiler, OP_BIT_AND);    break;
-    case TK_PIPE:    emitOpcode(compiler, OP_BIT_OR);     break;
-    case TK_CARET:   emitOpcode(compiler, OP_BIT_XOR);    break;
-    case TK_PLUS:    emitOpcode(compiler, OP_ADD);        break;
-    case TK_MINUS:   emitOpcode(compiler, OP_SUBTRACT);   break;
-    case TK_STAR:    emitOpcode(compiler, OP_MULTIPLY);   break;
-    case TK_FSLASH:  emitOpcode(compiler, OP_DIVIDE);     break;
-    case TK_GT:      emitOpcode(compiler, OP_GT);         break;
-    case TK_LT:      emitOpcode(compiler, OP_LT);         break;
-    case TK_EQEQ:    emitOpcode(compiler, OP_EQEQ);       break;
-    case TK_NOTEQ:   emitOpcode(compiler, OP_NOTEQ);      break;
-    case TK_GTEQ:    emitOpcode(compiler, OP_GTEQ);       break;
-    case TK_LTEQ:    emitOpcode(compiler, OP_LTEQ);       break;
-    case TK_SRIGHT:  emitOpcode(compiler, OP_BIT_RSHIFT); break;
-    case TK_SLEFT:   emitOpcode(compiler, OP_BIT_LSHIFT); break;
-    case TK_IN:      emitOpcode(compiler, OP_IN);         break;
+    case TK_DOTDOT:  opcode = OP_RANGE;      break;
+    case TK_PERCENT: opcode = OP_MOD;        break;
+    case TK_AMP:     opcode = OP_BIT_AND;    break;
+    case TK_PIPE:    opcode = OP_BIT_OR;     break;
+    case TK_CARET:   opcode = OP_BIT_XOR;    break;
+    case TK_PLUS:    opcode = OP_ADD;        break;
+    case TK_MINUS:   opcode = OP_SUBTRACT;   break;
+    case TK_STAR:    opcode = OP_MULTIPLY;   break;
+    case TK_FSLASH:  opcode = OP_DIVIDE;     break;
+    case TK_GT:      opcode = OP_GT;         break;
+    case TK_LT:      opcode = OP_LT;         break;
+    case TK_EQEQ:    opcode = OP_EQEQ;       break;
+    case TK_NOTEQ:   opcode = OP_NOTEQ;      break;
+    case TK_GTEQ:    opcode = OP_GTEQ;       break;
+    case TK_LTEQ:    opcode = OP_LTEQ;       break;
+    case TK_SRIGHT:  opcode = OP_BIT_RSHIFT; break;
+    case TK_SLEFT:   opcode = OP_BIT_LSHIFT; break;
+    case TK_IN:      opcode = OP_IN;         break;
     default:
       UNREACHABLE();
   }
 
+  // If both the operands are constants, evaluate it at compile time.
+  Var lhs, rhs, result;
+  if (compilerConstantAt(compiler, lhs_start, rhs_start, &lhs) &&
+      compilerConstantAt(compiler, rhs_start, (int)_FN->opcodes.count, &rhs) &&
+      foldBinaryOp(compiler, opcode, lhs, rhs, &result)) {
+    compilerDiscardCode(compiler, lhs_start);
+    compilerChangeStack(compiler, -2);
+    emitConstant(compiler, result);
+
+  } else {
+    emitOpcode(compiler, opcode);
+  }
+
   compiler->is_last_call = false;
 }
 
 static void exprUnaryOp(Compiler* compiler) {
   TokenType op = compiler->previous.type;
   skipNewLines(compiler);
+  int start = (int)_FN->opcodes.count;
   parsePrecedence(compiler, (Precedence)(PREC_UNARY + 1));
 
+  Opcode opcode;
   switch (op) {
-    case TK_TILD:  emitOpcode(compiler, OP_BIT_NOT); break;
-    case TK_MINUS: emitOpcode(compiler, OP_NEGATIVE); break;
-    case TK_NOT:   emitOpcode(compiler, OP_NOT); break;
+    case TK_TILD:  opcode = OP_BIT_NOT;  break;
+    case TK_MINUS: opcode = OP_NEGATIVE; break;
+    case TK_NOT:   opcode = OP_NOT;      break;
     default:
       UNREACHABLE();
   }
 
+  // If the operand is a constant, evaluate it at compile time.
+  Var value, result;
+  if (compilerConstantAt(compiler, start, (int)_FN->opcodes.count, &value) &&
+      foldUnaryOp(compiler, opcode, value, &result)) {
+    compilerDiscardCode(compiler, start);
+    compilerChangeStack(compiler, -1);
+    emitConstant(compiler, result);
+
+  } else {
+    emitOpcode(compiler, opcode);
+  }
+
   compiler->is_last_call = false;
 }
 
@@ -1549,6 +1969,13 @@ static void exprMap(Compiler* compiler) {
 
 static void exprCall(Compiler* compiler) {
 
+  // Instructions of the callee, to check if it's an intrinsic or a function
+  // of the script which could be inlined.
+  int callee_start = compiler->operand_start;
+  int callee_end = (int)_FN->opcodes.count;
+  bool is_fn = compilerFunctionAt(compiler, callee_start, callee_end);
+  int slot = compiler->stack_size - 1;
+
   // Compile parameters.
   int argc = 0;
   if (!match(compiler, TK_RPARAN)) {
@@ -1561,12 +1988,66 @@ static void exprCall(Compiler* compiler) {
     consume(compiler, TK_RPARAN, "Expected ')' after parameter list.");
   }
 
+  // Calls to the math functions are computed inline when they're called with
+  // numbers. It's not a call to optimize with the tail call.
+  int intrinsic = compilerIntrinsicAt(compiler, callee_start, callee_end);
+  if (intrinsic != -1 && argc == getIntrinsicArity((Intrinsic)intrinsic)) {
+    emitOpcode(compiler, OP_CALL_INTRINSIC);
+    emitByte(compiler, intrinsic);
+    compilerChangeStack(compiler, -argc);
+    compiler->is_last_call = false;
+    return;
+  }
+
+  int call = (int)_FN->opcodes.count;
   emitOpcode(compiler, OP_CALL);
   emitByte(compiler, argc);
+  compilerChangeStack(compiler, -argc);
+
+  if (is_fn) compilerAddCall(compiler, callee_start, call, slot);
 
   compiler->is_last_call = true;
 }
 
+// Emit the attribute getter of the name at [index] on the left operand. If
+// the operand is a global bound to an imported module and the attribute is a
+// function of it, it'll be resolved at compile time to avoid searching the
+// module's names every time it's accessed. The binding is still checked at
+// runtime since the variable could be modified from outside of the script.
+// A constant of the module is replaced with it's value.
+static void emitGetAttrib(Compiler* compiler, int index) {
+  int global = compilerGlobalAt(compiler, compiler->operand_start,
+                                (int)_FN->opcodes.count);
+  Script* module = (global != -1) ? compilerBoundModule(compiler, global)
+                                  : NULL;
+
+  if (module != NULL && index <= 0xffff) {
+    PKVM* vm = compiler->vm;
+    const String* name = compiler->script->names.data[index];
+
+    Var value;
+    int constant = scriptGetGlobals(vm, module, name->data, name->length);
+    if (constant != -1 && scriptGetConstant(module, constant, &value)) {
+      compilerDiscardCode(compiler, compiler->operand_start);
+      compilerChangeStack(compiler, -1);
+      emitConstant(compiler, value);
+      return;
+    }
+
+    if (scriptGetClass(vm, module, name->data, name->length) == -1) {
+      int fn_index = scriptGetFunc(vm, module, name->data, name->length);
+      if (fn_index != -1 && fn_index <= 0xff) {
+        emitOpcode(compiler, OP_GET_MODULE_FN);
+        emitShort(compiler, index);
+        emitByte(compiler, fn_index);
+        return;
+      }
+    }
+  }
+
+  emitAttribOpcode(compiler, OP_GET_ATTRIB, index);
+}
+
 static void exprAttrib(Compiler* compiler) {
   consume(compiler, TK_NAME, "Expected an attribute name after '.'.");
   const char* name = compiler->previous.start;
@@ -1580,20 +2061,17 @@ static void exprAttrib(Compiler* compiler) {
 
     TokenType assignment = compiler->previous.type;
     if (assignment != TK_EQ) {
-      emitOpcode(compiler, OP_GET_ATTRIB_KEEP);
-      emitShort(compiler, index);
+      emitAttribOpcode(compiler, OP_GET_ATTRIB_KEEP, index);
       compileExpression(compiler);
       emitAssignment(compiler, assignment);
     } else {
       compileExpression(compiler);
     }
 
-    emitOpcode(compiler, OP_SET_ATTRIB);
-    emitShort(compiler, index);
+    emitAttribOpcode(compiler, OP_SET_ATTRIB, index);
 
   } else {
-    emitOpcode(compiler, OP_GET_ATTRIB);
-    emitShort(compiler, index);
+    emitGetAttrib(compiler, index);
   }
 
   compiler->is_last_call = false;
@@ -1651,11 +2129,13 @@ static void parsePrecedence(Compiler* compiler, Precedence precedence) {
   compiler->is_last_call = false;
   compiler->l_value = precedence <= PREC_LOWEST;
 
+  int start = (int)_FN->opcodes.count;
   prefix(compiler);
 
   while (getRule(compiler->current.type)->precedence >= precedence) {
     lexToken(compiler);
     GrammarFn infix = getRule(compiler->previous.type)->infix;
+    compiler->operand_start = start;
     infix(compiler);
   }
 }
@@ -1678,6 +2158,12 @@ static void compilerInit(Compiler* compiler, PKVM* vm, const char* source,
   compiler->options = options;
 
   compiler->current_char = source;
+  compiler->source_end = source + strlen(source);
+
+  compiler->stream = NULL;
+  compiler->stream_ended = false;
+  compiler->blocks = NULL;
+  compiler->last_block = NULL;
   compiler->current_line = 1;
   compiler->next.type = TK_ERROR;
   compiler->next.start = NULL;
@@ -1686,15 +2172,33 @@ static void compilerInit(Compiler* compiler, PKVM* vm, const char* source,
   compiler->next.value = VAR_UNDEFINED;
 
   compiler->scope_depth = DEPTH_GLOBAL;
+  compiler->locals = NULL;
   compiler->local_count = 0;
+  compiler->local_capacity = 0;
   compiler->stack_size = 0;
 
   compiler->loop = NULL;
   compiler->func = NULL;
 
+  compiler->forwards = NULL;
   compiler->forwards_count = 0;
+  compiler->forwards_capacity = 0;
+
+  compiler->wide_params = NULL;
+  compiler->wide_count = 0;
+  compiler->wide_capacity = 0;
+
+  compiler->calls = NULL;
+  compiler->calls_count = 0;
+  compiler->calls_capacity = 0;
+
+  compiler->modules = NULL;
+  compiler->modules_count = 0;
+  compiler->modules_capacity = 0;
+
   compiler->new_local = false;
   compiler->is_last_call = false;
+  compiler->operand_start = -1;
 }
 
 // Add a variable and return it's index to the context. Assumes that the
@@ -1730,7 +2234,16 @@ static int compilerAddVariable(Compiler* compiler, const char* name,
     return (int)scriptAddGlobal(compiler->vm, compiler->script,
                                 name, length, VAR_NULL);
   } else {
-    Local* local = &compiler->locals [compiler->local_count];
+    if (compiler->local_count == compiler->local_capacity) {
+      int capacity = utilPowerOf2Ceil(compiler->local_count + 1);
+      if (capacity < MIN_CAPACITY) capacity = MIN_CAPACITY;
+      compiler->locals = (Local*)vmRealloc(compiler->vm, compiler->locals,
+                           sizeof(Local) * compiler->local_capacity,
+                           sizeof(Local) * capacity);
+      compiler->local_capacity = capacity;
+    }
+
+    Local* local = &compiler->locals[compiler->local_count];
     local->name = name;
     local->length = length;
     local->depth = compiler->scope_depth;
@@ -1743,10 +2256,22 @@ static int compilerAddVariable(Compiler* compiler, const char* name,
 
 static void compilerAddForward(Compiler* compiler, int instruction, Fn* fn,
                                const char* name, int length, int line) {
-  if (compiler->forwards_count == MAX_FORWARD_NAMES) {
-    parseError(compiler, "A script should contain at most %d implicit forward "
-               "function declarations.", MAX_FORWARD_NAMES);
-    return;
+  if (compiler->forwards_count == compiler->forwards_capacity) {
+    int capacity = utilPowerOf2Ceil(compiler->forwards_count + 1);
+    if (capacity < MIN_CAPACITY) capacity = MIN_CAPACITY;
+    compiler->forwards = (ForwardName*)vmRealloc(compiler->vm,
+                           compiler->forwards,
+                           sizeof(ForwardName) * compiler->forwards_capacity,
+                           sizeof(ForwardName) * capacity);
+    compiler->forwards_capacity = capacity;
+  }
+
+  // The source of a stream is freed as it's compiled, so the name should be
+  // kept in the script's names instead of pointing into the source.
+  if (compiler->stream != NULL) {
+    uint32_t index = scriptAddName(compiler->script, compiler->vm,
+                                   name, (uint32_t)length);
+    name = compiler->script->names.data[index]->data;
   }
 
   ForwardName* forward = &compiler->forwards[compiler->forwards_count++];
@@ -1757,15 +2282,187 @@ static void compilerAddForward(Compiler* compiler, int instruction, Fn* fn,
   forward->line = line;
 }
 
+// Add a parameter of the instruction at [index] of the [fn] which needs to be
+// re-written with the OP_WIDE prefix once the script is compiled.
+static void compilerAddWideParam(Compiler* compiler, Fn* fn, int index,
+                                 uint32_t value) {
+  if (compiler->wide_count == compiler->wide_capacity) {
+    int capacity = utilPowerOf2Ceil(compiler->wide_count + 1);
+    if (capacity < MIN_CAPACITY) capacity = MIN_CAPACITY;
+    compiler->wide_params = (WideParam*)vmRealloc(compiler->vm,
+                              compiler->wide_params,
+                              sizeof(WideParam) * compiler->wide_capacity,
+                              sizeof(WideParam) * capacity);
+    compiler->wide_capacity = capacity;
+  }
+
+  WideParam* param = &compiler->wide_params[compiler->wide_count++];
+  param->func = fn;
+  param->index = index;
+  param->value = value;
+}
+
+static void compilerAddCall(Compiler* compiler, int push, int call,
+                            int slot) {
+  if (compiler->calls_count == compiler->calls_capacity) {
+    int capacity = utilPowerOf2Ceil(compiler->calls_count + 1);
+    if (capacity < MIN_CAPACITY) capacity = MIN_CAPACITY;
+    compiler->calls = (InlineCall*)vmRealloc(compiler->vm, compiler->calls,
+                        sizeof(InlineCall) * compiler->calls_capacity,
+                        sizeof(InlineCall) * capacity);
+    compiler->calls_capacity = capacity;
+  }
+
+  InlineCall* record = &compiler->calls[compiler->calls_count++];
+  record->func = _FN;
+  record->push = push;
+  record->call = call;
+  record->slot = slot;
+}
+
+// Returns the binding of the [global] variable by an import statement or
+// NULL if it's not bound to any.
+static ModuleBinding* compilerGetBinding(Compiler* compiler, int global) {
+  for (int i = 0; i < compiler->modules_count; i++) {
+    if (compiler->modules[i].global == global) return &compiler->modules[i];
+  }
+  return NULL;
+}
+
+// Returns the module which the [global] variable is bound to by an import
+// statement or NULL if it's not bound to any.
+static Script* compilerBoundModule(Compiler* compiler, int global) {
+  ModuleBinding* binding = compilerGetBinding(compiler, global);
+  if (binding == NULL || binding->function != -1) return NULL;
+  return binding->module;
+}
+
+static void compilerUnbindModule(Compiler* compiler, int global) {
+  for (int i = 0; i < compiler->modules_count; i++) {
+    if (compiler->modules[i].global == global) {
+      compiler->modules[i] = compiler->modules[--compiler->modules_count];
+      return;
+    }
+  }
+}
+
+// Bind the [global] variable to the imported [module] or it's [function] if
+// it's not -1, the variable should be stored before calling this.
+static void compilerBindModule(Compiler* compiler, int global,
+                               Script* module, int function) {
+  if (compiler->modules_count == compiler->modules_capacity) {
+    int capacity = utilPowerOf2Ceil(compiler->modules_count + 1);
+    if (capacity < MIN_CAPACITY) capacity = MIN_CAPACITY;
+    compiler->modules = (ModuleBinding*)vmRealloc(compiler->vm,
+                          compiler->modules,
+                          sizeof(ModuleBinding) * compiler->modules_capacity,
+                          sizeof(ModuleBinding) * capacity);
+    compiler->modules_capacity = capacity;
+  }
+
+  ModuleBinding* binding = &compiler->modules[compiler->modules_count++];
+  binding->global = global;
+  binding->module = module;
+  binding->function = function;
+}
+
+// Bind the [global] variable to the function named [name] of the imported
+// [module] if it's a function of it, the variable should be stored with the
+// function before calling this.
+static void compilerBindImportedFn(Compiler* compiler, int global,
+                                   Script* module, const char* name,
+                                   uint32_t length) {
+  if (scriptGetClass(compiler->vm, module, name, length) != -1) return;
+  int function = scriptGetFunc(compiler->vm, module, name, length);
+  if (function != -1) compilerBindModule(compiler, global, module, function);
+}
+
+// If the symbol [name] of the imported [module] is a constant, make the newly
+// added [global] variable which it's imported to a constant of the same value.
+static void compilerImportConstant(Compiler* compiler, int global,
+                                   Script* module, const char* name,
+                                   uint32_t length) {
+  Var value;
+  int index = scriptGetGlobals(compiler->vm, module, name, length);
+  if (index != -1 && scriptGetConstant(module, index, &value)) {
+    scriptAddConstant(compiler->vm, compiler->script, global, value);
+  }
+}
+
+// Returns the intrinsic (see Intrinsic in pk_core.h) of the function if the
+// instructions between [start] and [end] of the current function only pushes
+// a function of the math library which is statically bound by an import
+// statement, otherwise -1.
+static int compilerIntrinsicAt(Compiler* compiler, int start, int end) {
+  if (compiler->has_errors) return -1;
+
+  Script* module = NULL;
+  int function = -1;
+
+  // from math import sqrt; sqrt(x)
+  int global = compilerGlobalAt(compiler, start, end);
+  if (global != -1) {
+    ModuleBinding* binding = compilerGetBinding(compiler, global);
+    if (binding == NULL) return -1;
+    module = binding->module;
+    function = binding->function;
+
+  // import math; math.sqrt(x)
+  } else if (end - start > 4) {
+    const uint8_t* opcodes = _FN->opcodes.data + end - 4;
+    if (opcodes[0] != OP_GET_MODULE_FN) return -1;
+    global = compilerGlobalAt(compiler, start, end - 4);
+    if (global == -1) return -1;
+    module = compilerBoundModule(compiler, global);
+    function = opcodes[3];
+  }
+
+  if (module == NULL || function == -1) return -1;
+  ASSERT_INDEX((uint32_t)function, module->functions.count);
+  return getIntrinsic(module->functions.data[function]);
+}
+
+// Returns the index of the global variable if the instructions between
+// [start] and [end] of the current function only pushes a global variable
+// otherwise -1.
+static int compilerGlobalAt(Compiler* compiler, int start, int end) {
+  if (start < 0 || start >= end || end > (int)_FN->opcodes.count) return -1;
+
+  const uint8_t* opcodes = _FN->opcodes.data + start;
+  if (end - start == 2 && opcodes[0] == OP_PUSH_GLOBAL) {
+    return opcodes[1];
+  }
+  if (end - start == 4 && opcodes[0] == OP_WIDE &&
+      opcodes[1] == OP_PUSH_GLOBAL) {
+    return (opcodes[2] << 8) | opcodes[3];
+  }
+  return -1;
+}
+
+// Returns true if the instructions between [start] and [end] of the current
+// function only pushes a function of the script (which could be a forward
+// declared function that's not compiled yet).
+static bool compilerFunctionAt(Compiler* compiler, int start, int end) {
+  if (start < 0 || start >= end || end > (int)_FN->opcodes.count) {
+    return false;
+  }
+
+  const uint8_t* opcodes = _FN->opcodes.data + start;
+  if (end - start == 2) return opcodes[0] == OP_PUSH_FN;
+  if (end - start == 4) {
+    return opcodes[0] == OP_WIDE && opcodes[1] == OP_PUSH_FN;
+  }
+  return false;
+}
+
 // Add a literal constant to scripts literals and return it's index.
 static int compilerAddConstant(Compiler* compiler, Var value) {
   pkVarBuffer* literals = &compiler->script->literals;
 
-  for (uint32_t i = 0; i < literals->count; i++) {
-    if (isValuesSame(literals->data[i], value)) {
-      return i;
-    }
-  }
+  // A string literal which was lexed before it's duplicate was added, will be
+  // a different string object with the same content, which will be found.
+  int index = scriptGetLiteral(compiler->vm, compiler->script, value);
+  if (index != -1) return index;
 
   // Add new constant to script.
   if (literals->count < MAX_CONSTANTS) {
@@ -1777,6 +2474,202 @@ static int compilerAddConstant(Compiler* compiler, Var value) {
   return (int)literals->count - 1;
 }
 
+// Returns true if the instructions of the current function from [start] to
+// [end] is a single instruction that pushes a constant and set it's value to
+// the [value].
+static bool compilerConstantAt(Compiler* compiler, int start, int end,
+                               Var* value) {
+  if (compiler->has_errors) return false;
+  if (start < 0 || start >= end || end > (int)_FN->opcodes.count) return false;
+
+  const uint8_t* opcodes = _FN->opcodes.data + start;
+  switch ((Opcode)opcodes[0]) {
+    case OP_PUSH_CONSTANT:
+    {
+      if (end - start != 3) return false;
+      int index = (opcodes[1] << 8) | opcodes[2];
+      ASSERT_INDEX(index, (int)compiler->script->literals.count);
+      *value = compiler->script->literals.data[index];
+      return true;
+    }
+
+    case OP_WIDE:
+    {
+      if (end - start != 6 || opcodes[1] != OP_PUSH_CONSTANT) return false;
+      int index = (opcodes[2] << 24) | (opcodes[3] << 16) |
+                  (opcodes[4] << 8) | opcodes[5];
+      ASSERT_INDEX(index, (int)compiler->script->literals.count);
+      *value = compiler->script->literals.data[index];
+      return true;
+    }
+
+    case OP_PUSH_NULL:  *value = VAR_NULL;  break;
+    case OP_PUSH_TRUE:  *value = VAR_TRUE;  break;
+    case OP_PUSH_FALSE: *value = VAR_FALSE; break;
+
+    default:
+      return false;
+  }
+
+  return end - start == 1;
+}
+
+// Discard all the instructions of the current function after [start] (the
+// constant operands that are folded or a statically dead code). The forward
+// names in the discarded code will still be resolved but not patched.
+static void compilerDiscardCode(Compiler* compiler, int start) {
+  ASSERT(start <= (int)_FN->opcodes.count, OOPS);
+  _FN->opcodes.count = start;
+  compiler->func->lines.count = start;
+
+  for (int i = 0; i < compiler->forwards_count; i++) {
+    ForwardName* forward = &compiler->forwards[i];
+    if (forward->func == _FN && forward->instruction >= start) {
+      forward->instruction = -1;
+    }
+  }
+
+  int count = 0;
+  for (int i = 0; i < compiler->wide_count; i++) {
+    WideParam* param = &compiler->wide_params[i];
+    if (param->func == _FN && param->index >= start) continue;
+    compiler->wide_params[count++] = *param;
+  }
+  compiler->wide_count = count;
+
+  count = 0;
+  for (int i = 0; i < compiler->calls_count; i++) {
+    InlineCall* call = &compiler->calls[i];
+    if (call->func == _FN && call->call >= start) continue;
+    compiler->calls[count++] = *call;
+  }
+  compiler->calls_count = count;
+}
+
+// Evaluate the binary operator [op] on the constants [lhs] and [rhs] at
+// compile time. Returns false if it can't be folded (if it could fail or the
+// result isn't a constant), which will then be evaluated at runtime.
+static bool foldBinaryOp(Compiler* compiler, Opcode op, Var lhs, Var rhs,
+                         Var* result) {
+  PKVM* vm = compiler->vm;
+  bool numbers = IS_NUM(lhs) && IS_NUM(rhs);
+  bool integers = IS_INT(lhs) && IS_INT(rhs);
+
+  switch (op) {
+    case OP_ADD:
+      if (numbers) {
+        *result = varAdd(vm, lhs, rhs);
+        return true;
+      }
+      if (IS_OBJ_TYPE(lhs, OBJ_STRING) && IS_OBJ_TYPE(rhs, OBJ_STRING)) {
+        *result = varAdd(vm, lhs, rhs);
+        return true;
+      }
+      return false;
+
+    case OP_SUBTRACT:
+      if (!numbers) return false;
+      *result = varSubtract(vm, lhs, rhs);
+      return true;
+
+    case OP_MULTIPLY:
+      if (!numbers) return false;
+      *result = varMultiply(vm, lhs, rhs);
+      return true;
+
+    case OP_DIVIDE:
+      if (!numbers) return false;
+      *result = varDivide(vm, lhs, rhs);
+      return true;
+
+    case OP_MOD:
+      if (!numbers) return false;
+      *result = varModulo(vm, lhs, rhs);
+      return true;
+
+    case OP_BIT_AND:
+      if (!integers) return false;
+      *result = varBitAnd(vm, lhs, rhs);
+      return true;
+
+    case OP_BIT_OR:
+      if (!integers) return false;
+      *result = varBitOr(vm, lhs, rhs);
+      return true;
+
+    case OP_BIT_XOR:
+      if (!integers) return false;
+      *result = varBitXor(vm, lhs, rhs);
+      return true;
+
+    case OP_BIT_LSHIFT:
+    case OP_BIT_RSHIFT:
+      if (!integers || AS_INT(rhs) < 0 || AS_INT(rhs) >= 32) return false;
+      *result = (op == OP_BIT_LSHIFT) ? varBitLshift(vm, lhs, rhs)
+                                      : varBitRshift(vm, lhs, rhs);
+      return true;
+
+    case OP_EQEQ:
+      *result = VAR_BOOL(isValuesEqual(lhs, rhs));
+      return true;
+
+    case OP_NOTEQ:
+      *result = VAR_BOOL(!isValuesEqual(lhs, rhs));
+      return true;
+
+    case OP_LT:
+      if (!numbers) return false;
+      *result = VAR_BOOL(varLesser(lhs, rhs));
+      return true;
+
+    case OP_LTEQ:
+      if (!numbers) return false;
+      *result = VAR_BOOL(varLesser(lhs, rhs) || isValuesEqual(lhs, rhs));
+      return true;
+
+    case OP_GT:
+      if (!numbers) return false;
+      *result = VAR_BOOL(varGreater(lhs, rhs));
+      return true;
+
+    case OP_GTEQ:
+      if (!numbers) return false;
+      *result = VAR_BOOL(varGreater(lhs, rhs) || isValuesEqual(lhs, rhs));
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+// Evaluate the unary operator [op] on the constant [value] at compile time.
+// Returns false if it can't be folded.
+static bool foldUnaryOp(Compiler* compiler, Opcode op, Var value,
+                        Var* result) {
+  switch (op) {
+    case OP_NEGATIVE:
+      if (IS_INT(value) && AS_INT(value) != INT32_MIN) {
+        *result = VAR_INT(-AS_INT(value));
+        return true;
+      }
+      if (!IS_NUM(value)) return false;
+      *result = VAR_NUM(-AS_NUM(value));
+      return true;
+
+    case OP_NOT:
+      *result = VAR_BOOL(!toBool(value));
+      return true;
+
+    case OP_BIT_NOT:
+      if (!IS_INT(value)) return false;
+      *result = varBitNot(compiler->vm, value);
+      return true;
+
+    default:
+      return false;
+  }
+}
+
 // Enters inside a block.
 static void compilerEnterBlock(Compiler* compiler) {
   compiler->scope_depth++;
@@ -1837,10 +2730,14 @@ static void compilerPushFunc(Compiler* compiler, Func* fn,
   fn->ptr = func;
   fn->depth = compiler->scope_depth;
   fn->index = index;
+  fn->outer_stack_size = compiler->stack_size;
+  pkUintBufferInit(&fn->lines);
   compiler->func = fn;
+  compiler->stack_size = 0;
 }
 
 static void compilerPopFunc(Compiler* compiler) {
+  compiler->stack_size = compiler->func->outer_stack_size;
   compiler->func = compiler->func->outer_func;
 }
 
@@ -1853,8 +2750,8 @@ static int emitByte(Compiler* compiler, int byte) {
 
   pkByteBufferWrite(&_FN->opcodes, compiler->vm,
                     (uint8_t)byte);
-  pkUintBufferWrite(&_FN->oplines, compiler->vm,
-                   compiler->previous.line);
+  pkUintBufferWrite(&compiler->func->lines, compiler->vm,
+                    compiler->previous.line);
   return (int)_FN->opcodes.count - 1;
 }
 
@@ -1871,11 +2768,69 @@ static void emitOpcode(Compiler* compiler, Opcode opcode) {
   compilerChangeStack(compiler, opcode_info[opcode].stack);
 }
 
+// Emits an instruction with it's parameter [arg]. If the [arg] doesn't fit in
+// the instruction's parameter, it'll be prefixed with OP_WIDE.
+static void emitOpcodeArg(Compiler* compiler, Opcode opcode, int arg) {
+  int params = opcode_info[opcode].params;
+  ASSERT(params == 1 || params == 2, OOPS);
+
+  if ((uint32_t)arg < (1u << (8 * params))) {
+    emitOpcode(compiler, opcode);
+    if (params == 1) emitByte(compiler, arg);
+    else emitShort(compiler, arg);
+    return;
+  }
+
+  emitByte(compiler, OP_WIDE);
+  emitOpcode(compiler, opcode);
+  if (params == 2) emitShort(compiler, (arg >> 16) & 0xffff);
+  emitShort(compiler, arg & 0xffff);
+}
+
+// Emit the attribute access instruction [opcode] of the attribute at the
+// [name] index of the script's names. The index of it's inline cache is set
+// once the function is compiled (see initAttribCaches()).
+static void emitAttribOpcode(Compiler* compiler, Opcode opcode, int name) {
+  emitOpcode(compiler, opcode);
+  emitShort(compiler, name);
+  emitByte(compiler, 0);
+}
+
+// Emit an instruction to push the constant [value], the numbers and strings
+// are added to the script's literals.
+static void emitConstant(Compiler* compiler, Var value) {
+  if (IS_NULL(value)) {
+    emitOpcode(compiler, OP_PUSH_NULL);
+
+  } else if (IS_BOOL(value)) {
+    emitOpcode(compiler, AS_BOOL(value) ? OP_PUSH_TRUE : OP_PUSH_FALSE);
+
+  } else {
+    // The value could be a new string that isn't referenced by anything yet.
+    if (IS_OBJ(value)) vmPushTempRef(compiler->vm, AS_OBJ(value)); // value.
+    int index = compilerAddConstant(compiler, value);
+    if (IS_OBJ(value)) vmPopTempRef(compiler->vm); // value.
+
+    emitOpcodeArg(compiler, OP_PUSH_CONSTANT, index);
+  }
+}
+
 // Jump back to the start of the loop.
 static void emitLoopJump(Compiler* compiler) {
+  // +3: The instruction (1 byte) and the offset (2 bytes).
+  int offset = (int)_FN->opcodes.count - compiler->loop->start + 3;
+  if (offset < MAX_JUMP) {
+    emitOpcode(compiler, OP_LOOP);
+    emitShort(compiler, offset);
+    return;
+  }
+
+  // +3: The OP_WIDE prefix and the offset is 4 bytes.
+  offset += 3;
+  emitByte(compiler, OP_WIDE);
   emitOpcode(compiler, OP_LOOP);
-  int offset = (int)_FN->opcodes.count - compiler->loop->start + 2;
-  emitShort(compiler, offset);
+  emitShort(compiler, (offset >> 16) & 0xffff);
+  emitShort(compiler, offset & 0xffff);
 }
 
 static void emitAssignment(Compiler* compiler, TokenType assignment) {
@@ -1906,19 +2861,36 @@ static void emitFunctionEnd(Compiler* compiler) {
   emitByte(compiler, OP_RETURN);
 
   emitOpcode(compiler, OP_END);
+
+  // Nothing will be emitted after the end, encode the line numbers.
+  Func* func = compiler->func;
+  fnSetLines(compiler->vm, _FN, func->lines.data, func->lines.count);
+  pkUintBufferClear(&func->lines, compiler->vm);
 }
 
 // Update the jump offset.
 static void patchJump(Compiler* compiler, int addr_index) {
   int offset = (int)_FN->opcodes.count - (addr_index + 2 /*bytes index*/);
-  ASSERT(offset < MAX_JUMP, "Too large address offset to jump to.");
+
+  // The jump will be re-written with the OP_WIDE prefix.
+  if (offset >= MAX_JUMP) {
+    compilerAddWideParam(compiler, _FN, addr_index, _FN->opcodes.count);
+    offset = 0;
+  }
 
   _FN->opcodes.data[addr_index] = (offset >> 8) & 0xff;
   _FN->opcodes.data[addr_index + 1] = offset & 0xff;
 }
 
 static void patchForward(Compiler* compiler, Fn* fn, int index, int name) {
-  fn->opcodes.data[index] = name & 0xff;
+
+  // The instruction will be re-written with the OP_WIDE prefix.
+  if (name > 0xff) {
+    compilerAddWideParam(compiler, fn, index, (uint32_t)name);
+    name = 0;
+  }
+
+  fn->opcodes.data[index] = name & 0xff;
 }
 
 /*****************************************************************************/
@@ -1930,10 +2902,12 @@ typedef enum {
   BLOCK_LOOP,
   BLOCK_IF,
   BLOCK_ELSE,
+  BLOCK_CASE,
 } BlockType;
 
 static void compileStatement(Compiler* compiler);
 static void compileBlockBody(Compiler* compiler, BlockType type);
+static void compileIfStatement(Compiler* compiler, bool elsif);
 
 // Compile a type and return it's index in the script's types buffer.
 static int compileType(Compiler* compiler) {
@@ -1972,8 +2946,7 @@ static int compileType(Compiler* compiler) {
   compilerEnterBlock(compiler);
 
   // Push an instance on the stack.
-  emitOpcode(compiler, OP_PUSH_INSTANCE);
-  emitByte(compiler, ty_index);
+  emitOpcodeArg(compiler, OP_PUSH_INSTANCE, ty_index);
 
   skipNewLines(compiler);
   TokenType next = peek(compiler);
@@ -1998,6 +2971,11 @@ static int compileType(Compiler* compiler) {
       }
     }
 
+    uint32_t field = type->field_names.count;
+    if (field >= MAX_FIELDS) {
+      parseError(compiler, "A class should contain at most %d fields.",
+                 MAX_FIELDS);
+    }
     pkUintBufferWrite(&type->field_names, compiler->vm, f_index);
 
     // Consume the assignment expression.
@@ -2006,7 +2984,8 @@ static int compileType(Compiler* compiler) {
     consumeEndStatement(compiler);
 
     // At this point the stack top would be the expression.
-    emitOpcode(compiler, OP_INST_APPEND);
+    emitOpcode(compiler, OP_INST_INIT_FIELD);
+    emitShort(compiler, (int)field);
 
     skipNewLines(compiler);
     next = peek(compiler);
@@ -2133,7 +3112,7 @@ static void compileBlockBody(Compiler* compiler, BlockType type) {
 
   compilerEnterBlock(compiler);
 
-  if (type == BLOCK_IF) {
+  if (type == BLOCK_IF || type == BLOCK_CASE) {
     consumeStartBlock(compiler, TK_THEN);
     skipNewLines(compiler);
 
@@ -2152,7 +3131,8 @@ static void compileBlockBody(Compiler* compiler, BlockType type) {
 
   TokenType next = peek(compiler);
   while (!(next == TK_END || next == TK_EOF || (
-    (type == BLOCK_IF) && (next == TK_ELSE || next == TK_ELSIF)))) {
+    (type == BLOCK_IF) && (next == TK_ELSE || next == TK_ELSIF)) || (
+    (type == BLOCK_CASE) && (next == TK_ELSE || next == TK_CASE)))) {
 
     compileStatement(compiler);
     skipNewLines(compiler);
@@ -2230,8 +3210,9 @@ static Script* importFile(Compiler* compiler, const char* path) {
   if (compiler->options) options = *compiler->options;
   options.repl_mode = false;
 
-  // Compile the source to the script and clean the source.
-  PkResult result = compile(vm, scr, source.string, &options);
+  // Compile the source to the script (or load it from the bytecode cache) and
+  // clean the source.
+  PkResult result = compileCached(vm, scr, source.string, &options);
   if (source.on_done != NULL) source.on_done(vm, source);
 
   if (result != PK_RESULT_SUCCESS) {
@@ -2307,8 +3288,15 @@ static int compilerImportName(Compiler* compiler, int line,
     case NAME_LOCAL_VAR:
       UNREACHABLE();
 
-    case NAME_GLOBAL_VAR:
+    case NAME_GLOBAL_VAR: {
+      Var value;
+      if (scriptGetConstant(compiler->script, result.index, &value)) {
+        parseError(compiler, "Cannot assign to the constant '%.*s'.",
+                   length, name);
+        return -1;
+      }
       return result.index;
+    }
 
     case NAME_FUNCTION:
     case NAME_CLASS:
@@ -2322,7 +3310,7 @@ static int compilerImportName(Compiler* compiler, int line,
 
 // This will called by the compilerImportAll() function to import a single
 // entry from the imported script. (could be a function or global variable).
-static void compilerImportSingleEntry(Compiler* compiler,
+static void compilerImportSingleEntry(Compiler* compiler, Script* script,
                                       const char* name, uint32_t length) {
 
   // Special names are begins with '$' like function body (only for now).
@@ -2337,11 +3325,17 @@ static void compilerImportSingleEntry(Compiler* compiler,
                                       name, length);
 
   // Get the function from the script.
-  emitOpcode(compiler, OP_GET_ATTRIB_KEEP);
-  emitShort(compiler, name_index);
+  emitAttribOpcode(compiler, OP_GET_ATTRIB_KEEP, name_index);
 
+  uint32_t globals_count = compiler->script->globals.count;
   int index = compilerImportName(compiler, line, name, length);
-  if (index != -1) emitStoreVariable(compiler, index, true);
+  if (index != -1) {
+    emitStoreVariable(compiler, index, true);
+    compilerBindImportedFn(compiler, index, script, name, length);
+    if (index == (int)globals_count) {
+      compilerImportConstant(compiler, index, script, name, length);
+    }
+  }
   emitOpcode(compiler, OP_POP);
 }
 
@@ -2356,14 +3350,14 @@ static void compilerImportAll(Compiler* compiler, Script* script) {
   for (uint32_t i = 0; i < script->classes.count; i++) {
     uint32_t name_ind = script->classes.data[i]->name;
     String* name = script->names.data[name_ind];
-    compilerImportSingleEntry(compiler, name->data, name->length);
+    compilerImportSingleEntry(compiler, script, name->data, name->length);
   }
 
   // Import all functions.
   for (uint32_t i = 0; i < script->functions.count; i++) {
     const char* name = script->functions.data[i]->name;
     uint32_t length = (uint32_t)strlen(name);
-    compilerImportSingleEntry(compiler, name, length);
+    compilerImportSingleEntry(compiler, script, name, length);
   }
 
   // Import all globals.
@@ -2372,7 +3366,7 @@ static void compilerImportAll(Compiler* compiler, Script* script) {
     ASSERT(script->global_names.data[i] < script->names.count, OOPS);
     const String* name = script->names.data[script->global_names.data[i]];
 
-    compilerImportSingleEntry(compiler, name->data, name->length);
+    compilerImportSingleEntry(compiler, script, name->data, name->length);
   }
 }
 
@@ -2405,8 +3399,9 @@ static void compileFromImport(Compiler* compiler) {
                                           name, length);
 
       // Don't pop the lib since it'll be used for the next entry.
-      emitOpcode(compiler, OP_GET_ATTRIB_KEEP);
-      emitShort(compiler, name_index); //< Name of the attrib.
+      emitAttribOpcode(compiler, OP_GET_ATTRIB_KEEP, name_index);
+      const char* symbol = name;
+      uint32_t symbol_length = length;
 
       // Check if it has an alias.
       if (match(compiler, TK_AS)) {
@@ -2423,8 +3418,19 @@ static void compileFromImport(Compiler* compiler) {
 
       // Get the variable to bind the imported symbol, if we already have a
       // variable with that name override it, otherwise use a new variable.
+      uint32_t globals_count = compiler->script->globals.count;
       int var_index = compilerImportName(compiler, line, name, length);
-      if (var_index != -1) emitStoreVariable(compiler, var_index, true);
+      if (var_index != -1) {
+        emitStoreVariable(compiler, var_index, true);
+        if (lib_from) {
+          compilerBindImportedFn(compiler, var_index, lib_from,
+                                 symbol, symbol_length);
+          if (var_index == (int)globals_count) {
+            compilerImportConstant(compiler, var_index, lib_from,
+                                   symbol, symbol_length);
+          }
+        }
+      }
       emitOpcode(compiler, OP_POP);
 
     } while (match(compiler, TK_COMMA) && (skipNewLines(compiler), true));
@@ -2484,6 +3490,7 @@ static void compileRegularImport(Compiler* compiler) {
 
     if (var_index != -1) {
       emitStoreVariable(compiler, var_index, true);
+      if (lib) compilerBindModule(compiler, var_index, lib, -1);
       emitOpcode(compiler, OP_POP);
 
     } else {
@@ -2503,10 +3510,65 @@ static void compileExpression(Compiler* compiler) {
   parsePrecedence(compiler, PREC_LOWEST);
 }
 
+// Compile a block body which would never be executed (ie. 'if false') and
+// discard it's code. It's still compiled to report the errors in it.
+static void compileDeadBlockBody(Compiler* compiler, BlockType type) {
+  int start = (int)_FN->opcodes.count;
+  int patch_count = (compiler->loop) ? compiler->loop->patch_count : 0;
+
+  compileBlockBody(compiler, type);
+
+  compilerDiscardCode(compiler, start);
+  if (compiler->loop) compiler->loop->patch_count = patch_count;
+}
+
+// Compile the rest of an if statement which condition is a constant. Only the
+// taken branch is emitted and the others are compiled as dead code.
+static void compileConstantIf(Compiler* compiler, bool taken) {
+
+  if (taken) compileBlockBody(compiler, BLOCK_IF);
+  else compileDeadBlockBody(compiler, BLOCK_IF);
+
+  if (match(compiler, TK_ELSIF)) {
+    int start = (int)_FN->opcodes.count;
+    int patch_count = (compiler->loop) ? compiler->loop->patch_count : 0;
+
+    compilerEnterBlock(compiler);
+    compileIfStatement(compiler, true);
+    compilerExitBlock(compiler);
+
+    if (taken) {
+      compilerDiscardCode(compiler, start);
+      if (compiler->loop) compiler->loop->patch_count = patch_count;
+    }
+
+  } else if (match(compiler, TK_ELSE)) {
+    if (taken) compileDeadBlockBody(compiler, BLOCK_ELSE);
+    else compileBlockBody(compiler, BLOCK_ELSE);
+  }
+}
+
 static void compileIfStatement(Compiler* compiler, bool elsif) {
 
   skipNewLines(compiler);
+  int cond_start = (int)_FN->opcodes.count;
   compileExpression(compiler); //< Condition.
+
+  // If the condition is a constant, the branch is decided at compile time.
+  Var cond;
+  if (compilerConstantAt(compiler, cond_start, (int)_FN->opcodes.count,
+                         &cond)) {
+    compilerDiscardCode(compiler, cond_start);
+    compilerChangeStack(compiler, -1);
+    compileConstantIf(compiler, toBool(cond));
+
+    if (!elsif) {
+      skipNewLines(compiler);
+      consume(compiler, TK_END, "Expected 'end' after statement end.");
+    }
+    return;
+  }
+
   emitOpcode(compiler, OP_JUMP_IF_NOT);
   int ifpatch = emitShort(compiler, 0xffff); //< Will be patched.
 
@@ -2558,13 +3620,36 @@ static void compileWhileStatement(Compiler* compiler) {
   compiler->loop = &loop;
 
   compileExpression(compiler); //< Condition.
-  emitOpcode(compiler, OP_JUMP_IF_NOT);
-  int whilepatch = emitShort(compiler, 0xffff); //< Will be patched.
+
+  // If the condition is a constant, it doesn't need to be checked on each
+  // iteration, and a 'while false' loop is dead code.
+  Var cond;
+  bool is_constant = compilerConstantAt(compiler, loop.start,
+                                        (int)_FN->opcodes.count, &cond);
+  if (is_constant) {
+    compilerDiscardCode(compiler, loop.start);
+    compilerChangeStack(compiler, -1);
+
+    if (!toBool(cond)) {
+      compileDeadBlockBody(compiler, BLOCK_LOOP);
+      compiler->loop = loop.outer_loop;
+
+      skipNewLines(compiler);
+      consume(compiler, TK_END, "Expected 'end' after statement end.");
+      return;
+    }
+  }
+
+  int whilepatch = -1;
+  if (!is_constant) {
+    emitOpcode(compiler, OP_JUMP_IF_NOT);
+    whilepatch = emitShort(compiler, 0xffff); //< Will be patched.
+  }
 
   compileBlockBody(compiler, BLOCK_LOOP);
 
   emitLoopJump(compiler);
-  patchJump(compiler, whilepatch);
+  if (whilepatch != -1) patchJump(compiler, whilepatch);
 
   // Patch break statement.
   for (int i = 0; i < compiler->loop->patch_count; i++) {
@@ -2631,6 +3716,248 @@ static void compileForStatement(Compiler* compiler) {
   compilerExitBlock(compiler); //< Iterator scope.
 }
 
+// Emit a jump to the [address] as an entry of a jump table of a match
+// statement. The entries should be the same size, so a jump that doesn't fit
+// is written with the OP_WIDE prefix once the function is finalized, where
+// all the entries of the table will be prefixed (see finalizeFunction()).
+static void emitTableJump(Compiler* compiler, int address) {
+  // +3: The instruction (1 byte) and the offset (2 bytes).
+  int next = (int)_FN->opcodes.count + 3;
+  bool loop = address < next;
+  int offset = loop ? next - address : address - next;
+
+  emitOpcode(compiler, loop ? OP_LOOP : OP_JUMP);
+  int index = emitShort(compiler, 0);
+  if (offset >= MAX_JUMP) {
+    compilerAddWideParam(compiler, _FN, index, (uint32_t)address);
+    offset = 0;
+  }
+
+  _FN->opcodes.data[index] = (offset >> 8) & 0xff;
+  _FN->opcodes.data[index + 1] = offset & 0xff;
+}
+
+// Emit the jump table of a match statement, the case [values] (which are
+// constants) will jump to the [bodies] at the same index and any other value
+// will jump to the [fallback] address (or the end of the table if it's -1).
+// A case value that's already matched by a case before it is ignored.
+//
+// If all the values are integers and they're dense, the table will have an
+// entry for each integer from the minimum to the maximum value (the missing
+// values jump to the fallback) and the entry is computed from the value,
+// otherwise the entry of the value is looked up in a map.
+static void emitJumpTable(Compiler* compiler, pkVarBuffer* values,
+                          pkUintBuffer* bodies, int fallback) {
+  PKVM* vm = compiler->vm;
+  int count = (int)values->count;
+
+  bool dense = true;
+  int32_t min = 0, max = 0;
+  for (int i = 0; i < count; i++) {
+    Var value = values->data[i];
+    if (!IS_INT(value)) {
+      dense = false;
+      break;
+    }
+    if (i == 0 || AS_INT(value) < min) min = AS_INT(value);
+    if (i == 0 || AS_INT(value) > max) max = AS_INT(value);
+  }
+
+  int64_t span = (int64_t)max - min + 1;
+  if (span > MATCH_TABLE_MAX_SIZE || span > 2 * (int64_t)count) {
+    dense = false;
+  }
+
+  // Address of the body of each entry (without the default entry) or -1 if
+  // it's the fallback.
+  int capacity = dense ? (int)span : count;
+  int* entries = ALLOCATE_ARRAY(vm, int, capacity);
+  int size = 0;
+  Var table;
+
+  if (dense) {
+    size = (int)span;
+    for (int i = 0; i < size; i++) entries[i] = -1;
+    for (int i = count - 1; i >= 0; i--) {
+      entries[AS_INT(values->data[i]) - min] = (int)bodies->data[i];
+    }
+    Range* range = newRange(vm, min, (double)max + 1, 1);
+    table = VAR_OBJ(range);
+    vmPushTempRef(vm, &range->_super); // table.
+
+  } else {
+    Map* map = newMap(vm);
+    table = VAR_OBJ(map);
+    vmPushTempRef(vm, &map->_super); // table.
+    for (int i = 0; i < count; i++) {
+      if (!IS_UNDEF(mapGet(map, values->data[i]))) continue;
+      entries[size++] = (int)bodies->data[i];
+      mapSet(vm, map, values->data[i], VAR_NUM((double)size));
+    }
+  }
+
+  int index = compilerAddConstant(compiler, table);
+  vmPopTempRef(vm); // table.
+  emitOpcodeArg(compiler, dense ? OP_SWITCH_TABLE : OP_SWITCH_MAP, index);
+
+  // +1: The default entry, each entry is 3 bytes till the function is
+  // finalized.
+  int end = (int)_FN->opcodes.count + (size + 1) * 3;
+  if (fallback == -1) fallback = end;
+
+  emitTableJump(compiler, fallback);
+  for (int i = 0; i < size; i++) {
+    emitTableJump(compiler, (entries[i] == -1) ? fallback : entries[i]);
+  }
+  ASSERT((int)_FN->opcodes.count == end, OOPS);
+
+  vmRealloc(vm, entries, sizeof(int) * capacity, 0);
+}
+
+// A match statement compares a value with the values of it's cases and runs
+// the body of the first case that's equal, or the else body if none of them.
+//
+//   match value
+//     case 1, 2 then ...
+//     case "foo" then ...
+//     else ...
+//   end
+//
+// The case values which are constants are dispatched with a jump table
+// which is emitted after the bodies since it's known only once all the cases
+// are compiled. Once a case value isn't a constant, it and all the values
+// after it are compared one by one in their order, which is the fallback of
+// the jump table:
+//
+//       (value)             ; The '@match' local.
+//       JUMP L_dispatch
+//   L_1:(body of case 1)
+//       JUMP L_end
+//   L_2:PUSH_LOCAL @match   ; A case which isn't a constant.
+//       (case value)
+//       EQEQ
+//       JUMP_IF_NOT L_else
+//       (body of case 2)
+//       JUMP L_end
+//   L_else:
+//       (else body)
+//       JUMP L_end
+//   L_dispatch:
+//       PUSH_LOCAL @match
+//       SWITCH_TABLE (table)
+//       JUMP L_2            ; The fallback.
+//       LOOP L_1            ; The entry of each case.
+//   L_end:
+static void compileMatchStatement(Compiler* compiler) {
+  PKVM* vm = compiler->vm;
+  compilerEnterBlock(compiler);
+
+  int value = compilerAddVariable(compiler, "@match", 6,
+                                  compiler->previous.line);
+  compileExpression(compiler);
+  skipNewLines(compiler);
+
+  emitOpcode(compiler, OP_JUMP);
+  int dispatch = emitShort(compiler, 0xffff); //< Will be patched.
+
+  pkVarBuffer values;   //< The case values dispatched with the jump table.
+  pkUintBuffer bodies;  //< The address of the body of each case value.
+  pkUintBuffer exits;   //< The jumps to the end of the statement.
+  pkUintBuffer matched; //< The jumps to the body of the current case.
+  pkVarBufferInit(&values);
+  pkUintBufferInit(&bodies);
+  pkUintBufferInit(&exits);
+  pkUintBufferInit(&matched);
+
+  // Address of the first case value that isn't a constant, where the values
+  // are compared one by one, or -1 if all of them are constants so far.
+  int fallback = -1;
+
+  while (match(compiler, TK_CASE)) {
+    uint32_t case_values = values.count;
+    matched.count = 0;
+
+    do {
+      skipNewLines(compiler);
+      int start = (int)_FN->opcodes.count;
+      emitPushVariable(compiler, value, false);
+      int value_start = (int)_FN->opcodes.count;
+      compileExpression(compiler);
+
+      Var constant;
+      if (fallback == -1 &&
+          compilerConstantAt(compiler, value_start, (int)_FN->opcodes.count,
+                             &constant)) {
+        compilerDiscardCode(compiler, start);
+        compilerChangeStack(compiler, -2);
+        pkVarBufferWrite(&values, vm, constant);
+        continue;
+      }
+
+      if (fallback == -1) fallback = start;
+      emitOpcode(compiler, OP_EQEQ);
+      emitOpcode(compiler, OP_JUMP_IF);
+      pkUintBufferWrite(&matched, vm, (uint32_t)emitShort(compiler, 0xffff));
+    } while (match(compiler, TK_COMMA));
+
+    // None of the compared values of the case are equal, jump to the next.
+    int next_case = -1;
+    if (matched.count > 0) {
+      emitOpcode(compiler, OP_JUMP);
+      next_case = emitShort(compiler, 0xffff); //< Will be patched.
+    }
+
+    uint32_t body = _FN->opcodes.count;
+    for (uint32_t i = case_values; i < values.count; i++) {
+      pkUintBufferWrite(&bodies, vm, body);
+    }
+    for (uint32_t i = 0; i < matched.count; i++) {
+      patchJump(compiler, (int)matched.data[i]);
+    }
+
+    compileBlockBody(compiler, BLOCK_CASE);
+
+    emitOpcode(compiler, OP_JUMP);
+    pkUintBufferWrite(&exits, vm, (uint32_t)emitShort(compiler, 0xffff));
+
+    if (next_case != -1) patchJump(compiler, next_case);
+  }
+
+  if (fallback == -1) fallback = (int)_FN->opcodes.count;
+  if (match(compiler, TK_ELSE)) compileBlockBody(compiler, BLOCK_ELSE);
+
+  skipNewLines(compiler);
+  consume(compiler, TK_END, "Expected 'end' after statement end.");
+
+  if (values.count == 0) {
+    // Nothing to dispatch, the cases are compared from the start.
+    _FN->opcodes.data[dispatch] = 0;
+    _FN->opcodes.data[dispatch + 1] = 0;
+
+  } else {
+    // The fallback of the table is the end if there is no else body.
+    if (fallback == (int)_FN->opcodes.count) fallback = -1;
+
+    emitOpcode(compiler, OP_JUMP);
+    pkUintBufferWrite(&exits, vm, (uint32_t)emitShort(compiler, 0xffff));
+
+    patchJump(compiler, dispatch);
+    emitPushVariable(compiler, value, false);
+    emitJumpTable(compiler, &values, &bodies, fallback);
+  }
+
+  for (uint32_t i = 0; i < exits.count; i++) {
+    patchJump(compiler, (int)exits.data[i]);
+  }
+
+  pkVarBufferClear(&values, vm);
+  pkUintBufferClear(&bodies, vm);
+  pkUintBufferClear(&exits, vm);
+  pkUintBufferClear(&matched, vm);
+
+  compilerExitBlock(compiler);
+}
+
 // Compiles a statement. Assignment could be an assignment statement or a new
 // variable declaration, which will be handled.
 static void compileStatement(Compiler* compiler) {
@@ -2712,6 +4039,9 @@ static void compileStatement(Compiler* compiler) {
   } else if (match(compiler, TK_FOR)) {
     compileForStatement(compiler);
 
+  } else if (match(compiler, TK_MATCH)) {
+    compileMatchStatement(compiler);
+
   } else {
     compiler->new_local = false;
     compileExpression(compiler);
@@ -2733,6 +4063,48 @@ static void compileStatement(Compiler* compiler) {
   if (is_temproary) emitOpcode(compiler, OP_POP);
 }
 
+// const NAME = <expression>
+// The expression should be evaluated to a null, boolean, number or a string at
+// compile time. The constant is a global variable with the value but the
+// compiler will use the value instead of the variable (see exprName()).
+static void compileConstDeclaration(Compiler* compiler) {
+  ASSERT(compiler->scope_depth == DEPTH_GLOBAL, OOPS);
+
+  consume(compiler, TK_NAME, "Expected a name for the constant.");
+  const char* name = compiler->previous.start;
+  uint32_t length = (uint32_t)compiler->previous.length;
+  int line = compiler->previous.line;
+
+  bool defined = compilerSearchName(compiler, name, length).type !=
+                   NAME_NOT_DEFINED;
+  if (defined) {
+    parseError(compiler, "Name '%.*s' already exists.", length, name);
+  }
+
+  consume(compiler, TK_EQ, "Expected '=' after the constant name.");
+  skipNewLines(compiler);
+
+  // The value is compiled as an expression to fold it, and the code is
+  // discarded since the constant doesn't need to be initialized at runtime.
+  int start = (int)_FN->opcodes.count;
+  compileExpression(compiler);
+
+  Var value;
+  if (compilerConstantAt(compiler, start, (int)_FN->opcodes.count, &value)) {
+    if (!defined) {
+      int index = compilerAddVariable(compiler, name, length, line);
+      scriptAddConstant(compiler->vm, compiler->script, index, value);
+    }
+  } else if (!compiler->has_errors) {
+    parseError(compiler, "Expected a constant expression as the value of "
+               "'%.*s'.", length, name);
+  }
+
+  compilerDiscardCode(compiler, start);
+  compilerChangeStack(compiler, -1);
+  consumeEndStatement(compiler);
+}
+
 // Compile statements that are only valid at the top level of the script. Such
 // as import statement, function define, and if we're running REPL mode top
 // level expression's evaluated value will be printed.
@@ -2756,6 +4128,9 @@ static void compileTopLevelStatement(Compiler* compiler) {
   } else if (match(compiler, TK_IMPORT)) {
     compileRegularImport(compiler);
 
+  } else if (match(compiler, TK_CONST)) {
+    compileConstDeclaration(compiler);
+
   } else if (match(compiler, TK_MODULE)) {
     parseError(compiler, "Module name must be the first statement "
                           "of the script.");
@@ -2765,15 +4140,1095 @@ static void compileTopLevelStatement(Compiler* compiler) {
   }
 }
 
-PkResult compile(PKVM* vm, Script* script, const char* source,
-                 const PkCompileOptions* options) {
+/*****************************************************************************/
+/* PEEPHOLE OPTIMIZER                                                        */
+/*****************************************************************************/
+
+// The single pass compiler emits the code of an expression without knowing
+// what comes next, which leaves a lot of stack shuffling (ie. storing a value
+// then popping it and pushing it again) and jumps to jumps in the bytecode.
+// Once a script is compiled the instructions of it's functions are decoded
+// and the wasteful patterns are rewritten, removed instructions are dropped
+// while writing them back and the jump offsets are re-calculated.
+//
+// Writing the instructions back is also where the parameters that didn't fit
+// when they were emitted (see WideParam) are prefixed with OP_WIDE.
+
+// Maximum number of passes over the instructions of a function, since a
+// rewrite could expose another pattern we iterate till nothing changes.
+#define PEEPHOLE_MAX_PASSES 8
+
+// Maximum number of instructions of a function to be inlined at the call
+// site (not including the return instructions).
+#define INLINE_MAX_INSTRUCTIONS 16
+
+// A decoded instruction of a function. Jumps refer to the index of the
+// target instruction instead of the address offset, so instructions could be
+// removed without invalidating them.
+typedef struct {
+  Opcode op;
+  uint32_t arg;    //< The parameter of the instruction (if it has any).
+  uint32_t line;   //< Line number of the instruction.
+  int target;      //< Index of the jump target instruction or -1.
+  bool wide;       //< True if it needs the OP_WIDE prefix.
+  bool removed;    //< True if the instruction was removed.
+  bool is_target;  //< True if any jump lands on the instruction.
+  bool entry;      //< True if it's an entry of a jump table.
+  int inlined;     //< Index of the inlined call it's a part of or -1.
+} PeepInstr;
+
+// A call inlined in the function which is being optimized. The calls which
+// were inlined in the called function are inlined along with it, their
+// [parent] is the call they were inlined in.
+typedef struct {
+  uint32_t fn_index; //< Index of the inlined function in the script.
+  uint32_t line;     //< Line number of the call.
+  int parent;        //< Index of the call it's inlined in or -1.
+} PeepInlined;
+
+// Returns true if the [op] is a jump instruction, the parameter of all the
+// jump instructions is the address offset to jump to.
+static bool peepIsJump(Opcode op) {
+  return op == OP_JUMP || op == OP_LOOP || op == OP_JUMP_IF ||
+         op == OP_JUMP_IF_NOT || op == OP_ITER;
+}
+
+// Returns true if the [op] is a switch instruction which is followed by the
+// entries of it's jump table.
+static bool peepIsSwitch(Opcode op) {
+  return op == OP_SWITCH_TABLE || op == OP_SWITCH_MAP;
+}
+
+// Returns the size of the [instr] in bytes including the OP_WIDE prefix.
+static uint32_t peepSize(PeepInstr* instr) {
+  int params = opcode_info[instr->op].params;
+  return instr->wide ? 2 + params * 2 : 1 + params;
+}
+
+// Returns the index of the first instruction at or after [index] which is
+// not removed. The last instruction (OP_END) is never removed.
+static int peepNext(PeepInstr* instrs, int index) {
+  while (instrs[index].removed) index++;
+  return index;
+}
+
+// Remove the instruction at [index], if it's a jump target the jumps will
+// land on the next instruction, mark it so no pattern would merge it with
+// the instructions before.
+static void peepRemove(PeepInstr* instrs, int index) {
+  instrs[index].removed = true;
+  if (instrs[index].is_target) {
+    instrs[peepNext(instrs, index)].is_target = true;
+  }
+}
+
+// Returns true if [op] pushes a value without any side effects, so pushing
+// and immediately popping it could be removed.
+static bool peepIsPurePush(Opcode op) {
+  return op == OP_PUSH_CONSTANT || op == OP_PUSH_NULL || op == OP_PUSH_0 ||
+         op == OP_PUSH_TRUE || op == OP_PUSH_FALSE ||
+         (OP_PUSH_LOCAL_0 <= op && op <= OP_PUSH_LOCAL_N);
+}
+
+// Returns true if the [push] instruction pushes the same variable stored by
+// the [store] instruction.
+static bool peepIsSameVariable(PeepInstr* store, PeepInstr* push) {
+  if (OP_STORE_LOCAL_0 <= store->op && store->op <= OP_STORE_LOCAL_N) {
+    int index = store->op - OP_STORE_LOCAL_0;
+    if (push->op != (Opcode)(OP_PUSH_LOCAL_0 + index)) return false;
+    return store->op != OP_STORE_LOCAL_N || store->arg == push->arg;
+  }
+
+  if (store->op == OP_STORE_GLOBAL) {
+    return push->op == OP_PUSH_GLOBAL && store->arg == push->arg;
+  }
 
-  // Skip utf8 BOM if there is any.
-  if (strncmp(source, "\xEF\xBB\xBF", 3) == 0) source += 3;
+  return false;
+}
+
+// Point the jump instruction at [index] to the instruction at [target], and
+// change the jump direction if needed. Returns false if it's not possible
+// since conditional jumps can only jump forward.
+static bool peepSetTarget(PeepInstr* instrs, int index, int target) {
+  PeepInstr* jump = &instrs[index];
+
+  if (target > index) {
+    if (jump->op == OP_LOOP) jump->op = OP_JUMP;
+
+  } else {
+    if (jump->op != OP_JUMP && jump->op != OP_LOOP) return false;
+    jump->op = OP_LOOP;
+  }
+
+  jump->target = target;
+  return true;
+}
+
+// Rewrite the patterns starting at the instruction at [index]. Returns true
+// if anything is changed.
+static bool peepRewrite(PeepInstr* instrs, int index) {
+  PeepInstr* a = &instrs[index];
+  if (a->op == OP_END) return false;
+
+  int next = peepNext(instrs, index + 1);
+  PeepInstr* b = &instrs[next];
+
+  // Jump to the next instruction. The entries of a jump table are never
+  // removed since they're indexed by the switch instruction.
+  if (a->op == OP_JUMP && a->target == next && !a->entry) {
+    peepRemove(instrs, index);
+    return true;
+  }
+
+  // Jump to a jump, jump to it's target directly.
+  if (a->op == OP_JUMP || a->op == OP_LOOP ||
+      a->op == OP_JUMP_IF || a->op == OP_JUMP_IF_NOT) {
+    PeepInstr* t = &instrs[a->target];
+    if ((t->op == OP_JUMP || t->op == OP_LOOP) && t != a &&
+        t->target != index && t->target != a->target) {
+      if (peepSetTarget(instrs, index, t->target)) return true;
+    }
+  }
+
+  if (b->op == OP_END || b->is_target) return false;
+  int after = peepNext(instrs, next + 1);
+  PeepInstr* c = &instrs[after];
+
+  // STORE x, POP, PUSH x -> STORE x. The stored value is still at the top.
+  if (b->op == OP_POP && !c->is_target && peepIsSameVariable(a, c)) {
+    peepRemove(instrs, next);
+    peepRemove(instrs, after);
+    return true;
+  }
+
+  // PUSH, POP -> (nothing).
+  if (peepIsPurePush(a->op) && b->op == OP_POP) {
+    peepRemove(instrs, index);
+    peepRemove(instrs, next);
+    return true;
+  }
+
+  // SWAP, SWAP -> (nothing).
+  if (a->op == OP_SWAP && b->op == OP_SWAP) {
+    peepRemove(instrs, index);
+    peepRemove(instrs, next);
+    return true;
+  }
+
+  // NOT, JUMP_IF(_NOT) -> JUMP_IF_NOT (JUMP_IF). The jumps test the
+  // condition with toBool() same as NOT does.
+  if (a->op == OP_NOT && (b->op == OP_JUMP_IF || b->op == OP_JUMP_IF_NOT)) {
+    b->op = (b->op == OP_JUMP_IF) ? OP_JUMP_IF_NOT : OP_JUMP_IF;
+    peepRemove(instrs, index);
+    return true;
+  }
+
+  // JUMP_IF_NOT L1, JUMP L2, L1: -> JUMP_IF L2, L1: (and vice versa).
+  if ((a->op == OP_JUMP_IF || a->op == OP_JUMP_IF_NOT) &&
+      b->op == OP_JUMP && a->target == after) {
+    a->op = (a->op == OP_JUMP_IF) ? OP_JUMP_IF_NOT : OP_JUMP_IF;
+    a->target = b->target;
+    peepRemove(instrs, next);
+    return true;
+  }
+
+  return false;
+}
+
+// Run the rewrite passes over the decoded instructions till nothing changes.
+static void peepOptimize(PeepInstr* instrs, int count) {
+  bool changed = true;
+  for (int pass = 0; changed && pass < PEEPHOLE_MAX_PASSES; pass++) {
+    changed = false;
+
+    for (int i = 0; i < count; i++) instrs[i].is_target = false;
+    for (int i = 0; i < count; i++) {
+      if (instrs[i].removed || instrs[i].target == -1) continue;
+      instrs[i].target = peepNext(instrs, instrs[i].target);
+      instrs[instrs[i].target].is_target = true;
+    }
+
+    for (int i = 0; i < count; i++) {
+      if (instrs[i].removed) continue;
+      if (peepRewrite(instrs, i)) changed = true;
+    }
+  }
+}
+
+// Decode the instructions of the function [fn] and return them, the number
+// of instructions will be written to [count]. The [indexes] will be set to
+// an array of the instruction index at each byte of the opcodes (only valid
+// at the start of an instruction) which should be freed by the caller.
+static PeepInstr* peepDecode(Compiler* compiler, Fn* fn, int* count,
+                             int** indexes) {
+  PKVM* vm = compiler->vm;
+
+  const uint8_t* code = fn->opcodes.data;
+  ASSERT(code[fn->opcodes.count - 1] == OP_END, OOPS);
+
+  int instr_count = 0;
+  for (uint32_t i = 0; i < fn->opcodes.count; i++) {
+    bool wide = (code[i] == OP_WIDE);
+    if (wide) i++;
+    i += opcode_info[code[i]].params * (wide ? 2 : 1);
+    instr_count++;
+  }
+
+  PeepInstr* instrs = ALLOCATE_ARRAY(vm, PeepInstr, instr_count);
+  int* offsets = ALLOCATE_ARRAY(vm, int, fn->opcodes.count);
+  uint32_t* lines = ALLOCATE_ARRAY(vm, uint32_t, fn->opcodes.count);
+  fnGetLines(fn, lines);
+
+  uint32_t offset = 0;
+  for (int i = 0; i < instr_count; i++) {
+    PeepInstr* instr = &instrs[i];
+    offsets[offset] = i;
+
+    instr->line = lines[offset];
+
+    // The innermost call which the instruction was inlined with.
+    instr->inlined = -1;
+    for (uint32_t j = 0; j < fn->inlined.count; j += INLINED_CALL_SIZE) {
+      const uint32_t* call = fn->inlined.data + j;
+      if (call[0] <= offset && offset < call[1]) {
+        instr->inlined = (int)(j / INLINED_CALL_SIZE);
+      }
+    }
+
+    instr->wide = (code[offset] == OP_WIDE);
+    if (instr->wide) offset++;
+    instr->op = (Opcode)code[offset++];
+    instr->target = -1;
+    instr->removed = false;
+    instr->is_target = false;
+    instr->entry = false;
+
+    instr->arg = 0;
+    int size = opcode_info[instr->op].params * (instr->wide ? 2 : 1);
+    for (int j = 0; j < size; j++) {
+      instr->arg = (instr->arg << 8) | code[offset++];
+    }
+
+    // For the jumps, the [arg] will be the address to jump to, which will be
+    // set to the [target] once all the instructions are decoded.
+    if (peepIsJump(instr->op)) {
+      instr->arg = (instr->op == OP_LOOP) ? offset - instr->arg
+                                          : offset + instr->arg;
+    }
+  }
+  vmRealloc(vm, lines, sizeof(uint32_t) * fn->opcodes.count, 0);
+
+  for (int i = 0; i < compiler->wide_count; i++) {
+    WideParam* param = &compiler->wide_params[i];
+    if (param->func != fn) continue;
+    // -1: The opcode is before the parameter.
+    instrs[offsets[param->index - 1]].arg = param->value;
+  }
+
+  for (int i = 0; i < instr_count; i++) {
+    if (!peepIsJump(instrs[i].op)) continue;
+    ASSERT(instrs[i].arg < fn->opcodes.count, OOPS);
+    instrs[i].target = offsets[instrs[i].arg];
+  }
+
+  // Mark the entries of the jump tables, the default entry and an entry for
+  // each case of the table.
+  for (int i = 0; i < instr_count; i++) {
+    if (!peepIsSwitch(instrs[i].op)) continue;
+
+    ASSERT_INDEX(instrs[i].arg, compiler->script->literals.count);
+    Var table = compiler->script->literals.data[instrs[i].arg];
+    int entries = 1;
+    if (instrs[i].op == OP_SWITCH_TABLE) {
+      entries += (int)(AS_RANGE(table)->to - AS_RANGE(table)->from);
+    } else {
+      entries += (int)AS_MAP(table)->count;
+    }
+
+    for (int j = i + 1; j <= i + entries; j++) {
+      ASSERT(j < instr_count && peepIsJump(instrs[j].op), OOPS);
+      instrs[j].entry = true;
+    }
+  }
+
+  *count = instr_count;
+  *indexes = offsets;
+  return instrs;
+}
+
+// Returns the index of the local variable accessed by the [instr] or -1 if
+// it doesn't access any.
+static int peepLocalIndex(PeepInstr* instr) {
+  Opcode op = instr->op;
+  if (op == OP_PUSH_LOCAL_N || op == OP_STORE_LOCAL_N) return instr->arg;
+  if (OP_PUSH_LOCAL_0 <= op && op < OP_PUSH_LOCAL_N) {
+    return op - OP_PUSH_LOCAL_0;
+  }
+  if (OP_STORE_LOCAL_0 <= op && op < OP_STORE_LOCAL_N) {
+    return op - OP_STORE_LOCAL_0;
+  }
+  return -1;
+}
+
+// Change the local variable accessed by the [instr] to the [index].
+static void peepSetLocalIndex(PeepInstr* instr, int index) {
+  bool store = (OP_STORE_LOCAL_0 <= instr->op &&
+                instr->op <= OP_STORE_LOCAL_N);
+  Opcode first = store ? OP_STORE_LOCAL_0 : OP_PUSH_LOCAL_0;
+
+  if (index < 9) { //< 0..8 locals have single opcode.
+    instr->op = (Opcode)(first + index);
+    instr->arg = 0;
+  } else {
+    instr->op = store ? OP_STORE_LOCAL_N : OP_PUSH_LOCAL_N;
+    instr->arg = (uint32_t)index;
+  }
+}
+
+// Returns the index of the return instruction of the decoded function
+// [body] of [count] instructions if it could be inlined, otherwise -1. Only
+// the small functions which has a single return statement at the end and
+// doesn't have locals other than it's [arity] parameters are inlined, so the
+// stack is the same at the return. The function at [index] of the script is
+// never inlined in itself.
+static int peepCanInline(PeepInstr* body, int count, int index, int arity) {
+  ASSERT(count >= 2 && body[count - 1].op == OP_END, OOPS);
+
+  // The return statement followed by the (unreachable) pops of the
+  // parameters and the return at the end of the function.
+  int ret = count - 2;
+  if (body[ret].op != OP_RETURN) return -1;
+  do ret--; while (ret >= 0 && body[ret].op == OP_POP);
+  if (ret < 0 || body[ret].op != OP_RETURN) return -1;
+  if (ret > INLINE_MAX_INSTRUCTIONS) return -1;
+
+  for (int i = 0; i < ret; i++) {
+    PeepInstr* instr = &body[i];
+    if (instr->op == OP_RETURN || instr->op == OP_REPL_PRINT) return -1;
+    if (peepIsSwitch(instr->op)) return -1;
+    if (instr->op == OP_PUSH_FN && (int)instr->arg == index) return -1;
+    if (peepLocalIndex(instr) >= arity) return -1;
+    if (instr->target > ret) return -1;
+  }
+
+  return ret;
+}
+
+// Inline the calls to the small functions of the script in the decoded
+// instructions of the function [fn], the [indexes] are the instruction index
+// at each byte of the opcodes. Returns the new instructions and update the
+// [count] (the [instrs] will be freed). The inlined calls are written to the
+// [calls] (which should be freed by the caller) and [calls_count], the
+// inlined instructions keep their line numbers and refer to their call, so
+// the errors are reported at the inlined function (see Fn.inlined).
+//
+// The arguments of a call are at the slots after the called function's slot
+// which are the parameters of the function. So the instructions of the
+// function are copied with it's locals shifted past the slot, and the
+// returned value is stored at the slot and the arguments are popped, the
+// same as returning from the call:
+//
+//   PUSH_FN f           PUSH_NULL
+//   (arguments)         (arguments)
+//   CALL argc       ->  (instructions of f without the return)
+//                       STORE_LOCAL slot
+//                       POP (argc + 1 times)
+//
+// If all the arguments are pushed with a single instruction without side
+// effects (ie. a local or a constant) and the function never assigns it's
+// parameters, the parameters are replaced with the arguments instead.
+//
+//   PUSH_FN sq          PUSH_LOCAL i
+//   PUSH_LOCAL i    ->  PUSH_LOCAL i
+//   CALL 1              MULTIPLY
+static PeepInstr* peepInline(Compiler* compiler, Fn* fn, PeepInstr* instrs,
+                             int* count, const int* indexes,
+                             PeepInlined** calls, int* calls_count) {
+  PKVM* vm = compiler->vm;
+  Script* script = compiler->script;
+
+  typedef struct {
+    int push, call;  //< Index of the pushed function and the call.
+    int slot;        //< Slot of the pushed function.
+    int argc;
+    Function* callee;
+    PeepInstr* body; //< The decoded instructions of the called function.
+    int body_count;
+    int ret;         //< Index of the return instruction in the [body].
+    bool replace;    //< True if the parameters are replaced.
+    int inlined;     //< Index of the inlined call in the [calls].
+  } InlineSite;
+
+  *calls = NULL;
+  *calls_count = 0;
+
+  int sites_count = 0;
+  for (int i = 0; i < compiler->calls_count; i++) {
+    if (compiler->calls[i].func == fn) sites_count++;
+  }
+  if (sites_count == 0) return instrs;
+
+  // The index of the site of each instruction if it's a pushed function, an
+  // argument or a call that's going to be inlined otherwise -1.
+  int* site_at = ALLOCATE_ARRAY(vm, int, *count);
+  for (int i = 0; i < *count; i++) site_at[i] = -1;
+
+  InlineSite* sites = ALLOCATE_ARRAY(vm, InlineSite, sites_count);
+  int inlined = 0;
+
+  for (int i = 0; i < compiler->calls_count; i++) {
+    InlineCall* call = &compiler->calls[i];
+    if (call->func != fn) continue;
+
+    InlineSite* site = &sites[inlined];
+    site->push = indexes[call->push];
+    site->call = indexes[call->call];
+    site->slot = call->slot;
+
+    PeepInstr* push = &instrs[site->push];
+    PeepInstr* at = &instrs[site->call];
+    ASSERT(push->op == OP_PUSH_FN, OOPS);
+    ASSERT(at->op == OP_CALL || at->op == OP_TAIL_CALL, OOPS);
+
+    ASSERT_INDEX(push->arg, script->functions.count);
+    Function* callee = script->functions.data[push->arg];
+    site->argc = (int)at->arg;
+    site->callee = callee;
+    if (callee->is_native || callee->arity != site->argc) continue;
+
+    int* body_indexes;
+    site->body = peepDecode(compiler, callee->fn, &site->body_count,
+                            &body_indexes);
+    vmRealloc(vm, body_indexes, sizeof(int) * callee->fn->opcodes.count, 0);
+
+    site->ret = peepCanInline(site->body, site->body_count, (int)push->arg,
+                              site->argc);
+    if (site->ret == -1) {
+      vmRealloc(vm, site->body, sizeof(PeepInstr) * site->body_count, 0);
+      continue;
+    }
+
+    site->replace = (site->call - site->push - 1 == site->argc);
+    for (int j = site->push + 1; site->replace && j < site->call; j++) {
+      if (!peepIsPurePush(instrs[j].op)) site->replace = false;
+    }
+    for (int j = 0; site->replace && j < site->ret; j++) {
+      PeepInstr* instr = &site->body[j];
+      if (OP_STORE_LOCAL_0 <= instr->op && instr->op <= OP_STORE_LOCAL_N) {
+        site->replace = false;
+      }
+    }
+
+    site_at[site->push] = site_at[site->call] = inlined;
+    if (site->replace) {
+      for (int j = site->push + 1; j < site->call; j++) site_at[j] = inlined;
+    }
+    inlined++;
+
+    // The call followed by the calls inlined in the called function.
+    site->inlined = *calls_count;
+    *calls_count += 1 + (int)(callee->fn->inlined.count / INLINED_CALL_SIZE);
+
+    // The stack of the function should fit the inlined function's stack
+    // which starts after the slot.
+    int stack_size = site->slot + 1 + callee->fn->stack_size;
+    if (fn->stack_size < stack_size) fn->stack_size = stack_size;
+  }
+
+  // Index of each instruction in the new instructions, the removed ones will
+  // have the index of the next instruction.
+  int* new_index = ALLOCATE_ARRAY(vm, int, *count + 1);
+  int new_count = 0;
+  for (int i = 0; i < *count; i++) {
+    new_index[i] = new_count;
+    if (site_at[i] == -1) {
+      new_count++;
+      continue;
+    }
+
+    InlineSite* site = &sites[site_at[i]];
+    if (i == site->call) {
+      new_count += site->ret;
+      if (!site->replace) new_count += site->argc + 2;
+    } else if (!site->replace) {
+      new_count++; //< The pushed function which will be replaced with null.
+    }
+  }
+  new_index[*count] = new_count;
+
+  if (*calls_count > 0) {
+    *calls = ALLOCATE_ARRAY(vm, PeepInlined, *calls_count);
+  }
+
+  PeepInstr* result = ALLOCATE_ARRAY(vm, PeepInstr, new_count);
+  int n = 0;
+  for (int i = 0; i < *count; i++) {
+    PeepInstr instr = instrs[i];
+    if (instr.target != -1) instr.target = new_index[instr.target];
+
+    if (site_at[i] == -1) {
+      result[n++] = instr;
+      continue;
+    }
+
+    InlineSite* site = &sites[site_at[i]];
+    if (i != site->call) {
+      if (!site->replace) {
+        ASSERT(instr.op == OP_PUSH_FN, OOPS);
+        instr.op = OP_PUSH_NULL;
+        instr.arg = 0;
+        result[n++] = instr;
+      }
+      continue;
+    }
+
+    PeepInlined* call = &(*calls)[site->inlined];
+    call->fn_index = instrs[site->push].arg;
+    call->line = instr.line;
+    call->parent = instr.inlined;
+
+    // The parent of a call inlined in the called function is the previous
+    // call which contains it, since they're in the order of their nesting.
+    const pkUintBuffer* callee_calls = &site->callee->fn->inlined;
+    int callee_count = (int)(callee_calls->count / INLINED_CALL_SIZE);
+    for (int j = 0; j < callee_count; j++) {
+      const uint32_t* inner = callee_calls->data + j * INLINED_CALL_SIZE;
+      PeepInlined* nested = &(*calls)[site->inlined + 1 + j];
+      nested->fn_index = inner[2];
+      nested->line = inner[3];
+      nested->parent = site->inlined;
+      for (int k = j - 1; k >= 0; k--) {
+        const uint32_t* outer = callee_calls->data + k * INLINED_CALL_SIZE;
+        if (outer[0] <= inner[0] && inner[1] <= outer[1]) {
+          nested->parent = site->inlined + 1 + k;
+          break;
+        }
+      }
+    }
+
+    int base = n;
+    for (int j = 0; j < site->ret; j++) {
+      PeepInstr body = site->body[j];
+      if (body.op == OP_TAIL_CALL) body.op = OP_CALL;
+      if (body.target != -1) body.target += base;
+
+      // The instructions which weren't inlined in the called function (-1)
+      // are a part of the call itself.
+      uint32_t line = body.line;
+      int body_inlined = site->inlined + 1 + body.inlined;
+
+      int local = peepLocalIndex(&body);
+      if (local != -1 && site->replace) {
+        body = instrs[site->push + 1 + local];
+        ASSERT(body.target == -1, OOPS);
+      } else if (local != -1) {
+        peepSetLocalIndex(&body, site->slot + 1 + local);
+      }
+
+      body.line = line;
+      body.inlined = body_inlined;
+      body.removed = body.is_target = false;
+      result[n++] = body;
+    }
+
+    if (!site->replace) {
+      instr.op = OP_STORE_LOCAL_0;
+      peepSetLocalIndex(&instr, site->slot);
+      result[n++] = instr;
+
+      instr.op = OP_POP;
+      instr.arg = 0;
+      for (int j = 0; j <= site->argc; j++) result[n++] = instr;
+    }
+  }
+  ASSERT(n == new_count, OOPS);
+
+  for (int i = 0; i < inlined; i++) {
+    vmRealloc(vm, sites[i].body, sizeof(PeepInstr) * sites[i].body_count, 0);
+  }
+  vmRealloc(vm, sites, sizeof(InlineSite) * sites_count, 0);
+  vmRealloc(vm, site_at, sizeof(int) * (*count), 0);
+  vmRealloc(vm, new_index, sizeof(int) * (*count + 1), 0);
+  vmRealloc(vm, instrs, sizeof(PeepInstr) * (*count), 0);
+
+  *count = new_count;
+  return result;
+}
+
+// The inferred type of a value on the stack.
+typedef enum {
+  PEEP_ANY = 0, //< Could be any value.
+  PEEP_NUMBER,  //< Always a number.
+  PEEP_RANGE,   //< Always a range (ie. the sequence of a for loop).
+} PeepType;
+
+// The types of the stack values at each instruction of a function, which are
+// propagated over the jumps with a worklist.
+typedef struct {
+  int width;          //< Maximum number of values on the stack.
+  int* depths;        //< Number of values on the stack or -1 if not reached.
+  uint8_t* types;     //< [width] types of the stack at each instruction.
+  int* worklist;      //< Indexes of the instructions to be visited.
+  int worklist_count;
+  bool* pending;      //< True if the instruction is in the worklist.
+} PeepTypes;
+
+// Apply the instruction [instr] to the [types] of the stack of [depth] values.
+// Returns false if the stack doesn't have enough values for the instruction
+// or it overflows (which shouldn't happen), and the types can't be inferred.
+static bool peepApplyTypes(Compiler* compiler, PeepInstr* instr,
+                           uint8_t* types, int* depth, int width) {
+  Opcode op = instr->op;
+  int d = *depth;
+
+  // The locals are the values at the bottom of the stack.
+  int local = peepLocalIndex(instr);
+  if (local != -1) {
+    if (local >= d) return false;
+    if (OP_STORE_LOCAL_0 <= op && op <= OP_STORE_LOCAL_N) {
+      types[local] = types[d - 1];
+    } else {
+      if (d >= width) return false;
+      types[(*depth)++] = types[local];
+    }
+    return true;
+  }
+
+  // Most of the instructions pop their operands and push a single value
+  // which could be any value.
+  int pops = 1 - opcode_info[op].stack;
+  bool push = true;
+  uint8_t result = PEEP_ANY;
+
+  switch (op) {
+    case OP_PUSH_CONSTANT: {
+      Script* script = compiler->script;
+      ASSERT_INDEX(instr->arg, script->literals.count);
+      if (IS_NUM(script->literals.data[instr->arg])) result = PEEP_NUMBER;
+    } break;
+
+    case OP_PUSH_0:
+      result = PEEP_NUMBER;
+      break;
+
+    case OP_SWAP: {
+      if (d < 2) return false;
+      uint8_t top = types[d - 1];
+      types[d - 1] = types[d - 2];
+      types[d - 2] = top;
+    } return true;
+
+    case OP_CALL:
+    case OP_TAIL_CALL:
+      pops = (int)instr->arg + 1;
+      break;
+
+    case OP_CALL_INTRINSIC:
+      pops = getIntrinsicArity((Intrinsic)instr->arg) + 1;
+      break;
+
+    // The iterator is always an integer and the value is a number if the
+    // sequence is a range.
+    case OP_ITER:
+      if (d < 3) return false;
+      types[d - 2] = PEEP_NUMBER;
+      types[d - 1] = (types[d - 3] == PEEP_RANGE) ? PEEP_NUMBER : PEEP_ANY;
+      return true;
+
+    case OP_POP:
+    case OP_JUMP_IF:
+    case OP_JUMP_IF_NOT:
+    case OP_SWITCH_TABLE:
+    case OP_SWITCH_MAP:
+      pops = 1;
+      push = false;
+      break;
+
+    case OP_JUMP:
+    case OP_LOOP:
+    case OP_ITER_TEST:
+    case OP_STORE_GLOBAL:
+    case OP_REPL_PRINT:
+    case OP_END:
+      return true;
+
+    // The function's return at the end pops the null at the base of the
+    // frame (not a value on the stack) and there is nothing after a return.
+    case OP_RETURN:
+      return true;
+
+    // Adding to a number results a number (or an error), the others always
+    // results a number.
+    case OP_ADD:
+    case OP_ADD_NN:
+      if (d >= 2 && types[d - 2] == PEEP_NUMBER) result = PEEP_NUMBER;
+      break;
+
+    case OP_NEGATIVE:
+    case OP_SUBTRACT:
+    case OP_SUBTRACT_NN:
+    case OP_MULTIPLY:
+    case OP_MULTIPLY_NN:
+    case OP_DIVIDE:
+    case OP_DIVIDE_NN:
+    case OP_MOD:
+      result = PEEP_NUMBER;
+      break;
+
+    case OP_RANGE:
+      result = PEEP_RANGE;
+      break;
+
+    default:
+      break;
+  }
+
+  if (d < pops) return false;
+  d -= pops;
+  if (push) {
+    if (d >= width) return false;
+    types[d++] = result;
+  }
+
+  *depth = d;
+  return true;
+}
+
+// Merge the [types] of the stack of [depth] values reaching the instruction
+// at [index], a value is a number only if it's a number on all the paths. If
+// anything changed the instruction will be visited again. Returns false if
+// the stack depths of the paths doesn't match.
+static bool peepMergeTypes(PeepTypes* pt, int index, const uint8_t* types,
+                           int depth) {
+  uint8_t* at = &pt->types[index * pt->width];
+  bool changed = false;
+
+  if (pt->depths[index] == -1) {
+    pt->depths[index] = depth;
+    memcpy(at, types, depth);
+    changed = true;
+
+  } else {
+    if (pt->depths[index] != depth) return false;
+    for (int i = 0; i < depth; i++) {
+      if (at[i] != types[i] && at[i] != PEEP_ANY) {
+        at[i] = PEEP_ANY;
+        changed = true;
+      }
+    }
+  }
+
+  if (changed && !pt->pending[index]) {
+    pt->pending[index] = true;
+    pt->worklist[pt->worklist_count++] = index;
+  }
+  return true;
+}
+
+// Infer the types of the stack values at each of the decoded [instrs] of the
+// function [fn] and rewrite the binary operators of two numbers to the
+// number only instructions (ie. OP_ADD to OP_ADD_NN). The locals are the
+// values at the bottom of the stack, so a local is a number where all the
+// values stored to it on the way are numbers. The [arity] parameters could
+// be any value, and the numbers come from the numeric literals, arithmetic
+// and iterating over a range. If the types couldn't be inferred nothing will
+// be changed.
+static void peepSpecialize(Compiler* compiler, Fn* fn, int arity,
+                           PeepInstr* instrs, int count) {
+  PKVM* vm = compiler->vm;
+  if (arity < 0 || arity > fn->stack_size) return;
+
+  PeepTypes pt;
+  pt.width = fn->stack_size;
+  pt.depths = ALLOCATE_ARRAY(vm, int, count);
+  pt.types = ALLOCATE_ARRAY(vm, uint8_t, count * pt.width + 1);
+  pt.worklist = ALLOCATE_ARRAY(vm, int, count);
+  pt.worklist_count = 0;
+  pt.pending = ALLOCATE_ARRAY(vm, bool, count);
+  uint8_t* types = ALLOCATE_ARRAY(vm, uint8_t, pt.width + 1);
+
+  for (int i = 0; i < count; i++) {
+    pt.depths[i] = -1;
+    pt.pending[i] = false;
+  }
+  for (int i = 0; i < arity; i++) types[i] = PEEP_ANY;
+
+  bool inferred = peepMergeTypes(&pt, peepNext(instrs, 0), types, arity);
+  while (inferred && pt.worklist_count > 0) {
+    int index = pt.worklist[--pt.worklist_count];
+    pt.pending[index] = false;
+
+    PeepInstr* instr = &instrs[index];
+    int depth = pt.depths[index];
+    memcpy(types, &pt.types[index * pt.width], depth);
+
+    if (!peepApplyTypes(compiler, instr, types, &depth, pt.width)) {
+      inferred = false;
+      break;
+    }
+
+    Opcode op = instr->op;
+    if (op == OP_RETURN || op == OP_END) continue;
+
+    // The switch jumps with any of the entries of it's table.
+    if (peepIsSwitch(op)) {
+      for (int j = index + 1; inferred && instrs[j].entry; j++) {
+        inferred = peepMergeTypes(&pt, j, types, depth);
+      }
+      continue;
+    }
+
+    if (instr->target != -1) {
+      int target = peepNext(instrs, instr->target);
+
+      // The stack isn't changed if the iteration is over.
+      if (op == OP_ITER) {
+        inferred = peepMergeTypes(&pt, target,
+                                  &pt.types[index * pt.width],
+                                  pt.depths[index]);
+      } else {
+        inferred = peepMergeTypes(&pt, target, types, depth);
+      }
+      if (op == OP_JUMP || op == OP_LOOP) continue;
+    }
+
+    if (inferred) {
+      int next = peepNext(instrs, index + 1);
+      inferred = peepMergeTypes(&pt, next, types, depth);
+    }
+  }
+
+  for (int i = 0; inferred && i < count; i++) {
+    PeepInstr* instr = &instrs[i];
+    int depth = pt.depths[i];
+    if (instr->removed || depth < 2) continue;
+
+    const uint8_t* at = &pt.types[i * pt.width];
+    if (at[depth - 1] != PEEP_NUMBER || at[depth - 2] != PEEP_NUMBER) {
+      continue;
+    }
+
+    if (OP_ADD <= instr->op && instr->op <= OP_DIVIDE) {
+      instr->op = (Opcode)(OP_ADD_NN + (instr->op - OP_ADD));
+    } else if (OP_LT <= instr->op && instr->op <= OP_GTEQ) {
+      instr->op = (Opcode)(OP_LT_NN + (instr->op - OP_LT));
+    }
+  }
+
+  vmRealloc(vm, pt.depths, sizeof(int) * count, 0);
+  vmRealloc(vm, pt.types, sizeof(uint8_t) * (count * pt.width + 1), 0);
+  vmRealloc(vm, pt.worklist, sizeof(int) * count, 0);
+  vmRealloc(vm, pt.pending, sizeof(bool) * count, 0);
+  vmRealloc(vm, types, sizeof(uint8_t) * (pt.width + 1), 0);
+}
+
+// Re-write the instructions of the compiled function [func] with the OP_WIDE
+// prefix for the [wide_params] of it, and inline the calls, run the peephole
+// optimizer and specialize the number operators if [optimize] is true.
+static void finalizeFunction(Compiler* compiler, Function* func,
+                             bool optimize) {
+  PKVM* vm = compiler->vm;
+  Fn* fn = func->fn;
+
+  bool has_wide = false;
+  for (int i = 0; i < compiler->wide_count; i++) {
+    if (compiler->wide_params[i].func == fn) has_wide = true;
+  }
+  if (!optimize && !has_wide) return;
+  if (fn->opcodes.count == 0) return;
+
+  // The function is finalized once so it doesn't have any inlined calls
+  // yet, otherwise they should be decoded as well.
+  ASSERT(fn->inlined.count == 0, OOPS);
+
+  int count, *indexes;
+  uint32_t code_count = fn->opcodes.count;
+  PeepInstr* instrs = peepDecode(compiler, fn, &count, &indexes);
+
+  PeepInlined* calls = NULL;
+  int calls_count = 0;
+
+  if (optimize) {
+    instrs = peepInline(compiler, fn, instrs, &count, indexes, &calls,
+                        &calls_count);
+    peepOptimize(instrs, count);
+    peepSpecialize(compiler, fn, func->arity, instrs, count);
+  }
+  vmRealloc(vm, indexes, sizeof(int) * code_count, 0);
+
+  // Calculate the new offsets of the instructions, a removed instruction
+  // would have the offset of the next instruction. If any jump doesn't fit
+  // it'll be prefixed with OP_WIDE which will change the offsets, so it's
+  // repeated till all the jumps fit.
+  for (int i = 0; i < count; i++) {
+    PeepInstr* instr = &instrs[i];
+    int params = opcode_info[instr->op].params;
+    instr->wide = !peepIsJump(instr->op) && params > 0 &&
+                  instr->arg >= (1u << (8 * params));
+  }
+
+  int* offsets = ALLOCATE_ARRAY(vm, int, count);
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+
+    uint32_t new_count = 0;
+    for (int i = 0; i < count; i++) {
+      offsets[i] = (int)new_count;
+      if (!instrs[i].removed) new_count += peepSize(&instrs[i]);
+    }
+
+    for (int i = 0; i < count; i++) {
+      PeepInstr* instr = &instrs[i];
+      if (instr->removed || instr->wide || instr->target == -1) continue;
+
+      uint32_t next = offsets[i] + peepSize(instr);
+      uint32_t dest = offsets[peepNext(instrs, instr->target)];
+      uint32_t jump = (instr->op == OP_LOOP) ? next - dest : dest - next;
+      if (jump >= MAX_JUMP) {
+        instr->wide = true;
+        changed = true;
+      }
+    }
+
+    // The entries of a jump table should be the same size, if any of them
+    // is wide all of them will be.
+    for (int i = 0; i < count; i++) {
+      if (!peepIsSwitch(instrs[i].op)) continue;
+
+      bool wide = false;
+      for (int j = i + 1; instrs[j].entry; j++) wide |= instrs[j].wide;
+      for (int j = i + 1; wide && instrs[j].entry; j++) {
+        if (!instrs[j].wide) changed = true;
+        instrs[j].wide = true;
+      }
+    }
+  }
+
+  // Write the instructions back.
+  pkByteBuffer opcodes;
+  pkUintBuffer lines;
+  pkByteBufferInit(&opcodes);
+  pkUintBufferInit(&lines);
+
+  for (int i = 0; i < count; i++) {
+    PeepInstr* instr = &instrs[i];
+    if (instr->removed) continue;
+
+    uint32_t arg = instr->arg;
+    if (instr->target != -1) {
+      uint32_t next = offsets[i] + peepSize(instr);
+      uint32_t dest = offsets[peepNext(instrs, instr->target)];
+      arg = (instr->op == OP_LOOP) ? next - dest : dest - next;
+    }
+
+    if (instr->wide) pkByteBufferWrite(&opcodes, vm, OP_WIDE);
+    pkByteBufferWrite(&opcodes, vm, (uint8_t)instr->op);
+    int size = opcode_info[instr->op].params * (instr->wide ? 2 : 1);
+    for (int j = size - 1; j >= 0; j--) {
+      pkByteBufferWrite(&opcodes, vm, (uint8_t)((arg >> (8 * j)) & 0xff));
+    }
+    pkUintBufferFill(&lines, vm, instr->line, (int)peepSize(instr));
+  }
+
+  pkByteBufferClear(&fn->opcodes, vm);
+  fn->opcodes = opcodes;
+  fnSetLines(vm, fn, lines.data, lines.count);
+  pkUintBufferClear(&lines, vm);
+
+  // The opcodes of an inlined call are from the first to the last
+  // instruction of it (or the calls inlined in it), the calls which don't
+  // have any instructions left are dropped.
+  if (calls_count > 0) {
+    uint32_t* starts = ALLOCATE_ARRAY(vm, uint32_t, calls_count);
+    uint32_t* ends = ALLOCATE_ARRAY(vm, uint32_t, calls_count);
+    for (int i = 0; i < calls_count; i++) {
+      starts[i] = UINT32_MAX;
+      ends[i] = 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+      PeepInstr* instr = &instrs[i];
+      if (instr->removed) continue;
+
+      uint32_t end = offsets[i] + peepSize(instr);
+      for (int j = instr->inlined; j != -1; j = calls[j].parent) {
+        if (starts[j] > (uint32_t)offsets[i]) starts[j] = offsets[i];
+        if (ends[j] < end) ends[j] = end;
+      }
+    }
+
+    for (int i = 0; i < calls_count; i++) {
+      if (starts[i] >= ends[i]) continue;
+      pkUintBufferWrite(&fn->inlined, vm, starts[i]);
+      pkUintBufferWrite(&fn->inlined, vm, ends[i]);
+      pkUintBufferWrite(&fn->inlined, vm, calls[i].fn_index);
+      pkUintBufferWrite(&fn->inlined, vm, calls[i].line);
+    }
+
+    vmRealloc(vm, starts, sizeof(uint32_t) * calls_count, 0);
+    vmRealloc(vm, ends, sizeof(uint32_t) * calls_count, 0);
+    vmRealloc(vm, calls, sizeof(PeepInlined) * calls_count, 0);
+  }
+
+  // The wide parameters are written, the function could be decoded again
+  // to be inlined in another function.
+  int wide_count = 0;
+  for (int i = 0; i < compiler->wide_count; i++) {
+    if (compiler->wide_params[i].func == fn) continue;
+    compiler->wide_params[wide_count++] = compiler->wide_params[i];
+  }
+  compiler->wide_count = wide_count;
+
+  vmRealloc(vm, instrs, sizeof(PeepInstr) * count, 0);
+  vmRealloc(vm, offsets, sizeof(int) * count, 0);
+}
+
+// Number the attribute access instructions of the [func] with the index of
+// their inline cache and allocate the caches (see AttribCache). It's done
+// once the function is finalized, so the instructions of the inlined
+// functions get their own caches.
+static void initAttribCaches(Compiler* compiler, Function* func) {
+  Fn* fn = func->fn;
+  uint8_t* code = fn->opcodes.data;
+
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < fn->opcodes.count; i++) {
+    bool wide = (code[i] == OP_WIDE);
+    if (wide) i++;
+
+    Opcode op = (Opcode)code[i];
+    if (op == OP_GET_ATTRIB || op == OP_GET_ATTRIB_KEEP ||
+        op == OP_SET_ATTRIB) {
+      ASSERT(!wide, OOPS);
+      uint32_t index = (count < MAX_ATTRIB_CACHES) ? count++
+                                                  : MAX_ATTRIB_CACHES - 1;
+      code[i + 3] = (uint8_t)index; //< +3: After the name index.
+    }
+    i += opcode_info[op].params * (wide ? 2 : 1);
+  }
+
+  fnInitAttribCaches(compiler->vm, fn, count);
+}
+
+// Compile the [source] string or if the [stream] isn't NULL the source read
+// from it, see compile() and compileStream().
+static PkResult compileScript(PKVM* vm, Script* script, const char* source,
+                              void* stream, const PkCompileOptions* options) {
 
   Compiler _compiler;
   Compiler* compiler = &_compiler; //< Compiler pointer for quick access.
   compilerInit(compiler, vm, source, script, options);
+  compiler->stream = stream;
+
+  // Skip utf8 BOM if there is any. The chars are matched one at a time since
+  // the BOM could be split between the chunks of a stream, which starts from
+  // the token start so the lexer could go back to it if it's not a BOM.
+  if (!(matchChar(compiler, '\xEF') && matchChar(compiler, '\xBB') &&
+        matchChar(compiler, '\xBF'))) {
+    compiler->current_char = compiler->token_start;
+  }
 
   // If compiling for an imported script the vm->compiler would be the compiler
   // of the script that imported this script. Add the all the compilers into a
@@ -2790,6 +5245,8 @@ PkResult compile(PKVM* vm, Script* script, const char* source,
   // REPL or evaluating an expression) we don't need the old main anymore.
   // just use the globals and functions of the script and use a new body func.
   pkByteBufferClear(&script->body->fn->opcodes, vm);
+  pkByteBufferClear(&script->body->fn->line_table, vm);
+  pkUintBufferClear(&script->body->fn->inlined, vm);
 
   // Remember the count of the globals, functions and types, If the compilation
   // failed discard all the globals and functions added by the compilation.
@@ -2801,6 +5258,8 @@ PkResult compile(PKVM* vm, Script* script, const char* source,
   curr_fn.depth = DEPTH_SCRIPT;
   curr_fn.ptr = script->body;
   curr_fn.outer_func = NULL;
+  curr_fn.outer_stack_size = 0;
+  pkUintBufferInit(&curr_fn.lines);
   compiler->func = &curr_fn;
 
   // Lex initial tokens. current <-- next.
@@ -2828,6 +5287,7 @@ PkResult compile(PKVM* vm, Script* script, const char* source,
   while (!match(compiler, TK_EOF)) {
     compileTopLevelStatement(compiler);
     skipNewLines(compiler);
+    lexFreeBlocks(compiler, false);
   }
 
   emitFunctionEnd(compiler);
@@ -2837,9 +5297,11 @@ PkResult compile(PKVM* vm, Script* script, const char* source,
     ForwardName* forward = &compiler->forwards[i];
     const char* name = forward->name;
     int length = forward->length;
-    int index = scriptGetFunc(script, name, (uint32_t)length);
+    int index = scriptGetFunc(vm, script, name, (uint32_t)length);
     if (index != -1) {
-      patchForward(compiler, forward->func, forward->instruction, index);
+      if (forward->instruction != -1) {
+        patchForward(compiler, forward->func, forward->instruction, index);
+      }
     } else {
       // need_more_lines is only true for unexpected EOF errors. For syntax
       // errors it'll be false by now but. Here it's a semantic errors, so
@@ -2852,11 +5314,44 @@ PkResult compile(PKVM* vm, Script* script, const char* source,
 
   vm->compiler = compiler->next_compiler;
 
+  // Write the wide parameters of the newly compiled functions and optimize
+  // them. The optimization is disabled at debug mode same as the tail call
+  // optimization.
+  if (!compiler->has_errors) {
+    bool optimize = compiler->options && !compiler->options->debug;
+    for (uint32_t i = functions_count; i < script->functions.count; i++) {
+      Function* func = script->functions.data[i];
+      if (func->is_native) continue;
+      finalizeFunction(compiler, func, optimize);
+      initAttribCaches(compiler, func);
+    }
+    finalizeFunction(compiler, script->body, optimize);
+    initAttribCaches(compiler, script->body);
+  }
+
+  vmRealloc(vm, compiler->locals,
+            sizeof(Local) * compiler->local_capacity, 0);
+  vmRealloc(vm, compiler->forwards,
+            sizeof(ForwardName) * compiler->forwards_capacity, 0);
+  vmRealloc(vm, compiler->wide_params,
+            sizeof(WideParam) * compiler->wide_capacity, 0);
+  vmRealloc(vm, compiler->calls,
+            sizeof(InlineCall) * compiler->calls_capacity, 0);
+  vmRealloc(vm, compiler->modules,
+            sizeof(ModuleBinding) * compiler->modules_capacity, 0);
+  lexFreeBlocks(compiler, true);
+
   // If compilation failed, discard all the invalid functions and globals.
   if (compiler->has_errors) {
     script->globals.count = script->global_names.count = globals_count;
     script->functions.count = functions_count;
     script->classes.count = types_count;
+    while (script->constants.count > 0 &&
+           script->constants.data[script->constants.count - 1] >=
+             globals_count) {
+      script->constants.count--;
+    }
+    scriptDiscardIndexes(script);
   }
 
 #if DEBUG_DUMP_COMPILED_CODE
@@ -2878,6 +5373,16 @@ PkResult compile(PKVM* vm, Script* script, const char* source,
   return PK_RESULT_SUCCESS;
 }
 
+PkResult compile(PKVM* vm, Script* script, const char* source,
+                 const PkCompileOptions* options) {
+  return compileScript(vm, script, source, NULL, options);
+}
+
+PkResult compileStream(PKVM* vm, Script* script, void* stream,
+                       const PkCompileOptions* options) {
+  return compileScript(vm, script, "", stream, options);
+}
+
 PkResult pkCompileModule(PKVM* vm, PkHandle* module, PkStringPtr source,
                          const PkCompileOptions* options) {
   __ASSERT(module != NULL, "Argument module was NULL.");
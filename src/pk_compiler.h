@@ -27,6 +27,12 @@ typedef struct Compiler Compiler;
 PkResult compile(PKVM* vm, Script* script, const char* source,
                  const PkCompileOptions* options);
 
+// Same as compile() but the source is read in chunks from the [stream] with
+// the vm's read_chunk_fn. The lexer only keeps the chunks from the start of
+// the current top level statement (and the tokens it's looking ahead).
+PkResult compileStream(PKVM* vm, Script* script, void* stream,
+                       const PkCompileOptions* options);
+
 // Mark the heap allocated objects of the compiler at the garbage collection
 // called at the marking phase of vmCollectGarbage().
 void compilerMarkObjects(PKVM* vm, Compiler* compiler);
@@ -44,6 +44,10 @@ static Script* newModuleInternal(PKVM* vm, const char* name);
 static void moduleAddGlobalInternal(PKVM* vm, Script* script,
                                     const char* name, Var value);
 
+// The internal function to add a constant to a module.
+static void moduleAddConstantInternal(PKVM* vm, Script* script,
+                                      const char* name, Var value);
+
 // The internal function to add functions to a module.
 static void moduleAddFunctionInternal(PKVM* vm, Script* script,
                                       const char* name, pkNativeFn fptr,
@@ -66,6 +70,22 @@ PK_PUBLIC void pkModuleAddGlobal(PKVM* vm, PkHandle* module,
   moduleAddGlobalInternal(vm, (Script*)AS_OBJ(scr), name, value->value);
 }
 
+// pkModuleAddConstant implementation (see atomlang.h for description).
+PK_PUBLIC void pkModuleAddConstant(PKVM* vm, PkHandle* module,
+                                   const char* name, PkHandle* value) {
+  __ASSERT(module != NULL, "Argument module was NULL.");
+  __ASSERT(value != NULL, "Argument value was NULL.");
+  Var scr = module->value;
+  __ASSERT(IS_OBJ_TYPE(scr, OBJ_SCRIPT), "Given handle is not a module");
+
+  Var val = value->value;
+  __ASSERT(IS_NULL(val) || IS_BOOL(val) || IS_NUM(val) ||
+           IS_OBJ_TYPE(val, OBJ_STRING),
+           "A constant should be a null, boolean, number or a string.");
+
+  moduleAddConstantInternal(vm, (Script*)AS_OBJ(scr), name, val);
+}
+
 // pkModuleAddFunction implementation (see atomlang.h for description).
 void pkModuleAddFunction(PKVM* vm, PkHandle* module, const char* name,
                          pkNativeFn fptr, int arity) {
@@ -301,6 +321,17 @@ void pkReturnInstNative(PKVM* vm, void* data, uint32_t id) {
   RET(VAR_OBJ(newInstanceNative(vm, data, id)));
 }
 
+void* pkTypedArrayGetData(const PkVar value, PkArrayType* type,
+                          uint32_t* count) {
+  const Var arr = (*(const Var*)value);
+  __ASSERT(IS_OBJ_TYPE(arr, OBJ_TYPED_ARRAY),
+           "Value should be of type typed array.");
+  TypedArray* array = (TypedArray*)AS_OBJ(arr);
+  if (type != NULL) *type = array->type;
+  if (count != NULL) *count = array->count;
+  return array->data;
+}
+
 const char* pkStringGetData(const PkVar value) {
   const Var str = (*(const Var*)value);
   __ASSERT(IS_OBJ_TYPE(str, OBJ_STRING), "Value should be of type string.");
@@ -345,6 +376,11 @@ static inline bool isNumeric(Var var, double* value) {
 
 // Check if [var] is a numeric value (bool/number) and set [value].
 static inline bool isInteger(Var var, int64_t* value) {
+  if (IS_INT(var)) {
+    *value = AS_INT(var);
+    return true;
+  }
+
   double number;
   if (isNumeric(var, &number)) {
     // TODO: check if the number is larger for a 64 bit integer.
@@ -395,13 +431,16 @@ static inline bool validateIndex(PKVM* vm, int64_t index, uint32_t size,
       char buff[12]; sprintf(buff, "%d", arg);                               \
       VM_SET_ERROR(vm, stringFormat(vm, "Expected a " m_name                 \
                    " at argument $.", buff, false));                         \
+      return false;                                                          \
     }                                                                        \
     *value = (m_class*)AS_OBJ(var);                                          \
     return true;                                                             \
    }
  VALIDATE_ARG_OBJ(String, OBJ_STRING, "string")
  VALIDATE_ARG_OBJ(List, OBJ_LIST, "list")
+ VALIDATE_ARG_OBJ(Deque, OBJ_DEQUE, "deque")
  VALIDATE_ARG_OBJ(Map, OBJ_MAP, "map")
+ VALIDATE_ARG_OBJ(Set, OBJ_SET, "set")
  VALIDATE_ARG_OBJ(Function, OBJ_FUNC, "function")
  VALIDATE_ARG_OBJ(Fiber, OBJ_FIBER, "fiber")
 
@@ -667,16 +706,21 @@ DEF(coreStrSub,
   if (!validateInteger(vm, ARG(2), &pos, "Argument 2")) return;
   if (!validateInteger(vm, ARG(3), &len, "Argument 3")) return;
 
-  if (pos < 0 || str->length < pos)
+  // The position and the length are in codepoints, not bytes.
+  uint32_t count = stringCodepointCount(vm, str);
+
+  if (pos < 0 || count < pos)
     RET_ERR(newString(vm, "Index out of range."));
 
-  if (str->length < pos + len)
+  if (len < 0 || count < pos + len)
     RET_ERR(newString(vm, "Substring length exceeded the limit."));
 
   // Edge case, empty string.
   if (len == 0) RET(VAR_OBJ(newStringLength(vm, "", 0)));
 
-  RET(VAR_OBJ(newStringLength(vm, str->data + pos, (uint32_t)len)));
+  uint32_t start = stringCodepointOffset(vm, str, (uint32_t)pos);
+  uint32_t end = stringCodepointOffset(vm, str, (uint32_t)(pos + len));
+  RET(VAR_OBJ(newStringLength(vm, str->data + start, end - start)));
 }
 
 DEF(coreStrChr,
@@ -723,6 +767,54 @@ DEF(coreListAppend,
   RET(VAR_OBJ(list));
 }
 
+// Deque functions.
+// ----------------
+
+DEF(coreDequePush,
+  "deque_push(self:Deque, value:var) -> Deque\n"
+  "Add the [value] to the end of the deque [self] and return the deque.") {
+
+  Deque* deque;
+  if (!validateArgDeque(vm, 1, &deque)) return;
+  dequePushBack(vm, deque, ARG(2));
+  RET(VAR_OBJ(deque));
+}
+
+DEF(coreDequePushFront,
+  "deque_push_front(self:Deque, value:var) -> Deque\n"
+  "Add the [value] to the beginning of the deque [self] and return the "
+  "deque.") {
+
+  Deque* deque;
+  if (!validateArgDeque(vm, 1, &deque)) return;
+  dequePushFront(vm, deque, ARG(2));
+  RET(VAR_OBJ(deque));
+}
+
+DEF(coreDequePop,
+  "deque_pop(self:Deque) -> var\n"
+  "Remove and return the last element of the deque [self].") {
+
+  Deque* deque;
+  if (!validateArgDeque(vm, 1, &deque)) return;
+  if (deque->count == 0) {
+    RET_ERR(newString(vm, "Cannot pop from an empty deque."));
+  }
+  RET(dequePopBack(deque));
+}
+
+DEF(coreDequePopFront,
+  "deque_pop_front(self:Deque) -> var\n"
+  "Remove and return the first element of the deque [self].") {
+
+  Deque* deque;
+  if (!validateArgDeque(vm, 1, &deque)) return;
+  if (deque->count == 0) {
+    RET_ERR(newString(vm, "Cannot pop from an empty deque."));
+  }
+  RET(dequePopFront(deque));
+}
+
 // Map functions.
 // --------------
 
@@ -738,6 +830,134 @@ DEF(coreMapRemove,
   RET(mapRemoveKey(vm, map, key));
 }
 
+// Set functions.
+// --------------
+
+// Add the [key] to the [set] if it's hashable, otherwise set an error and
+// return false.
+static bool _setAddKey(PKVM* vm, Set* set, Var key) {
+  if (IS_OBJ(key) && !isObjectHashable(AS_OBJ(key)->type)) {
+    VM_SET_ERROR(vm, stringFormat(vm, "$ type is not hashable.",
+                                  varTypeName(key)));
+    return false;
+  }
+  setAdd(vm, set, key);
+  return true;
+}
+
+DEF(coreSetAdd,
+  "set_add(self:Set, value:var) -> Set\n"
+  "Add the [value] to the set [self] and return the set.") {
+
+  Set* set;
+  if (!validateArgSet(vm, 1, &set)) return;
+  if (!_setAddKey(vm, set, ARG(2))) return;
+  RET(VAR_OBJ(set));
+}
+
+DEF(coreSetRemove,
+  "set_remove(self:Set, value:var) -> bool\n"
+  "Remove the [value] from the set [self] and return true if it was exists "
+  "in the set.") {
+
+  Set* set;
+  if (!validateArgSet(vm, 1, &set)) return;
+
+  Var key = ARG(2);
+  if (IS_OBJ(key) && !isObjectHashable(AS_OBJ(key)->type)) {
+    VM_SET_ERROR(vm, stringFormat(vm, "$ type is not hashable.",
+                                  varTypeName(key)));
+    return;
+  }
+  RET(VAR_BOOL(setRemove(vm, set, key)));
+}
+
+DEF(coreSetUnion,
+  "set_union(s1:Set, s2:Set) -> Set\n"
+  "Returns a new set with the values of both [s1] and [s2].") {
+
+  Set *s1, *s2;
+  if (!validateArgSet(vm, 1, &s1)) return;
+  if (!validateArgSet(vm, 2, &s2)) return;
+  RET(VAR_OBJ(setUnion(vm, s1, s2)));
+}
+
+DEF(coreSetIntersect,
+  "set_intersect(s1:Set, s2:Set) -> Set\n"
+  "Returns a new set with the values which are in both [s1] and [s2].") {
+
+  Set *s1, *s2;
+  if (!validateArgSet(vm, 1, &s1)) return;
+  if (!validateArgSet(vm, 2, &s2)) return;
+  RET(VAR_OBJ(setIntersection(vm, s1, s2)));
+}
+
+DEF(coreSetDifference,
+  "set_difference(s1:Set, s2:Set) -> Set\n"
+  "Returns a new set with the values of [s1] which are not in [s2].") {
+
+  Set *s1, *s2;
+  if (!validateArgSet(vm, 1, &s1)) return;
+  if (!validateArgSet(vm, 2, &s2)) return;
+  RET(VAR_OBJ(setDifference(vm, s1, s2)));
+}
+
+// Typed array functions.
+// ----------------------
+
+// Create a new typed array of [type] from the first argument which could be
+// the number of elements (initialized to zero), a list or an other typed
+// array to convert from.
+static void _newTypedArrayFrom(PKVM* vm, PkArrayType type) {
+  Var init = ARG(1);
+
+  if (IS_NUM(init)) {
+    int64_t count;
+    if (!validateInteger(vm, init, &count, "Argument 1")) return;
+    if (count < 0 || count > UINT32_MAX) {
+      RET_ERR(newString(vm, "Invalid typed array size."));
+    }
+    RET(VAR_OBJ(newTypedArray(vm, type, (uint32_t)count)));
+  }
+
+  if (IS_OBJ_TYPE(init, OBJ_LIST)) {
+    pkVarBuffer* elems = &((List*)AS_OBJ(init))->elements;
+    TypedArray* array = newTypedArray(vm, type, elems->count);
+    for (uint32_t i = 0; i < elems->count; i++) {
+      if (!typedArraySet(vm, array, i, elems->data[i])) return;
+    }
+    RET(VAR_OBJ(array));
+  }
+
+  if (IS_OBJ_TYPE(init, OBJ_RANGE)) {
+    Range* range = (Range*)AS_OBJ(init);
+    double length = rangeLength(range);
+    if (length > UINT32_MAX) {
+      RET_ERR(newString(vm, "Invalid typed array size."));
+    }
+    TypedArray* array = newTypedArray(vm, type, (uint32_t)length);
+    for (uint32_t i = 0; i < array->count; i++) {
+      if (!typedArraySet(vm, array, i, VAR_NUM(rangeGet(range, i)))) return;
+    }
+    RET(VAR_OBJ(array));
+  }
+
+  if (IS_OBJ_TYPE(init, OBJ_TYPED_ARRAY)) {
+    TypedArray* src = (TypedArray*)AS_OBJ(init);
+    if (src->type == type) {
+      RET(VAR_OBJ(typedArraySlice(vm, src, 0, src->count)));
+    }
+    TypedArray* array = newTypedArray(vm, type, src->count);
+    for (uint32_t i = 0; i < src->count; i++) {
+      if (!typedArraySet(vm, array, i, typedArrayGet(src, i))) return;
+    }
+    RET(VAR_OBJ(array));
+  }
+
+  RET_ERR(stringFormat(vm, "Cannot create a $ from $.",
+                       getArrayTypeName(type), varTypeName(init)));
+}
+
 /*****************************************************************************/
 /* CORE MODULE METHODS                                                       */
 /*****************************************************************************/
@@ -773,13 +993,13 @@ static Script* newModuleInternal(PKVM* vm, const char* name) {
 static inline void assertModuleNameDef(PKVM* vm, Script* script,
                                        const char* name) {
   // Check if function with the same name already exists.
-  if (scriptGetFunc(script, name, (uint32_t)strlen(name)) != -1) {
+  if (scriptGetFunc(vm, script, name, (uint32_t)strlen(name)) != -1) {
     __ASSERT(false, stringFormat(vm, "A function named '$' already esists "
       "on module '@'", name, script->module)->data);
   }
 
   // Check if a global variable with the same name already exists.
-  if (scriptGetGlobals(script, name, (uint32_t)strlen(name)) != -1) {
+  if (scriptGetGlobals(vm, script, name, (uint32_t)strlen(name)) != -1) {
     __ASSERT(false, stringFormat(vm, "A global variable named '$' already "
       "esists on module '@'", name, script->module)->data);
   }
@@ -796,6 +1016,18 @@ static void moduleAddGlobalInternal(PKVM* vm, Script* script,
   scriptAddGlobal(vm, script, name, (uint32_t)strlen(name), value);
 }
 
+// An internal function to add a constant to the given [script].
+static void moduleAddConstantInternal(PKVM* vm, Script* script,
+                                      const char* name, Var value) {
+
+  // Ensure the name isn't defined already.
+  assertModuleNameDef(vm, script, name);
+
+  uint32_t index = scriptAddGlobal(vm, script, name, (uint32_t)strlen(name),
+                                   value);
+  scriptAddConstant(vm, script, index, value);
+}
+
 // An internal function to add a function to the given [script].
 static void moduleAddFunctionInternal(PKVM* vm, Script* script,
                                       const char* name, pkNativeFn fptr,
@@ -947,7 +1179,7 @@ DEF(stdMathHash,
       RET(VAR_NULL);
     }
   }
-  RET(VAR_NUM((double)varHashValue(ARG(1))));
+  RET(VAR_NUM((double)varHashValue(vm, ARG(1))));
 }
 
 DEF(stdMathSine,
@@ -1065,6 +1297,174 @@ DEF(stdMathRound,
   RET(VAR_NUM(round(num)));
 }
 
+// Native functions of the intrinsics, indexed by the Intrinsic enum.
+static const pkNativeFn intrinsic_fns[] = {
+  stdMathFloor,
+  stdMathCeil,
+  stdMathSqrt,
+  stdMathAbs,
+  stdMathSine,
+  stdMathCosine,
+  stdMathRound,
+  stdMathPow,
+};
+
+// getIntrinsic implementation (see core.h for description).
+int getIntrinsic(const Function* fn) {
+  if (!fn->is_native) return -1;
+  for (int i = 0; i < INTRINSIC_COUNT; i++) {
+    if (fn->native == intrinsic_fns[i]) return i;
+  }
+  return -1;
+}
+
+// getIntrinsicFn implementation (see core.h for description).
+pkNativeFn getIntrinsicFn(Intrinsic intrinsic) {
+  ASSERT_INDEX((uint32_t)intrinsic, INTRINSIC_COUNT);
+  return intrinsic_fns[intrinsic];
+}
+
+// 'collections' library methods.
+// ------------------------------
+
+DEF(stdCollectionsDeque,
+  "deque([values:List|Range]) -> Deque\n"
+  "Returns a new deque. If [values] is given the elements of the list or the "
+  "range are added to the new deque.") {
+
+  int argc = ARGC;
+  if (argc > 1) { // deque() or deque(values).
+    RET_ERR(newString(vm, "Invalid argument count."));
+  }
+
+  Deque* deque = newDeque(vm);
+  if (argc == 0) RET(VAR_OBJ(deque));
+
+  Var values = ARG(1);
+  vmPushTempRef(vm, &deque->_super); // deque.
+
+  if (IS_OBJ_TYPE(values, OBJ_LIST)) {
+    List* list = (List*)AS_OBJ(values);
+    for (uint32_t i = 0; i < list->elements.count; i++) {
+      dequePushBack(vm, deque, list->elements.data[i]);
+    }
+
+  } else if (IS_OBJ_TYPE(values, OBJ_RANGE)) {
+    Range* range = (Range*)AS_OBJ(values);
+    double length = rangeLength(range);
+    for (double i = 0; i < length; i++) {
+      dequePushBack(vm, deque, VAR_NUM(rangeGet(range, i)));
+    }
+
+  } else {
+    VM_SET_ERROR(vm, stringFormat(vm, "Cannot create a Deque from $.",
+                                  varTypeName(values)));
+  }
+
+  vmPopTempRef(vm); // deque.
+
+  RET(VAR_OBJ(deque));
+}
+
+DEF(stdCollectionsRange,
+  "range(from:num, to:num, [step:num]) -> Range\n"
+  "Returns a range from [from] (inclusive) to [to] (exclusive) increased by "
+  "[step]. The default step is 1 if from <= to otherwise -1.") {
+
+  int argc = ARGC;
+  if (argc != 2 && argc != 3) {
+    RET_ERR(newString(vm, "Invalid argument count."));
+  }
+
+  double from, to, step;
+  if (!validateNumeric(vm, ARG(1), &from, "Argument 1")) return;
+  if (!validateNumeric(vm, ARG(2), &to, "Argument 2")) return;
+
+  if (argc == 3) {
+    if (!validateNumeric(vm, ARG(3), &step, "Argument 3")) return;
+    if (step == 0) RET_ERR(newString(vm, "Range step cannot be zero."));
+  } else {
+    step = rangeDefaultStep(from, to);
+  }
+
+  RET(VAR_OBJ(newRange(vm, from, to, step)));
+}
+
+DEF(stdCollectionsSet,
+  "set([values:List|Map|Set|Range]) -> Set\n"
+  "Returns a new set. If [values] is given the elements of the list or the "
+  "range, the keys of the map or the keys of the set are added to the new "
+  "set.") {
+
+  int argc = ARGC;
+  if (argc > 1) { // set() or set(values).
+    RET_ERR(newString(vm, "Invalid argument count."));
+  }
+
+  Set* set = newSet(vm);
+  if (argc == 0) RET(VAR_OBJ(set));
+
+  Var values = ARG(1);
+  vmPushTempRef(vm, &set->_super); // set.
+
+  if (IS_OBJ_TYPE(values, OBJ_LIST)) {
+    pkVarBuffer* elems = &((List*)AS_OBJ(values))->elements;
+    for (uint32_t i = 0; i < elems->count; i++) {
+      if (!_setAddKey(vm, set, elems->data[i])) break;
+    }
+
+  } else if (IS_OBJ_TYPE(values, OBJ_MAP)) {
+    Map* map = (Map*)AS_OBJ(values);
+    uint32_t iter = 0;
+    Var key;
+    while (mapIterate(map, &iter, &key, NULL)) setAdd(vm, set, key);
+
+  } else if (IS_OBJ_TYPE(values, OBJ_SET)) {
+    Set* other = (Set*)AS_OBJ(values);
+    uint32_t iter = 0;
+    Var key;
+    while (setIterate(other, &iter, &key)) setAdd(vm, set, key);
+
+  } else if (IS_OBJ_TYPE(values, OBJ_RANGE)) {
+    Range* range = (Range*)AS_OBJ(values);
+    double length = rangeLength(range);
+    for (double i = 0; i < length; i++) {
+      setAdd(vm, set, VAR_NUM(rangeGet(range, i)));
+    }
+
+  } else {
+    VM_SET_ERROR(vm, stringFormat(vm, "Cannot create a Set from $.",
+                                  varTypeName(values)));
+  }
+
+  vmPopTempRef(vm); // set.
+  RET(VAR_OBJ(set));
+}
+
+DEF(stdCollectionsFloat64Array,
+  "float64_array(init:num|List|Range|TypedArray) -> Float64Array\n"
+  "Returns a new array of unboxed 64 bit floating point numbers. If [init] "
+  "is a number it'll be the size of the array initialized to zero, "
+  "otherwise the elements are copied from [init].") {
+  _newTypedArrayFrom(vm, PK_ARRAY_FLOAT64);
+}
+
+DEF(stdCollectionsInt32Array,
+  "int32_array(init:num|List|Range|TypedArray) -> Int32Array\n"
+  "Returns a new array of unboxed 32 bit integers. If [init] is a number "
+  "it'll be the size of the array initialized to zero, otherwise the "
+  "elements are copied from [init].") {
+  _newTypedArrayFrom(vm, PK_ARRAY_INT32);
+}
+
+DEF(stdCollectionsByteArray,
+  "byte_array(init:num|List|Range|TypedArray) -> ByteArray\n"
+  "Returns a new array of unsigned bytes. If [init] is a number it'll be "
+  "the size of the array initialized to zero, otherwise the elements are "
+  "copied from [init].") {
+  _newTypedArrayFrom(vm, PK_ARRAY_UINT8);
+}
+
 // 'Fiber' module methods.
 // -----------------------
 
@@ -1177,9 +1577,22 @@ void initializeCore(PKVM* vm) {
   // List functions.
   INITIALIZE_BUILTIN_FN("list_append", coreListAppend, 2);
 
+  // Deque functions.
+  INITIALIZE_BUILTIN_FN("deque_push",       coreDequePush,       2);
+  INITIALIZE_BUILTIN_FN("deque_push_front", coreDequePushFront,  2);
+  INITIALIZE_BUILTIN_FN("deque_pop",        coreDequePop,        1);
+  INITIALIZE_BUILTIN_FN("deque_pop_front",  coreDequePopFront,   1);
+
   // Map functions.
   INITIALIZE_BUILTIN_FN("map_remove",  coreMapRemove,  2);
 
+  // Set functions.
+  INITIALIZE_BUILTIN_FN("set_add",        coreSetAdd,        2);
+  INITIALIZE_BUILTIN_FN("set_remove",     coreSetRemove,     2);
+  INITIALIZE_BUILTIN_FN("set_union",      coreSetUnion,      2);
+  INITIALIZE_BUILTIN_FN("set_intersect",  coreSetIntersect,  2);
+  INITIALIZE_BUILTIN_FN("set_difference", coreSetDifference, 2);
+
   // Core Modules /////////////////////////////////////////////////////////////
 
   Script* lang = newModuleInternal(vm, "lang");
@@ -1211,12 +1624,17 @@ void initializeCore(PKVM* vm) {
   MODULE_ADD_FN(math, "log10", stdMathLog10,       1);
   MODULE_ADD_FN(math, "round", stdMathRound,       1);
 
-  // Note that currently it's mutable (since it's a global variable, not
-  // constant and atomlang doesn't support constant) so the user shouldn't
-  // modify the PI, like in python.
-  // TODO: at varSetAttrib() we can detect if the user try to change an
-  // attribute of a core module and we can throw an error.
-  moduleAddGlobalInternal(vm, math, "PI", VAR_NUM(M_PI));
+  moduleAddConstantInternal(vm, math, "PI", VAR_NUM(M_PI));
+
+  // The constructors of the collection types aren't builtin functions, so
+  // their names could still be used for variables.
+  Script* collections = newModuleInternal(vm, "collections");
+  MODULE_ADD_FN(collections, "deque", stdCollectionsDeque, -1);
+  MODULE_ADD_FN(collections, "range", stdCollectionsRange, -1);
+  MODULE_ADD_FN(collections, "set",   stdCollectionsSet,   -1);
+  MODULE_ADD_FN(collections, "float64_array", stdCollectionsFloat64Array, 1);
+  MODULE_ADD_FN(collections, "int32_array",   stdCollectionsInt32Array,   1);
+  MODULE_ADD_FN(collections, "byte_array",    stdCollectionsByteArray,    1);
 
   Script* fiber = newModuleInternal(vm, "Fiber");
   MODULE_ADD_FN(fiber, "new",      stdFiberNew,     1);
@@ -1235,9 +1653,20 @@ void initializeCore(PKVM* vm) {
 
 #define RIGHT_OPERAND "Right operand"
 
+// Returns the result of an integer operation as a var, if the result overflows
+// the 32 bit integer range it'll be promoted to a double.
+static inline Var intResult(int64_t value) {
+  if (INT32_MIN <= value && value <= INT32_MAX) return VAR_INT(value);
+  return VAR_NUM((double)value);
+}
+
 Var varAdd(PKVM* vm, Var v1, Var v2) {
   double d1, d2;
 
+  if (IS_INT(v1) && IS_INT(v2)) {
+    return intResult((int64_t)AS_INT(v1) + (int64_t)AS_INT(v2));
+  }
+
   if (isNumeric(v1, &d1)) {
     if (validateNumeric(vm, v2, &d2, RIGHT_OPERAND)) {
       return VAR_NUM(d1 + d2);
@@ -1261,15 +1690,26 @@ Var varAdd(PKVM* vm, Var v1, Var v2) {
         if (o2->type == OBJ_LIST) {
           return VAR_OBJ(listJoin(vm, (List*)o1, (List*)o2));
         }
+        if (o2->type == OBJ_RANGE) {
+          uint32_t count = ((List*)o1)->elements.count;
+          if (rangeLength((Range*)o2) > UINT32_MAX - count) {
+            VM_SET_ERROR(vm, newString(vm, "List size is too large."));
+            return VAR_NULL;
+          }
+          return VAR_OBJ(listJoinRange(vm, (List*)o1, (Range*)o2));
+        }
       } break;
 
+      case OBJ_DEQUE:
       case OBJ_MAP:
+      case OBJ_SET:
       case OBJ_RANGE:
       case OBJ_SCRIPT:
       case OBJ_FUNC:
       case OBJ_FIBER:
       case OBJ_CLASS:
       case OBJ_INST:
+      case OBJ_TYPED_ARRAY:
         break;
     }
   }
@@ -1281,6 +1721,10 @@ Var varAdd(PKVM* vm, Var v1, Var v2) {
 Var varSubtract(PKVM* vm, Var v1, Var v2) {
   double d1, d2;
 
+  if (IS_INT(v1) && IS_INT(v2)) {
+    return intResult((int64_t)AS_INT(v1) - (int64_t)AS_INT(v2));
+  }
+
   if (isNumeric(v1, &d1)) {
     if (validateNumeric(vm, v2, &d2, RIGHT_OPERAND)) {
       return VAR_NUM(d1 - d2);
@@ -1295,6 +1739,10 @@ Var varSubtract(PKVM* vm, Var v1, Var v2) {
 Var varMultiply(PKVM* vm, Var v1, Var v2) {
   double d1, d2;
 
+  if (IS_INT(v1) && IS_INT(v2)) {
+    return intResult((int64_t)AS_INT(v1) * (int64_t)AS_INT(v2));
+  }
+
   if (isNumeric(v1, &d1)) {
     if (validateNumeric(vm, v2, &d2, RIGHT_OPERAND)) {
       return VAR_NUM(d1 * d2);
@@ -1323,6 +1771,11 @@ Var varDivide(PKVM* vm, Var v1, Var v2) {
 Var varModulo(PKVM* vm, Var v1, Var v2) {
   double d1, d2;
 
+  // Integer modulo by zero falls through to fmod() which returns nan.
+  if (IS_INT(v1) && IS_INT(v2) && AS_INT(v2) != 0) {
+    return intResult((int64_t)AS_INT(v1) % (int64_t)AS_INT(v2));
+  }
+
   if (isNumeric(v1, &d1)) {
     if (validateNumeric(vm, v2, &d2, RIGHT_OPERAND)) {
       return VAR_NUM(fmod(d1, d2));
@@ -1342,6 +1795,10 @@ Var varModulo(PKVM* vm, Var v1, Var v2) {
 Var varBitAnd(PKVM* vm, Var v1, Var v2) {
   int64_t i1, i2;
 
+  if (IS_INT(v1) && IS_INT(v2)) {
+    return VAR_INT(AS_INT(v1) & AS_INT(v2));
+  }
+
   if (isInteger(v1, &i1)) {
     if (validateInteger(vm, v2, &i2, RIGHT_OPERAND)) {
       return VAR_NUM((double)(i1 & i2));
@@ -1356,6 +1813,10 @@ Var varBitAnd(PKVM* vm, Var v1, Var v2) {
 Var varBitOr(PKVM* vm, Var v1, Var v2) {
   int64_t i1, i2;
 
+  if (IS_INT(v1) && IS_INT(v2)) {
+    return VAR_INT(AS_INT(v1) | AS_INT(v2));
+  }
+
   if (isInteger(v1, &i1)) {
     if (validateInteger(vm, v2, &i2, RIGHT_OPERAND)) {
       return VAR_NUM((double)(i1 | i2));
@@ -1370,6 +1831,10 @@ Var varBitOr(PKVM* vm, Var v1, Var v2) {
 Var varBitXor(PKVM* vm, Var v1, Var v2) {
   int64_t i1, i2;
 
+  if (IS_INT(v1) && IS_INT(v2)) {
+    return VAR_INT(AS_INT(v1) ^ AS_INT(v2));
+  }
+
   if (isInteger(v1, &i1)) {
     if (validateInteger(vm, v2, &i2, RIGHT_OPERAND)) {
       return VAR_NUM((double)(i1 ^ i2));
@@ -1384,6 +1849,10 @@ Var varBitXor(PKVM* vm, Var v1, Var v2) {
 Var varBitLshift(PKVM* vm, Var v1, Var v2) {
   int64_t i1, i2;
 
+  if (IS_INT(v1) && IS_INT(v2) && 0 <= AS_INT(v2) && AS_INT(v2) < 32) {
+    return intResult((int64_t)AS_INT(v1) * ((int64_t)1 << AS_INT(v2)));
+  }
+
   if (isInteger(v1, &i1)) {
     if (validateInteger(vm, v2, &i2, RIGHT_OPERAND)) {
       return VAR_NUM((double)(i1 << i2));
@@ -1398,6 +1867,10 @@ Var varBitLshift(PKVM* vm, Var v1, Var v2) {
 Var varBitRshift(PKVM* vm, Var v1, Var v2) {
   int64_t i1, i2;
 
+  if (IS_INT(v1) && IS_INT(v2) && 0 <= AS_INT(v2) && AS_INT(v2) < 32) {
+    return VAR_INT(AS_INT(v1) >> AS_INT(v2));
+  }
+
   if (isInteger(v1, &i1)) {
     if (validateInteger(vm, v2, &i2, RIGHT_OPERAND)) {
       return VAR_NUM((double)(i1 >> i2));
@@ -1410,6 +1883,8 @@ Var varBitRshift(PKVM* vm, Var v1, Var v2) {
 }
 
 Var varBitNot(PKVM* vm, Var v) {
+  if (IS_INT(v)) return VAR_INT(~AS_INT(v));
+
   int64_t i;
   if (!validateInteger(vm, v, &i, "Unary operand")) return VAR_NULL;
   return VAR_NUM((double)(~i));
@@ -1418,6 +1893,8 @@ Var varBitNot(PKVM* vm, Var v) {
 bool varGreater(Var v1, Var v2) {
   double d1, d2;
 
+  if (IS_INT(v1) && IS_INT(v2)) return AS_INT(v1) > AS_INT(v2);
+
   if (isNumeric(v1, &d1) && isNumeric(v2, &d2)) {
     return d1 > d2;
   }
@@ -1429,6 +1906,8 @@ bool varGreater(Var v1, Var v2) {
 bool varLesser(Var v1, Var v2) {
   double d1, d2;
 
+  if (IS_INT(v1) && IS_INT(v2)) return AS_INT(v1) < AS_INT(v2);
+
   if (isNumeric(v1, &d1) && isNumeric(v2, &d2)) {
     return d1 < d2;
   }
@@ -1444,6 +1923,7 @@ bool varContains(PKVM* vm, Var elem, Var container) {
   if (!IS_OBJ(container)) {
     VM_SET_ERROR(vm, stringFormat(vm, "'$' is not iterable.",
                  varTypeName(container)));
+    return false;
   }
   Object* obj = AS_OBJ(container);
 
@@ -1475,7 +1955,34 @@ bool varContains(PKVM* vm, Var elem, Var container) {
       return !IS_UNDEF(mapGet(map, elem));
     } break;
 
-    case OBJ_RANGE:
+    case OBJ_DEQUE: {
+      Deque* deque = (Deque*)AS_OBJ(container);
+      for (uint32_t i = 0; i < deque->count; i++) {
+        if (isValuesEqual(elem, *dequeAt(deque, i))) return true;
+      }
+      return false;
+    } break;
+
+    case OBJ_SET: {
+      Set* set = (Set*)AS_OBJ(container);
+      return setContains(set, elem);
+    } break;
+
+    case OBJ_TYPED_ARRAY: {
+      TypedArray* array = (TypedArray*)AS_OBJ(container);
+      if (!IS_NUM(elem)) return false;
+      for (uint32_t i = 0; i < array->count; i++) {
+        if (isValuesEqual(elem, typedArrayGet(array, i))) return true;
+      }
+      return false;
+    } break;
+
+    case OBJ_RANGE: {
+      Range* range = (Range*)AS_OBJ(container);
+      if (!IS_NUM(elem)) return false;
+      return rangeContains(range, AS_NUM(elem));
+    } break;
+
     case OBJ_SCRIPT:
     case OBJ_FUNC:
     case OBJ_FIBER:
@@ -1512,7 +2019,7 @@ Var varGetAttrib(PKVM* vm, Var on, String* attrib) {
       switch (attrib->hash) {
 
         case CHECK_HASH("length", 0x83d03615):
-          return VAR_NUM((double)(str->length));
+          return VAR_NUM((double)(stringCodepointCount(vm, str)));
 
         case CHECK_HASH("lower", 0xb51d04ba):
           return VAR_OBJ(stringLower(vm, str));
@@ -1547,6 +2054,57 @@ Var varGetAttrib(PKVM* vm, Var on, String* attrib) {
       UNREACHABLE();
     }
 
+    case OBJ_DEQUE:
+    {
+      Deque* deque = (Deque*)obj;
+      switch (attrib->hash) {
+
+        case CHECK_HASH("length", 0x83d03615):
+          return VAR_NUM((double)(deque->count));
+
+        default:
+          ERR_NO_ATTRIB(vm, on, attrib);
+          return VAR_NULL;
+      }
+
+      UNREACHABLE();
+    }
+
+    case OBJ_SET:
+    {
+      Set* set = (Set*)obj;
+      switch (attrib->hash) {
+
+        case CHECK_HASH("length", 0x83d03615):
+          return VAR_NUM((double)(set->count));
+
+        default:
+          ERR_NO_ATTRIB(vm, on, attrib);
+          return VAR_NULL;
+      }
+
+      UNREACHABLE();
+    }
+
+    case OBJ_TYPED_ARRAY:
+    {
+      TypedArray* array = (TypedArray*)obj;
+      switch (attrib->hash) {
+
+        case CHECK_HASH("length", 0x83d03615):
+          return VAR_NUM((double)(array->count));
+
+        case CHECK_HASH("as_list", 0x1562c22):
+          return VAR_OBJ(typedArrayAsList(vm, array));
+
+        default:
+          ERR_NO_ATTRIB(vm, on, attrib);
+          return VAR_NULL;
+      }
+
+      UNREACHABLE();
+    }
+
     case OBJ_MAP:
     {
       // Not sure should I allow string values could be accessed with
@@ -1563,8 +2121,18 @@ Var varGetAttrib(PKVM* vm, Var on, String* attrib) {
       switch (attrib->hash) {
 
         case CHECK_HASH("as_list", 0x1562c22):
+          if (rangeLength(range) > UINT32_MAX) {
+            VM_SET_ERROR(vm, newString(vm, "List size is too large."));
+            return VAR_NULL;
+          }
           return VAR_OBJ(rangeAsList(vm, range));
 
+        case CHECK_HASH("length", 0x83d03615):
+          return VAR_NUM(rangeLength(range));
+
+        case CHECK_HASH("step", 0xc7441a0f):
+          return VAR_NUM(range->step);
+
         // We can't use 'start', 'end' since 'end' in atomlang is a
         // keyword. Also we can't use 'from', 'to' since 'from' is a keyword
         // too. So, we're using 'first' and 'last' to access the range limits.
@@ -1588,21 +2156,21 @@ Var varGetAttrib(PKVM* vm, Var on, String* attrib) {
       Script* scr = (Script*)obj;
 
       // Search in types.
-      int index = scriptGetClass(scr, attrib->data, attrib->length);
+      int index = scriptGetClass(vm, scr, attrib->data, attrib->length);
       if (index != -1) {
         ASSERT_INDEX((uint32_t)index, scr->classes.count);
         return VAR_OBJ(scr->classes.data[index]);
       }
 
       // Search in functions.
-      index = scriptGetFunc(scr, attrib->data, attrib->length);
+      index = scriptGetFunc(vm, scr, attrib->data, attrib->length);
       if (index != -1) {
         ASSERT_INDEX((uint32_t)index, scr->functions.count);
         return VAR_OBJ(scr->functions.data[index]);
       }
 
       // Search in globals.
-      index = scriptGetGlobals(scr, attrib->data, attrib->length);
+      index = scriptGetGlobals(vm, scr, attrib->data, attrib->length);
       if (index != -1) {
         ASSERT_INDEX((uint32_t)index, scr->globals.count);
         return scr->globals.data[index];
@@ -1712,31 +2280,54 @@ do {                                                                          \
 
     case OBJ_RANGE:
       ATTRIB_IMMUTABLE("as_list");
+      ATTRIB_IMMUTABLE("length");
+      ATTRIB_IMMUTABLE("step");
       ATTRIB_IMMUTABLE("first");
       ATTRIB_IMMUTABLE("last");
       ERR_NO_ATTRIB(vm, on, attrib);
       return;
 
+    case OBJ_DEQUE:
+    case OBJ_SET:
+      ATTRIB_IMMUTABLE("length");
+      ERR_NO_ATTRIB(vm, on, attrib);
+      return;
+
+    case OBJ_TYPED_ARRAY:
+      ATTRIB_IMMUTABLE("length");
+      ATTRIB_IMMUTABLE("as_list");
+      ERR_NO_ATTRIB(vm, on, attrib);
+      return;
+
     case OBJ_SCRIPT: {
       Script* scr = (Script*)obj;
 
       // Check globals.
-      int index = scriptGetGlobals(scr, attrib->data, attrib->length);
+      int index = scriptGetGlobals(vm, scr, attrib->data, attrib->length);
       if (index != -1) {
         ASSERT_INDEX((uint32_t)index, scr->globals.count);
+
+        // The compiler has used the constant's value instead of the global.
+        Var constant;
+        if (scriptGetConstant(scr, (uint32_t)index, &constant)) {
+          VM_SET_ERROR(vm, stringFormat(vm, "'$' is a constant.",
+                                        attrib->data));
+          return;
+        }
+
         scr->globals.data[index] = value;
         return;
       }
 
       // Check function (Functions are immutable).
-      index = scriptGetFunc(scr, attrib->data, attrib->length);
+      index = scriptGetFunc(vm, scr, attrib->data, attrib->length);
       if (index != -1) {
         ASSERT_INDEX((uint32_t)index, scr->functions.count);
         ATTRIB_IMMUTABLE(scr->functions.data[index]->name);
         return;
       }
 
-      index = scriptGetClass(scr, attrib->data, attrib->length);
+      index = scriptGetClass(vm, scr, attrib->data, attrib->length);
       if (index != -1) {
         ASSERT_INDEX((uint32_t)index, scr->classes.count);
         ASSERT_INDEX(scr->classes.data[index]->name, scr->names.count);
@@ -1803,10 +2394,13 @@ Var varGetSubscript(PKVM* vm, Var on, Var key) {
       if (!validateInteger(vm, key, &index, "List index")) {
         return VAR_NULL;
       }
-      if (!validateIndex(vm, index, str->length, "String")) {
+      if (!validateIndex(vm, index, stringCodepointCount(vm, str),
+                         "String")) {
         return VAR_NULL;
       }
-      String* c = newStringLength(vm, str->data + index, 1);
+      uint32_t offset = stringCodepointOffset(vm, str, (uint32_t)index);
+      String* c = newStringLength(vm, str->data + offset,
+                                  stringCodepointWidth(str, offset));
       return VAR_OBJ(c);
     }
 
@@ -1823,6 +2417,47 @@ Var varGetSubscript(PKVM* vm, Var on, Var key) {
       return elems->data[index];
     }
 
+    case OBJ_DEQUE:
+    {
+      int64_t index;
+      Deque* deque = (Deque*)obj;
+      if (!validateInteger(vm, key, &index, "Deque index")) {
+        return VAR_NULL;
+      }
+      if (!validateIndex(vm, index, deque->count, "Deque")) {
+        return VAR_NULL;
+      }
+      return *dequeAt(deque, (uint32_t)index);
+    }
+
+    case OBJ_TYPED_ARRAY:
+    {
+      TypedArray* array = (TypedArray*)obj;
+
+      // Subscripting with a range returns a copy of the slice.
+      if (IS_OBJ_TYPE(key, OBJ_RANGE)) {
+        Range* range = (Range*)AS_OBJ(key);
+        double from = range->from, to = range->to;
+        if (range->step != 1 || from < 0 || to < from ||
+            (double)array->count < to ||
+            floor(from) != from || floor(to) != to) {
+          VM_SET_ERROR(vm, newString(vm, "Invalid slice range."));
+          return VAR_NULL;
+        }
+        return VAR_OBJ(typedArraySlice(vm, array, (uint32_t)from,
+                                       (uint32_t)to));
+      }
+
+      int64_t index;
+      if (!validateInteger(vm, key, &index, "Array index")) {
+        return VAR_NULL;
+      }
+      if (!validateIndex(vm, index, array->count, varTypeName(on))) {
+        return VAR_NULL;
+      }
+      return typedArrayGet(array, (uint32_t)index);
+    }
+
     case OBJ_MAP:
     {
       Var value = mapGet((Map*)obj, key);
@@ -1841,7 +2476,25 @@ Var varGetSubscript(PKVM* vm, Var on, Var key) {
       return value;
     }
 
+    case OBJ_SET:
+      VM_SET_ERROR(vm, stringFormat(vm, "$ type is not subscriptable.",
+                                    varTypeName(on)));
+      return VAR_NULL;
+
     case OBJ_RANGE:
+    {
+      int64_t index;
+      Range* range = (Range*)obj;
+      if (!validateInteger(vm, key, &index, "Range index")) {
+        return VAR_NULL;
+      }
+      if (index < 0 || rangeLength(range) <= (double)index) {
+        VM_SET_ERROR(vm, newString(vm, "Range index out of bound."));
+        return VAR_NULL;
+      }
+      return VAR_NUM(rangeGet(range, (double)index));
+    }
+
     case OBJ_SCRIPT:
     case OBJ_FUNC:
     case OBJ_FIBER:
@@ -1880,6 +2533,26 @@ void varsetSubscript(PKVM* vm, Var on, Var key, Var value) {
       return;
     }
 
+    case OBJ_DEQUE:
+    {
+      int64_t index;
+      Deque* deque = (Deque*)obj;
+      if (!validateInteger(vm, key, &index, "Deque index")) return;
+      if (!validateIndex(vm, index, deque->count, "Deque")) return;
+      *dequeAt(deque, (uint32_t)index) = value;
+      return;
+    }
+
+    case OBJ_TYPED_ARRAY:
+    {
+      int64_t index;
+      TypedArray* array = (TypedArray*)obj;
+      if (!validateInteger(vm, key, &index, "Array index")) return;
+      if (!validateIndex(vm, index, array->count, varTypeName(on))) return;
+      typedArraySet(vm, array, (uint32_t)index, value);
+      return;
+    }
+
     case OBJ_MAP:
     {
       if (IS_OBJ(key) && !isObjectHashable(AS_OBJ(key)->type)) {
@@ -1891,6 +2564,11 @@ void varsetSubscript(PKVM* vm, Var on, Var key, Var value) {
       return;
     }
 
+    case OBJ_SET:
+      VM_SET_ERROR(vm, stringFormat(vm, "$ type is not subscriptable.",
+                                    varTypeName(on)));
+      return;
+
     case OBJ_RANGE:
     case OBJ_SCRIPT:
     case OBJ_FUNC:
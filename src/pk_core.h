@@ -20,6 +20,34 @@ const char* getBuiltinFunctionName(const PKVM* vm, int index);
 // otherwise returns NULL.
 Script* getCoreLib(const PKVM* vm, String* name);
 
+// Functions of the math library which are computed inline by the
+// OP_CALL_INTRINSIC instruction if they're called with numbers, instead of
+// calling the native function.
+typedef enum {
+  INTRINSIC_FLOOR,
+  INTRINSIC_CEIL,
+  INTRINSIC_SQRT,
+  INTRINSIC_ABS,
+  INTRINSIC_SIN,
+  INTRINSIC_COS,
+  INTRINSIC_ROUND,
+  INTRINSIC_POW, //< The only intrinsic with 2 arguments.
+
+  INTRINSIC_COUNT,
+} Intrinsic;
+
+// Returns the intrinsic of the function [fn] if it's one of them, otherwise
+// returns -1.
+int getIntrinsic(const Function* fn);
+
+// Returns the native function of the [intrinsic].
+pkNativeFn getIntrinsicFn(Intrinsic intrinsic);
+
+// Returns the number of arguments of the [intrinsic].
+static inline int getIntrinsicArity(Intrinsic intrinsic) {
+  return (intrinsic == INTRINSIC_POW) ? 2 : 1;
+}
+
 /*****************************************************************************/
 /* OPERATORS                                                                 */
 /*****************************************************************************/
@@ -45,7 +45,8 @@ void dumpFunctionCode(PKVM* vm, Function* func, pkByteBuffer* buff) {
 
   uint32_t i = 0;
   uint8_t* opcodes = func->fn->opcodes.data;
-  uint32_t* lines = func->fn->oplines.data;
+  uint32_t* lines = ALLOCATE_ARRAY(vm, uint32_t, func->fn->opcodes.count);
+  fnGetLines(func->fn, lines);
   uint32_t line = 1, last_line = 0;
 
   // This will print: Instruction Dump of function 'fn' "path.pk"\n
@@ -58,6 +59,14 @@ void dumpFunctionCode(PKVM* vm, Function* func, pkByteBuffer* buff) {
 
 #define READ_BYTE() (opcodes[i++])
 #define READ_SHORT() (i += 2, opcodes[i - 2] << 8 | opcodes[i-1])
+#define READ_INT() (i += 4, opcodes[i - 4] << 24 | opcodes[i - 3] << 16 | \
+                            opcodes[i - 2] << 8 | opcodes[i - 1])
+
+  // True if the current instruction is prefixed with OP_WIDE, where it's 1
+  // byte parameter is 2 bytes and a 2 bytes parameter is 4 bytes.
+  bool wide = false;
+#define READ_ARG_BYTE() (wide ? READ_SHORT() : READ_BYTE())
+#define READ_ARG_SHORT() (wide ? READ_INT() : READ_SHORT())
 
 #define NO_ARGS() ADD_CHAR(vm, buff, '\n')
 #define BYTE_ARG()                                 \
@@ -103,8 +112,10 @@ void dumpFunctionCode(PKVM* vm, Function* func, pkByteBuffer* buff) {
     Opcode op = (Opcode)func->fn->opcodes.data[i++];
     switch (op) {
       case OP_PUSH_CONSTANT:
+      case OP_SWITCH_TABLE:
+      case OP_SWITCH_MAP:
       {
-        int index = READ_SHORT();
+        int index = READ_ARG_SHORT();
         ASSERT_INDEX((uint32_t)index, func->owner->literals.count);
         Var value = func->owner->literals.data[index];
 
@@ -127,7 +138,7 @@ void dumpFunctionCode(PKVM* vm, Function* func, pkByteBuffer* buff) {
       case OP_PUSH_LIST:     SHORT_ARG(); break;
       case OP_PUSH_INSTANCE:
       {
-        int ty_index = READ_BYTE();
+        int ty_index = READ_ARG_BYTE();
         ASSERT_INDEX((uint32_t)ty_index, func->owner->classes.count);
         uint32_t name_ind = func->owner->classes.data[ty_index]->name;
         ASSERT_INDEX(name_ind, func->owner->names.count);
@@ -143,7 +154,7 @@ void dumpFunctionCode(PKVM* vm, Function* func, pkByteBuffer* buff) {
       case OP_PUSH_MAP:      NO_ARGS();   break;
       case OP_LIST_APPEND:   NO_ARGS();   break;
       case OP_MAP_INSERT:    NO_ARGS();   break;
-      case OP_INST_APPEND:   NO_ARGS();   break;
+      case OP_INST_INIT_FIELD: SHORT_ARG(); break;
 
       case OP_PUSH_LOCAL_0:
       case OP_PUSH_LOCAL_1:
@@ -159,7 +170,7 @@ void dumpFunctionCode(PKVM* vm, Function* func, pkByteBuffer* buff) {
 
         int arg;
         if (op == OP_PUSH_LOCAL_N) {
-          arg = READ_BYTE();
+          arg = READ_ARG_BYTE();
           ADD_INTEGER(vm, buff, arg, INT_WIDTH);
 
         } else {
@@ -192,7 +203,7 @@ void dumpFunctionCode(PKVM* vm, Function* func, pkByteBuffer* buff) {
       {
         int arg;
         if (op == OP_STORE_LOCAL_N) {
-          arg = READ_BYTE();
+          arg = READ_ARG_BYTE();
           ADD_INTEGER(vm, buff, arg, INT_WIDTH);
 
         } else {
@@ -215,7 +226,7 @@ void dumpFunctionCode(PKVM* vm, Function* func, pkByteBuffer* buff) {
       case OP_PUSH_GLOBAL:
       case OP_STORE_GLOBAL:
       {
-        int index = READ_BYTE();
+        int index = READ_ARG_BYTE();
         int name_index = func->owner->global_names.data[index];
         String* name = func->owner->names.data[name_index];
 
@@ -229,7 +240,7 @@ void dumpFunctionCode(PKVM* vm, Function* func, pkByteBuffer* buff) {
 
       case OP_PUSH_FN:
       {
-        int fn_index = READ_BYTE();
+        int fn_index = READ_ARG_BYTE();
         const char* name = func->owner->functions.data[fn_index]->name;
 
         // Prints: %5d [Fn:%s]\n
@@ -242,7 +253,7 @@ void dumpFunctionCode(PKVM* vm, Function* func, pkByteBuffer* buff) {
 
       case OP_PUSH_TYPE:
       {
-        int ty_index = READ_BYTE();
+        int ty_index = READ_ARG_BYTE();
         ASSERT_INDEX((uint32_t)ty_index, func->owner->classes.count);
         uint32_t name_ind = func->owner->classes.data[ty_index]->name;
         ASSERT_INDEX(name_ind, func->owner->names.count);
@@ -296,6 +307,12 @@ void dumpFunctionCode(PKVM* vm, Function* func, pkByteBuffer* buff) {
         pkByteBufferAddString(buff, vm, STR_AND_LEN(" (argc)\n"));
         break;
 
+      case OP_CALL_INTRINSIC:
+        // Prints: %5d (intrinsic)\n
+        ADD_INTEGER(vm, buff, READ_BYTE(), INT_WIDTH);
+        pkByteBufferAddString(buff, vm, STR_AND_LEN(" (intrinsic)\n"));
+        break;
+
       case OP_ITER_TEST: NO_ARGS(); break;
 
       case OP_ITER:
@@ -303,7 +320,7 @@ void dumpFunctionCode(PKVM* vm, Function* func, pkByteBuffer* buff) {
       case OP_JUMP_IF:
       case OP_JUMP_IF_NOT:
       {
-        int offset = READ_SHORT();
+        int offset = READ_ARG_SHORT();
 
         // Prints: %5d (ip:%d)\n
         ADD_INTEGER(vm, buff, offset, INT_WIDTH);
@@ -315,7 +332,7 @@ void dumpFunctionCode(PKVM* vm, Function* func, pkByteBuffer* buff) {
 
       case OP_LOOP:
       {
-        int offset = READ_SHORT();
+        int offset = READ_ARG_SHORT();
 
         // Prints: %5d (ip:%d)\n
         ADD_INTEGER(vm, buff, -offset, INT_WIDTH);
@@ -332,13 +349,31 @@ void dumpFunctionCode(PKVM* vm, Function* func, pkByteBuffer* buff) {
       case OP_SET_ATTRIB:
       {
         int index = READ_SHORT();
+        int cache = READ_BYTE();
         String* name = func->owner->names.data[index];
 
-        // Prints: %5d '%s'\n
+        // Prints: %5d '%s' [Cache:%d]\n
         ADD_INTEGER(vm, buff, index, INT_WIDTH);
         pkByteBufferAddString(buff, vm, STR_AND_LEN(" '"));
         pkByteBufferAddString(buff, vm, name->data, name->length);
-        pkByteBufferAddString(buff, vm, STR_AND_LEN("'\n"));
+        pkByteBufferAddString(buff, vm, STR_AND_LEN("' [Cache:"));
+        ADD_INTEGER(vm, buff, cache, 0);
+        pkByteBufferAddString(buff, vm, STR_AND_LEN("]\n"));
+      } break;
+
+      case OP_GET_MODULE_FN:
+      {
+        int index = READ_SHORT();
+        int fn_index = READ_BYTE();
+        String* name = func->owner->names.data[index];
+
+        // Prints: %5d '%s' [Fn:%d]\n
+        ADD_INTEGER(vm, buff, index, INT_WIDTH);
+        pkByteBufferAddString(buff, vm, STR_AND_LEN(" '"));
+        pkByteBufferAddString(buff, vm, name->data, name->length);
+        pkByteBufferAddString(buff, vm, STR_AND_LEN("' [Fn:"));
+        ADD_INTEGER(vm, buff, fn_index, 0);
+        pkByteBufferAddString(buff, vm, STR_AND_LEN("]\n"));
       } break;
 
       case OP_GET_SUBSCRIPT:
@@ -368,18 +403,34 @@ void dumpFunctionCode(PKVM* vm, Function* func, pkByteBuffer* buff) {
       case OP_GTEQ:
       case OP_RANGE:
       case OP_IN:
+      case OP_ADD_NN:
+      case OP_SUBTRACT_NN:
+      case OP_MULTIPLY_NN:
+      case OP_DIVIDE_NN:
+      case OP_LT_NN:
+      case OP_LTEQ_NN:
+      case OP_GT_NN:
+      case OP_GTEQ_NN:
       case OP_REPL_PRINT:
       case OP_END:
         NO_ARGS();
         break;
 
+      case OP_WIDE:
+        NO_ARGS();
+        wide = true;
+        continue;
+
       default:
         UNREACHABLE();
         break;
     }
+
+    wide = false;
   }
 
   ADD_CHAR(vm, buff, '\0');
+  DEALLOCATE(vm, lines);
 
 // Undefin everything defined for this function.
 #undef INDENTATION
@@ -387,6 +438,9 @@ void dumpFunctionCode(PKVM* vm, Function* func, pkByteBuffer* buff) {
 #undef STR_AND_LEN
 #undef READ_BYTE
 #undef READ_SHORT
+#undef READ_INT
+#undef READ_ARG_BYTE
+#undef READ_ARG_SHORT
 #undef BYTE_ARG
 #undef SHORT_ARG
 
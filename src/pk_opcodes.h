@@ -1,5 +1,10 @@
-#pragma once 
+// Opcodes X-macro: this file is intentionally not include guarded since it's
+// included multiple times with different OPCODE() definitions (to generate
+// the Opcode enum, the opcode names and the opcode info table).
+// OPCODE(name, params_size, stack_change)
 
+// Load the constant at index [arg] from the script's literals.
+// params: 2 byte (uint16_t) index value.
 OPCODE(PUSH_CONSTANT, 2, 1)
 
 // Push null on the stack.
@@ -36,9 +41,11 @@ OPCODE(LIST_APPEND, 0, -1)
 // Insert the key value pairs to the map. Used in literal map construction.
 OPCODE(MAP_INSERT, 0, -2)
 
-// Pop the value on the stack, the next stack top would be an instance. Append
-// the value to the instance. Used in instance construction.
-OPCODE(INST_APPEND, 0, -1)
+// Pop the value on the stack, the next stack top would be an instance. Set
+// the value to the instance's field at the index. Used in instance
+// construction.
+// params: 2 byte (uint16_t) field index.
+OPCODE(INST_INIT_FIELD, 2, -1)
 
 // Push stack local on top of the stack. Locals at 0 to 8 marked explicitly
 // since it's performance critical.
@@ -117,6 +124,13 @@ OPCODE(CALL, 1, -0) //< Stack size will calculated at compile time.
 // params: 1 byte argc.
 OPCODE(TAIL_CALL, 1, -0) //< Stack size will calculated at compile time.
 
+// Calls a math function of the core library (see Intrinsic in pk_core.h)
+// with it's arguments at the stack top. If the callable is still the
+// intrinsic's function and the arguments are numbers, the result is computed
+// without calling it, otherwise it's same as OP_CALL.
+// params: 1 byte intrinsic.
+OPCODE(CALL_INTRINSIC, 1, -0) //< Stack size will calculated at compile time.
+
 // Starts the iteration and test the sequence if it's iterable, before the
 // iteration instead of checking it everytime.
 OPCODE(ITER_TEST, 0, 0)
@@ -124,9 +138,8 @@ OPCODE(ITER_TEST, 0, 0)
 // The stack top will be iteration value, next one is iterator (integer) and
 // next would be the container. It'll update those values but not push or pop
 // any values. We need to ensure that stack state at the point.
-// param: 1 byte iterate type (will be set by ITER_TEST at runtime).
 // param: 2 bytes jump offset if the iteration should stop.
-OPCODE(ITER, 3, 0)
+OPCODE(ITER, 2, 0)
 
 // The address offset to jump to. It'll add the offset to ip.
 // param: 2 bytes jump address offset.
@@ -144,21 +157,42 @@ OPCODE(JUMP_IF, 2, -1)
 // param: 2 bytes jump address.
 OPCODE(JUMP_IF_NOT, 2, -1)
 
+// Pop the stack top value and jump with the entry of it's case in the jump
+// table which follows the instruction. The table is a default jump followed
+// by a jump for each case and all of them are the same size (either all or
+// none of them are prefixed with OP_WIDE). The table literal is a range of
+// the dense integer cases, the (n+1)th entry is the jump of (from + n).
+// param: 2 bytes table literal index.
+OPCODE(SWITCH_TABLE, 2, -1)
+
+// Same as SWITCH_TABLE but the table literal is a map of the case values to
+// the index of their entry in the jump table.
+// param: 2 bytes table literal index.
+OPCODE(SWITCH_MAP, 2, -1)
+
 // Pop the stack top value and store it to the current stack frame's 0 index.
 // Then it'll pop the current stack frame.
 OPCODE(RETURN, 0, -1)
 
-// Pop var get attribute push the value.
-// param: 2 byte attrib name index.
-OPCODE(GET_ATTRIB, 2, 0)
+// Pop var get attribute push the value. If the var is an instance of the
+// class in the inline cache of the instruction, the field is read with the
+// cached index (see AttribCache).
+// params: 2 byte attrib name index, 1 byte inline cache index.
+OPCODE(GET_ATTRIB, 3, 0)
+
+// Pop the module and push it's function which is resolved at compile time.
+// If the stack top isn't the module it was resolved from, it'll get the
+// attribute same as GET_ATTRIB.
+// params: 2 byte attrib name index, 1 byte function index of the module.
+OPCODE(GET_MODULE_FN, 3, 0)
 
 // It'll keep the instance on the stack and push the attribute on the stack.
-// param: 2 byte attrib name index.
-OPCODE(GET_ATTRIB_KEEP, 2, 1)
+// params: 2 byte attrib name index, 1 byte inline cache index.
+OPCODE(GET_ATTRIB_KEEP, 3, 1)
 
 // Pop var and value update the attribute push result.
-// param: 2 byte attrib name index.
-OPCODE(SET_ATTRIB, 2, -1)
+// params: 2 byte attrib name index, 1 byte inline cache index.
+OPCODE(SET_ATTRIB, 3, -1)
 
 // Pop var, key, get value and push the result.
 OPCODE(GET_SUBSCRIPT, 0, -1)
@@ -198,10 +232,29 @@ OPCODE(GTEQ, 0, -1)
 OPCODE(RANGE, 0, -1) //< Pop 2 integer make range push.
 OPCODE(IN, 0, -1)
 
+// Binary operators of two numbers, these are never emitted while parsing. The
+// compiler rewrites the generic operators to them when both the operands are
+// known to be numbers, so they skip the type dispatch. (The order should be
+// the same as the generic operators above).
+OPCODE(ADD_NN, 0, -1)
+OPCODE(SUBTRACT_NN, 0, -1)
+OPCODE(MULTIPLY_NN, 0, -1)
+OPCODE(DIVIDE_NN, 0, -1)
+OPCODE(LT_NN, 0, -1)
+OPCODE(LTEQ_NN, 0, -1)
+OPCODE(GT_NN, 0, -1)
+OPCODE(GTEQ_NN, 0, -1)
+
 // Print the repr string of the value at the stack top, used in REPL mode.
 // This will not pop the value.
 OPCODE(REPL_PRINT, 0, 0)
 
+// Prefix of the next instruction which makes it's parameter twice as wide (a
+// 1 byte parameter will be 2 bytes and a 2 bytes parameter will be 4 bytes).
+// It's only emitted if the parameter doesn't fit (ie. the 256th global or a
+// jump over more than 64K bytes) so small scripts won't pay for it.
+OPCODE(WIDE, 0, 0)
+
 // A sudo instruction which will never be called. A function's last opcode
 // used for debugging.
 OPCODE(END, 0, 0)
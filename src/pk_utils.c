@@ -89,6 +89,46 @@ uint32_t utilHashString(const char* string) {
 #undef FNV_offset_basis_32_bit
 }
 
+// Function implementation, see utils.h for description.
+uint32_t utilHashStringLength(const char* string, uint32_t length) {
+  // FNV-1a hash same as utilHashString().
+
+#define FNV_prime_32_bit 16777619u
+#define FNV_offset_basis_32_bit 2166136261u
+
+  uint32_t hash = FNV_offset_basis_32_bit;
+
+  for (uint32_t i = 0; i < length; i++) {
+    hash ^= string[i];
+    hash *= FNV_prime_32_bit;
+  }
+
+  return hash;
+
+#undef FNV_prime_32_bit
+#undef FNV_offset_basis_32_bit
+}
+
+// Function implementation, see utils.h for description.
+uint64_t utilHashString64(const char* string) {
+  // 64 bit FNV-1a hash same as utilHashString().
+
+#define FNV_prime_64_bit 1099511628211ull
+#define FNV_offset_basis_64_bit 14695981039346656037ull
+
+  uint64_t hash = FNV_offset_basis_64_bit;
+
+  for (const char* c = string; *c != '\0'; c++) {
+    hash ^= (uint8_t)*c;
+    hash *= FNV_prime_64_bit;
+  }
+
+  return hash;
+
+#undef FNV_prime_64_bit
+#undef FNV_offset_basis_64_bit
+}
+
 /****************************************************************************
  * UTF8                                                                     *
  ****************************************************************************/
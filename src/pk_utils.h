@@ -27,6 +27,14 @@ uint32_t utilHashNumber(double num);
 // Generate a has code for [string].
 uint32_t utilHashString(const char* string);
 
+// Generate a hash code for the [length] chars at [string], which is the same
+// as utilHashString() if the chars doesn't have a null byte.
+uint32_t utilHashStringLength(const char* string, uint32_t length);
+
+// Generate a 64 bit hash code for [string], used where a collision of 32 bit
+// hashes isn't acceptable (ie. validating a bytecode cache with the source).
+uint64_t utilHashString64(const char* string);
+
 #ifndef UTF8_H
 #define UTF8_H
 
@@ -29,13 +29,16 @@ PkVarType pkGetValueType(const PkVar value) {
   switch (obj->type) {
     case OBJ_STRING: return PK_STRING;
     case OBJ_LIST:   return PK_LIST;
+    case OBJ_DEQUE:  return PK_DEQUE;
     case OBJ_MAP:    return PK_MAP;
+    case OBJ_SET:    return PK_SET;
     case OBJ_RANGE:  return PK_RANGE;
     case OBJ_SCRIPT: return PK_SCRIPT;
     case OBJ_FUNC:   return PK_FUNCTION;
     case OBJ_FIBER:  return PK_FIBER;
     case OBJ_CLASS:  return PK_CLASS;
     case OBJ_INST:   return PK_INST;
+    case OBJ_TYPED_ARRAY: return PK_TYPED_ARRAY;
   }
 
   UNREACHABLE();
@@ -73,6 +76,14 @@ PkHandle* pkNewMap(PKVM* vm) {
   return handle;
 }
 
+PkHandle* pkNewTypedArray(PKVM* vm, PkArrayType type, uint32_t count) {
+  TypedArray* array = newTypedArray(vm, type, count);
+  vmPushTempRef(vm, &array->_super); // array
+  PkHandle* handle = vmNewHandle(vm, VAR_OBJ(array));
+  vmPopTempRef(vm); // array
+  return handle;
+}
+
 PkHandle* pkNewFiber(PKVM* vm, PkHandle* fn) {
   __ASSERT(IS_OBJ_TYPE(fn->value, OBJ_FUNC), "Fn should be of type function.");
 
@@ -97,14 +108,46 @@ PkHandle* pkNewInstNative(PKVM* vm, void* data, uint32_t id) {
 
 // The maximum percentage of the map entries that can be filled before the map
 // is grown. A lower percentage reduce collision which makes looks up faster
-// but take more memory.
-#define MAP_LOAD_PERCENT 75
+// but take more memory. Since the control bytes of a group are probed at once
+// the map could be filled more than a linear probing map (7/8 just like the
+// SwissTable).
+#define MAP_LOAD_PERCENT 87
+
+// Number of the entries (and control bytes) in a group which are probed
+// together. The capacity of a map is always a multiple of the group size.
+#define MAP_GROUP_SIZE 16
+
+// Control bytes of the unused entries (they have the high bit set). A used
+// entry's control byte is the lower 7 bits of it's key's hash (MAP_H2).
+#define MAP_CTRL_EMPTY   0x80
+#define MAP_CTRL_DELETED 0xfe
+
+// The hash value of a key is splitted into 2 parts, the higher bits (H1) is
+// used to find the starting group and the lower 7 bits (H2) is stored in the
+// control byte to filter out most of the non matching keys without comparing.
+#define MAP_H1(hash) ((hash) >> 7)
+#define MAP_H2(hash) ((uint8_t)((hash) & 0x7f))
+
+// Use SSE2 to match the control bytes of a group with a single instruction
+// if it's available.
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #include <emmintrin.h>
+  #define MAP_USE_SSE2 1
+#else
+  #define MAP_USE_SSE2 0
+#endif
 
 // The factor a collection would grow by when it's exceeds the current
 // capacity. The new capacity will be calculated by multiplying it's old
 // capacity by the GROW_FACTOR.
 #define GROW_FACTOR 2
 
+// The number of codepoints between two cached breadcrumbs of an UTF-8 string.
+// A random access will walk at most this many codepoints from the nearest
+// breadcrumb, and the breadcrumbs take (4 / STRIDE) bytes per codepoint.
+#define STRING_BREADCRUMB_STRIDE 32
+
 // Buffer implementations.
 DEFINE_BUFFER(Uint, uint32_t)
 DEFINE_BUFFER(Byte, uint8_t)
@@ -122,8 +165,10 @@ void pkByteBufferAddString(pkByteBuffer* self, PKVM* vm, const char* str,
 }
 
 void varInitObject(Object* self, PKVM* vm, ObjectType type) {
-  self->type = type;
+  STATIC_ASSERT(sizeof(Object) == sizeof(uint64_t) + sizeof(Object*));
+  self->type = (uint8_t)type;
   self->is_marked = false;
+  self->hash = 0;
   self->next = vm->first;
   vm->first = self;
 }
@@ -178,6 +223,11 @@ static void popMarkedObjectsInternal(Object* obj, PKVM* vm) {
     case OBJ_STRING: {
       vm->bytes_allocated += sizeof(String);
       vm->bytes_allocated += ((size_t)((String*)obj)->length + 1);
+      StringIndexCache* cache = ((String*)obj)->cache;
+      if (cache != NULL) {
+        vm->bytes_allocated += sizeof(StringIndexCache) + sizeof(uint32_t) *
+          (cache->cp_count / STRING_BREADCRUMB_STRIDE + 1);
+      }
     } break;
 
     case OBJ_LIST: {
@@ -187,21 +237,53 @@ static void popMarkedObjectsInternal(Object* obj, PKVM* vm) {
       vm->bytes_allocated += sizeof(Var) * list->elements.capacity;
     } break;
 
+    case OBJ_DEQUE: {
+      Deque* deque = (Deque*)obj;
+      for (uint32_t i = 0; i < deque->count; i++) {
+        markValue(vm, *dequeAt(deque, i));
+      }
+      vm->bytes_allocated += sizeof(Deque);
+      vm->bytes_allocated += sizeof(Var) * deque->capacity;
+    } break;
+
     case OBJ_MAP: {
       Map* map = (Map*)obj;
+      for (uint32_t i = 0; i < map->array_size; i++) {
+        if (IS_UNDEF(map->array[i])) continue;
+        markValue(vm, map->array[i]);
+      }
       for (uint32_t i = 0; i < map->capacity; i++) {
         if (IS_UNDEF(map->entries[i].key)) continue;
         markValue(vm, map->entries[i].key);
         markValue(vm, map->entries[i].value);
       }
       vm->bytes_allocated += sizeof(Map);
-      vm->bytes_allocated += sizeof(MapEntry) * map->capacity;
+      vm->bytes_allocated += sizeof(Var) * map->array_size;
+      vm->bytes_allocated += (sizeof(MapEntry) + 1) * map->capacity;
+    } break;
+
+    case OBJ_SET: {
+      Set* set = (Set*)obj;
+      for (uint32_t i = 0; i < set->capacity; i++) {
+        if (IS_UNDEF(set->keys[i])) continue;
+        markValue(vm, set->keys[i]);
+      }
+      vm->bytes_allocated += sizeof(Set);
+      vm->bytes_allocated += (sizeof(Var) + 1) * set->capacity;
     } break;
 
     case OBJ_RANGE: {
       vm->bytes_allocated += sizeof(Range);
     } break;
 
+    case OBJ_TYPED_ARRAY: {
+      // Elements are unboxed numbers, nothing to mark.
+      TypedArray* array = (TypedArray*)obj;
+      vm->bytes_allocated += sizeof(TypedArray);
+      vm->bytes_allocated += (size_t)array->count *
+                             typedArrayElementSize(array->type);
+    } break;
+
     case OBJ_SCRIPT:
     {
       Script* scr = (Script*)obj;
@@ -215,6 +297,7 @@ static void popMarkedObjectsInternal(Object* obj, PKVM* vm) {
 
       // Integer buffer has no gray call.
       vm->bytes_allocated += sizeof(uint32_t) * scr->global_names.capacity;
+      vm->bytes_allocated += sizeof(uint32_t) * scr->constants.capacity;
 
       markVarBuffer(vm, &scr->literals);
       vm->bytes_allocated += sizeof(Var) * scr->literals.capacity;
@@ -228,6 +311,11 @@ static void popMarkedObjectsInternal(Object* obj, PKVM* vm) {
       markStringBuffer(vm, &scr->names);
       vm->bytes_allocated += sizeof(String*) * scr->names.capacity;
 
+      vm->bytes_allocated += sizeof(ScriptIndexSlot) *
+        ((size_t)scr->names_index.capacity +
+         scr->functions_index.capacity + scr->globals_index.capacity +
+         scr->classes_index.capacity + scr->literals_index.capacity);
+
       markObject(vm, &scr->body->_super);
     } break;
 
@@ -243,7 +331,16 @@ static void popMarkedObjectsInternal(Object* obj, PKVM* vm) {
         vm->bytes_allocated += sizeof(Fn);
 
         vm->bytes_allocated += sizeof(uint8_t)* fn->opcodes.capacity;
-        vm->bytes_allocated += sizeof(uint32_t) * fn->oplines.capacity;
+        vm->bytes_allocated += sizeof(uint8_t) * fn->line_table.capacity;
+        vm->bytes_allocated += sizeof(uint32_t) * fn->inlined.capacity;
+
+        // The classes of the caches are marked, otherwise a freed class could
+        // be matched with a new class allocated at the same address.
+        for (uint32_t i = 0; i < fn->attrib_count; i++) {
+          Class* type = fn->attrib_caches[i].type;
+          if (type != NULL) markObject(vm, &type->_super);
+        }
+        vm->bytes_allocated += sizeof(AttribCache) * fn->attrib_count;
       }
     } break;
 
@@ -285,10 +382,13 @@ static void popMarkedObjectsInternal(Object* obj, PKVM* vm) {
     {
       Instance* inst = (Instance*)obj;
       if (!inst->is_native) {
-        Inst* ins = inst->ins;
-        vm->bytes_allocated += sizeof(Inst);
-        vm->bytes_allocated += sizeof(Var*) * ins->fields.capacity;
+        markObject(vm, &inst->type->_super);
+        for (uint32_t i = 0; i < inst->field_count; i++) {
+          markValue(vm, inst->fields[i]);
+        }
       }
+      vm->bytes_allocated += sizeof(Instance);
+      vm->bytes_allocated += sizeof(Var) * inst->field_count;
     } break;
   }
 }
@@ -302,6 +402,12 @@ void popMarkedObjects(PKVM* vm) {
 
 Var doubleToVar(double value) {
 #if VAR_NAN_TAGGING
+  // Negative zero is kept as a double to preserve it's sign (and NaN fails
+  // the range check).
+  if (INT32_MIN <= value && value <= INT32_MAX &&
+      value == (double)(int32_t)value && (value != 0 || !signbit(value))) {
+    return VAR_INT((int32_t)value);
+  }
   return utilDoubleToBits(value);
 #else
 #error TODO:
@@ -310,6 +416,7 @@ Var doubleToVar(double value) {
 
 double varToDouble(Var value) {
 #if VAR_NAN_TAGGING
+  if (IS_INT(value)) return (double)AS_INT(value);
   return utilDoubleFromBits(value);
 #else
   #error TODO:
@@ -322,6 +429,8 @@ static String* _allocateString(PKVM* vm, size_t length) {
   string->length = (uint32_t)length;
   string->data[length] = '\0';
   string->capacity = (uint32_t)(length + 1);
+  string->encoding = STRING_ENCODING_UNKNOWN;
+  string->cache = NULL;
   return string;
 }
 
@@ -350,23 +459,70 @@ List* newList(PKVM* vm, uint32_t size) {
   return list;
 }
 
+Deque* newDeque(PKVM* vm) {
+  Deque* deque = ALLOCATE(vm, Deque);
+  varInitObject(&deque->_super, vm, OBJ_DEQUE);
+  deque->head = 0;
+  deque->count = 0;
+  deque->capacity = 0;
+  deque->data = NULL;
+  return deque;
+}
+
 Map* newMap(PKVM* vm) {
   Map* map = ALLOCATE(vm, Map);
   varInitObject(&map->_super, vm, OBJ_MAP);
   map->capacity = 0;
   map->count = 0;
+  map->deleted = 0;
   map->entries = NULL;
+  map->ctrl = NULL;
+  map->array = NULL;
+  map->array_size = 0;
+  map->array_count = 0;
   return map;
 }
 
-Range* newRange(PKVM* vm, double from, double to) {
+Set* newSet(PKVM* vm) {
+  Set* set = ALLOCATE(vm, Set);
+  varInitObject(&set->_super, vm, OBJ_SET);
+  set->capacity = 0;
+  set->count = 0;
+  set->deleted = 0;
+  set->keys = NULL;
+  set->ctrl = NULL;
+  return set;
+}
+
+Range* newRange(PKVM* vm, double from, double to, double step) {
+  ASSERT(step != 0, OOPS);
   Range* range = ALLOCATE(vm, Range);
   varInitObject(&range->_super, vm, OBJ_RANGE);
   range->from = from;
   range->to = to;
+  range->step = step;
   return range;
 }
 
+TypedArray* newTypedArray(PKVM* vm, PkArrayType type, uint32_t count) {
+  TypedArray* array = ALLOCATE(vm, TypedArray);
+  varInitObject(&array->_super, vm, OBJ_TYPED_ARRAY);
+  array->type = type;
+  array->count = 0;
+  array->data = NULL;
+
+  if (count > 0) {
+    size_t size = (size_t)count * typedArrayElementSize(type);
+    vmPushTempRef(vm, &array->_super); // array.
+    array->data = ALLOCATE_ARRAY(vm, uint8_t, size);
+    vmPopTempRef(vm); // array.
+    memset(array->data, 0, size);
+    array->count = count;
+  }
+
+  return array;
+}
+
 Script* newScript(PKVM* vm, String* name, bool is_core) {
   Script* script = ALLOCATE(vm, Script);
   varInitObject(&script->_super, vm, OBJ_SCRIPT);
@@ -377,17 +533,29 @@ Script* newScript(PKVM* vm, String* name, bool is_core) {
   script->module = NULL;
   script->initialized = is_core;
   script->body = NULL;
+  script->source_hash = 0;
 
   // Core modules has its name as the module name.
   if (is_core) script->module = name;
 
   pkVarBufferInit(&script->globals);
   pkUintBufferInit(&script->global_names);
+  pkUintBufferInit(&script->constants);
   pkVarBufferInit(&script->literals);
   pkFunctionBufferInit(&script->functions);
   pkClassBufferInit(&script->classes);
   pkStringBufferInit(&script->names);
 
+  ScriptIndex* indexes[] = {
+    &script->names_index, &script->functions_index, &script->globals_index,
+    &script->classes_index, &script->literals_index,
+  };
+  for (int i = 0; i < (int)(sizeof(indexes) / sizeof(*indexes)); i++) {
+    indexes[i]->slots = NULL;
+    indexes[i]->capacity = 0;
+    indexes[i]->count = 0;
+  }
+
   // Add a implicit main function and the '__file__' global to the module, only
   // if it's not a core module.
   if (!is_core) {
@@ -438,7 +606,10 @@ Function* newFunction(PKVM* vm, const char* name, int length, Script* owner,
   } else {
     Fn* fn = ALLOCATE(vm, Fn);
     pkByteBufferInit(&fn->opcodes);
-    pkUintBufferInit(&fn->oplines);
+    pkByteBufferInit(&fn->line_table);
+    pkUintBufferInit(&fn->inlined);
+    fn->attrib_caches = NULL;
+    fn->attrib_count = 0;
     fn->stack_size = 0;
     func->fn = fn;
   }
@@ -523,27 +694,18 @@ Class* newClass(PKVM* vm, Script* scr, const char* name, uint32_t length) {
   return type;
 }
 
-Instance* newInstance(PKVM* vm, Class* ty, bool initialize) {
+Instance* newInstance(PKVM* vm, Class* ty) {
 
-  Instance* inst = ALLOCATE(vm, Instance);
+  uint32_t field_count = ty->field_names.count;
+  Instance* inst = ALLOCATE_DYNAMIC(vm, Instance, field_count, Var);
   varInitObject(&inst->_super, vm, OBJ_INST);
 
-  vmPushTempRef(vm, &inst->_super); // inst.
-
   ASSERT(ty->name < ty->owner->names.count, OOPS);
   inst->name = ty->owner->names.data[ty->name]->data;
   inst->is_native = false;
-
-  Inst* ins = ALLOCATE(vm, Inst);
-  inst->ins = ins;
-  ins->type = ty;
-  pkVarBufferInit(&ins->fields);
-
-  if (initialize && ty->field_names.count != 0) {
-    pkVarBufferFill(&ins->fields, vm, VAR_NULL, ty->field_names.count);
-  }
-
-  vmPopTempRef(vm); // inst.
+  inst->type = ty;
+  inst->field_count = field_count;
+  for (uint32_t i = 0; i < field_count; i++) inst->fields[i] = VAR_NULL;
 
   return inst;
 }
@@ -561,22 +723,114 @@ Instance* newInstanceNative(PKVM* vm, void* data, uint32_t id) {
   }
 
   inst->native = data;
+  inst->field_count = 0;
   return inst;
 }
 
+double rangeDefaultStep(double from, double to) {
+  return (from <= to) ? 1 : -1;
+}
+
+double rangeLength(const Range* self) {
+  double length = ceil((self->to - self->from) / self->step);
+  return (length > 0) ? length : 0;
+}
+
+double rangeGet(const Range* self, double index) {
+  return self->from + index * self->step;
+}
+
+bool rangeContains(const Range* self, double value) {
+  double index = (value - self->from) / self->step;
+  if (index < 0 || index >= rangeLength(self)) return false;
+  if (floor(index) != index) return false;
+
+  // Make sure the value isn't an approximation for fractional steps.
+  return rangeGet(self, index) == value;
+}
+
 List* rangeAsList(PKVM* vm, Range* self) {
-  List* list;
-  if (self->from < self->to) {
-    list = newList(vm, (uint32_t)(self->to - self->from));
-    for (double i = self->from; i < self->to; i++) {
-      pkVarBufferWrite(&list->elements, vm, VAR_NUM(i));
-    }
-    return list;
+  double length = rangeLength(self);
+  ASSERT(length <= UINT32_MAX, "The caller should check the list size.");
+
+  List* list = newList(vm, (uint32_t)length);
+  for (uint32_t i = 0; i < (uint32_t)length; i++) {
+    pkVarBufferWrite(&list->elements, vm, VAR_NUM(rangeGet(self, i)));
+  }
+  return list;
+}
+
+uint32_t typedArrayElementSize(PkArrayType type) {
+  switch (type) {
+    case PK_ARRAY_FLOAT64: return sizeof(double);
+    case PK_ARRAY_INT32:   return sizeof(int32_t);
+    case PK_ARRAY_UINT8:   return sizeof(uint8_t);
+  }
+  UNREACHABLE();
+}
+
+Var typedArrayGet(TypedArray* self, uint32_t index) {
+  ASSERT_INDEX(index, self->count);
+  switch (self->type) {
+    case PK_ARRAY_FLOAT64: return VAR_NUM(((double*)self->data)[index]);
+    case PK_ARRAY_INT32:   return VAR_INT(((int32_t*)self->data)[index]);
+    case PK_ARRAY_UINT8:   return VAR_INT(((uint8_t*)self->data)[index]);
+  }
+  UNREACHABLE();
+}
 
+bool typedArraySet(PKVM* vm, TypedArray* self, uint32_t index, Var value) {
+  ASSERT_INDEX(index, self->count);
+
+  if (!IS_NUM(value)) {
+    VM_SET_ERROR(vm, stringFormat(vm, "Expected a number to set in $, got $.",
+                 getArrayTypeName(self->type), varTypeName(value)));
+    return false;
+  }
+
+  if (self->type == PK_ARRAY_FLOAT64) {
+    ((double*)self->data)[index] = AS_NUM(value);
+    return true;
+  }
+
+  // Integer arrays only accepts whole numbers in their range.
+  double num = AS_NUM(value);
+  double min = 0, max = UINT8_MAX;
+  if (self->type == PK_ARRAY_INT32) min = INT32_MIN, max = INT32_MAX;
+
+  if (!(min <= num && num <= max) || floor(num) != num) {
+    VM_SET_ERROR(vm, stringFormat(vm, "Value is not in the range of $.",
+                 getArrayTypeName(self->type)));
+    return false;
+  }
+
+  if (self->type == PK_ARRAY_INT32) {
+    ((int32_t*)self->data)[index] = (int32_t)num;
   } else {
-    list = newList(vm, 0);
+    ((uint8_t*)self->data)[index] = (uint8_t)num;
+  }
+  return true;
+}
+
+TypedArray* typedArraySlice(PKVM* vm, TypedArray* self,
+                            uint32_t from, uint32_t to) {
+  ASSERT(from <= to && to <= self->count, OOPS);
+
+  TypedArray* slice = newTypedArray(vm, self->type, to - from);
+  if (to > from) {
+    uint32_t size = typedArrayElementSize(self->type);
+    memcpy(slice->data, (uint8_t*)self->data + (size_t)from * size,
+           (size_t)(to - from) * size);
   }
+  return slice;
+}
 
+List* typedArrayAsList(PKVM* vm, TypedArray* self) {
+  List* list = newList(vm, self->count);
+  for (uint32_t i = 0; i < self->count; i++) {
+    list->elements.data[i] = typedArrayGet(self, i);
+  }
+  list->elements.count = self->count;
   return list;
 }
 
@@ -655,6 +909,108 @@ String* stringStrip(PKVM* vm, String* self) {
   return newStringLength(vm, start, (uint32_t)(end - start + 1));
 }
 
+uint32_t stringCodepointWidth(const String* self, uint32_t offset) {
+  ASSERT(offset < self->length, OOPS);
+
+  // A leading byte followed by less continuation bytes than it claims is an
+  // invalid sequence, consume only the continuation bytes that exists.
+  uint32_t count = utf8_decodeBytesCount((uint8_t)self->data[offset]);
+  uint32_t width = 1;
+  while (width < count && offset + width < self->length &&
+         ((uint8_t)self->data[offset + width] & 0xc0) == 0x80) {
+    width++;
+  }
+  return width;
+}
+
+// Compute the encoding of the string and build the index cache if it contains
+// multi byte sequence(s). This is done only once per string.
+static void _stringBuildIndexCache(PKVM* vm, String* self) {
+  ASSERT(self->encoding == STRING_ENCODING_UNKNOWN, OOPS);
+
+  uint32_t offset = 0;
+  while (offset < self->length && (self->data[offset] & 0x80) == 0) offset++;
+
+  if (offset == self->length) {
+    self->encoding = STRING_ENCODING_ASCII;
+    return;
+  }
+
+  // Count the codepoints starting from the first non ASCII byte.
+  uint32_t count = offset;
+  while (offset < self->length) {
+    offset += stringCodepointWidth(self, offset);
+    count++;
+  }
+
+  // Allocating the cache may trigger a garbage collection.
+  vmPushTempRef(vm, &self->_super); // self.
+  uint32_t breadcrumbs_count = count / STRING_BREADCRUMB_STRIDE + 1;
+  StringIndexCache* cache = ALLOCATE_DYNAMIC(vm, StringIndexCache,
+                                             breadcrumbs_count, uint32_t);
+  vmPopTempRef(vm); // self.
+
+  uint32_t* breadcrumbs = cache->breadcrumbs;
+  offset = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    if (i % STRING_BREADCRUMB_STRIDE == 0) {
+      breadcrumbs[i / STRING_BREADCRUMB_STRIDE] = offset;
+    }
+    offset += stringCodepointWidth(self, offset);
+  }
+  if (count % STRING_BREADCRUMB_STRIDE == 0) {
+    breadcrumbs[count / STRING_BREADCRUMB_STRIDE] = offset;
+  }
+
+  cache->cp_count = count;
+  cache->cursor_index = 0;
+  cache->cursor_offset = 0;
+
+  self->encoding = STRING_ENCODING_UTF8;
+  self->cache = cache;
+}
+
+uint32_t stringCodepointCount(PKVM* vm, String* self) {
+  if (self->encoding == STRING_ENCODING_UNKNOWN) {
+    _stringBuildIndexCache(vm, self);
+  }
+  if (self->encoding == STRING_ENCODING_ASCII) return self->length;
+  return self->cache->cp_count;
+}
+
+uint32_t stringCodepointOffset(PKVM* vm, String* self, uint32_t index) {
+  if (self->encoding == STRING_ENCODING_UNKNOWN) {
+    _stringBuildIndexCache(vm, self);
+  }
+
+  if (self->encoding == STRING_ENCODING_ASCII) {
+    ASSERT(index <= self->length, OOPS);
+    return index;
+  }
+
+  StringIndexCache* cache = self->cache;
+  ASSERT(index <= cache->cp_count, OOPS);
+  if (index == cache->cp_count) return self->length;
+
+  // Start from the nearest breadcrumb before the index, unless the last
+  // accessed position is closer (sequential access).
+  uint32_t current = index - index % STRING_BREADCRUMB_STRIDE;
+  uint32_t offset = cache->breadcrumbs[index / STRING_BREADCRUMB_STRIDE];
+  if (cache->cursor_index <= index && current < cache->cursor_index) {
+    current = cache->cursor_index;
+    offset = cache->cursor_offset;
+  }
+
+  while (current < index) {
+    offset += stringCodepointWidth(self, offset);
+    current++;
+  }
+
+  cache->cursor_index = index;
+  cache->cursor_offset = offset;
+  return offset;
+}
+
 String* stringFormat(PKVM* vm, const char* fmt, ...) {
   va_list arg_list;
 
@@ -784,8 +1140,96 @@ List* listJoin(PKVM* vm, List* l1, List* l2) {
   return list;
 }
 
+List* listJoinRange(PKVM* vm, List* list, Range* range) {
+  double length = rangeLength(range);
+  ASSERT(length <= UINT32_MAX - list->elements.count,
+         "The caller should check the list size.");
+
+  List* joined = newList(vm, list->elements.count + (uint32_t)length);
+
+  vmPushTempRef(vm, &joined->_super);
+  pkVarBufferConcat(&joined->elements, vm, &list->elements);
+  for (uint32_t i = 0; i < (uint32_t)length; i++) {
+    listAppend(vm, joined, VAR_NUM(rangeGet(range, i)));
+  }
+  vmPopTempRef(vm);
+
+  return joined;
+}
+
+// Grow the deque's ring buffer by GROW_FACTOR, the elements are copied to the
+// beginning of the new buffer so the head will be 0.
+static void _dequeGrow(PKVM* vm, Deque* self) {
+  uint32_t capacity = (self->capacity == 0)
+                    ? MIN_CAPACITY : self->capacity * GROW_FACTOR;
+  Var* data = ALLOCATE_ARRAY(vm, Var, capacity);
+  for (uint32_t i = 0; i < self->count; i++) {
+    data[i] = self->data[(self->head + i) & (self->capacity - 1)];
+  }
+  DEALLOCATE(vm, self->data);
+  self->data = data;
+  self->capacity = capacity;
+  self->head = 0;
+}
+
+Var* dequeAt(Deque* self, uint32_t index) {
+  ASSERT_INDEX(index, self->count);
+  return &self->data[(self->head + index) & (self->capacity - 1)];
+}
+
+void dequePushBack(PKVM* vm, Deque* self, Var value) {
+  if (self->count == self->capacity) {
+    if (IS_OBJ(value)) vmPushTempRef(vm, AS_OBJ(value));
+    _dequeGrow(vm, self);
+    if (IS_OBJ(value)) vmPopTempRef(vm);
+  }
+  self->data[(self->head + self->count) & (self->capacity - 1)] = value;
+  self->count++;
+}
+
+void dequePushFront(PKVM* vm, Deque* self, Var value) {
+  if (self->count == self->capacity) {
+    if (IS_OBJ(value)) vmPushTempRef(vm, AS_OBJ(value));
+    _dequeGrow(vm, self);
+    if (IS_OBJ(value)) vmPopTempRef(vm);
+  }
+  self->head = (self->head - 1) & (self->capacity - 1);
+  self->data[self->head] = value;
+  self->count++;
+}
+
+Var dequePopBack(Deque* self) {
+  ASSERT(self->count > 0, OOPS);
+  self->count--;
+  return self->data[(self->head + self->count) & (self->capacity - 1)];
+}
+
+Var dequePopFront(Deque* self) {
+  ASSERT(self->count > 0, OOPS);
+  Var value = self->data[self->head];
+  self->head = (self->head + 1) & (self->capacity - 1);
+  self->count--;
+  return value;
+}
+
+// Returns true if the object is compared (and hashed) by it's identity.
+static inline bool _isIdentityHashed(ObjectType type) {
+  return type == OBJ_SCRIPT || type == OBJ_FUNC || type == OBJ_FIBER ||
+         type == OBJ_CLASS || type == OBJ_INST;
+}
+
+// Returns the identity hash of the object, which is assigned from the vm's
+// counter the first time it's hashed and stored in the object's header, so it
+// won't change even if the object is moved in the memory. The [vm] could be
+// NULL if the object is already hashed.
+static uint32_t _identityHash(PKVM* vm, Object* obj) {
+  ASSERT(vm != NULL || obj->hash != 0, OOPS);
+  while (obj->hash == 0) obj->hash = utilHashBits(++vm->identity_hash_count);
+  return obj->hash;
+}
+
 // Return a hash value for the object.
-static uint32_t _hashObject(Object* obj) {
+static uint32_t _hashObject(PKVM* vm, Object* obj) {
 
   ASSERT(isObjectHashable(obj->type),
          "Check if it's hashable before calling this method.");
@@ -796,22 +1240,26 @@ static uint32_t _hashObject(Object* obj) {
       return ((String*)obj)->hash;
 
     case OBJ_LIST:
+    case OBJ_DEQUE:
     case OBJ_MAP:
+    case OBJ_SET:
+    case OBJ_TYPED_ARRAY:
       goto L_unhashable;
 
     case OBJ_RANGE:
     {
       Range* range = (Range*)obj;
-      return utilHashNumber(range->from) ^ utilHashNumber(range->to);
+      return utilHashNumber(range->from) ^ utilHashNumber(range->to) ^
+             utilHashNumber(range->step);
     }
 
+    // Compared by their identity (see isValuesEqual()).
     case OBJ_SCRIPT:
     case OBJ_FUNC:
     case OBJ_FIBER:
     case OBJ_CLASS:
     case OBJ_INST:
-      TODO;
-      UNREACHABLE();
+      return _identityHash(vm, obj);
 
     default:
     L_unhashable:
@@ -822,8 +1270,8 @@ static uint32_t _hashObject(Object* obj) {
   UNREACHABLE();
 }
 
-uint32_t varHashValue(Var v) {
-  if (IS_OBJ(v)) return _hashObject(AS_OBJ(v));
+uint32_t varHashValue(PKVM* vm, Var v) {
+  if (IS_OBJ(v)) return _hashObject(vm, AS_OBJ(v));
 
 #if VAR_NAN_TAGGING
   return utilHashBits(v);
@@ -832,140 +1280,447 @@ uint32_t varHashValue(Var v) {
 #endif
 }
 
-// Find the entry with the [key]. Returns true if found and set [result] to
-// point to the entry, return false otherwise and points [result] to where
-// the entry should be inserted.
-static bool _mapFindEntry(Map* self, Var key, MapEntry** result) {
+// Get the hash of the [key] to look it up in a map or a set, without assigning
+// an identity hash to it. Returns false if it's an object which was never
+// hashed, since it can't be in any of them.
+static inline bool _lookupHash(Var key, uint32_t* hash) {
+  if (IS_OBJ(key) && _isIdentityHashed(AS_OBJ(key)->type) &&
+      AS_OBJ(key)->hash == 0) {
+    return false;
+  }
+  *hash = varHashValue(NULL, key);
+  return true;
+}
 
-  // An empty map won't contain the key.
-  if (self->capacity == 0) return false;
+// Returns a bit mask of the control bytes of the group which are equal to
+// [byte], where the i th bit is set if the i th control byte matches.
+static inline uint32_t _mapGroupMatch(const uint8_t* group, uint8_t byte) {
+#if MAP_USE_SSE2
+  __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+  __m128i match = _mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)byte));
+  return (uint32_t)_mm_movemask_epi8(match);
+#else
+  uint32_t mask = 0;
+  for (int i = 0; i < MAP_GROUP_SIZE; i++) {
+    if (group[i] == byte) mask |= (uint32_t)1 << i;
+  }
+  return mask;
+#endif
+}
 
-  // The [start_index] is where the entry supposed to be if there wasn't any
-  // collision occurred. It'll be the start index for the linear probing.
-  uint32_t start_index = varHashValue(key) % self->capacity;
-  uint32_t index = start_index;
+// Returns a bit mask of the unused (empty or deleted) entries of the group.
+static inline uint32_t _mapGroupMatchUnused(const uint8_t* group) {
+#if MAP_USE_SSE2
+  // The unused control bytes has their high bit set, which is what movemask
+  // collects.
+  __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+  return (uint32_t)_mm_movemask_epi8(ctrl);
+#else
+  uint32_t mask = 0;
+  for (int i = 0; i < MAP_GROUP_SIZE; i++) {
+    if (group[i] & 0x80) mask |= (uint32_t)1 << i;
+  }
+  return mask;
+#endif
+}
 
-  // Keep track of the first tombstone after the [start_index] if we don't find
-  // the key anywhere. The tombstone would be the entry at where we will have
-  // to insert the key/value pair.
-  MapEntry* tombstone = NULL;
+// Returns the index of the lowest set bit of the non zero [mask].
+static inline uint32_t _maskLowestBit(uint32_t mask) {
+  ASSERT(mask != 0, OOPS);
+#if defined(__GNUC__) || defined(__clang__)
+  return (uint32_t)__builtin_ctz(mask);
+#else
+  uint32_t index = 0;
+  while ((mask & 1) == 0) mask >>= 1, index++;
+  return index;
+#endif
+}
 
-  do {
-    MapEntry* entry = &self->entries[index];
+// The map and the set share the same hash table layout (control bytes and
+// the probing) but the keys are stored differently (the map entries and the
+// set keys), so the probing functions below access the i th key with it's
+// [stride] in bytes from the first key.
+#define _TABLE_KEY(keys, stride, index) \
+  (*(const Var*)((const uint8_t*)(keys) + (size_t)(stride) * (index)))
+
+// Find the [key] which has the hash value [hash] in the hash table. Returns
+// true if found and set [result] to the index of the key, return false
+// otherwise and set [result] to the index where the key should be inserted.
+static bool _tableFindKey(const uint8_t* ctrl_bytes, uint32_t capacity,
+                          const void* keys, size_t stride,
+                          Var key, uint32_t hash, uint32_t* result) {
+
+  // An empty table won't contain the key.
+  if (capacity == 0) return false;
+
+  uint32_t group_mask = capacity / MAP_GROUP_SIZE - 1;
+  uint32_t group = MAP_H1(hash) & group_mask;
+  uint8_t h2 = MAP_H2(hash);
+
+  // The first unused entry along the probe sequence, where the key should be
+  // inserted if it doesn't exists.
+  bool unused_found = false;
+  uint32_t unused_index = 0;
+
+  // The groups are probed with triangular numbers (1, 3, 6, ...) which visits
+  // every group exactly once since the group count is a power of 2. And the
+  // table always has an empty entry (load factor < 1) so the loop terminates.
+  for (uint32_t probe = 1;; probe++) {
+    uint32_t base = group * MAP_GROUP_SIZE;
+    const uint8_t* ctrl = ctrl_bytes + base;
+
+    uint32_t match = _mapGroupMatch(ctrl, h2);
+    while (match != 0) {
+      uint32_t index = base + _maskLowestBit(match);
+      if (isValuesEqual(_TABLE_KEY(keys, stride, index), key)) {
+        *result = index;
+        return true;
+      }
+      match &= match - 1;
+    }
 
-    if (IS_UNDEF(entry->key)) {
-      ASSERT(IS_BOOL(entry->value), OOPS);
+    if (!unused_found) {
+      uint32_t unused = _mapGroupMatchUnused(ctrl);
+      if (unused != 0) {
+        unused_index = base + _maskLowestBit(unused);
+        unused_found = true;
+      }
+    }
 
-      if (IS_TRUE(entry->value)) {
+    // If the group has an empty entry, the key would have been inserted
+    // in this group (or before), so it doesn't exists.
+    if (_mapGroupMatch(ctrl, MAP_CTRL_EMPTY) != 0) break;
 
-        // We've found a tombstone, if we haven't found one [tombstone] should
-        // be updated. We still need to keep search for if the key exists.
-        if (tombstone == NULL) tombstone = entry;
+    ASSERT(probe <= group_mask, OOPS);
+    group = (group + probe) & group_mask;
+  }
 
-      } else {
-        // We've found a new empty slot and the key isn't found. If we've
-        // found a tombstone along the sequence we could use that entry
-        // otherwise the entry at the current index.
+  ASSERT(unused_found, OOPS);
+  *result = unused_index;
+  return false;
+}
 
-        *result = (tombstone != NULL) ? tombstone : entry;
-        return false;
-      }
+// Returns the index of the first unused entry along the probe sequence of the
+// [hash], used when we know that the key doesn't already exists in the table
+// (ie. when re-inserting the keys after a resize).
+static uint32_t _tableFindUnused(const uint8_t* ctrl, uint32_t capacity,
+                                 uint32_t hash) {
+  uint32_t group_mask = capacity / MAP_GROUP_SIZE - 1;
+  uint32_t group = MAP_H1(hash) & group_mask;
 
-    } else if (isValuesEqual(entry->key, key)) {
-      // We've found the key.
-      *result = entry;
-      return true;
-    }
+  for (uint32_t probe = 1;; probe++) {
+    uint32_t base = group * MAP_GROUP_SIZE;
+    uint32_t unused = _mapGroupMatchUnused(ctrl + base);
+    if (unused != 0) return base + _maskLowestBit(unused);
 
-    index = (index + 1) % self->capacity;
+    ASSERT(probe <= group_mask, OOPS);
+    group = (group + probe) & group_mask;
+  }
+}
 
-  } while (index != start_index);
+// Mark the used entry at [index] as unused and returns true if it became a
+// tombstone. If the group still has an empty entry, no probe sequence goes
+// beyond this group and the entry can be marked as empty, otherwise it should
+// be a tombstone to continue the probe sequences that passes through.
+static bool _tableEraseCtrl(uint8_t* ctrl, uint32_t index) {
+  const uint8_t* group = ctrl + (index - index % MAP_GROUP_SIZE);
+  if (_mapGroupMatch(group, MAP_CTRL_EMPTY) != 0) {
+    ctrl[index] = MAP_CTRL_EMPTY;
+    return false;
+  }
+  ctrl[index] = MAP_CTRL_DELETED;
+  return true;
+}
 
-  // If we reach here means the map is filled with tombstone. Set the first
-  // tombstone as result for the next insertion and return false.
-  ASSERT(tombstone != NULL, OOPS);
-  *result = tombstone;
-  return false;
+// Find the entry with the [key] in the map's hash part (see _tableFindKey()).
+static inline bool _mapFindEntry(const Map* self, Var key, uint32_t hash,
+                                 uint32_t* result) {
+  return _tableFindKey(self->ctrl, self->capacity, self->entries,
+                       sizeof(MapEntry), key, hash, result);
 }
 
-// Add the key, value pair to the entries array of the map. Returns true if
-// the entry added for the first time and false for replaced value.
-static bool _mapInsertEntry(Map* self, Var key, Var value) {
+// Returns the index of the first unused entry of the map's hash part for
+// the [hash] (see _tableFindUnused()).
+static inline uint32_t _mapFindUnused(const Map* self, uint32_t hash) {
+  return _tableFindUnused(self->ctrl, self->capacity, hash);
+}
 
-  ASSERT(self->capacity != 0, "Should ensure the capacity before inserting.");
+// Set the entry at [index] (which should be unused) with the key, value pair.
+static inline void _mapFillEntry(Map* self, uint32_t index, uint32_t hash,
+                                 Var key, Var value) {
+  ASSERT(self->ctrl[index] & 0x80, OOPS);
+  if (self->ctrl[index] == MAP_CTRL_DELETED) self->deleted--;
+  self->ctrl[index] = MAP_H2(hash);
+  self->entries[index].key = key;
+  self->entries[index].value = value;
+}
 
-  MapEntry* result;
-  if (_mapFindEntry(self, key, &result)) {
-    // Key already found, just replace the value.
-    result->value = value;
-    return false;
-  } else {
-    result->key = key;
-    result->value = value;
+// If the [key] belongs to the array part of the map, set [index] and return
+// true.
+static inline bool _mapArrayIndex(const Map* self, Var key, uint32_t* index) {
+  // Negative integers are casted to a large unsigned value which is out of
+  // the array part.
+  if (IS_INT(key) && (uint32_t)AS_INT(key) < self->array_size) {
+    *index = (uint32_t)AS_INT(key);
     return true;
   }
+  return false;
 }
 
-// Resize the map's size to the given [capacity].
-static void _mapResize(PKVM* vm, Map* self, uint32_t capacity) {
+// Returns the smallest power of 2 (multiple of MAP_GROUP_SIZE) capacity of
+// the hash part to hold [count] entries without exceeding the load factor.
+static uint32_t _mapCapacityFor(uint32_t count) {
+  if (count == 0) return 0;
+  uint32_t capacity = MAP_GROUP_SIZE;
+  while (count > capacity * MAP_LOAD_PERCENT / 100) capacity *= GROW_FACTOR;
+  return capacity;
+}
+
+// Resize the map's hash part to the given [capacity] and the array part to
+// [array_size], and move the entries to the part they belongs to. The caller
+// should make sure the hash part could hold the keys which doesn't fit in the
+// new array part.
+static void _mapResize(PKVM* vm, Map* self, uint32_t capacity,
+                       uint32_t array_size) {
+  ASSERT(capacity % MAP_GROUP_SIZE == 0, OOPS);
 
   MapEntry* old_entries = self->entries;
+  uint8_t* old_ctrl = self->ctrl;
   uint32_t old_capacity = self->capacity;
+  Var* old_array = self->array;
+  uint32_t old_array_size = self->array_size;
+
+  // Allocate everything before modifying the map, since an allocation could
+  // trigger a garbage collection which will mark the map.
+  Var* array = old_array;
+  if (array_size != old_array_size) {
+    array = (array_size == 0) ? NULL : ALLOCATE_ARRAY(vm, Var, array_size);
+    for (uint32_t i = 0; i < array_size; i++) array[i] = VAR_UNDEFINED;
+  }
+
+  // The entries and the control bytes are allocated as a single block.
+  uint8_t* block = NULL;
+  if (capacity != 0) {
+    block = ALLOCATE_ARRAY(vm, uint8_t, (sizeof(MapEntry) + 1) * capacity);
+  }
 
-  self->entries = ALLOCATE_ARRAY(vm, MapEntry, capacity);
+  self->entries = (MapEntry*)block;
+  self->ctrl = (block == NULL) ? NULL : block + sizeof(MapEntry) * capacity;
   self->capacity = capacity;
+  self->deleted = 0;
+  self->array = array;
+  self->array_size = array_size;
+  if (array != old_array) self->array_count = 0;
   for (uint32_t i = 0; i < capacity; i++) {
     self->entries[i].key = VAR_UNDEFINED;
-    self->entries[i].value = VAR_FALSE;
+    self->entries[i].value = VAR_NULL;
+  }
+  if (capacity != 0) memset(self->ctrl, MAP_CTRL_EMPTY, capacity);
+
+  // Move the array part values if the array part is changed.
+  if (array != old_array) {
+    for (uint32_t i = 0; i < old_array_size; i++) {
+      if (IS_UNDEF(old_array[i])) continue;
+      if (i < array_size) {
+        array[i] = old_array[i];
+        self->array_count++;
+      } else {
+        Var key = VAR_INT(i);
+        uint32_t hash = varHashValue(vm, key);
+        _mapFillEntry(self, _mapFindUnused(self, hash), hash,
+                      key, old_array[i]);
+      }
+    }
+    DEALLOCATE(vm, old_array);
   }
 
-  // Insert the old entries to the new entries.
+  // Insert the old entries to the new entries, the keys are unique so we
+  // don't have to compare them.
   for (uint32_t i = 0; i < old_capacity; i++) {
     // Skip the empty entries or tombstones.
-    if (IS_UNDEF(old_entries[i].key)) continue;
+    if (old_ctrl[i] & 0x80) continue;
+
+    Var key = old_entries[i].key;
+    uint32_t index;
+    if (_mapArrayIndex(self, key, &index)) {
+      self->array[index] = old_entries[i].value;
+      self->array_count++;
+      continue;
+    }
 
-    _mapInsertEntry(self, old_entries[i].key, old_entries[i].value);
+    uint32_t hash = varHashValue(vm, key);
+    _mapFillEntry(self, _mapFindUnused(self, hash), hash,
+                  key, old_entries[i].value);
   }
 
   DEALLOCATE(vm, old_entries);
 }
 
+// Returns the 'bucket' of a non negative integer key, which is the number of
+// bits required to represent it, so that the bucket i contains the keys in
+// the range [2^(i-1), 2^i) and the keys [0, 2^i) are in the buckets 0 to i.
+static inline int _mapKeyBucket(uint32_t key) {
+  int bucket = 0;
+  while (key != 0) key >>= 1, bucket++;
+  return bucket;
+}
+
+// Called when the hash part of the map is about to fill and the [key] (which
+// doesn't exists in the map) is going to be inserted. Compute the new array
+// part size (the largest power of 2 where more than half of it is used) and
+// the hash part capacity for the rest of the keys and resize the map.
+static void _mapRebalance(PKVM* vm, Map* self, Var key) {
+
+  // Number of the integer keys in each bucket (see _mapKeyBucket()).
+  uint32_t nums[33];
+  memset(nums, 0, sizeof(nums));
+  uint32_t int_keys = 0;
+
+  for (uint32_t i = 0; i < self->array_size; i++) {
+    if (IS_UNDEF(self->array[i])) continue;
+    nums[_mapKeyBucket(i)]++, int_keys++;
+  }
+  for (uint32_t i = 0; i < self->capacity; i++) {
+    Var k = self->entries[i].key;
+    if (!IS_INT(k) || AS_INT(k) < 0) continue;
+    nums[_mapKeyBucket((uint32_t)AS_INT(k))]++, int_keys++;
+  }
+  if (IS_INT(key) && AS_INT(key) >= 0) {
+    nums[_mapKeyBucket((uint32_t)AS_INT(key))]++, int_keys++;
+  }
+
+  // Find the optimal array size, [in_array] is the number of keys that would
+  // go to the array part.
+  uint32_t array_size = 0, in_array = 0, accumulated = 0;
+  for (int i = 0; i < 32; i++) {
+    uint64_t size = (uint64_t)1 << i;
+    if (size / 2 >= int_keys) break;
+    accumulated += nums[i];
+    if (accumulated > size / 2) {
+      array_size = (uint32_t)size;
+      in_array = accumulated;
+    }
+  }
+
+  // Count the new key as well to ensure the capacity of the hash part. The
+  // tombstones are cleaned by the resize.
+  uint32_t in_hash = (self->count + 1) - in_array;
+  _mapResize(vm, self, _mapCapacityFor(in_hash), array_size);
+}
+
 Var mapGet(Map* self, Var key) {
-  MapEntry* entry;
-  if (_mapFindEntry(self, key, &entry)) return entry->value;
+  uint32_t index;
+  if (_mapArrayIndex(self, key, &index)) return self->array[index];
+
+  // An empty hash part won't contain the key, and the key might not even be
+  // hashable (ie. [1] in {}) so don't hash it.
+  if (self->capacity == 0) return VAR_UNDEFINED;
+
+  uint32_t hash;
+  if (!_lookupHash(key, &hash)) return VAR_UNDEFINED;
+  if (_mapFindEntry(self, key, hash, &index)) {
+    return self->entries[index].value;
+  }
   return VAR_UNDEFINED;
 }
 
 void mapSet(PKVM* vm, Map* self, Var key, Var value) {
 
-  // If map is about to fill, resize it first.
-  if (self->count + 1 > self->capacity * MAP_LOAD_PERCENT / 100) {
-    uint32_t capacity = self->capacity * GROW_FACTOR;
-    if (capacity < MIN_CAPACITY) capacity = MIN_CAPACITY;
-    _mapResize(vm, self, capacity);
+  uint32_t index;
+  if (_mapArrayIndex(self, key, &index)) {
+    if (IS_UNDEF(self->array[index])) { //< A new key added.
+      self->count++;
+      self->array_count++;
+    }
+    self->array[index] = value;
+    return;
+  }
+
+  uint32_t hash = varHashValue(vm, key);
+  if (_mapFindEntry(self, key, hash, &index)) {
+    // Key already found, just replace the value.
+    self->entries[index].value = value;
+    return;
   }
 
-  if (_mapInsertEntry(self, key, value)) {
-    self->count++; //< A new key added.
+  // If the hash part is about to fill (including the tombstones), re-balance
+  // the map first, the key might go to the array part after that.
+  uint32_t used = (self->count - self->array_count) + self->deleted + 1;
+  if (used > self->capacity * MAP_LOAD_PERCENT / 100) {
+    _mapRebalance(vm, self, key);
+
+    if (_mapArrayIndex(self, key, &index)) {
+      self->array[index] = value;
+      self->count++;
+      self->array_count++;
+      return;
+    }
+    index = _mapFindUnused(self, hash);
   }
+
+  _mapFillEntry(self, index, hash, key, value);
+  self->count++; //< A new key added.
 }
 
 void mapClear(PKVM* vm, Map* self) {
   DEALLOCATE(vm, self->entries);
+  DEALLOCATE(vm, self->array);
   self->entries = NULL;
+  self->ctrl = NULL;
   self->capacity = 0;
   self->count = 0;
+  self->deleted = 0;
+  self->array = NULL;
+  self->array_size = 0;
+  self->array_count = 0;
+}
+
+bool mapIterate(const Map* self, uint32_t* iter, Var* key, Var* value) {
+  uint32_t i = *iter;
+
+  for (; i < self->array_size; i++) {
+    if (IS_UNDEF(self->array[i])) continue;
+    if (key != NULL) *key = VAR_INT(i);
+    if (value != NULL) *value = self->array[i];
+    *iter = i + 1;
+    return true;
+  }
+
+  for (; i - self->array_size < self->capacity; i++) {
+    const MapEntry* entry = &self->entries[i - self->array_size];
+    if (IS_UNDEF(entry->key)) continue;
+    if (key != NULL) *key = entry->key;
+    if (value != NULL) *value = entry->value;
+    *iter = i + 1;
+    return true;
+  }
+
+  *iter = i;
+  return false;
 }
 
 Var mapRemoveKey(PKVM* vm, Map* self, Var key) {
-  MapEntry* entry;
-  if (!_mapFindEntry(self, key, &entry)) return VAR_NULL;
+  uint32_t index;
+  Var value;
+
+  if (_mapArrayIndex(self, key, &index)) {
+    if (IS_UNDEF(self->array[index])) return VAR_NULL;
+    value = self->array[index];
+    self->array[index] = VAR_UNDEFINED;
+    self->array_count--;
+
+  } else {
+    uint32_t hash;
+    if (self->capacity == 0) return VAR_NULL; //< Empty hash part.
+    if (!_lookupHash(key, &hash)) return VAR_NULL;
+    if (!_mapFindEntry(self, key, hash, &index)) return VAR_NULL;
+
+    value = self->entries[index].value;
+    self->entries[index].key = VAR_UNDEFINED;
+    self->entries[index].value = VAR_NULL;
 
-  // Set the key as VAR_UNDEFINED to mark is as an available slow and set it's
-  // value to VAR_TRUE for tombstone.
-  Var value = entry->value;
-  entry->key = VAR_UNDEFINED;
-  entry->value = VAR_TRUE;
+    if (_tableEraseCtrl(self->ctrl, index)) self->deleted++;
+  }
 
   self->count--;
 
@@ -975,20 +1730,20 @@ Var mapRemoveKey(PKVM* vm, Map* self, Var key) {
     // Clear the map if it's empty.
     mapClear(vm, self);
 
- } else if ((self->capacity > MIN_CAPACITY) &&
+ } else if ((self->capacity > MAP_GROUP_SIZE) &&
              (self->capacity / (GROW_FACTOR * GROW_FACTOR)) >
-             ((self->count * 100) / MAP_LOAD_PERCENT)) {
+             (((self->count - self->array_count) * 100) / MAP_LOAD_PERCENT)) {
 
-    // We grow the map when it's filled 75% (MAP_LOAD_PERCENT) by 2
+    // We grow the map when it's filled 7/8 (MAP_LOAD_PERCENT) by 2
     // (GROW_FACTOR) but we're not shrink the map when it's half filled (ie.
-    // half of the capacity is 75%). Instead we wait till it'll become 1/4 is
+    // half of the capacity is 7/8). Instead we wait till it'll become 1/4 is
     // filled (1/4 = 1/(GROW_FACTOR*GROW_FACTOR)) to minimize the
     // reallocations and which is more faster.
 
     uint32_t capacity = self->capacity / (GROW_FACTOR * GROW_FACTOR);
-    if (capacity < MIN_CAPACITY) capacity = MIN_CAPACITY;
+    if (capacity < MAP_GROUP_SIZE) capacity = MAP_GROUP_SIZE;
 
-    _mapResize(vm, self, capacity);
+    _mapResize(vm, self, capacity, self->array_size);
   }
 
   if (IS_OBJ(value)) vmPopTempRef(vm);
@@ -996,6 +1751,187 @@ Var mapRemoveKey(PKVM* vm, Map* self, Var key) {
   return value;
 }
 
+// Resize the set's hash table to the given [capacity] (0 or a multiple of
+// MAP_GROUP_SIZE) and re-insert all the keys.
+static void _setResize(PKVM* vm, Set* self, uint32_t capacity) {
+  ASSERT(capacity % MAP_GROUP_SIZE == 0, OOPS);
+  ASSERT(capacity == 0 || self->count < capacity, OOPS);
+
+  Var* old_keys = self->keys;
+  uint8_t* old_ctrl = self->ctrl;
+  uint32_t old_capacity = self->capacity;
+
+  // The keys and the control bytes are allocated as a single block.
+  uint8_t* block = NULL;
+  if (capacity != 0) {
+    block = ALLOCATE_ARRAY(vm, uint8_t, (sizeof(Var) + 1) * capacity);
+  }
+
+  self->keys = (Var*)block;
+  self->ctrl = (block == NULL) ? NULL : block + sizeof(Var) * capacity;
+  self->capacity = capacity;
+  self->deleted = 0;
+  for (uint32_t i = 0; i < capacity; i++) self->keys[i] = VAR_UNDEFINED;
+  if (capacity != 0) memset(self->ctrl, MAP_CTRL_EMPTY, capacity);
+
+  for (uint32_t i = 0; i < old_capacity; i++) {
+    if (old_ctrl[i] & 0x80) continue;
+    uint32_t hash = varHashValue(vm, old_keys[i]);
+    uint32_t index = _tableFindUnused(self->ctrl, capacity, hash);
+    self->ctrl[index] = MAP_H2(hash);
+    self->keys[index] = old_keys[i];
+  }
+
+  DEALLOCATE(vm, old_keys);
+}
+
+bool setContains(const Set* self, Var key) {
+  // An unhashable key can't be added to a set.
+  if (IS_OBJ(key) && !isObjectHashable(AS_OBJ(key)->type)) return false;
+
+  uint32_t index, hash;
+  if (!_lookupHash(key, &hash)) return false;
+  return _tableFindKey(self->ctrl, self->capacity, self->keys, sizeof(Var),
+                       key, hash, &index);
+}
+
+bool setAdd(PKVM* vm, Set* self, Var key) {
+  uint32_t hash = varHashValue(vm, key);
+
+  uint32_t index;
+  if (_tableFindKey(self->ctrl, self->capacity, self->keys, sizeof(Var),
+                    key, hash, &index)) {
+    return false;
+  }
+
+  // If the set is about to fill (including the tombstones), resize it. If
+  // it's mostly filled with tombstones re-hash it with the same capacity.
+  if (self->count + self->deleted + 1 >
+      self->capacity * MAP_LOAD_PERCENT / 100) {
+    _setResize(vm, self, _mapCapacityFor((self->count + 1) * GROW_FACTOR));
+    index = _tableFindUnused(self->ctrl, self->capacity, hash);
+  }
+
+  ASSERT(self->ctrl[index] & 0x80, OOPS);
+  if (self->ctrl[index] == MAP_CTRL_DELETED) self->deleted--;
+  self->ctrl[index] = MAP_H2(hash);
+  self->keys[index] = key;
+  self->count++;
+  return true;
+}
+
+bool setRemove(PKVM* vm, Set* self, Var key) {
+  if (IS_OBJ(key) && !isObjectHashable(AS_OBJ(key)->type)) return false;
+
+  uint32_t index, hash;
+  if (!_lookupHash(key, &hash)) return false;
+  if (!_tableFindKey(self->ctrl, self->capacity, self->keys, sizeof(Var),
+                     key, hash, &index)) {
+    return false;
+  }
+
+  self->keys[index] = VAR_UNDEFINED;
+  if (_tableEraseCtrl(self->ctrl, index)) self->deleted++;
+  self->count--;
+
+  // Shrink the set when it's 1/4 filled, just like the map does.
+  if (self->count == 0) {
+    setClear(vm, self);
+
+  } else if ((self->capacity > MAP_GROUP_SIZE) &&
+             (self->capacity / (GROW_FACTOR * GROW_FACTOR)) >
+             ((self->count * 100) / MAP_LOAD_PERCENT)) {
+    uint32_t capacity = self->capacity / (GROW_FACTOR * GROW_FACTOR);
+    if (capacity < MAP_GROUP_SIZE) capacity = MAP_GROUP_SIZE;
+    _setResize(vm, self, capacity);
+  }
+
+  return true;
+}
+
+void setClear(PKVM* vm, Set* self) {
+  DEALLOCATE(vm, self->keys);
+  self->keys = NULL;
+  self->ctrl = NULL;
+  self->capacity = 0;
+  self->count = 0;
+  self->deleted = 0;
+}
+
+bool setIterate(const Set* self, uint32_t* iter, Var* key) {
+  for (uint32_t i = *iter; i < self->capacity; i++) {
+    if (IS_UNDEF(self->keys[i])) continue;
+    *key = self->keys[i];
+    *iter = i + 1;
+    return true;
+  }
+  *iter = self->capacity;
+  return false;
+}
+
+// Allocate a new set with the same keys of the [other] set, the hash table
+// is copied as it is without re-hashing the keys.
+static Set* _setCopy(PKVM* vm, const Set* other) {
+  Set* set = newSet(vm);
+  if (other->capacity == 0) return set;
+
+  size_t size = (sizeof(Var) + 1) * other->capacity;
+  vmPushTempRef(vm, &set->_super); // set.
+  uint8_t* block = ALLOCATE_ARRAY(vm, uint8_t, size);
+  vmPopTempRef(vm); // set.
+
+  memcpy(block, other->keys, size);
+  set->keys = (Var*)block;
+  set->ctrl = block + sizeof(Var) * other->capacity;
+  set->capacity = other->capacity;
+  set->count = other->count;
+  set->deleted = other->deleted;
+  return set;
+}
+
+Set* setUnion(PKVM* vm, const Set* s1, const Set* s2) {
+  // Copy the larger set and add the keys of the smaller one.
+  if (s1->count < s2->count) {
+    const Set* tmp = s1; s1 = s2; s2 = tmp;
+  }
+
+  Set* set = _setCopy(vm, s1);
+  vmPushTempRef(vm, &set->_super); // set.
+  for (uint32_t i = 0; i < s2->capacity; i++) {
+    if (IS_UNDEF(s2->keys[i])) continue;
+    setAdd(vm, set, s2->keys[i]);
+  }
+  vmPopTempRef(vm); // set.
+  return set;
+}
+
+Set* setIntersection(PKVM* vm, const Set* s1, const Set* s2) {
+  // Iterate over the smaller set and look up in the larger one.
+  if (s1->count > s2->count) {
+    const Set* tmp = s1; s1 = s2; s2 = tmp;
+  }
+
+  Set* set = newSet(vm);
+  vmPushTempRef(vm, &set->_super); // set.
+  for (uint32_t i = 0; i < s1->capacity; i++) {
+    if (IS_UNDEF(s1->keys[i])) continue;
+    if (setContains(s2, s1->keys[i])) setAdd(vm, set, s1->keys[i]);
+  }
+  vmPopTempRef(vm); // set.
+  return set;
+}
+
+Set* setDifference(PKVM* vm, const Set* s1, const Set* s2) {
+  Set* set = newSet(vm);
+  vmPushTempRef(vm, &set->_super); // set.
+  for (uint32_t i = 0; i < s1->capacity; i++) {
+    if (IS_UNDEF(s1->keys[i])) continue;
+    if (!setContains(s2, s1->keys[i])) setAdd(vm, set, s1->keys[i]);
+  }
+  vmPopTempRef(vm); // set.
+  return set;
+}
+
 bool fiberHasError(Fiber* fiber) {
   return fiber->error != NULL;
 }
@@ -1011,6 +1947,7 @@ void freeObject(PKVM* vm, Object* self) {
   // removed at the sweeping phase of the garbage collection.
   switch (self->type) {
     case OBJ_STRING:
+      DEALLOCATE(vm, ((String*)self)->cache);
       break;
 
     case OBJ_LIST:
@@ -1019,26 +1956,48 @@ void freeObject(PKVM* vm, Object* self) {
 
     case OBJ_MAP:
       DEALLOCATE(vm, ((Map*)self)->entries);
+      DEALLOCATE(vm, ((Map*)self)->array);
+      break;
+
+    case OBJ_DEQUE:
+      DEALLOCATE(vm, ((Deque*)self)->data);
+      break;
+
+    case OBJ_SET:
+      DEALLOCATE(vm, ((Set*)self)->keys);
       break;
 
     case OBJ_RANGE:
       break;
 
+    case OBJ_TYPED_ARRAY:
+      DEALLOCATE(vm, ((TypedArray*)self)->data);
+      break;
+
     case OBJ_SCRIPT: {
       Script* scr = (Script*)self;
       pkVarBufferClear(&scr->globals, vm);
       pkUintBufferClear(&scr->global_names, vm);
+      pkUintBufferClear(&scr->constants, vm);
       pkVarBufferClear(&scr->literals, vm);
       pkFunctionBufferClear(&scr->functions, vm);
       pkClassBufferClear(&scr->classes, vm);
       pkStringBufferClear(&scr->names, vm);
+
+      DEALLOCATE(vm, scr->names_index.slots);
+      DEALLOCATE(vm, scr->functions_index.slots);
+      DEALLOCATE(vm, scr->globals_index.slots);
+      DEALLOCATE(vm, scr->classes_index.slots);
+      DEALLOCATE(vm, scr->literals_index.slots);
     } break;
 
     case OBJ_FUNC: {
       Function* func = (Function*)self;
       if (!func->is_native) {
         pkByteBufferClear(&func->fn->opcodes, vm);
-        pkUintBufferClear(&func->fn->oplines, vm);
+        pkByteBufferClear(&func->fn->line_table, vm);
+        pkUintBufferClear(&func->fn->inlined, vm);
+        DEALLOCATE(vm, func->fn->attrib_caches);
         DEALLOCATE(vm, func->fn);
       }
     } break;
@@ -1064,10 +2023,6 @@ void freeObject(PKVM* vm, Object* self) {
           vm->config.inst_free_fn(vm, inst->native, inst->native_id);
         }
 
-      } else {
-        Inst* ins = inst->ins;
-        pkVarBufferClear(&ins->fields, vm);
-        DEALLOCATE(vm, ins);
       }
 
       break;
@@ -1077,15 +2032,212 @@ void freeObject(PKVM* vm, Object* self) {
   DEALLOCATE(vm, self);
 }
 
+// The buffers of a script which are indexed by a ScriptIndex.
+typedef enum {
+  INDEX_NAMES,
+  INDEX_FUNCTIONS,
+  INDEX_GLOBALS,
+  INDEX_CLASSES,
+  INDEX_LITERALS,
+} ScriptIndexKind;
+
+// The key of an element in a script index, which is the name of the element
+// or the content of a string literal. If the [data] is NULL it's a literal
+// [value] which isn't a string.
+typedef struct {
+  const char* data;
+  uint32_t length;
+  Var value;
+} ScriptIndexKey;
+
+// Returns the index of the [kind] of the script and set the number of
+// elements in it's buffer to [count].
+static ScriptIndex* scriptIndexOf(Script* scr, ScriptIndexKind kind,
+                                  uint32_t* count) {
+  switch (kind) {
+    case INDEX_NAMES:
+      *count = scr->names.count;
+      return &scr->names_index;
+
+    case INDEX_FUNCTIONS:
+      *count = scr->functions.count;
+      return &scr->functions_index;
+
+    case INDEX_GLOBALS:
+      *count = scr->global_names.count;
+      return &scr->globals_index;
+
+    case INDEX_CLASSES:
+      *count = scr->classes.count;
+      return &scr->classes_index;
+
+    case INDEX_LITERALS:
+      *count = scr->literals.count;
+      return &scr->literals_index;
+  }
+
+  UNREACHABLE();
+  return NULL;
+}
+
+// Returns the key of the element at the index [i] of the [kind] of buffer.
+static ScriptIndexKey scriptIndexKeyAt(Script* scr, ScriptIndexKind kind,
+                                       uint32_t i) {
+  ScriptIndexKey key = { NULL, 0, VAR_NULL };
+  String* name = NULL;
+
+  switch (kind) {
+    case INDEX_NAMES:
+      name = scr->names.data[i];
+      break;
+
+    case INDEX_FUNCTIONS:
+      key.data = scr->functions.data[i]->name;
+      key.length = (uint32_t)strlen(key.data);
+      break;
+
+    case INDEX_GLOBALS:
+      ASSERT(scr->global_names.data[i] < scr->names.count, OOPS);
+      name = scr->names.data[scr->global_names.data[i]];
+      break;
+
+    case INDEX_CLASSES:
+      ASSERT(scr->classes.data[i]->name < scr->names.count, OOPS);
+      name = scr->names.data[scr->classes.data[i]->name];
+      break;
+
+    case INDEX_LITERALS:
+      key.value = scr->literals.data[i];
+      if (IS_OBJ_TYPE(key.value, OBJ_STRING)) name = (String*)AS_OBJ(key.value);
+      break;
+  }
+
+  if (name != NULL) {
+    key.data = name->data;
+    key.length = name->length;
+  }
+  return key;
+}
+
+static uint32_t scriptIndexHash(ScriptIndexKey key) {
+  if (key.data != NULL) return utilHashStringLength(key.data, key.length);
+  return utilHashBits(key.value);
+}
+
+static bool scriptIndexKeyEquals(ScriptIndexKey k1, ScriptIndexKey k2) {
+  if (k1.data == NULL || k2.data == NULL) {
+    return k1.data == k2.data && isValuesSame(k1.value, k2.value);
+  }
+  return k1.length == k2.length &&
+         memcmp(k1.data, k2.data, k1.length) == 0;
+}
+
+// Returns the index of the element of the [key] in the [kind] of buffer if
+// it's in the index, otherwise returns -1.
+static int scriptIndexFind(Script* scr, ScriptIndexKind kind,
+                           ScriptIndexKey key, uint32_t hash) {
+  uint32_t count;
+  ScriptIndex* index = scriptIndexOf(scr, kind, &count);
+  if (index->capacity == 0) return -1;
+
+  // The index is never full, so there will be an empty slot to stop.
+  uint32_t mask = index->capacity - 1;
+  for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+    ScriptIndexSlot* slot = &index->slots[i];
+    if (slot->index == 0) return -1;
+
+    if (slot->hash == hash &&
+        scriptIndexKeyEquals(scriptIndexKeyAt(scr, kind, slot->index - 1),
+                             key)) {
+      return (int)slot->index - 1;
+    }
+  }
+}
+
+// Insert the element at [elem_index] with the [hash] to the [index] which
+// should have at least one empty slot.
+static void scriptIndexInsert(ScriptIndex* index, uint32_t hash,
+                              uint32_t elem_index) {
+  uint32_t mask = index->capacity - 1;
+  uint32_t i = hash & mask;
+  while (index->slots[i].index != 0) i = (i + 1) & mask;
+  index->slots[i].hash = hash;
+  index->slots[i].index = elem_index + 1;
+}
+
+// Index the elements of the [kind] of buffer which aren't indexed yet.
+static void scriptIndexUpdate(PKVM* vm, Script* scr, ScriptIndexKind kind) {
+  uint32_t count;
+  ScriptIndex* index = scriptIndexOf(scr, kind, &count);
+
+  // If the buffer was truncated (without discarding the index), index all of
+  // it's elements again.
+  if (index->count > count) {
+    memset(index->slots, 0, sizeof(ScriptIndexSlot) * index->capacity);
+    index->count = 0;
+  }
+
+  for (; index->count < count; index->count++) {
+
+    // Keep the load factor at most 75% (the index has less slots used than
+    // the elements if there are duplicates).
+    if ((index->count + 1) * 4 > index->capacity * 3) {
+      uint32_t capacity = (index->capacity == 0) ? MIN_CAPACITY * 2
+                                                 : index->capacity * 2;
+      ScriptIndexSlot* slots = index->slots;
+      uint32_t old_capacity = index->capacity;
+
+      index->slots = ALLOCATE_ARRAY(vm, ScriptIndexSlot, capacity);
+      memset(index->slots, 0, sizeof(ScriptIndexSlot) * capacity);
+      index->capacity = capacity;
+
+      for (uint32_t i = 0; i < old_capacity; i++) {
+        if (slots[i].index == 0) continue;
+        scriptIndexInsert(index, slots[i].hash, slots[i].index - 1);
+      }
+      DEALLOCATE(vm, slots);
+    }
+
+    // If there are elements with the same key, the first one will be found
+    // same as a linear search.
+    ScriptIndexKey key = scriptIndexKeyAt(scr, kind, index->count);
+    uint32_t hash = scriptIndexHash(key);
+    if (scriptIndexFind(scr, kind, key, hash) == -1) {
+      scriptIndexInsert(index, hash, index->count);
+    }
+  }
+}
+
+// Returns the index of the element of the [key] in the [kind] of buffer or
+// -1 if not found.
+static int scriptIndexGet(PKVM* vm, Script* scr, ScriptIndexKind kind,
+                          ScriptIndexKey key) {
+  scriptIndexUpdate(vm, scr, kind);
+  return scriptIndexFind(scr, kind, key, scriptIndexHash(key));
+}
+
+void scriptDiscardIndexes(Script* script) {
+  ScriptIndex* indexes[] = {
+    &script->names_index, &script->functions_index, &script->globals_index,
+    &script->classes_index, &script->literals_index,
+  };
+  for (int i = 0; i < (int)(sizeof(indexes) / sizeof(*indexes)); i++) {
+    if (indexes[i]->capacity != 0) {
+      memset(indexes[i]->slots, 0,
+             sizeof(ScriptIndexSlot) * indexes[i]->capacity);
+    }
+    indexes[i]->count = 0;
+  }
+}
+
 uint32_t scriptAddName(Script* self, PKVM* vm, const char* name,
   uint32_t length) {
 
-  for (uint32_t i = 0; i < self->names.count; i++) {
-    String* _name = self->names.data[i];
-    if (_name->length == length && strncmp(_name->data, name, length) == 0) {
-      // Name already exists in the buffer.
-      return i;
-    }
+  ScriptIndexKey key = { name, length, VAR_NULL };
+  int index = scriptIndexGet(vm, self, INDEX_NAMES, key);
+  if (index != -1) {
+    // Name already exists in the buffer.
+    return (uint32_t)index;
   }
 
   // If we reach here the name doesn't exists in the buffer, so add it and
@@ -1097,39 +2249,38 @@ uint32_t scriptAddName(Script* self, PKVM* vm, const char* name,
   return self->names.count - 1;
 }
 
-int scriptGetClass(Script* script, const char* name, uint32_t length) {
-  for (uint32_t i = 0; i < script->classes.count; i++) {
-    uint32_t name_ind = script->classes.data[i]->name;
-    ASSERT(name_ind < script->names.count, OOPS);
-    String* ty_name = script->names.data[name_ind];
-    if (ty_name->length == length &&
-        strncmp(ty_name->data, name, length) == 0) {
-      return (int)i;
-    }
-  }
-  return -1;
+int scriptGetClass(PKVM* vm, Script* script, const char* name,
+                   uint32_t length) {
+  ScriptIndexKey key = { name, length, VAR_NULL };
+  return scriptIndexGet(vm, script, INDEX_CLASSES, key);
 }
 
-int scriptGetFunc(Script* script, const char* name, uint32_t length) {
-  for (uint32_t i = 0; i < script->functions.count; i++) {
-    const char* fn_name = script->functions.data[i]->name;
-    uint32_t fn_length = (uint32_t)strlen(fn_name);
-    if (fn_length == length && strncmp(fn_name, name, length) == 0) {
-      return (int)i;
-    }
-  }
-  return -1;
+int scriptGetFunc(PKVM* vm, Script* script, const char* name,
+                  uint32_t length) {
+  ScriptIndexKey key = { name, length, VAR_NULL };
+  return scriptIndexGet(vm, script, INDEX_FUNCTIONS, key);
 }
 
-int scriptGetGlobals(Script* script, const char* name, uint32_t length) {
-  for (uint32_t i = 0; i < script->global_names.count; i++) {
-    uint32_t name_index = script->global_names.data[i];
-    String* g_name = script->names.data[name_index];
-    if (g_name->length == length && strncmp(g_name->data, name, length) == 0) {
-      return (int)i;
-    }
+int scriptGetGlobals(PKVM* vm, Script* script, const char* name,
+                     uint32_t length) {
+  ScriptIndexKey key = { name, length, VAR_NULL };
+  return scriptIndexGet(vm, script, INDEX_GLOBALS, key);
+}
+
+int scriptGetLiteral(PKVM* vm, Script* script, Var value) {
+  ScriptIndexKey key = { NULL, 0, value };
+  if (IS_OBJ_TYPE(value, OBJ_STRING)) {
+    String* str = (String*)AS_OBJ(value);
+    key.data = str->data;
+    key.length = str->length;
   }
-  return -1;
+  return scriptIndexGet(vm, script, INDEX_LITERALS, key);
+}
+
+int scriptGetStringLiteral(PKVM* vm, Script* script, const char* data,
+                           uint32_t length) {
+  ScriptIndexKey key = { data, length, VAR_NULL };
+  return scriptIndexGet(vm, script, INDEX_LITERALS, key);
 }
 
 uint32_t scriptAddGlobal(PKVM* vm, Script* script,
@@ -1137,7 +2288,7 @@ uint32_t scriptAddGlobal(PKVM* vm, Script* script,
                     Var value) {
 
   // If already exists update the value.
-  int var_ind = scriptGetGlobals(script, name, length);
+  int var_ind = scriptGetGlobals(vm, script, name, length);
   if (var_ind != -1) {
     ASSERT(var_ind < (int)script->globals.count, OOPS);
     script->globals.data[var_ind] = value;
@@ -1152,6 +2303,32 @@ uint32_t scriptAddGlobal(PKVM* vm, Script* script,
   return script->globals.count - 1;
 }
 
+void scriptAddConstant(PKVM* vm, Script* script, uint32_t index, Var value) {
+  ASSERT_INDEX(index, script->globals.count);
+  ASSERT(script->constants.count == 0 ||
+         script->constants.data[script->constants.count - 1] < index, OOPS);
+
+  script->globals.data[index] = value;
+  pkUintBufferWrite(&script->constants, vm, index);
+}
+
+bool scriptGetConstant(const Script* script, uint32_t index, Var* value) {
+
+  // The constants are in ascending order of their indexes.
+  int low = 0, high = (int)script->constants.count - 1;
+  while (low <= high) {
+    int mid = low + (high - low) / 2;
+    uint32_t constant = script->constants.data[mid];
+    if (constant == index) {
+      *value = script->globals.data[index];
+      return true;
+    }
+    if (constant < index) low = mid + 1;
+    else high = mid - 1;
+  }
+  return false;
+}
+
 void scriptAddMain(PKVM* vm, Script* script) {
   ASSERT(script->body == NULL, OOPS);
 
@@ -1162,6 +2339,101 @@ void scriptAddMain(PKVM* vm, Script* script) {
   script->initialized = false;
 }
 
+// Write the [value] to the [buff] as a variable length integer.
+static void writeVarint(pkByteBuffer* buff, PKVM* vm, uint32_t value) {
+  while (value >= 0x80) {
+    pkByteBufferWrite(buff, vm, (uint8_t)((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  pkByteBufferWrite(buff, vm, (uint8_t)value);
+}
+
+// Read a variable length integer at the [index] of the [buff] and advance the
+// index. A truncated integer will be read till the end of the buffer.
+static uint32_t readVarint(const pkByteBuffer* buff, uint32_t* index) {
+  uint32_t value = 0;
+  for (int shift = 0; *index < buff->count; shift += 7) {
+    uint8_t byte = buff->data[(*index)++];
+    if (shift < 32) value |= (uint32_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) break;
+  }
+  return value;
+}
+
+void fnSetLines(PKVM* vm, Fn* fn, const uint32_t* lines, uint32_t count) {
+  pkByteBufferClear(&fn->line_table, vm);
+
+  uint32_t line = 0; //< Line of the previous run.
+  uint32_t i = 0;
+  while (i < count) {
+    uint32_t start = i;
+    while (i < count && lines[i] == lines[start]) i++;
+
+    int32_t delta = (int32_t)(lines[start] - line);
+    writeVarint(&fn->line_table, vm,
+                ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+    writeVarint(&fn->line_table, vm, i - start);
+    line = lines[start];
+  }
+}
+
+// Read the next run of the line table at the [index] and update the [line]
+// to it's line. Returns the number of bytes in the run.
+static uint32_t readLineRun(const Fn* fn, uint32_t* index, uint32_t* line) {
+  uint32_t delta = readVarint(&fn->line_table, index);
+  *line += (delta >> 1) ^ (0u - (delta & 1));
+  return readVarint(&fn->line_table, index);
+}
+
+uint32_t fnGetLine(const Fn* fn, uint32_t offset) {
+  uint32_t index = 0, line = 0, end = 0;
+  while (index < fn->line_table.count) {
+    end += readLineRun(fn, &index, &line);
+    if (offset < end) break;
+  }
+  return line;
+}
+
+void fnGetLines(const Fn* fn, uint32_t* lines) {
+  uint32_t index = 0, line = 0, offset = 0;
+  uint32_t count = fn->opcodes.count;
+
+  while (offset < count) {
+    // If the table is shorter than the opcodes, the remaining opcodes will
+    // have the last line.
+    uint32_t run = count - offset;
+    if (index < fn->line_table.count) run = readLineRun(fn, &index, &line);
+    for (; run > 0 && offset < count; run--) lines[offset++] = line;
+  }
+}
+
+void fnInitAttribCaches(PKVM* vm, Fn* fn, uint32_t count) {
+  ASSERT(count <= MAX_ATTRIB_CACHES, OOPS);
+
+  DEALLOCATE(vm, fn->attrib_caches);
+  fn->attrib_caches = NULL;
+  fn->attrib_count = 0;
+  if (count == 0) return;
+
+  AttribCache* caches = ALLOCATE_ARRAY(vm, AttribCache, count);
+  for (uint32_t i = 0; i < count; i++) {
+    caches[i].type = NULL;
+    caches[i].name = NULL;
+    caches[i].index = 0;
+  }
+  fn->attrib_caches = caches;
+  fn->attrib_count = count;
+}
+
+int classFieldIndex(Class* self, String* name) {
+  for (uint32_t i = 0; i < self->field_names.count; i++) {
+    ASSERT_INDEX(self->field_names.data[i], self->owner->names.count);
+    String* f_name = self->owner->names.data[self->field_names.data[i]];
+    if (IS_STR_EQ(f_name, name)) return (int)i;
+  }
+  return -1;
+}
+
 bool instGetAttrib(PKVM* vm, Instance* inst, String* attrib, Var* value) {
   ASSERT(inst != NULL, OOPS);
   ASSERT(attrib != NULL, OOPS);
@@ -1211,20 +2483,14 @@ bool instGetAttrib(PKVM* vm, Instance* inst, String* attrib, Var* value) {
 
   } else {
 
-    // TODO: Optimize this with binary search.
-    Class* ty = inst->ins->type;
-    for (uint32_t i = 0; i < ty->field_names.count; i++) {
-      ASSERT_INDEX(i, ty->field_names.count);
-      ASSERT_INDEX(ty->field_names.data[i], ty->owner->names.count);
-      String* f_name = ty->owner->names.data[ty->field_names.data[i]];
-      if (IS_STR_EQ(f_name, attrib)) {
-        *value = inst->ins->fields.data[i];
-        return true;
-      }
-    }
+    int index = classFieldIndex(inst->type, attrib);
 
     // Couldn't find the attribute in it's type class, return false.
-    return false;
+    if (index == -1) return false;
+
+    ASSERT_INDEX((uint32_t)index, inst->field_count);
+    *value = inst->fields[index];
+    return true;
   }
 
   UNREACHABLE();
@@ -1263,22 +2529,14 @@ bool instSetAttrib(PKVM* vm, Instance* inst, String* attrib, Var value) {
 
   } else {
 
-    // TODO: Optimize this with binary search.
-    Class* ty = inst->ins->type;
-    for (uint32_t i = 0; i < ty->field_names.count; i++) {
-      ASSERT_INDEX(i, ty->field_names.count);
-      ASSERT_INDEX(ty->field_names.data[i], ty->owner->names.count);
-      String* f_name = ty->owner->names.data[ty->field_names.data[i]];
-      if (f_name->hash == attrib->hash &&
-        f_name->length == attrib->length &&
-        memcmp(f_name->data, attrib->data, attrib->length) == 0) {
-        inst->ins->fields.data[i] = value;
-        return true;
-      }
-    }
+    int index = classFieldIndex(inst->type, attrib);
 
     // Couldn't find the attribute in it's type class, return false.
-    return false;
+    if (index == -1) return false;
+
+    ASSERT_INDEX((uint32_t)index, inst->field_count);
+    inst->fields[index] = value;
+    return true;
   }
 
   UNREACHABLE();
@@ -1302,6 +2560,9 @@ const char* getPkVarTypeName(PkVarType type) {
     case PK_FIBER:    return "Fiber";
     case PK_CLASS:    return "Class";
     case PK_INST:     return "Inst";
+    case PK_TYPED_ARRAY: return "TypedArray";
+    case PK_SET:      return "Set";
+    case PK_DEQUE:    return "Deque";
   }
 
   UNREACHABLE();
@@ -1311,13 +2572,25 @@ const char* getObjectTypeName(ObjectType type) {
   switch (type) {
     case OBJ_STRING:  return "String";
     case OBJ_LIST:    return "List";
+    case OBJ_DEQUE:   return "Deque";
     case OBJ_MAP:     return "Map";
+    case OBJ_SET:     return "Set";
     case OBJ_RANGE:   return "Range";
     case OBJ_SCRIPT:  return "Script";
     case OBJ_FUNC:    return "Func";
     case OBJ_FIBER:   return "Fiber";
     case OBJ_CLASS:   return "Class";
     case OBJ_INST:    return "Inst";
+    case OBJ_TYPED_ARRAY: return "TypedArray";
+  }
+  UNREACHABLE();
+}
+
+const char* getArrayTypeName(PkArrayType type) {
+  switch (type) {
+    case PK_ARRAY_FLOAT64: return "Float64Array";
+    case PK_ARRAY_INT32:   return "Int32Array";
+    case PK_ARRAY_UINT8:   return "ByteArray";
   }
   UNREACHABLE();
 }
@@ -1329,6 +2602,9 @@ const char* varTypeName(Var v) {
 
   ASSERT(IS_OBJ(v), OOPS);
   Object* obj = AS_OBJ(v);
+  if (obj->type == OBJ_TYPED_ARRAY) {
+    return getArrayTypeName(((TypedArray*)obj)->type);
+  }
   return getObjectTypeName(obj->type);
 }
 
@@ -1353,7 +2629,8 @@ bool isValuesEqual(Var v1, Var v2) {
   switch (o1->type) {
     case OBJ_RANGE:
       return ((Range*)o1)->from == ((Range*)o2)->from &&
-             ((Range*)o1)->to   == ((Range*)o2)->to;
+             ((Range*)o1)->to   == ((Range*)o2)->to &&
+             ((Range*)o1)->step == ((Range*)o2)->step;
 
     case OBJ_STRING: {
       String* s1 = (String*)o1, *s2 = (String*)o2;
@@ -1380,25 +2657,69 @@ bool isValuesEqual(Var v1, Var v2) {
       return true;
     }
 
+    case OBJ_DEQUE: {
+      Deque *d1 = (Deque*)o1, *d2 = (Deque*)o2;
+      if (d1->count != d2->count) return false;
+      for (uint32_t i = 0; i < d1->count; i++) {
+        if (!isValuesEqual(*dequeAt(d1, i), *dequeAt(d2, i))) return false;
+      }
+      return true;
+    }
+
+    case OBJ_SET: {
+      // The keys are hashable which can't contain the set itself, so it
+      // won't be recursive.
+      Set *s1 = (Set*)o1, *s2 = (Set*)o2;
+      if (s1->count != s2->count) return false;
+      for (uint32_t i = 0; i < s1->capacity; i++) {
+        if (IS_UNDEF(s1->keys[i])) continue;
+        if (!setContains(s2, s1->keys[i])) return false;
+      }
+      return true;
+    }
+
+    case OBJ_TYPED_ARRAY: {
+      TypedArray *a1 = (TypedArray*)o1, *a2 = (TypedArray*)o2;
+      if (a1->type != a2->type || a1->count != a2->count) return false;
+      // Not a memcmp() of the buffers, the elements are compared the same way
+      // as the numbers they're read as (ex: 0.0 == -0.0).
+      for (uint32_t i = 0; i < a1->count; i++) {
+        if (!isValuesEqual(typedArrayGet(a1, i), typedArrayGet(a2, i))) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // Compared by their identity, which is already checked above. Their hash
+    // values are also identity based (see _hashObject()).
+    case OBJ_SCRIPT:
+    case OBJ_FUNC:
+    case OBJ_FIBER:
+    case OBJ_CLASS:
+    case OBJ_INST:
+      return false;
+
     default:
       return false;
   }
 }
 
 bool isObjectHashable(ObjectType type) {
-  // Only list and map are un-hashable.
-  return type != OBJ_LIST && type != OBJ_MAP;
+  // Only list, deque, map, set and typed arrays are un-hashable.
+  return type != OBJ_LIST && type != OBJ_DEQUE && type != OBJ_MAP &&
+         type != OBJ_SET && type != OBJ_TYPED_ARRAY;
 }
 
-// This will prevent recursive list/map from crash when calling to_string, by
-// checking if the current sequence is in the outer sequence linked list.
+// This will prevent recursive list/deque/map from crash when calling
+// to_string, by checking if the current sequence is in the outer sequence
+// linked list.
 struct OuterSequence {
   struct OuterSequence* outer;
-  // If false it'll be map. If we have multiple sequence we should use an enum
-  // here but we only ever support list and map as builtin sequence (so bool).
-  bool is_list;
+  ObjectType type; //< One of OBJ_LIST, OBJ_DEQUE or OBJ_MAP.
   union {
     const List* list;
+    const Deque* deque;
     const Map* map;
   };
 };
@@ -1417,6 +2738,12 @@ static void _toStringInternal(PKVM* vm, const Var v, pkByteBuffer* buff,
     else pkByteBufferAddString(buff, vm, "false", 5);
     return;
 
+  } else if (IS_INT(v)) {
+    char num_buff[STR_INT_BUFF_SIZE];
+    int length = sprintf(num_buff, "%d", AS_INT(v));
+    pkByteBufferAddString(buff, vm, num_buff, length);
+    return;
+
   } else if (IS_NUM(v)) {
     double value = AS_NUM(v);
 
@@ -1482,14 +2809,14 @@ static void _toStringInternal(PKVM* vm, const Var v, pkByteBuffer* buff,
         // Check if the list is recursive.
         OuterSequence* seq = outer;
         while (seq != NULL) {
-          if (seq->is_list && seq->list == list) {
+          if (seq->type == OBJ_LIST && seq->list == list) {
             pkByteBufferAddString(buff, vm, "[...]", 5);
             return;
           }
           seq = seq->outer;
         }
         OuterSequence seq_list;
-        seq_list.outer = outer; seq_list.is_list = true; seq_list.list = list;
+        seq_list.outer = outer; seq_list.type = OBJ_LIST; seq_list.list = list;
 
         pkByteBufferWrite(buff, vm, '[');
         for (uint32_t i = 0; i < list->elements.count; i++) {
@@ -1500,10 +2827,36 @@ static void _toStringInternal(PKVM* vm, const Var v, pkByteBuffer* buff,
         return;
       }
 
+      case OBJ_DEQUE:
+      {
+        Deque* deque = (Deque*)obj;
+
+        // Check if the deque is recursive.
+        OuterSequence* seq = outer;
+        while (seq != NULL) {
+          if (seq->type == OBJ_DEQUE && seq->deque == deque) {
+            pkByteBufferAddString(buff, vm, "[Deque:...]", 11);
+            return;
+          }
+          seq = seq->outer;
+        }
+        OuterSequence seq_deque;
+        seq_deque.outer = outer; seq_deque.type = OBJ_DEQUE;
+        seq_deque.deque = deque;
+
+        pkByteBufferAddString(buff, vm, "[Deque:", 7);
+        for (uint32_t i = 0; i < deque->count; i++) {
+          if (i != 0) pkByteBufferAddString(buff, vm, ", ", 2);
+          _toStringInternal(vm, *dequeAt(deque, i), buff, &seq_deque, true);
+        }
+        pkByteBufferWrite(buff, vm, ']');
+        return;
+      }
+
       case OBJ_MAP:
       {
         const Map* map = (const Map*)obj;
-        if (map->entries == NULL) {
+        if (map->count == 0) {
           pkByteBufferAddString(buff, vm, "{}", 2);
           return;
         }
@@ -1511,38 +2864,28 @@ static void _toStringInternal(PKVM* vm, const Var v, pkByteBuffer* buff,
         // Check if the map is recursive.
         OuterSequence* seq = outer;
         while (seq != NULL) {
-          if (!seq->is_list && seq->map == map) {
+          if (seq->type == OBJ_MAP && seq->map == map) {
             pkByteBufferAddString(buff, vm, "{...}", 5);
             return;
           }
           seq = seq->outer;
         }
         OuterSequence seq_map;
-        seq_map.outer = outer; seq_map.is_list = false; seq_map.map = map;
+        seq_map.outer = outer; seq_map.type = OBJ_MAP; seq_map.map = map;
 
         pkByteBufferWrite(buff, vm, '{');
-        uint32_t i = 0;     // Index of the current entry to iterate.
+        uint32_t iter = 0;  // Iterator of the map entries.
         bool _first = true; // For first element no ',' required.
-        do {
-
-          // Get the next valid key index.
-          bool _done = false;
-          while (IS_UNDEF(map->entries[i].key)) {
-            if (++i >= map->capacity) {
-              _done = true;
-              break;
-            }
-          }
-          if (_done) break;
-
+        Var key, value;
+        while (mapIterate(map, &iter, &key, &value)) {
           if (!_first) pkByteBufferAddString(buff, vm, ", ", 2);
 
-          _toStringInternal(vm, map->entries[i].key, buff, &seq_map, true);
+          _toStringInternal(vm, key, buff, &seq_map, true);
           pkByteBufferWrite(buff, vm, ':');
-          _toStringInternal(vm, map->entries[i].value, buff, &seq_map, true);
+          _toStringInternal(vm, value, buff, &seq_map, true);
 
-          i++; _first = false;
-        } while (i < map->capacity);
+          _first = false;
+        }
 
         pkByteBufferWrite(buff, vm, '}');
         return;
@@ -1563,6 +2906,48 @@ static void _toStringInternal(PKVM* vm, const Var v, pkByteBuffer* buff,
         pkByteBufferAddString(buff, vm, buff_from, len_from);
         pkByteBufferAddString(buff, vm, "..", 2);
         pkByteBufferAddString(buff, vm, buff_to, len_to);
+
+        // The step is only written if it's not the default one.
+        if (range->step != rangeDefaultStep(range->from, range->to)) {
+          char buff_step[STR_DBL_BUFF_SIZE];
+          const int len_step = snprintf(buff_step, sizeof(buff_step),
+                                        DOUBLE_FMT, range->step);
+          pkByteBufferAddString(buff, vm, " step ", 6);
+          pkByteBufferAddString(buff, vm, buff_step, len_step);
+        }
+        pkByteBufferWrite(buff, vm, ']');
+        return;
+      }
+
+      case OBJ_SET:
+      {
+        // Keys of a set are hashable, so it can't be recursive.
+        const Set* set = (const Set*)obj;
+        pkByteBufferAddString(buff, vm, "[Set:", 5);
+        uint32_t iter = 0;
+        bool _first = true;
+        Var key;
+        while (setIterate(set, &iter, &key)) {
+          if (!_first) pkByteBufferAddString(buff, vm, ", ", 2);
+          _toStringInternal(vm, key, buff, NULL, true);
+          _first = false;
+        }
+        pkByteBufferWrite(buff, vm, ']');
+        return;
+      }
+
+      case OBJ_TYPED_ARRAY:
+      {
+        // Elements are numbers, so it can't be recursive.
+        TypedArray* array = (TypedArray*)obj;
+        const char* name = getArrayTypeName(array->type);
+        pkByteBufferWrite(buff, vm, '[');
+        pkByteBufferAddString(buff, vm, name, (uint32_t)strlen(name));
+        pkByteBufferWrite(buff, vm, ':');
+        for (uint32_t i = 0; i < array->count; i++) {
+          if (i != 0) pkByteBufferAddString(buff, vm, ", ", 2);
+          _toStringInternal(vm, typedArrayGet(array, i), buff, NULL, true);
+        }
         pkByteBufferWrite(buff, vm, ']');
         return;
       }
@@ -1617,9 +3002,8 @@ static void _toStringInternal(PKVM* vm, const Var v, pkByteBuffer* buff,
         pkByteBufferWrite(buff, vm, ':');
 
         if (!inst->is_native) {
-          const Class* ty = inst->ins->type;
-          const Inst* ins = inst->ins;
-          ASSERT(ins->fields.count == ty->field_names.count, OOPS);
+          const Class* ty = inst->type;
+          ASSERT(inst->field_count == ty->field_names.count, OOPS);
 
           for (uint32_t i = 0; i < ty->field_names.count; i++) {
             if (i != 0) pkByteBufferWrite(buff, vm, ',');
@@ -1628,7 +3012,7 @@ static void _toStringInternal(PKVM* vm, const Var v, pkByteBuffer* buff,
             String* f_name = ty->owner->names.data[ty->field_names.data[i]];
             pkByteBufferAddString(buff, vm, f_name->data, f_name->length);
             pkByteBufferWrite(buff, vm, '=');
-            _toStringInternal(vm, ins->fields.data[i], buff, outer, repr);
+            _toStringInternal(vm, inst->fields[i], buff, outer, repr);
           }
         } else {
 
@@ -1686,6 +3070,9 @@ bool toBool(Var v) {
     case OBJ_STRING: return ((String*)o)->length != 0;
     case OBJ_LIST:   return ((List*)o)->elements.count != 0;
     case OBJ_MAP:    return ((Map*)o)->count != 0;
+    case OBJ_SET:    return ((Set*)o)->count != 0;
+    case OBJ_DEQUE:  return ((Deque*)o)->count != 0;
+    case OBJ_TYPED_ARRAY: return ((TypedArray*)o)->count != 0;
     case OBJ_RANGE: // [[FALLTHROUGH]]
     case OBJ_SCRIPT:
     case OBJ_FUNC:
@@ -87,6 +87,12 @@
  * |
  * '-- c is const bit.
  *
+ * Integers are not a separated type in the language, they're numbers. To keep
+ * the bit representation of each value unique (equality and hashing compares
+ * the bits) a number which is a whole number in the 32 bit integer range is
+ * always stored as an INTEGER and never as a double (see doubleToVar()). Use
+ * IS_NUM() and AS_NUM() to treat both of them as a number and IS_INT() and
+ * AS_INT() for the integer fast paths.
  */
 
 #if VAR_NAN_TAGGING
@@ -129,11 +135,13 @@
 #define IS_TRUE(value)  ((value) == VAR_TRUE)
 #define IS_BOOL(value)  (IS_TRUE(value) || IS_FALSE(value))
 #define IS_INT(value)   ((value & _MASK_INTEGER) == _MASK_INTEGER)
-#define IS_NUM(value)   ((value & _MASK_QNAN) != _MASK_QNAN)
+#define IS_DOUBLE(value) ((value & _MASK_QNAN) != _MASK_QNAN)
+#define IS_NUM(value)   (IS_DOUBLE(value) || IS_INT(value))
 #define IS_OBJ(value)   ((value & _MASK_OBJECT) == _MASK_OBJECT)
 
 // Evaluate to true if the var is an object and type of [obj_type].
-#define IS_OBJ_TYPE(var, obj_type) IS_OBJ(var) && AS_OBJ(var)->type == obj_type
+#define IS_OBJ_TYPE(var, obj_type) \
+  (IS_OBJ(var) && AS_OBJ(var)->type == obj_type)
 
 // Check if the 2 atomlang strings are equal.
 #define IS_STR_EQ(s1, s2)          \
@@ -157,6 +165,7 @@
 #define AS_CSTRING(value) (AS_STRING(value)->data)
 #define AS_ARRAY(value)   ((List*)AS_OBJ(value))
 #define AS_MAP(value)     ((Map*)AS_OBJ(value))
+#define AS_SET(value)     ((Set*)AS_OBJ(value))
 #define AS_RANGE(value)   ((Range*)AS_OBJ(value))
 
 #else
@@ -190,13 +199,16 @@ struct Var {
 typedef struct Object Object;
 typedef struct String String;
 typedef struct List List;
+typedef struct Deque Deque;
 typedef struct Map Map;
+typedef struct Set Set;
 typedef struct Range Range;
 typedef struct Script Script;
 typedef struct Function Function;
 typedef struct Fiber Fiber;
 typedef struct Class Class;
 typedef struct Instance Instance;
+typedef struct TypedArray TypedArray;
 
 // Declaration of buffer objects of different types.
 DECLARE_BUFFER(Uint, uint32_t)
@@ -216,28 +228,60 @@ void pkByteBufferAddString(pkByteBuffer* self, PKVM* vm, const char* str,
 typedef enum {
   OBJ_STRING,
   OBJ_LIST,
+  OBJ_DEQUE,
   OBJ_MAP,
+  OBJ_SET,
   OBJ_RANGE,
   OBJ_SCRIPT,
   OBJ_FUNC,
   OBJ_FIBER,
   OBJ_CLASS,
   OBJ_INST,
+  OBJ_TYPED_ARRAY,
 } ObjectType;
 
-// Base struct for all heap allocated objects.
+// Encoding of a string's data which is computed once (lazily) per string to
+// decide if it can be indexed by bytes or need to walk through the codepoints.
+typedef enum {
+  STRING_ENCODING_UNKNOWN = 0, //< Not computed yet.
+  STRING_ENCODING_ASCII,       //< All bytes are ASCII (codepoint == byte).
+  STRING_ENCODING_UTF8,        //< Contains multi byte UTF-8 sequence(s).
+} StringEncoding;
+
+// Base struct for all heap allocated objects. The type and the mark are stored
+// as bytes so that the hash fits in the padding before the next pointer and
+// the header stays 16 bytes on 64 bit targets.
 struct Object {
-  ObjectType type;  //< Type of the object in \ref var_Object_Type.
-  bool is_marked;   //< Marked when garbage collection's marking phase.
-  Object* next;     //< Next object in the heap allocated link list.
+  uint8_t type;      //< Type of the object (an ObjectType value).
+  uint8_t is_marked; //< Marked when garbage collection's marking phase.
+  uint32_t hash;     //< Identity hash, assigned lazily (0 if not assigned).
+  Object* next;      //< Next object in the heap allocated link list.
 };
 
+// Codepoint index of an UTF-8 string, allocated lazily on the first codepoint
+// based access (see stringCodepointOffset()). Strings are immutable once
+// created so the cache never goes stale.
+typedef struct {
+  uint32_t cp_count;       //< Number of codepoints in the string.
+  uint32_t cursor_index;   //< Codepoint index of the last access.
+  uint32_t cursor_offset;  //< Byte offset of the last access.
+
+  // Byte offsets of every STRING_BREADCRUMB_STRIDE th codepoint.
+  uint32_t breadcrumbs[DYNAMIC_TAIL_ARRAY];
+} StringIndexCache;
+
 struct String {
   Object _super;
 
   uint32_t hash;      //< 32 bit hash value of the string.
   uint32_t length;    //< Length of the string in \ref data.
   uint32_t capacity;  //< Size of allocated \ref data.
+
+  // For all ASCII strings only the encoding is set and the codepoint index is
+  // the byte index, so only the UTF-8 strings will allocate the cache.
+  StringEncoding encoding; //< Encoding of the data, or unknown till computed.
+  StringIndexCache* cache; //< Codepoint index (NULL if not UTF-8).
+
   char data[DYNAMIC_TAIL_ARRAY];
 };
 
@@ -247,30 +291,106 @@ struct List {
   pkVarBuffer elements; //< Elements of the array.
 };
 
+// A double ended queue implemented as a ring buffer, the i th element is at
+// the index (head + i) % capacity of the buffer, so the elements can be
+// pushed and popped at both ends in O(1) without shifting the others.
+struct Deque {
+  Object _super;
+
+  uint32_t head;     //< Index of the first element in the buffer.
+  uint32_t count;    //< Number of elements in the deque.
+  uint32_t capacity; //< Size of the buffer (0 or a power of 2).
+  Var* data;         //< The ring buffer.
+};
+
 typedef struct {
-  // If the key is VAR_UNDEFINED it's an empty slot and if the value is false
-  // the entry is new and available, if true it's a tombstone - the entry
-  // previously used but then deleted.
+  // The occupancy of the entry is tracked by the map's control bytes, but the
+  // key of an unused entry is always kept as VAR_UNDEFINED so the entries
+  // could be iterated without looking at the control bytes.
 
   Var key;   //< The entry's key or VAR_UNDEFINED of the entry is not in use.
   Var value; //< The entry's value.
 } MapEntry;
 
+// The map has 2 parts (just like Lua tables), an array part for the integer
+// keys in the range [0, array_size) where the value of a key is stored at the
+// index of the key, and a hash part for all the other keys. The array size is
+// chosen (when the hash part is resized) as the largest power of 2 where more
+// than half of it's slots are used.
+//
+// The hash part is an open addressing hash table with a control byte per
+// entry (SwissTable style). The entries are divided into groups of
+// MAP_GROUP_SIZE and the control bytes of a group are matched at once (with
+// SSE2 if it's available). A control byte is either MAP_CTRL_EMPTY,
+// MAP_CTRL_DELETED or the lower 7 bits of the key's hash for used entries, so
+// most of the non matching keys are skipped without comparing them.
 struct Map {
   Object _super;
 
-  uint32_t capacity; //< Allocated entry's count.
-  uint32_t count;    //< Number of entries in the map.
+  uint32_t capacity; //< Allocated entry's count (0 or a power of 2).
+  uint32_t count;    //< Number of entries in the map (including array part).
+  uint32_t deleted;  //< Number of tombstones (MAP_CTRL_DELETED) in the map.
   MapEntry* entries; //< Pointer to the contiguous array.
+  uint8_t* ctrl;     //< Control bytes, allocated along with the entries.
+
+  Var* array;           //< Values of the array part (VAR_UNDEFINED if unset).
+  uint32_t array_size;  //< Size of the array part (0 or a power of 2).
+  uint32_t array_count; //< Number of the used slots in the array part.
+};
+
+// A set is a keys only hash table with the same layout of the map's hash
+// part (see above), so each key takes a single Var instead of a MapEntry.
+struct Set {
+  Object _super;
+
+  uint32_t capacity; //< Allocated key's count (0 or a power of 2).
+  uint32_t count;    //< Number of keys in the set.
+  uint32_t deleted;  //< Number of tombstones (MAP_CTRL_DELETED) in the set.
+  Var* keys;         //< The keys or VAR_UNDEFINED if the slot is not in use.
+  uint8_t* ctrl;     //< Control bytes, allocated along with the keys.
 };
 
+// A range is a lazy arithmetic sequence (from, from + step, ...) which ends
+// before reaching [to], the elements are computed when they're accessed so
+// the length, subscript and contains operations are all O(1).
 struct Range {
   Object _super;
 
   double from; //< Beggining of the range inclusive.
   double to;   //< End of the range exclusive.
+  double step; //< Non zero difference between the consecutive elements.
+};
+
+// Fixed size array of unboxed numbers. The elements are never scanned by the
+// garbage collector and the buffer is exposed to the host application as it
+// is (see pkTypedArrayGetData()).
+struct TypedArray {
+  Object _super;
+
+  PkArrayType type; //< Element type of the array.
+  uint32_t count;   //< Number of elements in the array.
+  void* data;       //< Contiguous buffer of (count * element size) bytes.
 };
 
+// A slot of a script index, see ScriptIndex.
+typedef struct {
+  uint32_t hash;  //< Hash of the element's name (or the literal's value).
+  uint32_t index; //< Index of the element in it's buffer + 1 (0 if empty).
+} ScriptIndexSlot;
+
+// An open addressing hash table of the elements of a script's buffer (names,
+// functions, etc.) to their indexes, to find an element by it's name without
+// comparing it with every element of the buffer. The buffer is the owner of
+// the elements, the index only have their indexes. The new elements of the
+// buffer are indexed when it's searched, if the buffer was truncated (and
+// possibly grown again) the index should be discarded with
+// scriptDiscardIndexes().
+typedef struct {
+  ScriptIndexSlot* slots; //< The slots, allocated with vmRealloc.
+  uint32_t capacity;      //< Number of the slots (power of 2, or 0).
+  uint32_t count;         //< Number of the buffer's elements indexed.
+} ScriptIndex;
+
 struct Script {
   Object _super;
 
@@ -282,6 +402,11 @@ struct Script {
   pkVarBuffer globals;         //< Script level global variables.
   pkUintBuffer global_names;   //< Name map to index in globals.
 
+  // Indexes of the globals which are constants in ascending order. The value
+  // of a constant is set in the globals when it's declared and the compiler
+  // will use the value instead of the global (see scriptGetConstant()).
+  pkUintBuffer constants;
+
   pkFunctionBuffer functions;  //< Functions of the script.
   pkClassBuffer classes;       //< Classes of the script.
 
@@ -290,17 +415,63 @@ struct Script {
 
   Function* body;              //< Script body is an anonymous function.
 
+  // Indexes of the buffers above by the names of the elements. Two literals
+  // are the same if they're the same value or strings with the same content.
+  ScriptIndex names_index;
+  ScriptIndex functions_index;
+  ScriptIndex globals_index;
+  ScriptIndex classes_index;
+  ScriptIndex literals_index;
+
+  // Hash of the source the script was compiled from, used to validate the
+  // script's bytecode cache (0 if not known).
+  uint64_t source_hash;
+
   // When a script has globals, it's body need to be executed to initialize the
   // global values, this will be false if the module isn't initialized yet and
   // we need to execute the script's body whe we're importing it.
   bool initialized;
 };
 
+// Number of values of each call in the inlined calls of a function (see
+// Fn.inlined) which are the start and the end offset of the opcodes of the
+// inlined function, the index of the inlined function in the owner script
+// and the line number of the call.
+#define INLINED_CALL_SIZE 4
+
+// Maximum number of the inline caches of a function (see AttribCache), the
+// attribute accesses after that share the last cache.
+#define MAX_ATTRIB_CACHES 256
+
+// Inline cache of an attribute access instruction (see OP_GET_ATTRIB), which
+// is the index of the field [name] in the instances of the class [type] the
+// instruction accessed last. The field is accessed with the index if the class
+// and the name are the same (the name is checked since the caches are shared
+// after MAX_ATTRIB_CACHES accesses).
+typedef struct {
+  Class* type;    //< Class of the instance accessed last or NULL.
+  String* name;   //< Name of the field in the owner script's names.
+  uint32_t index; //< Index of the field in the instances of the [type].
+} AttribCache;
+
 // Script function pointer.
 typedef struct {
-  pkByteBuffer opcodes;  //< Buffer of opcodes.
-  pkUintBuffer oplines;  //< Line number of opcodes for debug (1 based).
-  int stack_size;        //< Maximum size of stack required.
+  pkByteBuffer opcodes;    //< Buffer of opcodes.
+  pkByteBuffer line_table; //< Encoded line numbers of the opcodes.
+
+  // The calls inlined in the function, so that an error in the opcodes of an
+  // inlined function (which have the line numbers of the inlined function)
+  // could be reported as it was called. A call which was inlined in an
+  // inlined function comes after the call it was inlined in.
+  pkUintBuffer inlined;
+
+  // The inline caches of the attribute access instructions of the function,
+  // which refer to their cache with an index (allocated when the function is
+  // compiled or loaded, see fnInitAttribCaches()).
+  AttribCache* attrib_caches;
+  uint32_t attrib_count; //< Number of the inline caches.
+
+  int stack_size;          //< Maximum size of stack required.
 } Fn;
 
 struct Function {
@@ -377,15 +548,15 @@ struct Class {
   uint32_t name; //< Index of the type's name in the script's name buffer.
 
   Function* ctor; //< The constructor function.
+
+  // The class is the shape of it's instances, the i th field of all the
+  // instances is named field_names[i] and stored at the instance's fields[i].
   pkUintBuffer field_names; //< Buffer of field names.
-  // TODO: ordered names buffer for binary search.
 };
 
-typedef struct {
-  Class* type;        //< Class this instance belongs to.
-  pkVarBuffer fields; //< Var buffer of the instance.
-} Inst;
-
+// A script instance is a single allocation with it's field values stored
+// inline after the header, the number of fields is fixed by the class when
+// the instance is created.
 struct Instance {
   Object _super;
 
@@ -396,8 +567,11 @@ struct Instance {
 
   union {
     void* native;  //< C struct pointer. // TODO:
-    Inst* ins;     //< Module instance pointer.
+    Class* type;   //< Class of the script instance.
   };
+
+  uint32_t field_count; //< Number of fields (0 for native instances).
+  Var fields[DYNAMIC_TAIL_ARRAY];
 };
 
 /*****************************************************************************/
@@ -429,11 +603,21 @@ String* newStringLength(PKVM* vm, const char* text, uint32_t length);
 // Allocate new List and return List*.
 List* newList(PKVM* vm, uint32_t size);
 
+// Allocate new Deque and return Deque*.
+Deque* newDeque(PKVM* vm);
+
 // Allocate new Map and return Map*.
 Map* newMap(PKVM* vm);
 
-// Allocate new Range object and return Range*.
-Range* newRange(PKVM* vm, double from, double to);
+// Allocate new Set and return Set*.
+Set* newSet(PKVM* vm);
+
+// Allocate new Range object and return Range*. The [step] should not be zero.
+Range* newRange(PKVM* vm, double from, double to, double step);
+
+// Allocate new TypedArray of [count] elements of [type] and return
+// TypedArray*. All the elements are initialized to zero.
+TypedArray* newTypedArray(PKVM* vm, PkArrayType type, uint32_t count);
 
 // Allocate new Script object and return Script*, if the argument [is_core] is
 // true the script will be used as a core module and the body of the script
@@ -457,10 +641,9 @@ Fiber* newFiber(PKVM* vm, Function* fn);
 // Allocate new Class object and return Class* with name [name].
 Class* newClass(PKVM* vm, Script* scr, const char* name, uint32_t length);
 
-// Allocate new instance with of the base [type]. Note that if [initialize] is
-// false, the field value buffer of the instance would be un initialized (ie.
-// the buffer count = 0). Otherwise they'll be set to VAR_NULL.
-Instance* newInstance(PKVM* vm, Class* ty, bool initialize);
+// Allocate new instance with of the base [type] with all of it's fields set
+// to VAR_NULL.
+Instance* newInstance(PKVM* vm, Class* ty);
 
 // Allocate new native instance and with [data] as the native type handle and
 // return Instance*. The [id] is the unique id of the instance, this would be
@@ -497,11 +680,45 @@ void markFunctionBuffer(PKVM* vm, pkFunctionBuffer* self);
 // all the reachable objects.
 void popMarkedObjects(PKVM* vm);
 
-// Returns a number list from the range. starts with range.from and ends with
-// (range.to - 1) increase by 1. Note that if the range is reversed
-// (ie. range.from > range.to) It'll return an empty list ([]).
+// Returns the default step of a range from [from] to [to] which is 1 if
+// from <= to, otherwise -1 (reversed range).
+double rangeDefaultStep(double from, double to);
+
+// Returns the number of elements in the range. It's 0 if the step doesn't
+// goes from range.from towards range.to.
+double rangeLength(const Range* self);
+
+// Returns the element at [index] of the range, which should be less than the
+// length of the range.
+double rangeGet(const Range* self, double index);
+
+// Returns true if the [value] is an element of the range.
+bool rangeContains(const Range* self, double value);
+
+// Returns a number list with the elements of the range, which should have at
+// most UINT32_MAX elements.
 List* rangeAsList(PKVM* vm, Range* self);
 
+// Returns the size of a single element of a typed array of [type] in bytes.
+uint32_t typedArrayElementSize(PkArrayType type);
+
+// Returns the element at [index] of the typed array as a number var. The
+// [index] should be less than the count of the array.
+Var typedArrayGet(TypedArray* self, uint32_t index);
+
+// Set the element at [index] of the typed array from the number [value]. If
+// the value is not a number or not in the range of the element type, it'll
+// set a runtime error to the VM and return false.
+bool typedArraySet(PKVM* vm, TypedArray* self, uint32_t index, Var value);
+
+// Returns a new typed array of the same type with the elements from [from]
+// (inclusive) to [to] (exclusive) copied, assuming from <= to <= count.
+TypedArray* typedArraySlice(PKVM* vm, TypedArray* self,
+                            uint32_t from, uint32_t to);
+
+// Returns a new list with the elements of the typed array.
+List* typedArrayAsList(PKVM* vm, TypedArray* self);
+
 // Returns a lower case version of the given string. If the string is
 // already lower it'll return the same string.
 String* stringLower(PKVM* vm, String* self);
@@ -514,6 +731,22 @@ String* stringUpper(PKVM* vm, String* self);
 // If the string is already trimmed it'll return the same string.
 String* stringStrip(PKVM* vm, String* self);
 
+// Returns the number of UTF-8 codepoints in the string. For all ASCII strings
+// it's the same as it's length.
+uint32_t stringCodepointCount(PKVM* vm, String* self);
+
+// Returns the byte offset of the [index] th codepoint of the string, where
+// [index] should be less than or equal to the codepoint count (the count
+// returns the length of the string). All ASCII strings are indexed in O(1)
+// and UTF-8 strings are indexed using the cached breadcrumbs and the last
+// accessed position, which makes sequential and near-sequential access
+// amortized O(1).
+uint32_t stringCodepointOffset(PKVM* vm, String* self, uint32_t index);
+
+// Returns the number of bytes of the codepoint starting at the byte [offset]
+// of the string. Invalid sequences are treated as single byte codepoints.
+uint32_t stringCodepointWidth(const String* self, uint32_t offset);
+
 // Creates a new string from the arguments. This is intended for internal
 // usage and it has 2 formated characters (just like wren does).
 // $ - a C string
@@ -546,6 +779,27 @@ Var listRemoveAt(PKVM* vm, List* self, uint32_t index);
 // Create a new list by joining the 2 given list and return the result.
 List* listJoin(PKVM* vm, List* l1, List* l2);
 
+// Create a new list with the elements of the [list] followed by the elements
+// of the [range] and return the result. The joined list should have at most
+// UINT32_MAX elements.
+List* listJoinRange(PKVM* vm, List* list, Range* range);
+
+// Returns a pointer to the element at [index] of the deque, where the index
+// should be less than the count of the deque.
+Var* dequeAt(Deque* self, uint32_t index);
+
+// Add the [value] to the end of the deque.
+void dequePushBack(PKVM* vm, Deque* self, Var value);
+
+// Add the [value] to the beginning of the deque.
+void dequePushFront(PKVM* vm, Deque* self, Var value);
+
+// Remove and return the last element of the non empty deque.
+Var dequePopBack(Deque* self);
+
+// Remove and return the first element of the non empty deque.
+Var dequePopFront(Deque* self);
+
 // Returns the value for the [key] in the map. If key not exists return
 // VAR_UNDEFINED.
 Var mapGet(Map* self, Var key);
@@ -556,10 +810,43 @@ void mapSet(PKVM* vm, Map* self, Var key, Var value);
 // Remove all the entries from the map.
 void mapClear(PKVM* vm, Map* self);
 
+// Get the next entry of the map starting from the iteration index [iter]
+// (should be 0 for the first entry) and set it to [key] and [value] (if
+// they're not NULL), then update [iter] for the next call. Returns false if
+// there is no more entries. The array part entries are iterated first (in
+// the order of the keys) and then the hash part entries.
+bool mapIterate(const Map* self, uint32_t* iter, Var* key, Var* value);
+
 // Remove the [key] from the map. If the key exists return it's value
 // otherwise return VAR_NULL.
 Var mapRemoveKey(PKVM* vm, Map* self, Var key);
 
+// Returns true if the [key] exists in the set (false if it's not hashable).
+bool setContains(const Set* self, Var key);
+
+// Add the [key] to the set, returns false if it already exists.
+bool setAdd(PKVM* vm, Set* self, Var key);
+
+// Remove the [key] from the set, returns false if it doesn't exists.
+bool setRemove(PKVM* vm, Set* self, Var key);
+
+// Remove all the keys from the set.
+void setClear(PKVM* vm, Set* self);
+
+// Get the next key of the set starting from the iteration index [iter]
+// (should be 0 for the first key) and update [iter] for the next call.
+// Returns false if there is no more keys.
+bool setIterate(const Set* self, uint32_t* iter, Var* key);
+
+// Returns a new set with the keys of both [s1] and [s2].
+Set* setUnion(PKVM* vm, const Set* s1, const Set* s2);
+
+// Returns a new set with the keys which exists in both [s1] and [s2].
+Set* setIntersection(PKVM* vm, const Set* s1, const Set* s2);
+
+// Returns a new set with the keys of [s1] which doesn't exists in [s2].
+Set* setDifference(PKVM* vm, const Set* s1, const Set* s2);
+
 // Returns true if the fiber has error, and if it has any the fiber cannot be
 // resumed anymore.
 bool fiberHasError(Fiber* fiber);
@@ -571,27 +858,78 @@ uint32_t scriptAddName(Script* self, PKVM* vm, const char* name,
 
 // Search for the type name in the script and return it's index in it's
 // [classes] buffer. If not found returns -1.
-int scriptGetClass(Script* script, const char* name, uint32_t length);
+int scriptGetClass(PKVM* vm, Script* script, const char* name,
+                   uint32_t length);
 
 // Search for the function name in the script and return it's index in it's
 // [functions] buffer. If not found returns -1.
-int scriptGetFunc(Script* script, const char* name, uint32_t length);
+int scriptGetFunc(PKVM* vm, Script* script, const char* name,
+                  uint32_t length);
 
 // Search for the global variable name in the script and return it's index in
 // it's [globals] buffer. If not found returns -1.
-int scriptGetGlobals(Script* script, const char* name, uint32_t length);
+int scriptGetGlobals(PKVM* vm, Script* script, const char* name,
+                     uint32_t length);
+
+// Search for the [value] in the script's [literals] buffer and return it's
+// index, a string is found if a literal has the same content. If not found
+// returns -1.
+int scriptGetLiteral(PKVM* vm, Script* script, Var value);
+
+// Search for a string literal with the [length] chars at [data] in the
+// script's [literals] buffer and return it's index. If not found returns -1.
+int scriptGetStringLiteral(PKVM* vm, Script* script, const char* data,
+                           uint32_t length);
+
+// Discard the indexes of the script's buffers, it should be called when any
+// of the buffers are truncated (ie. a compilation failed) since the elements
+// at the same indexes may not be the same once they're grown again.
+void scriptDiscardIndexes(Script* script);
 
 // Add a global [value] to the [scrpt] and return its index.
 uint32_t scriptAddGlobal(PKVM* vm, Script* script,
                          const char* name, uint32_t length,
                          Var value);
 
+// Make the global at [index] a constant of the [value], which should be
+// greater than the index of the script's other constants.
+void scriptAddConstant(PKVM* vm, Script* script, uint32_t index, Var value);
+
+// Returns true if the global at [index] of the script is a constant and set
+// it's value to [value].
+bool scriptGetConstant(const Script* script, uint32_t index, Var* value);
+
 // This will allocate a new implicit main function for the script and assign to
 // the script's body attribute. And the attribute initialized will be set to
 // false for the new function. Note that the body of the script should be NULL
 // before calling this function.
 void scriptAddMain(PKVM* vm, Script* script);
 
+// Encode the line numbers of each byte of the opcodes ([lines] of [count]
+// values, 1 based) to the line table of the [fn]. The table is a sequence of
+// runs of bytes on the same line, each run is the difference of it's line
+// from the previous run's line (zigzag encoded) followed by the number of
+// bytes in the run, both written as variable length integers (7 bits per
+// byte and the high bit is set if more bytes follow). So a line costs about
+// 2 bytes instead of 4 bytes for each byte of it's opcodes.
+void fnSetLines(PKVM* vm, Fn* fn, const uint32_t* lines, uint32_t count);
+
+// Returns the line number of the opcode at the [offset] of the [fn] by
+// decoding it's line table.
+uint32_t fnGetLine(const Fn* fn, uint32_t offset);
+
+// Decode the line table of the [fn] and write the line number of each byte
+// of it's opcodes to [lines], which should have room for all the opcodes.
+void fnGetLines(const Fn* fn, uint32_t* lines);
+
+// Allocate [count] empty inline caches for the attribute accesses of the [fn]
+// (see AttribCache), the previous caches of the function will be freed.
+void fnInitAttribCaches(PKVM* vm, Fn* fn, uint32_t count);
+
+// Returns the index of the field named [name] in the instances of the class
+// or -1 if the class doesn't have a field with the name.
+int classFieldIndex(Class* self, String* name);
+
 // Get the attribut from the instance and set it [value]. On success return
 // true, if the attribute not exists it'll return false but won't set an error.
 bool instGetAttrib(PKVM* vm, Instance* inst, String* attrib, Var* value);
@@ -609,10 +947,12 @@ void freeObject(PKVM* vm, Object* self);
 /* UTILITY FUNCTIONS                                                         */
 /*****************************************************************************/
 
-// Internal method behind VAR_NUM(value) don't use it directly.
+// Internal method behind VAR_NUM(value) don't use it directly. If the value
+// is a whole number in the 32 bit integer range it'll return an integer var.
 Var doubleToVar(double value);
 
-// Internal method behind AS_NUM(value) don't use it directly.
+// Internal method behind AS_NUM(value) don't use it directly. Integer vars
+// are converted to double.
 double varToDouble(Var value);
 
 // Returns the type name of the PkVarType enum value.
@@ -621,6 +961,9 @@ const char* getPkVarTypeName(PkVarType type);
 // Returns the type name of the ObjectType enum value.
 const char* getObjectTypeName(ObjectType type);
 
+// Returns the type name of the typed array's element type.
+const char* getArrayTypeName(PkArrayType type);
+
 // Returns the type name of the var [v].
 const char* varTypeName(Var v);
 
@@ -630,8 +973,10 @@ bool isValuesSame(Var v1, Var v2);
 // Returns true if both variables are equal (ie v1 == v2).
 bool isValuesEqual(Var v1, Var v2);
 
-// Return the hash value of the variable. (variable should be hashable).
-uint32_t varHashValue(Var v);
+// Return the hash value of the variable. (variable should be hashable). If
+// it's an object compared by it's identity, a hash is assigned to it from the
+// vm's counter the first time it's hashed.
+uint32_t varHashValue(PKVM* vm, Var v);
 
 // Return true if the object type is hashable.
 bool isObjectHashable(ObjectType type);
@@ -6,6 +6,7 @@
 #include "pk_vm.h"
 
 #include <math.h>
+#include "pk_cache.h"
 #include "pk_core.h"
 #include "pk_utils.h"
 #include "pk_debug.h"
@@ -37,6 +38,9 @@ PkConfiguration pkNewConfiguration(void) {
 
   config.load_script_fn = NULL;
   config.resolve_path_fn = NULL;
+  config.load_cache_fn = NULL;
+  config.write_cache_fn = NULL;
+  config.read_chunk_fn = NULL;
   config.user_data = NULL;
 
   return config;
@@ -131,8 +135,10 @@ void pkReleaseHandle(PKVM* vm, PkHandle* handle) {
 
 // This function is responsible to call on_done function if it's done with the
 // provided string pointers.
-PkResult pkInterpretSource(PKVM* vm, PkStringPtr source, PkStringPtr path,
-                           const PkCompileOptions* options) {
+// Compile the [source] to the script at the [path] (if the vm doesn't have
+// the script a new one will be created) and set it to [scr].
+static PkResult compileSource(PKVM* vm, PkStringPtr source, PkStringPtr path,
+                              const PkCompileOptions* options, Script** scr) {
 
   String* path_name = newString(vm, path.string);
   if (path.on_done) path.on_done(vm, path);
@@ -141,6 +147,56 @@ PkResult pkInterpretSource(PKVM* vm, PkStringPtr source, PkStringPtr path,
   // TODO: Should I clean the script if it already exists before compiling it?
 
   // Load a new script to the vm's scripts cache.
+  bool is_new = false;
+  Script* script = vmGetScript(vm, path_name);
+  if (script == NULL) {
+    script = newScript(vm, path_name, false);
+    vmPushTempRef(vm, &script->_super); // script.
+    mapSet(vm, vm->scripts, VAR_OBJ(path_name), VAR_OBJ(script));
+    vmPopTempRef(vm); // script.
+    is_new = true;
+  }
+  vmPopTempRef(vm); // path_name.
+  *scr = script;
+
+  // Compile the source. Only a new script could be loaded from the bytecode
+  // cache, an existing script will be compiled on top of what it has.
+  PkResult result = (is_new)
+                  ? compileCached(vm, script, source.string, options)
+                  : compile(vm, script, source.string, options);
+  if (source.on_done) source.on_done(vm, source);
+  return result;
+}
+
+PkResult pkInterpretSource(PKVM* vm, PkStringPtr source, PkStringPtr path,
+                           const PkCompileOptions* options) {
+
+  Script* scr;
+  PkResult result = compileSource(vm, source, path, options, &scr);
+  if (result != PK_RESULT_SUCCESS) return result;
+
+  // Set script initialized to true before the execution ends to prevent cyclic
+  // inclusion cause a crash.
+  scr->initialized = true;
+
+  return runFiber(vm, newFiber(vm, scr->body));
+}
+
+PkResult pkCompileSource(PKVM* vm, PkStringPtr source, PkStringPtr path,
+                         const PkCompileOptions* options) {
+  Script* scr;
+  return compileSource(vm, source, path, options, &scr);
+}
+
+PkResult pkInterpretStream(PKVM* vm, void* stream, PkStringPtr path,
+                           const PkCompileOptions* options) {
+  __ASSERT(vm->config.read_chunk_fn != NULL,
+           "The read_chunk_fn wasn't set in the configuration.");
+
+  String* path_name = newString(vm, path.string);
+  if (path.on_done) path.on_done(vm, path);
+  vmPushTempRef(vm, &path_name->_super); // path_name.
+
   Script* scr = vmGetScript(vm, path_name);
   if (scr == NULL) {
     scr = newScript(vm, path_name, false);
@@ -150,15 +206,41 @@ PkResult pkInterpretSource(PKVM* vm, PkStringPtr source, PkStringPtr path,
   }
   vmPopTempRef(vm); // path_name.
 
-  // Compile the source.
-  PkResult result = compile(vm, scr, source.string, options);
-  if (source.on_done) source.on_done(vm, source);
+  PkResult result = compileStream(vm, scr, stream, options);
   if (result != PK_RESULT_SUCCESS) return result;
 
-  // Set script initialized to true before the execution ends to prevent cyclic
-  // inclusion cause a crash.
   scr->initialized = true;
+  return runFiber(vm, newFiber(vm, scr->body));
+}
+
+PkResult pkInterpretBytecode(PKVM* vm, PkStringPtr bytecode,
+                             PkStringPtr path,
+                             const PkCompileOptions* options) {
 
+  String* path_name = newString(vm, path.string);
+  if (path.on_done) path.on_done(vm, path);
+  vmPushTempRef(vm, &path_name->_super); // path_name.
+
+  Script* scr = newScript(vm, path_name, false);
+  vmPushTempRef(vm, &scr->_super); // scr.
+  mapSet(vm, vm->scripts, VAR_OBJ(path_name), VAR_OBJ(scr));
+  vmPopTempRef(vm); // scr.
+  vmPopTempRef(vm); // path_name.
+
+  bool debug = options != NULL && options->debug;
+  bool loaded = cacheLoadScript(vm, scr, (const uint8_t*)bytecode.string,
+                                bytecode.length, debug, false);
+  if (bytecode.on_done) bytecode.on_done(vm, bytecode);
+
+  if (!loaded) {
+    if (vm->config.error_fn != NULL) {
+      vm->config.error_fn(vm, PK_ERROR_COMPILE, scr->path->data, 1,
+                          "Invalid or incompatible bytecode.");
+    }
+    return PK_RESULT_COMPILE_ERROR;
+  }
+
+  scr->initialized = true;
   return runFiber(vm, newFiber(vm, scr->body));
 }
 
@@ -543,9 +625,14 @@ static inline void pushCallFrame(PKVM* vm, const Function* fn, Var* rbp) {
     vm->fiber->frame_capacity = new_capacity;
   }
 
-  // Grow the stack if needed.
+  // Grow the stack if needed. The [rbp] points to a slot in the current stack
+  // so it needs to be mapped to the new stack if it's moved.
   int needed = fn->fn->stack_size + (int)(vm->fiber->sp - vm->fiber->stack);
-  if (vm->fiber->stack_size <= needed) growStack(vm, needed);
+  if (vm->fiber->stack_size <= needed) {
+    int offset = (int)(rbp - vm->fiber->stack);
+    growStack(vm, needed);
+    rbp = vm->fiber->stack + offset;
+  }
 
   CallFrame* frame = vm->fiber->frames + vm->fiber->frame_count++;
   frame->rbp = rbp;
@@ -594,12 +681,68 @@ static void reportError(PKVM* vm) {
     CallFrame* frame = &fiber->frames[i];
     const Function* fn = frame->fn;
     ASSERT(!fn->is_native, OOPS);
-    int line = fn->fn->oplines.data[frame->ip - fn->fn->opcodes.data - 1];
+    uint32_t offset = (uint32_t)(frame->ip - fn->fn->opcodes.data - 1);
+    int line = (int)fnGetLine(fn->fn, offset);
+
+    // If the error is in an inlined function, it's reported as it was called
+    // from the innermost inlined call to the outermost one.
+    const pkUintBuffer* inlined = &fn->fn->inlined;
+    for (uint32_t j = inlined->count; j > 0; j -= INLINED_CALL_SIZE) {
+      const uint32_t* call = inlined->data + j - INLINED_CALL_SIZE;
+      if (offset < call[0] || call[1] <= offset) continue;
+      const Function* callee = fn->owner->functions.data[call[2]];
+      vm->config.error_fn(vm, PK_ERROR_STACKTRACE, fn->owner->path->data,
+                          line, callee->name);
+      line = (int)call[3];
+    }
+
     vm->config.error_fn(vm, PK_ERROR_STACKTRACE, fn->owner->path->data, line,
                         fn->name);
   }
 }
 
+// Returns the index of the entry for the [value] in the jump table of a
+// match statement (0 is the default entry), where the [table] is a range of
+// the dense integer cases. A whole number in the range of the table is
+// always stored as an integer.
+static inline uint32_t switchTableEntry(const Range* table, Var value) {
+  if (!IS_INT(value)) return 0;
+  double num = (double)AS_INT(value);
+  if (num < table->from || num >= table->to) return 0;
+  return (uint32_t)(num - table->from) + 1;
+}
+
+// Same as switchTableEntry() but the [table] is a map of the case values to
+// the index of their entries.
+static inline uint32_t switchMapEntry(Map* table, Var value) {
+  if (IS_OBJ(value) && !isObjectHashable(AS_OBJ(value)->type)) return 0;
+  Var entry = mapGet(table, value);
+  if (IS_UNDEF(entry)) return 0;
+  return (uint32_t)AS_NUM(entry);
+}
+
+// Returns the index of the field [name] of the [on] value if it's a script
+// instance, using the inline [cache] of the instruction (see AttribCache), or
+// -1 if it's not an instance or doesn't have the field. Only the first access
+// of a class at the instruction needs to look up the field.
+static inline int attribCacheField(AttribCache* cache, Var on, String* name) {
+  if (!IS_OBJ_TYPE(on, OBJ_INST)) return -1;
+  Instance* inst = (Instance*)AS_OBJ(on);
+  if (inst->is_native) return -1;
+
+  if (cache->type == inst->type && cache->name == name) {
+    return (int)cache->index;
+  }
+
+  int index = classFieldIndex(inst->type, name);
+  if (index != -1) {
+    cache->type = inst->type;
+    cache->name = name;
+    cache->index = (uint32_t)index;
+  }
+  return index;
+}
+
 /******************************************************************************
  * RUNTIME                                                                    *
  *****************************************************************************/
@@ -620,6 +763,14 @@ static PkResult runFiber(PKVM* vm, Fiber* fiber) {
   register CallFrame* frame; //< Current call frame.
   register Script* script;   //< Currently executing script.
 
+  // The exit address offset of the OP_ITER instruction, which is read before
+  // the iteration (either a short or an int if it's prefixed with OP_WIDE).
+  uint32_t iter_exit;
+
+  // Number of arguments of a call, which is read before the call (it's not
+  // a parameter of the OP_CALL_INTRINSIC instruction).
+  uint8_t call_argc;
+
 #if DEBUG
   #define PUSH(value)                                                        \
   do {                                                                       \
@@ -636,6 +787,16 @@ static PkResult runFiber(PKVM* vm, Fiber* fiber) {
 #define PEEK(off)    (*(vm->fiber->sp + (off)))
 #define READ_BYTE()  (*ip++)
 #define READ_SHORT() (ip+=2, (uint16_t)((ip[-2] << 8) | ip[-1]))
+#define READ_INT()   (ip+=4, ((uint32_t)ip[-4] << 24) | (ip[-3] << 16) | \
+                             (ip[-2] << 8) | ip[-1])
+
+// Read the index of the inline cache of an attribute access instruction and
+// returns the cache of the current function (see AttribCache).
+#define READ_ATTRIB_CACHE() (&frame->fn->fn->attrib_caches[READ_BYTE()])
+
+// Size of an entry of the jump table at [ip] which follows a switch
+// instruction, the entries are jumps of the same size.
+#define SWITCH_ENTRY_SIZE(ip) (((ip)[0] == OP_WIDE) ? 6 : 3)
 
 // Switch back to the caller of the current fiber, will be called when we're
 // done with the fiber or aborting it for runtime errors.
@@ -726,7 +887,7 @@ static PkResult runFiber(PKVM* vm, Fiber* fiber) {
       DISPATCH();
 
     OPCODE(PUSH_0):
-      PUSH(VAR_NUM(0));
+      PUSH(VAR_INT(0));
       DISPATCH();
 
     OPCODE(PUSH_TRUE):
@@ -763,7 +924,7 @@ static PkResult runFiber(PKVM* vm, Fiber* fiber) {
     {
       uint8_t index = READ_BYTE();
       ASSERT_INDEX(index, script->classes.count);
-      Instance* inst = newInstance(vm, script->classes.data[index], false);
+      Instance* inst = newInstance(vm, script->classes.data[index]);
       PUSH(VAR_OBJ(inst));
       DISPATCH();
     }
@@ -798,17 +959,16 @@ static PkResult runFiber(PKVM* vm, Fiber* fiber) {
       DISPATCH();
     }
 
-    OPCODE(INST_APPEND):
+    OPCODE(INST_INIT_FIELD):
     {
-      Var value = PEEK(-1); // Don't pop yet, we need the reference for gc.
+      uint16_t index = READ_SHORT();
       Var inst = PEEK(-2);
       ASSERT(IS_OBJ_TYPE(inst, OBJ_INST), OOPS);
 
       Instance* inst_p = (Instance*)AS_OBJ(inst);
       ASSERT(!inst_p->is_native, OOPS);
-      Inst* ins = inst_p->ins;
-      pkVarBufferWrite(&ins->fields, vm, value);
-      DROP(); // value
+      ASSERT_INDEX(index, inst_p->field_count);
+      inst_p->fields[index] = POP();
 
       DISPATCH();
     }
@@ -938,8 +1098,10 @@ static PkResult runFiber(PKVM* vm, Fiber* fiber) {
 
     OPCODE(CALL):
     OPCODE(TAIL_CALL):
+      call_argc = READ_BYTE();
+    L_do_call:
     {
-      const uint8_t argc = READ_BYTE();
+      const uint8_t argc = call_argc;
 
       // The call might change the vm->fiber so we need the reference to the
       // fiber that actually called the function.
@@ -1002,14 +1164,12 @@ static PkResult runFiber(PKVM* vm, Fiber* fiber) {
 
       } else {
 
-        if (instruction == OP_CALL) {
+        if (instruction != OP_TAIL_CALL) { //< OP_CALL or OP_CALL_INTRINSIC.
           UPDATE_FRAME(); //< Update the current frame's ip.
           pushCallFrame(vm, fn, callable);
           LOAD_FRAME();  //< Load the top frame to vm's execution variables.
 
         } else {
-          ASSERT(instruction == OP_TAIL_CALL, OOPS);
-
           reuseCallFrame(vm, fn);
           LOAD_FRAME();  //< Re-load the frame to vm's execution variables.
         }
@@ -1018,6 +1178,45 @@ static PkResult runFiber(PKVM* vm, Fiber* fiber) {
       DISPATCH();
     }
 
+    OPCODE(CALL_INTRINSIC):
+    {
+      Intrinsic intrinsic = (Intrinsic)READ_BYTE();
+      call_argc = (uint8_t)getIntrinsicArity(intrinsic);
+
+      // If the callable isn't the intrinsic's function anymore (the variable
+      // was reassigned) or the arguments aren't numbers, call it as usual
+      // to get the same result (or error) of the function.
+      Var* callable = vm->fiber->sp - call_argc - 1;
+      if (!IS_OBJ_TYPE(*callable, OBJ_FUNC)) goto L_do_call;
+      const Function* fn = (const Function*)AS_OBJ(*callable);
+      if (!fn->is_native || fn->native != getIntrinsicFn(intrinsic)) {
+        goto L_do_call;
+      }
+
+      Var* args = callable + 1;
+      if (!IS_NUM(args[0])) goto L_do_call;
+      if (call_argc == 2 && !IS_NUM(args[1])) goto L_do_call;
+
+      double num = AS_NUM(args[0]);
+      switch (intrinsic) {
+        case INTRINSIC_FLOOR: num = floor(num); break;
+        case INTRINSIC_CEIL:  num = ceil(num);  break;
+        case INTRINSIC_SQRT:  num = sqrt(num);  break;
+        case INTRINSIC_ABS:   if (num < 0) num = -num; break;
+        case INTRINSIC_SIN:   num = sin(num);   break;
+        case INTRINSIC_COS:   num = cos(num);   break;
+        case INTRINSIC_ROUND: num = round(num); break;
+        case INTRINSIC_POW:   num = pow(num, AS_NUM(args[1])); break;
+
+        default:
+          UNREACHABLE();
+      }
+
+      vm->fiber->sp = callable;
+      PUSH(VAR_NUM(num));
+      DISPATCH();
+    }
+
     OPCODE(ITER_TEST):
     {
       Var seq = PEEK(-3);
@@ -1039,77 +1238,107 @@ static PkResult runFiber(PKVM* vm, Fiber* fiber) {
     }
 
     OPCODE(ITER):
+      iter_exit = READ_SHORT();
+    L_do_iter:
     {
       Var* value    = (vm->fiber->sp - 1);
       Var* iterator = (vm->fiber->sp - 2);
       Var seq       = PEEK(-3);
-      uint16_t jump_offset = READ_SHORT();
 
     #define JUMP_ITER_EXIT() \
       do {                   \
-        ip += jump_offset;   \
+        ip += iter_exit;     \
         DISPATCH();          \
       } while (false)
 
-      ASSERT(IS_NUM(*iterator), OOPS);
-      double it = AS_NUM(*iterator); //< Nth iteration.
-      ASSERT(AS_NUM(*iterator) == (int32_t)trunc(it), OOPS);
+      // The iterator is an integer counter (or the byte offset for strings)
+      // which starts from 0 (pushed by PUSH_0). Only the iterator of a range
+      // could be a double, once it's past INT32_MAX.
+      ASSERT(IS_INT(*iterator) || IS_OBJ_TYPE(seq, OBJ_RANGE), OOPS);
+      int32_t it = AS_INT(*iterator); //< Nth iteration.
 
       Object* obj = AS_OBJ(seq);
       switch (obj->type) {
 
         case OBJ_STRING: {
-          uint32_t iter = (int32_t)trunc(it);
+          // The iterator of a string is the byte offset of the next codepoint
+          // (not the codepoint index) so we don't have to walk the string.
+          uint32_t iter = (uint32_t)it;
 
-          // TODO: // Need to consider utf8.
           String* str = ((String*)obj);
           if (iter >= str->length) JUMP_ITER_EXIT();
 
           //TODO: vm's char (and reusable) strings.
-          *value = VAR_OBJ(newStringLength(vm, str->data + iter, 1));
-          *iterator = VAR_NUM((double)iter + 1);
+          uint32_t width = stringCodepointWidth(str, iter);
+          *value = VAR_OBJ(newStringLength(vm, str->data + iter, width));
+          *iterator = VAR_INT(iter + width);
 
         } DISPATCH();
 
         case OBJ_LIST: {
-          uint32_t iter = (int32_t)trunc(it);
+          uint32_t iter = (uint32_t)it;
           pkVarBuffer* elems = &((List*)obj)->elements;
           if (iter >= elems->count) JUMP_ITER_EXIT();
           *value = elems->data[iter];
-          *iterator = VAR_NUM((double)iter + 1);
+          *iterator = VAR_INT(iter + 1);
 
         } DISPATCH();
 
         case OBJ_MAP: {
-          uint32_t iter = (int32_t)trunc(it);
+          uint32_t iter = (uint32_t)it;
 
           Map* map = (Map*)obj;
-          if (map->entries == NULL) JUMP_ITER_EXIT();
-          MapEntry* e = map->entries + iter;
-          for (; iter < map->capacity; iter++, e++) {
-            if (!IS_UNDEF(e->key)) break;
-          }
-          if (iter >= map->capacity) JUMP_ITER_EXIT();
+          Var key;
+          if (!mapIterate(map, &iter, &key, NULL)) JUMP_ITER_EXIT();
+
+          *value = key;
+          *iterator = VAR_INT(iter);
+
+        } DISPATCH();
 
-          *value = map->entries[iter].key;
-          *iterator = VAR_NUM((double)iter + 1);
+        case OBJ_DEQUE: {
+          uint32_t iter = (uint32_t)it;
+          Deque* deque = (Deque*)obj;
+          if (iter >= deque->count) JUMP_ITER_EXIT();
+          *value = *dequeAt(deque, iter);
+          *iterator = VAR_INT(iter + 1);
+
+        } DISPATCH();
+
+        case OBJ_SET: {
+          uint32_t iter = (uint32_t)it;
+          Var key;
+          if (!setIterate((Set*)obj, &iter, &key)) JUMP_ITER_EXIT();
+
+          *value = key;
+          *iterator = VAR_INT(iter);
+
+        } DISPATCH();
+
+        case OBJ_TYPED_ARRAY: {
+          uint32_t iter = (uint32_t)it;
+          TypedArray* array = (TypedArray*)obj;
+          if (iter >= array->count) JUMP_ITER_EXIT();
+          *value = typedArrayGet(array, iter);
+          *iterator = VAR_INT(iter + 1);
 
         } DISPATCH();
 
         case OBJ_RANGE: {
-          double from = ((Range*)obj)->from;
-          double to = ((Range*)obj)->to;
-          if (from == to) JUMP_ITER_EXIT();
-
-          double current;
-          if (from <= to) { //< Straight range.
-            current = from + it;
-          } else {          //< Reversed range.
-            current = from - it;
+          const Range* range = (const Range*)obj;
+          if (IS_INT(*iterator) && it < INT32_MAX) {
+            if ((double)it >= rangeLength(range)) JUMP_ITER_EXIT();
+            *value = VAR_NUM(rangeGet(range, it));
+            *iterator = VAR_INT(it + 1);
+            DISPATCH();
           }
-          if (current == to) JUMP_ITER_EXIT();
-          *value = VAR_NUM(current);
-          *iterator = VAR_NUM(it + 1);
+
+          // A range could have more than INT32_MAX elements, the iterator
+          // continues as a double.
+          double iter = AS_NUM(*iterator);
+          if (iter >= rangeLength(range)) JUMP_ITER_EXIT();
+          *value = VAR_NUM(rangeGet(range, iter));
+          *iterator = VAR_NUM(iter + 1);
 
         } DISPATCH();
 
@@ -1160,6 +1389,30 @@ static PkResult runFiber(PKVM* vm, Fiber* fiber) {
       DISPATCH();
     }
 
+    OPCODE(SWITCH_TABLE):
+    {
+      uint16_t index = READ_SHORT();
+      ASSERT_INDEX(index, script->literals.count);
+      Var table = script->literals.data[index];
+      ASSERT(IS_OBJ_TYPE(table, OBJ_RANGE), OOPS);
+
+      uint32_t entry = switchTableEntry((Range*)AS_OBJ(table), POP());
+      ip += entry * SWITCH_ENTRY_SIZE(ip);
+      DISPATCH();
+    }
+
+    OPCODE(SWITCH_MAP):
+    {
+      uint16_t index = READ_SHORT();
+      ASSERT_INDEX(index, script->literals.count);
+      Var table = script->literals.data[index];
+      ASSERT(IS_OBJ_TYPE(table, OBJ_MAP), OOPS);
+
+      uint32_t entry = switchMapEntry((Map*)AS_OBJ(table), POP());
+      ip += entry * SWITCH_ENTRY_SIZE(ip);
+      DISPATCH();
+    }
+
     OPCODE(RETURN):
     {
 
@@ -1197,6 +1450,44 @@ static PkResult runFiber(PKVM* vm, Fiber* fiber) {
     {
       Var on = PEEK(-1); // Don't pop yet, we need the reference for gc.
       String* name = script->names.data[READ_SHORT()];
+      AttribCache* cache = READ_ATTRIB_CACHE();
+
+      int index = attribCacheField(cache, on, name);
+      if (index != -1) {
+        DROP(); // on
+        PUSH(((Instance*)AS_OBJ(on))->fields[index]);
+        DISPATCH();
+      }
+
+      Var value = varGetAttrib(vm, on, name);
+      DROP(); // on
+      PUSH(value);
+
+      CHECK_ERROR();
+      DISPATCH();
+    }
+
+    OPCODE(GET_MODULE_FN):
+    {
+      Var on = PEEK(-1); // Don't pop yet, we need the reference for gc.
+      String* name = script->names.data[READ_SHORT()];
+      uint32_t index = READ_BYTE();
+
+      // Check if the function at the index is still the attribute, since the
+      // module variable could be assigned to something else at runtime.
+      if (IS_OBJ_TYPE(on, OBJ_SCRIPT)) {
+        Script* module = (Script*)AS_OBJ(on);
+        if (index < module->functions.count) {
+          Function* fn = module->functions.data[index];
+          if (strncmp(fn->name, name->data, name->length) == 0 &&
+              fn->name[name->length] == '\0') {
+            DROP(); // on
+            PUSH(VAR_OBJ(fn));
+            DISPATCH();
+          }
+        }
+      }
+
       Var value = varGetAttrib(vm, on, name);
       DROP(); // on
       PUSH(value);
@@ -1209,6 +1500,14 @@ static PkResult runFiber(PKVM* vm, Fiber* fiber) {
     {
       Var on = PEEK(-1);
       String* name = script->names.data[READ_SHORT()];
+      AttribCache* cache = READ_ATTRIB_CACHE();
+
+      int index = attribCacheField(cache, on, name);
+      if (index != -1) {
+        PUSH(((Instance*)AS_OBJ(on))->fields[index]);
+        DISPATCH();
+      }
+
       PUSH(varGetAttrib(vm, on, name));
       CHECK_ERROR();
       DISPATCH();
@@ -1219,7 +1518,14 @@ static PkResult runFiber(PKVM* vm, Fiber* fiber) {
       Var value = PEEK(-1); // Don't pop yet, we need the reference for gc.
       Var on = PEEK(-2);    // Don't pop yet, we need the reference for gc.
       String* name = script->names.data[READ_SHORT()];
-      varSetAttrib(vm, on, name, value);
+      AttribCache* cache = READ_ATTRIB_CACHE();
+
+      int index = attribCacheField(cache, on, name);
+      if (index != -1) {
+        ((Instance*)AS_OBJ(on))->fields[index] = value;
+      } else {
+        varSetAttrib(vm, on, name, value);
+      }
 
       DROP(); // value
       DROP(); // on
@@ -1269,6 +1575,10 @@ static PkResult runFiber(PKVM* vm, Fiber* fiber) {
     OPCODE(NEGATIVE):
     {
       Var num = POP();
+      if (IS_INT(num) && AS_INT(num) != INT32_MIN) {
+        PUSH(VAR_INT(-AS_INT(num)));
+        DISPATCH();
+      }
       if (!IS_NUM(num)) {
         RUNTIME_ERROR(newString(vm, "Can not negate a non numeric value."));
       }
@@ -1492,7 +1802,8 @@ static PkResult runFiber(PKVM* vm, Fiber* fiber) {
       }
       DROP(); // to
       DROP(); // from
-      PUSH(VAR_OBJ(newRange(vm, AS_NUM(from), AS_NUM(to))));
+      double _from = AS_NUM(from), _to = AS_NUM(to);
+      PUSH(VAR_OBJ(newRange(vm, _from, _to, rangeDefaultStep(_from, _to))));
       DISPATCH();
     }
 
@@ -1507,6 +1818,77 @@ static PkResult runFiber(PKVM* vm, Fiber* fiber) {
       DISPATCH();
     }
 
+    // The operands of the instructions below are known to be numbers at
+    // compile time, they produce the same result as the generic operators
+    // (an integer result that overflows is promoted to a double).
+
+  #define NUMBER_OPERANDS()                   \
+    Var r = POP(), l = POP();                 \
+    ASSERT(IS_NUM(l) && IS_NUM(r), OOPS)
+
+  #define NUMBER_ARITHMETIC(op)                                       \
+    do {                                                              \
+      NUMBER_OPERANDS();                                              \
+      if (IS_INT(l) && IS_INT(r)) {                                   \
+        int64_t value = (int64_t)AS_INT(l) op (int64_t)AS_INT(r);     \
+        if (INT32_MIN <= value && value <= INT32_MAX) {               \
+          PUSH(VAR_INT(value));                                       \
+          DISPATCH();                                                 \
+        }                                                             \
+      }                                                               \
+      PUSH(VAR_NUM(AS_NUM(l) op AS_NUM(r)));                          \
+      DISPATCH();                                                     \
+    } while (false)
+
+  #define NUMBER_COMPARE(op)                                          \
+    do {                                                              \
+      NUMBER_OPERANDS();                                              \
+      if (IS_INT(l) && IS_INT(r)) {                                   \
+        PUSH(VAR_BOOL(AS_INT(l) op AS_INT(r)));                       \
+      } else {                                                        \
+        PUSH(VAR_BOOL(AS_NUM(l) op AS_NUM(r)));                       \
+      }                                                               \
+      DISPATCH();                                                     \
+    } while (false)
+
+    OPCODE(ADD_NN):      NUMBER_ARITHMETIC(+);
+    OPCODE(SUBTRACT_NN): NUMBER_ARITHMETIC(-);
+    OPCODE(MULTIPLY_NN): NUMBER_ARITHMETIC(*);
+
+    OPCODE(DIVIDE_NN):
+    {
+      NUMBER_OPERANDS();
+      PUSH(VAR_NUM(AS_NUM(l) / AS_NUM(r)));
+      DISPATCH();
+    }
+
+    OPCODE(LT_NN): NUMBER_COMPARE(<);
+    OPCODE(GT_NN): NUMBER_COMPARE(>);
+
+    // Same as the generic operators, values with the same bits are equal
+    // (ie. NaN <= NaN) but -0 and 0 aren't.
+    OPCODE(LTEQ_NN):
+    {
+      NUMBER_OPERANDS();
+      bool lteq = IS_INT(l) && IS_INT(r) ? AS_INT(l) < AS_INT(r)
+                                         : AS_NUM(l) < AS_NUM(r);
+      PUSH(VAR_BOOL(lteq || isValuesSame(l, r)));
+      DISPATCH();
+    }
+
+    OPCODE(GTEQ_NN):
+    {
+      NUMBER_OPERANDS();
+      bool gteq = IS_INT(l) && IS_INT(r) ? AS_INT(l) > AS_INT(r)
+                                         : AS_NUM(l) > AS_NUM(r);
+      PUSH(VAR_BOOL(gteq || isValuesSame(l, r)));
+      DISPATCH();
+    }
+
+  #undef NUMBER_COMPARE
+  #undef NUMBER_ARITHMETIC
+  #undef NUMBER_OPERANDS
+
     OPCODE(REPL_PRINT):
     {
       if (vm->config.write_fn != NULL) {
@@ -1519,6 +1901,124 @@ static PkResult runFiber(PKVM* vm, Fiber* fiber) {
       DISPATCH();
     }
 
+    OPCODE(WIDE):
+    {
+      // The parameter of the next instruction is twice as wide. Only the
+      // instructions which parameters could exceed are handled here.
+      Opcode op = (Opcode)READ_BYTE();
+      switch (op) {
+        case OP_PUSH_CONSTANT:
+        {
+          uint32_t index = READ_INT();
+          ASSERT_INDEX(index, script->literals.count);
+          PUSH(script->literals.data[index]);
+          DISPATCH();
+        }
+
+        case OP_PUSH_INSTANCE:
+        {
+          uint16_t index = READ_SHORT();
+          ASSERT_INDEX(index, script->classes.count);
+          Instance* inst = newInstance(vm, script->classes.data[index]);
+          PUSH(VAR_OBJ(inst));
+          DISPATCH();
+        }
+
+        case OP_PUSH_LOCAL_N:
+        {
+          uint16_t index = READ_SHORT();
+          PUSH(rbp[index + 1]);  // +1: rbp[0] is return value.
+          DISPATCH();
+        }
+
+        case OP_STORE_LOCAL_N:
+        {
+          uint16_t index = READ_SHORT();
+          rbp[index + 1] = PEEK(-1);  // +1: rbp[0] is return value.
+          DISPATCH();
+        }
+
+        case OP_PUSH_GLOBAL:
+        {
+          uint16_t index = READ_SHORT();
+          ASSERT_INDEX(index, script->globals.count);
+          PUSH(script->globals.data[index]);
+          DISPATCH();
+        }
+
+        case OP_STORE_GLOBAL:
+        {
+          uint16_t index = READ_SHORT();
+          ASSERT_INDEX(index, script->globals.count);
+          script->globals.data[index] = PEEK(-1);
+          DISPATCH();
+        }
+
+        case OP_PUSH_FN:
+        {
+          uint16_t index = READ_SHORT();
+          ASSERT_INDEX(index, script->functions.count);
+          PUSH(VAR_OBJ(script->functions.data[index]));
+          DISPATCH();
+        }
+
+        case OP_PUSH_TYPE:
+        {
+          uint16_t index = READ_SHORT();
+          ASSERT_INDEX(index, script->classes.count);
+          PUSH(VAR_OBJ(script->classes.data[index]));
+          DISPATCH();
+        }
+
+        case OP_ITER:
+          iter_exit = READ_INT();
+          goto L_do_iter;
+
+        case OP_JUMP:
+        {
+          uint32_t offset = READ_INT();
+          ip += offset;
+          DISPATCH();
+        }
+
+        case OP_LOOP:
+        {
+          uint32_t offset = READ_INT();
+          ip -= offset;
+          DISPATCH();
+        }
+
+        case OP_SWITCH_TABLE:
+        case OP_SWITCH_MAP:
+        {
+          uint32_t index = READ_INT();
+          ASSERT_INDEX(index, script->literals.count);
+          Var table = script->literals.data[index];
+
+          uint32_t entry = (op == OP_SWITCH_TABLE)
+            ? switchTableEntry((Range*)AS_OBJ(table), POP())
+            : switchMapEntry((Map*)AS_OBJ(table), POP());
+          ip += entry * SWITCH_ENTRY_SIZE(ip);
+          DISPATCH();
+        }
+
+        case OP_JUMP_IF:
+        case OP_JUMP_IF_NOT:
+        {
+          Var cond = POP();
+          uint32_t offset = READ_INT();
+          if (toBool(cond) == (op == OP_JUMP_IF)) {
+            ip += offset;
+          }
+          DISPATCH();
+        }
+
+        default:
+          UNREACHABLE();
+      }
+      DISPATCH();
+    }
+
     OPCODE(END):
       UNREACHABLE();
       break;
@@ -119,6 +119,10 @@ struct PKVM {
   BuiltinFn builtins[BUILTIN_FN_CAPACITY];
   uint32_t builtins_count;
 
+  // The counter of the identity hashes of the objects (see varHashValue()),
+  // it's per vm since the objects are never shared between them.
+  uint64_t identity_hash_count;
+
   // Current fiber.
   Fiber* fiber;
 };
@@ -2,7 +2,7 @@
 ## Copyright (c) 2020-2021 Thakee Nathees
 ## Distributed Under The MIT License
 
-import os, sys, platform
+import os, sys, platform, tempfile, shutil
 import subprocess, json, re
 from os.path import join, abspath, dirname, relpath
 
@@ -41,6 +41,10 @@ SYSTEM_TO_BINARY_PATH = {
   "Darwin": "../build/debug/atomlang",
 }
 
+## Format of the test names and the indentation of their errors.
+FMT_PATH = "%-25s"
+INDENTATION = '  | '
+
 ## This global variable will be set to true if any test failed.
 tests_failed = False
 
@@ -56,29 +60,168 @@ def main():
 def run_all_tests():
   ## get the interpreter.
   atomlang = get_atomlang_binary()
-  
+
+  ## Caches of a previous run are removed so the tests are compiled from
+  ## their sources and the caches are written by this run.
+  remove_caches()
+
   for suite in TEST_SUITE:
     print_title(suite)
     for test in TEST_SUITE[suite]:
       path = join(THIS_PATH, test)
       run_test_file(atomlang, test, path)
 
+  ## Run the tests again which are now loaded from the caches written above
+  ## and run the caches directly.
+  print_title("Bytecode Cache")
+  for suite in TEST_SUITE:
+    for test in TEST_SUITE[suite]:
+      path = join(THIS_PATH, test)
+      run_cached_test(atomlang, test, path)
+
+  remove_caches()
+
+  ## The imports are compiled in parallel (and cached) before the script is
+  ## run, and once again when they're already cached.
+  print_title("Command Line")
+  command = [atomlang, '-j', '4', join(THIS_PATH, 'lang/import.pk')]
+  run_test('lang/import.pk -j 4', command)
+  run_test('lang/import.pk -j 4', command)
+  remove_caches()
+
+  ## The generated tests are written to a temporary directory.
+  print_title("Generated Tests")
+  temp_dir = tempfile.mkdtemp()
+  try:
+    path = join(temp_dir, 'limits.pk')
+    with open(path, 'w') as file:
+      file.write(generate_limits_test())
+    run_test_file(atomlang, 'limits.pk', path)
+    run_cached_test(atomlang, 'limits.pk', path)
+
+    ## The script is piped to the stdin which is larger than the chunks it's
+    ## read and compiled.
+    with open(path, 'rb') as file:
+      run_test('limits.pk (stdin)', [atomlang, '-'], file.read())
+
+    path = join(temp_dir, 'inlined.pk')
+    with open(path, 'w') as file:
+      file.write(INLINED_TRACE_TEST)
+    run_trace_test(atomlang, 'inlined.pk', path)
+  finally:
+    shutil.rmtree(temp_dir)
+
 def run_test_file(atomlang, test, path):
-  FMT_PATH = "%-25s"
-  INDENTATION = '  | '
-  print(FMT_PATH % test, end='')
+  run_test(test, [atomlang, path])
+
+## Run the test at [path] which should be loaded from it's cache (written by
+## a previous run) and then run the cache file itself.
+def run_cached_test(atomlang, test, path):
+  cache = path + 'c'
+  if not os.path.exists(cache):
+    print(FMT_PATH % test, end='')
+    print_error('-- Failed')
+    print_error(INDENTATION + "cache not written at '%s'" % cache)
+    return
+
+  ## A cache which was rejected would be written again (to a new file which
+  ## is renamed to the cache's path) after the script is compiled.
+  stat = os.stat(cache)
+  if run_test(test, [atomlang, path]):
+    new_stat = os.stat(cache)
+    if (new_stat.st_ino, new_stat.st_mtime_ns) != \
+       (stat.st_ino, stat.st_mtime_ns):
+      print_error(INDENTATION + "cache at '%s' was not loaded" % cache)
+
+  run_test(test + 'c', [atomlang, cache])
+
+## Run the [command] of the test (with the [input] bytes piped to it's stdin
+## if it's not None) and print the result, returns true if the test passed.
+def run_test(name, command, input=None):
+  print(FMT_PATH % name, end='')
 
   sys.stdout.flush()
-  result = run_command([atomlang, path])
+  result = run_command(command, input)
   if result.returncode != 0:
     print_error('-- Failed')
     err = INDENTATION + result.stderr \
         .decode('utf8')               \
         .replace('\n', '\n' + INDENTATION)
     print_error(err)
+    return False
+
+  print_success('-- PASSED')
+  return True
+
+## Returns a script which exceeds the limits of the instruction parameters
+## (ie. more than 256 locals, globals, functions and classes, more than 65535
+## literals and jumps over more than 64K bytes) so they need OP_WIDE.
+def generate_limits_test():
+  COUNT, LITERALS = 300, 70000
+  lines = ['## Generated by tests.py']
+
+  lines += ['g%i = %i' % (i, i) for i in range(COUNT)]
+  lines += ['def f%i() return %i end' % (i, i) for i in range(COUNT)]
+  for i in range(COUNT):
+    lines += ['class C%i' % i, '  x = %i' % i, 'end']
+
+  lines.append('def locals()')
+  lines += ['  l%i = %i' % (i, i) for i in range(COUNT)]
+  lines.append('  return l0 + l%i + l%i' % (COUNT // 2, COUNT - 1))
+  lines.append('end')
+
+  ## Each of the literals is a new constant and the if and the while body
+  ## is larger than 64K bytes.
+  lines += ['def literals(n)', '  sum = 0', '  while n > 0', '    if n > 0']
+  lines += ['      sum += %i' % (100000 + i) for i in range(LITERALS)]
+  lines += ['    end', '    n -= 1', '  end', '  return sum', 'end']
+
+  last = COUNT - 1
+  lines.append('assert(g%i == %i and f%i() == %i and C%i().x == %i)' %
+               (last, last, last, last, last, last))
+  lines.append('assert(locals() == %i)' % (COUNT // 2 + last))
+  lines.append('assert(literals(2) == %i)' %
+               (2 * sum(range(100000, 100000 + LITERALS))))
+  lines.append("print('All TESTS PASSED')")
+  return '\n'.join(lines) + '\n'
+
+## Run the test at [path] which should fail with the same error and stack
+## trace when it's optimized and when it's compiled with -d (without any
+## optimizations).
+def run_trace_test(atomlang, test, path):
+  print(FMT_PATH % test, end='')
+
+  sys.stdout.flush()
+  optimized = run_command([atomlang, path])
+  debug = run_command([atomlang, '-d', path])
+  if optimized.returncode == 0 or optimized.stderr != debug.stderr:
+    print_error('-- Failed')
+    err = INDENTATION + optimized.stderr \
+        .decode('utf8')                  \
+        .replace('\n', '\n' + INDENTATION)
+    print_error(err)
   else:
     print_success('-- PASSED')
 
+## The functions are inlined in the script's body when it's optimized, the
+## error should be reported at the inlined function.
+INLINED_TRACE_TEST = '''
+def sq(x) return x * x end
+def twice(x) return sq(x) + 1 end
+def main()
+  assert(twice(3) == 10)
+  return twice('a')
+end
+main()
+'''
+
+## Remove all the bytecode caches in the tests directory.
+def remove_caches():
+  for root, _, files in os.walk(THIS_PATH):
+    for file in files:
+      if file.endswith('.pkc'):
+        os.remove(join(root, file))
+
 ## This will return the path of the atomlang binary (on different platforms).
 ## The debug version of it for enabling the assertions.
 def get_atomlang_binary():
@@ -92,8 +235,9 @@ def get_atomlang_binary():
 
   return atomlang
 
-def run_command(command):
+def run_command(command, input=None):
   return subprocess.run(command,
+                        input=input,
                         stdout=subprocess.PIPE,
                         stderr=subprocess.PIPE)
 